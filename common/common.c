@@ -27,4 +27,16 @@ CAPI STRCPTR DGetCwd(VOID)
 	return s_Cwd;
 }
 
+CAPI UINT DGetCpuNum(VOID)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1U;
+#else
+	long num = sysconf(_SC_NPROCESSORS_ONLN);
+	return num > 0 ? (UINT)num : 1U;
+#endif
+}
+
 /************************************************************************/
@@ -8,6 +8,11 @@
 
 #include <file.hpp>
 
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
 /************************************************************************/
 
 #ifdef _WIN32
@@ -156,6 +161,30 @@ UINT DFile::Read(VPTR buf, UINT size)
 #endif
 }
 
+UINT DFile::ReadAt(UINT pos, VPTR buf, UINT size) CONST
+{
+	if (m_File == INVALID_FILE || !buf || !size)
+		return 0U;
+
+	// 按位置读取，不依赖共享的文件位置，可供多个线程同时调用
+#ifdef _WIN32
+	// 同步打开的句柄上，带偏移的ReadFile仍会把文件位置移到读取的末尾，调用者不能依赖此后的文件位置
+	OVERLAPPED ov;
+	DVarClr(ov);
+	ov.Offset = pos;
+
+	DWORD rd_size = 0UL;
+	if (!::ReadFile(m_File, buf, size, &rd_size, &ov))
+		return 0U;
+	return rd_size;
+#else
+	ssize_t ret = ::pread(::fileno(m_File), buf, size, pos);
+	if (ret < 0)
+		return 0U;
+	return ret;
+#endif
+}
+
 UINT DFile::ReadLine(STRPTR buf, UINT size /* = 0U */)
 {
 	// TODO:
@@ -194,12 +223,18 @@ UINT DFile::WriteFormat(STRCPTR fmt, ...)
 	return 0U;
 }
 
-VOID DFile::Flush(VOID)
+BOOL DFile::Flush(VOID)
 {
+	if (m_File == INVALID_FILE)
+		return FALSE;
+
 #ifdef _WIN32
-	::FlushFileBuffers(m_File);
+	return ::FlushFileBuffers(m_File);
 #else
-	::fflush(m_File);
+	// 与FlushFileBuffers一致，数据要写入磁盘
+	if (::fflush(m_File))
+		return FALSE;
+	return !::fsync(::fileno(m_File));
 #endif
 }
 
@@ -277,7 +312,10 @@ BOOL DFile::SetSize(UINT size)
 		return FALSE;
 	return ::SetEndOfFile(m_File);
 #else
-	return ::ftruncate(::fileno(m_File), size) != 0;
+	// 先写出缓冲中的数据，否则截断之后还会被写回
+	if (::fflush(m_File))
+		return FALSE;
+	return !::ftruncate(::fileno(m_File), size);
 #endif
 }
 
@@ -350,7 +388,20 @@ UINT DFile::GetFullPath(STRCPTR name, STRPTR buf /* = NULL */, UINT buf_size /*
 #ifdef _WIN32
 	return ::GetFullPathName(name, buf_size, buf, NULL);
 #else
-	// TODO:
+	// 与GetFullPathName一致：缓冲区不足时返回包括结尾0的所需大小，否则返回路径长度
+	STRPTR path = ::realpath(name, NULL);
+	if (!path)
+		return 0;
+
+	UINT len = (UINT)::strlen(path);
+	UINT ret = len + 1;
+	if (buf && buf_size > len) {
+		DMemCpy(buf, path, len + 1);
+		ret = len;
+	}
+
+	::free(path);
+	return ret;
 #endif
 }
 
@@ -424,6 +475,48 @@ BOOL DFile::Remove(STRCPTR name)
 	return TRUE;
 }
 
+BOOL DFile::CreateDir(STRCPTR name)
+{
+	if (!name || !*name)
+		return FALSE;
+
+	// 目录已经存在也视为成功
+#ifdef _WIN32
+	if (!::CreateDirectory(name, NULL) && ::GetLastError() != ERROR_ALREADY_EXISTS)
+		return FALSE;
+#else
+	if (::mkdir(name, 0755) && errno != EEXIST)
+		return FALSE;
+#endif
+
+	return TRUE;
+}
+
+BOOL DFile::GetStatus(STRCPTR name, UINT &size, QWORD &time)
+{
+	if (!name || !*name)
+		return FALSE;
+
+	// 时间只用于判断文件是否被修改过，不同平台的单位不同
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!::GetFileAttributesEx(name, GetFileExInfoStandard, &data))
+		return FALSE;
+	if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY || data.nFileSizeHigh)
+		return FALSE;
+	size = data.nFileSizeLow;
+	time = ((QWORD)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat st;
+	if (::stat(name, &st) || !S_ISREG(st.st_mode) || (QWORD)st.st_size > 0xffffffffULL)
+		return FALSE;
+	size = (UINT)st.st_size;
+	time = (QWORD)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#endif
+
+	return TRUE;
+}
+
 /************************************************************************/
 
 DFile::DFile(CONST DFile &file)
@@ -70,6 +70,7 @@ typedef CONST BYTE		*BUFCPTR;
 /************************************************************************/
 
 CAPI extern STRCPTR DGetCwd(VOID);
+CAPI extern UINT DGetCpuNum(VOID);
 
 /************************************************************************/
 
@@ -45,12 +45,13 @@ public:
 	BOOL Close(VOID);
 	BOOL CreateTempFile(VOID);
 	UINT Read(VPTR buf, UINT size);
+	UINT ReadAt(UINT pos, VPTR buf, UINT size) CONST;
 	UINT ReadLine(STRPTR buf, UINT size = 0U);
 	UINT ReadFormat(STRPTR buf, STRCPTR fmt, ...);
 	UINT Write(VCPTR buf, UINT size);
 	UINT WriteLine(STRCPTR buf, UINT size = 0U);
 	UINT WriteFormat(STRCPTR fmt, ...);
-	VOID Flush(VOID);
+	BOOL Flush(VOID);
 	UINT Position(VOID) CONST;
 	UINT Seek(INT offset, SEEK_MODE mode = SM_BEGIN);
 	VOID Rewind(VOID);
@@ -66,6 +67,8 @@ public:
 	static BOOL IsFile(STRCPTR name);
 	static BOOL IsDir(STRCPTR name);
 	static BOOL Remove(STRCPTR name);
+	static BOOL CreateDir(STRCPTR name);
+	static BOOL GetStatus(STRCPTR name, UINT &size, QWORD &time);
 
 protected:
 
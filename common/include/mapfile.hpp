@@ -0,0 +1,54 @@
+﻿/************************************************************************/
+/* File Name   : mapfile.hpp                                            */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Common library                                         */
+/* Descript    : DMapFile class declaration                             */
+/************************************************************************/
+
+#ifndef __SD_COMMON_MAPFILE_HPP__
+#define __SD_COMMON_MAPFILE_HPP__
+
+/************************************************************************/
+
+#include <common.h>
+#include <string.hpp>
+
+/************************************************************************/
+
+class DMapFile {
+
+public:
+
+	DMapFile();
+	~DMapFile();
+
+	STRCPTR GetName(VOID) CONST;
+	BOOL IsOpen(VOID) CONST;
+	BOOL Open(STRCPTR name);
+	BOOL Close(VOID);
+	UINT GetSize(VOID) CONST;
+	BUFCPTR GetData(VOID) CONST;
+	BUFCPTR GetData(UINT offset, UINT size) CONST;
+
+protected:
+
+	DString		m_Name;
+	UINT		m_Size;
+	BUFPTR		m_Data;
+#ifdef _WIN32
+	HANDLE		m_File;
+	HANDLE		m_Mapping;
+#endif
+
+private:
+
+	DMapFile(CONST DMapFile &file);
+
+	DMapFile &operator = (CONST DMapFile &file);
+
+};
+
+/************************************************************************/
+
+#endif	/* __SD_COMMON_MAPFILE_HPP__ */
@@ -133,6 +133,10 @@ enum SEEK_MODE {
 #define DLoByte(w)				((BYTE)(w))
 #define DHiByte(w)				((BYTE)((WORD)(w) >> 8))
 
+#define DAtomicInc(p)			__sync_add_and_fetch(p, 1)
+#define DAtomicDec(p)			__sync_sub_and_fetch(p, 1)
+#define DAtomicCas(p, c, v)		__sync_val_compare_and_swap(p, c, v)
+
 #define DAssert					assert
 #ifdef NDEBUG
 #define DVerify(x)				x
@@ -33,6 +33,7 @@ public:
 public:
 
 	DThread();
+	virtual ~DThread();
 
 	INT GetPriority(VOID) CONST;
 	VOID SetPriority(INT priority);
@@ -46,6 +47,15 @@ public:
 
 protected:
 
+#ifdef _WIN32
+	static DWORD WINAPI ThreadRoutine(VPTR thread);
+#else
+	static VPTR ThreadRoutine(VPTR thread);
+#endif
+
+	VPTR		m_Param;
+	INT			m_Return;
+	BOOL		m_Running;
 #ifdef _WIN32
 	HANDLE		m_Thread;
 #else
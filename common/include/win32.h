@@ -93,6 +93,10 @@ typedef enum {
 #define DLoByte					LOBYTE
 #define DHiByte					HIBYTE
 
+#define DAtomicInc(p)			InterlockedIncrement((LONG volatile *)(p))
+#define DAtomicDec(p)			InterlockedDecrement((LONG volatile *)(p))
+#define DAtomicCas(p, c, v)		InterlockedCompareExchange((LONG volatile *)(p), v, c)
+
 #ifdef NDEBUG
 #define DAssert(x)				((VOID)0)
 #define DVerify(x)				(x)
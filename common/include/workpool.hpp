@@ -0,0 +1,80 @@
+﻿/************************************************************************/
+/* File Name   : workpool.hpp                                           */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Common library                                         */
+/* Descript    : DWorkPool class declaration                            */
+/************************************************************************/
+
+#ifndef __SD_COMMON_WORKPOOL_HPP__
+#define __SD_COMMON_WORKPOOL_HPP__
+
+/************************************************************************/
+
+#include <common.h>
+#include <mutex.hpp>
+#include <thread.hpp>
+
+/************************************************************************/
+
+class DWork {
+
+public:
+
+	virtual ~DWork() {}
+
+	// index为任务序号，worker为执行任务的线程序号（0到GetWorkerNum() - 1）
+	virtual BOOL Process(UINT index, UINT worker) = 0;
+
+};
+
+/************************************************************************/
+
+class DWorkPool {
+
+public:
+
+	DWorkPool();
+	~DWorkPool();
+
+	UINT GetWorkerNum(VOID) CONST;
+	VOID SetWorkerNum(UINT num);
+
+	BOOL Run(DWork &work, UINT count);
+	BOOL Post(DWork &work, UINT count);
+	BOOL Join(VOID);
+
+protected:
+
+	class DWorker;
+	class DSignal;
+
+	BOOL Start(UINT num);
+	VOID Stop(VOID);
+	BOOL Loop(UINT worker);
+	BOOL Serve(UINT worker);
+
+	UINT		m_WorkerNum;
+	DWork		*m_Work;
+	UINT		m_Count;
+	UINT		m_Next;
+	BOOL		m_Result;
+	DMutex		m_Lock;
+	DWorker		*m_Resident;
+	UINT		m_ResidentNum;
+	UINT		m_Posted;
+	BOOL		m_Quit;
+	DSignal		*m_WorkSignal;
+	DSignal		*m_DoneSignal;
+
+private:
+
+	DWorkPool(CONST DWorkPool &pool);
+
+	DWorkPool &operator = (CONST DWorkPool &pool);
+
+};
+
+/************************************************************************/
+
+#endif	/* __SD_COMMON_WORKPOOL_HPP__ */
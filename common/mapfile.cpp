@@ -0,0 +1,172 @@
+﻿/************************************************************************/
+/* File Name   : mapfile.cpp                                            */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Common library                                         */
+/* Descript    : DMapFile class implementation                          */
+/************************************************************************/
+
+#include <mapfile.hpp>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/************************************************************************/
+
+DMapFile::DMapFile() :
+	m_Size(0U),
+	m_Data(NULL)
+#ifdef _WIN32
+	, m_File(INVALID_HANDLE_VALUE),
+	m_Mapping(NULL)
+#endif
+{
+
+}
+
+DMapFile::~DMapFile()
+{
+	Close();
+}
+
+STRCPTR DMapFile::GetName(VOID) CONST
+{
+	return m_Name;
+}
+
+BOOL DMapFile::IsOpen(VOID) CONST
+{
+	if (!m_Data)
+		return FALSE;
+
+	return TRUE;
+}
+
+BOOL DMapFile::Open(STRCPTR name)
+{
+	DAssert(!m_Data);
+
+	if (!name)
+		return FALSE;
+
+#ifdef _WIN32
+	m_File = ::CreateFile(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_File == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	DWORD size = ::GetFileSize(m_File, NULL);
+	if (size == INVALID_FILE_SIZE || !size) {
+		Close();
+		return FALSE;
+	}
+
+	m_Mapping = ::CreateFileMapping(m_File, NULL, PAGE_READONLY, 0UL, 0UL, NULL);
+	if (!m_Mapping) {
+		Close();
+		return FALSE;
+	}
+
+	m_Data = static_cast<BUFPTR>(::MapViewOfFile(m_Mapping, FILE_MAP_READ, 0UL, 0UL, 0U));
+	if (!m_Data) {
+		Close();
+		return FALSE;
+	}
+#else
+	INT fd = ::open(name, O_RDONLY);
+	if (fd < 0)
+		return FALSE;
+
+	struct stat st;
+	if (::fstat(fd, &st) || st.st_size <= 0 || st.st_size >= static_cast<off_t>(ERROR_SIZE)) {
+		::close(fd);
+		return FALSE;
+	}
+
+	UINT size = st.st_size;
+
+	// 映射建立后即可关闭文件描述符
+	VPTR data = ::mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (data == MAP_FAILED)
+		return FALSE;
+#endif
+
+	m_Name = name;
+	m_Size = size;
+#ifndef _WIN32
+	m_Data = static_cast<BUFPTR>(data);
+#endif
+
+	return TRUE;
+}
+
+BOOL DMapFile::Close(VOID)
+{
+#ifdef _WIN32
+	if (m_File == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	if (m_Data)
+		::UnmapViewOfFile(m_Data);
+	if (m_Mapping)
+		::CloseHandle(m_Mapping);
+	::CloseHandle(m_File);
+
+	m_File = INVALID_HANDLE_VALUE;
+	m_Mapping = NULL;
+#else
+	if (!m_Data)
+		return FALSE;
+
+	::munmap(m_Data, m_Size);
+#endif
+
+	m_Name.Clear();
+	m_Size = 0U;
+	m_Data = NULL;
+	return TRUE;
+}
+
+UINT DMapFile::GetSize(VOID) CONST
+{
+	if (!m_Data)
+		return ERROR_SIZE;
+
+	return m_Size;
+}
+
+BUFCPTR DMapFile::GetData(VOID) CONST
+{
+	return m_Data;
+}
+
+BUFCPTR DMapFile::GetData(UINT offset, UINT size) CONST
+{
+	if (!m_Data)
+		return NULL;
+
+	// 防止越界以及整数溢出
+	if (offset > m_Size || size > m_Size - offset)
+		return NULL;
+
+	return m_Data + offset;
+}
+
+/************************************************************************/
+
+DMapFile::DMapFile(CONST DMapFile &file)
+{
+	DAssert(FALSE);
+}
+
+DMapFile &DMapFile::operator = (CONST DMapFile &file)
+{
+	DAssert(FALSE);
+	return *this;
+}
+
+/************************************************************************/
@@ -10,27 +10,22 @@
 
 /************************************************************************/
 
-struct PARAMETER {
-	DThread *thread;
-	VPTR param;
-};
-
-/************************************************************************/
-
-static INT ThreadRoutine(CONST PARAMETER *param)
+DThread::DThread() :
+	m_Param(NULL),
+	m_Return(RV_UNKNOWN),
+	m_Running(FALSE)
+#ifdef _WIN32
+	, m_Thread(NULL)
+#endif
 {
-	if (!param || !param->thread)
-		return DThread::RV_PARAM;
 
-	return param->thread->Process(param->param) ? DThread::RV_SUCCESS : DThread::RV_ERROR;
 }
 
-/************************************************************************/
-
-DThread::DThread() :
-	m_Thread(NULL)
+DThread::~DThread()
 {
-
+	// 线程对象销毁之前必须等待线程结束
+	if (m_Running)
+		Wait();
 }
 
 INT DThread::GetPriority(VOID) CONST
@@ -51,17 +46,23 @@ VOID DThread::SetPriority(INT priority)
 
 BOOL DThread::Run(VPTR param)
 {
-	PARAMETER tmp_parm = { this, param };
+	if (m_Running)
+		return FALSE;
+
+	// 参数保存在对象中，线程开始运行时栈上的临时变量可能已经失效
+	m_Param = param;
+	m_Return = RV_UNKNOWN;
 
 #ifdef _WIN32
-	m_Thread = ::CreateThread(NULL, 0, reinterpret_cast<PTHREAD_START_ROUTINE>(&::ThreadRoutine), &tmp_parm, 0, NULL);
+	m_Thread = ::CreateThread(NULL, 0, &ThreadRoutine, this, 0, NULL);
 	if (!m_Thread)
 		return FALSE;
 #else
-	if (!::pthread_create(&m_Thread, NULL, reinterpret_cast<START_ROUTINE *>(&::ThreadRoutine), &tmp_parm))
+	if (::pthread_create(&m_Thread, NULL, &ThreadRoutine, this))
 		return FALSE;
 #endif
 
+	m_Running = TRUE;
 	return TRUE;
 }
 
@@ -74,29 +75,49 @@ BOOL DThread::Terminate(VOID)
 
 VOID DThread::Wait(VOID)
 {
+	if (!m_Running)
+		return;
+
 #ifdef _WIN32
 	::WaitForSingleObject(m_Thread, INFINITE);
+	::CloseHandle(m_Thread);
+	m_Thread = NULL;
 #else
 	::pthread_join(m_Thread, NULL);
 #endif
+
+	m_Running = FALSE;
 }
 
 INT DThread::GetReturn(VOID)
 {
-	INT ret = RV_UNKNOWN;
+	Wait();
+
+	return m_Return;
+}
+
+/************************************************************************/
 
 #ifdef _WIN32
-	DWORD tmp;
-	::WaitForSingleObject(m_Thread, INFINITE);
-	if (::GetExitCodeThread(m_Thread, &tmp))
-		ret = tmp;
+DWORD WINAPI DThread::ThreadRoutine(VPTR thread)
 #else
-	::pthread_join(m_Thread, static_cast<VPTR *>&ret);
+VPTR DThread::ThreadRoutine(VPTR thread)
 #endif
+{
+	DThread *self = static_cast<DThread *>(thread);
+	DAssert(self);
 
-	return ret;
+	self->m_Return = self->Process(self->m_Param) ? RV_SUCCESS : RV_ERROR;
+
+#ifdef _WIN32
+	return self->m_Return;
+#else
+	return NULL;
+#endif
 }
 
+/************************************************************************/
+
 #if 0
 BOOL DThread::GetReturn(INT *ret /* = NULL */)
 {
@@ -0,0 +1,326 @@
+﻿/************************************************************************/
+/* File Name   : workpool.cpp                                           */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Common library                                         */
+/* Descript    : DWorkPool class implementation                         */
+/************************************************************************/
+
+#include <workpool.hpp>
+
+/************************************************************************/
+
+class DWorkPool::DWorker : public DThread {
+
+public:
+
+	DWorker() : m_Pool(NULL), m_Index(0U), m_Resident(FALSE) {}
+
+	VOID Bind(DWorkPool *pool, UINT index, BOOL resident = FALSE)
+	{
+		m_Pool = pool;
+		m_Index = index;
+		m_Resident = resident;
+	}
+
+	virtual BOOL Process(VPTR /* param */)
+	{
+		// 常驻线程处理完一批任务后继续等待下一批
+		return m_Resident ? m_Pool->Serve(m_Index) : m_Pool->Loop(m_Index);
+	}
+
+protected:
+
+	DWorkPool	*m_Pool;
+	UINT		m_Index;
+	BOOL		m_Resident;
+
+};
+
+/************************************************************************/
+
+class DWorkPool::DSignal {
+
+public:
+
+	DSignal()
+	{
+#ifdef _WIN32
+		m_Semaphore = ::CreateSemaphore(NULL, 0L, 0x7fffffffL, NULL);
+#else
+		m_Count = 0U;
+		::pthread_mutex_init(&m_Lock, NULL);
+		::pthread_cond_init(&m_Cond, NULL);
+#endif
+	}
+
+	~DSignal()
+	{
+#ifdef _WIN32
+		::CloseHandle(m_Semaphore);
+#else
+		::pthread_cond_destroy(&m_Cond);
+		::pthread_mutex_destroy(&m_Lock);
+#endif
+	}
+
+	VOID Post(UINT count)
+	{
+#ifdef _WIN32
+		::ReleaseSemaphore(m_Semaphore, count, NULL);
+#else
+		::pthread_mutex_lock(&m_Lock);
+		m_Count += count;
+		::pthread_cond_broadcast(&m_Cond);
+		::pthread_mutex_unlock(&m_Lock);
+#endif
+	}
+
+	VOID Wait(VOID)
+	{
+#ifdef _WIN32
+		::WaitForSingleObject(m_Semaphore, INFINITE);
+#else
+		::pthread_mutex_lock(&m_Lock);
+		while (!m_Count)
+			::pthread_cond_wait(&m_Cond, &m_Lock);
+		m_Count--;
+		::pthread_mutex_unlock(&m_Lock);
+#endif
+	}
+
+protected:
+
+#ifdef _WIN32
+	HANDLE			m_Semaphore;
+#else
+	UINT			m_Count;
+	pthread_mutex_t	m_Lock;
+	pthread_cond_t	m_Cond;
+#endif
+
+};
+
+/************************************************************************/
+
+DWorkPool::DWorkPool() :
+	m_WorkerNum(0U),
+	m_Work(NULL),
+	m_Count(0U),
+	m_Next(0U),
+	m_Result(TRUE),
+	m_Resident(NULL),
+	m_ResidentNum(0U),
+	m_Posted(0U),
+	m_Quit(FALSE),
+	m_WorkSignal(NULL),
+	m_DoneSignal(NULL)
+{
+
+}
+
+DWorkPool::~DWorkPool()
+{
+	Stop();
+}
+
+UINT DWorkPool::GetWorkerNum(VOID) CONST
+{
+	// 未指定时使用全部CPU
+	return m_WorkerNum ? m_WorkerNum : DGetCpuNum();
+}
+
+VOID DWorkPool::SetWorkerNum(UINT num)
+{
+	// 常驻线程的数目随之改变，下次投递时重新启动
+	if (num != m_WorkerNum)
+		Stop();
+
+	m_WorkerNum = num;
+}
+
+BOOL DWorkPool::Run(DWork &work, UINT count)
+{
+	DAssert(!m_Work);
+
+	if (!count)
+		return TRUE;
+
+	UINT worker_num = GetWorkerNum();
+	if (worker_num > count)
+		worker_num = count;
+
+	// 任务太少时不值得启动线程
+	if (worker_num <= 1U) {
+		for (UINT i = 0U; i < count; i++) {
+			if (!work.Process(i, 0U))
+				return FALSE;
+		}
+		return TRUE;
+	}
+
+	m_Work = &work;
+	m_Count = count;
+	m_Next = 0U;
+	m_Result = TRUE;
+
+	// 调用线程自身作为0号线程参与工作
+	DWorker *workers = new DWorker[worker_num - 1];
+	UINT run_num = 0U;
+
+	for (; run_num < worker_num - 1; run_num++) {
+		workers[run_num].Bind(this, run_num + 1);
+		if (!workers[run_num].Run(NULL))
+			break;
+	}
+
+	Loop(0U);
+
+	for (UINT i = 0U; i < run_num; i++)
+		workers[i].Wait();
+
+	delete [] workers;
+
+	m_Work = NULL;
+	m_Count = 0U;
+
+	return m_Result;
+}
+
+BOOL DWorkPool::Post(DWork &work, UINT count)
+{
+	DAssert(!m_Work);
+
+	m_Result = TRUE;
+	m_Posted = 0U;
+
+	if (!count)
+		return TRUE;
+
+	// 常驻线程在第一次投递时启动，之后一直等待新的任务，直到线程池销毁
+	// 无法启动线程时在当前线程中完成全部任务
+	if (!m_ResidentNum && !Start(GetWorkerNum())) {
+		for (UINT i = 0U; i < count; i++) {
+			if (!work.Process(i, 0U)) {
+				m_Result = FALSE;
+				break;
+			}
+		}
+		return m_Result;
+	}
+
+	m_Work = &work;
+	m_Count = count;
+	m_Next = 0U;
+
+	// 调用线程不参与工作，投递之后立即返回
+	m_Posted = DMin(m_ResidentNum, count);
+	m_WorkSignal->Post(m_Posted);
+
+	return TRUE;
+}
+
+BOOL DWorkPool::Join(VOID)
+{
+	// 每个被唤醒的线程处理完之后发出一次信号
+	for (; m_Posted; m_Posted--)
+		m_DoneSignal->Wait();
+
+	m_Work = NULL;
+	m_Count = 0U;
+
+	return m_Result;
+}
+
+/************************************************************************/
+
+BOOL DWorkPool::Start(UINT num)
+{
+	DAssert(num && !m_ResidentNum);
+
+	m_WorkSignal = new DSignal;
+	m_DoneSignal = new DSignal;
+	m_Resident = new DWorker[num];
+
+	for (; m_ResidentNum < num; m_ResidentNum++) {
+		m_Resident[m_ResidentNum].Bind(this, m_ResidentNum, TRUE);
+		if (!m_Resident[m_ResidentNum].Run(NULL))
+			break;
+	}
+
+	if (m_ResidentNum)
+		return TRUE;
+
+	Stop();
+	return FALSE;
+}
+
+VOID DWorkPool::Stop(VOID)
+{
+	// 先等待已投递的任务完成，再让常驻线程退出
+	Join();
+
+	if (m_ResidentNum) {
+		m_Quit = TRUE;
+		m_WorkSignal->Post(m_ResidentNum);
+		for (UINT i = 0U; i < m_ResidentNum; i++)
+			m_Resident[i].Wait();
+		m_Quit = FALSE;
+		m_ResidentNum = 0U;
+	}
+
+	delete [] m_Resident;
+	m_Resident = NULL;
+
+	delete m_WorkSignal;
+	m_WorkSignal = NULL;
+
+	delete m_DoneSignal;
+	m_DoneSignal = NULL;
+}
+
+BOOL DWorkPool::Serve(UINT worker)
+{
+	for (;;) {
+
+		m_WorkSignal->Wait();
+
+		// 只在没有投递任务时才会要求退出
+		if (m_Quit)
+			break;
+
+		Loop(worker);
+		m_DoneSignal->Post(1U);
+	}
+
+	return TRUE;
+}
+
+BOOL DWorkPool::Loop(UINT worker)
+{
+	DAssert(m_Work);
+
+	for (;;) {
+
+		UINT index;
+
+		{
+			DAutoLock lock(m_Lock);
+			if (m_Next >= m_Count)
+				break;
+			index = m_Next++;
+		}
+
+		if (m_Work->Process(index, worker))
+			continue;
+
+		// 任何一个任务失败则放弃剩下的任务
+		DAutoLock lock(m_Lock);
+		m_Result = FALSE;
+		m_Next = m_Count;
+	}
+
+	return TRUE;
+}
+
+/************************************************************************/
@@ -6,11 +6,45 @@
 /* Descript    : DArchive class implementation                          */
 /************************************************************************/
 
+#include <algorithm>
 #include "archive.hpp"
 
 /************************************************************************/
 
-DArchive::DArchive()
+class DArchive::DSubExtractor : public DMpq::DExtractor {
+
+public:
+
+	DSubExtractor(DMpq::DExtractor &extractor, CONST DIndexList &index_list) :
+		m_Extractor(extractor),
+		m_IndexList(index_list)
+	{
+
+	}
+
+	// 把单个档案中的序号换回整批中的序号
+	virtual BOOL Output(UINT index, STRCPTR file_name, BUFCPTR data, UINT size)
+	{
+		return m_Extractor.Output(m_IndexList[index], file_name, data, size);
+	}
+
+	virtual VOID Fail(UINT index, STRCPTR file_name)
+	{
+		m_Extractor.Fail(m_IndexList[index], file_name);
+	}
+
+protected:
+
+	DMpq::DExtractor	&m_Extractor;
+	CONST DIndexList	&m_IndexList;
+
+};
+
+/************************************************************************/
+
+DArchive::DArchive() :
+	m_IndexLocale(0UL),
+	m_Filter(NULL)
 {
 
 }
@@ -19,17 +53,23 @@ DArchive::~DArchive()
 {
 	for (DArcList::iterator it = m_ArcList.begin(); it != m_ArcList.end(); ++it)
 		delete it->mpq;
+
+	delete m_Filter;
 }
 
 /************************************************************************/
 
-DMpq *DArchive::UseArchive(STRCPTR mpq_name, UINT priority /* = 0U */)
+DMpq *DArchive::UseArchive(STRCPTR mpq_name, UINT priority /* = 0U */, UINT flags /* = 0U */)
 {
 	if (!mpq_name)
 		return NULL;
 
+	// 合并索引记录的是各档案散列表中的位置，档案被修改后就会失效，因此只接受只读打开的档案
+	if (flags & DMpq::OF_WRITE)
+		return NULL;
+
 	DMpq *mpq = new DMpq;
-	if (!mpq->OpenArchive(mpq_name)) {
+	if (!mpq->OpenArchive(mpq_name, flags)) {
 		delete mpq;
 		return NULL;
 	}
@@ -46,6 +86,8 @@ DMpq *DArchive::UseArchive(STRCPTR mpq_name, UINT priority /* = 0U */)
 	}
 
 	m_ArcList.insert(it, archive);
+	RebuildIndex();
+
 	return mpq;
 }
 
@@ -61,6 +103,8 @@ BOOL DArchive::CloseArchive(DMpq *mpq)
 		}
 	}
 
+	RebuildIndex();
+
 	BOOL ret = mpq->CloseArchive();
 	delete mpq;
 	return ret;
@@ -68,7 +112,13 @@ BOOL DArchive::CloseArchive(DMpq *mpq)
 
 BOOL DArchive::FileExist(STRCPTR file_name)
 {
-	if (!SearchFile(file_name))
+	return FileExist(DMpq::DNameKey(file_name));
+}
+
+BOOL DArchive::FileExist(CONST DMpq::DNameKey &name_key)
+{
+	UINT hash_idx;
+	if (!SearchFile(name_key, hash_idx))
 		return FALSE;
 
 	return TRUE;
@@ -76,11 +126,18 @@ BOOL DArchive::FileExist(STRCPTR file_name)
 
 HANDLE DArchive::OpenFile(STRCPTR file_name)
 {
-	DMpq *mpq = SearchFile(file_name);
+	// 只计算一次散列值，供各个档案查找
+	return OpenFile(DMpq::DNameKey(file_name));
+}
+
+HANDLE DArchive::OpenFile(CONST DMpq::DNameKey &name_key)
+{
+	UINT hash_idx;
+	DMpq *mpq = SearchFile(name_key, hash_idx);
 	if (!mpq)
 		return NULL;
 
-	HANDLE file = mpq->OpenFile(file_name);
+	HANDLE file = mpq->OpenFile(name_key, hash_idx);
 	if (!file)
 		return NULL;
 
@@ -107,6 +164,11 @@ UINT DArchive::ReadFile(HANDLE file, VPTR data, UINT size)
 	return DMpq::ReadFile(file, data, size);
 }
 
+UINT DArchive::ReadAll(HANDLE file, VPTR data, UINT size)
+{
+	return DMpq::ReadAll(file, data, size);
+}
+
 UINT DArchive::SeekFile(HANDLE file, INT offset, SEEK_MODE mode /* = SM_BEGIN */)
 {
 	return DMpq::SeekFile(file, offset, mode);
@@ -114,27 +176,195 @@ UINT DArchive::SeekFile(HANDLE file, INT offset, SEEK_MODE mode /* = SM_BEGIN */
 
 HANDLE DArchive::OpenHandle(STRCPTR file_name)
 {
-	DMpq *mpq = SearchFile(file_name);
+	return OpenHandle(DMpq::DNameKey(file_name));
+}
+
+HANDLE DArchive::OpenHandle(CONST DMpq::DNameKey &name_key)
+{
+	UINT hash_idx;
+	DMpq *mpq = SearchFile(name_key, hash_idx);
 	if (!mpq)
 		return NULL;
 
-	HANDLE file = mpq->OpenHandle(file_name);
+	HANDLE file = mpq->OpenHandle(name_key, hash_idx);
 	if (!file)
 		return NULL;
 
 	return file;
 }
 
+BOOL DArchive::ListFiles(DMpq::DNameList &names)
+{
+	names.clear();
+
+	BOOL ret = FALSE;
+
+	for (DArcList::iterator it = m_ArcList.begin(); it != m_ArcList.end(); ++it) {
+		DMpq::DNameList list;
+		if (!it->mpq || !it->mpq->ListFiles(list))
+			continue;
+		names.insert(names.end(), list.begin(), list.end());
+		ret = TRUE;
+	}
+
+	// 多个档案中的同名文件只保留一个
+	std::sort(names.begin(), names.end(), CompareName);
+	names.erase(std::unique(names.begin(), names.end(), EqualName), names.end());
+
+	return ret;
+}
+
+UINT DArchive::ExtractFiles(CONST DMpq::DNameList &names, DMpq::DExtractor &extractor)
+{
+	// 先按优先级找出每个文件所在的档案
+	std::vector<DMpq *> owners(names.size());
+
+	for (UINT i = 0U; i < names.size(); i++) {
+		UINT hash_idx;
+		owners[i] = SearchFile(DMpq::DNameKey(names[i]), hash_idx);
+		if (!owners[i])
+			extractor.Fail(i, names[i]);
+	}
+
+	UINT num = 0U;
+
+	// 再逐个档案批量解压
+	for (DArcList::iterator it = m_ArcList.begin(); it != m_ArcList.end(); ++it) {
+
+		DMpq::DNameList sub_names;
+		DIndexList index_list;
+
+		for (UINT i = 0U; i < names.size(); i++) {
+			if (owners[i] != it->mpq)
+				continue;
+			sub_names.push_back(names[i]);
+			index_list.push_back(i);
+		}
+
+		if (sub_names.empty())
+			continue;
+
+		DSubExtractor sub(extractor, index_list);
+		num += it->mpq->ExtractFiles(sub_names, sub);
+	}
+
+	return num;
+}
+
+UINT DArchive::ExtractAll(DMpq::DExtractor &extractor)
+{
+	DMpq::DNameList names;
+	if (!ListFiles(names))
+		return 0U;
+
+	return ExtractFiles(names, extractor);
+}
+
+VOID DArchive::RebuildIndex(VOID)
+{
+	m_Index.clear();
+	m_IndexLocale = DMpq::GetLocale();
+
+	delete m_Filter;
+	m_Filter = NULL;
+
+	UINT num = 0U;
+	BOOL filter = FALSE;
+	for (DArcList::const_iterator it = m_ArcList.begin(); it != m_ArcList.end(); ++it) {
+		if (it->mpq && it->mpq->m_HashTable)
+			num += it->mpq->m_HashNum;
+		if (it->mpq && it->mpq->m_Filter)
+			filter = TRUE;
+	}
+
+	if (!num)
+		return;
+
+	// 至少保留一半空位，使探测序列很短
+	UINT size = 1U;
+	while (size < num * 2U)
+		size <<= 1;
+
+	INDEXENTRY empty;
+	DVarClr(empty);
+	m_Index.assign(size, empty);
+
+	LANGID lang = DLoc2Lang(m_IndexLocale);
+	UINT used_num = 0U;
+
+	// 按优先级从高到低合并各档案的散列表
+	for (DArcList::const_iterator it = m_ArcList.begin(); it != m_ArcList.end(); ++it) {
+
+		DMpq *mpq = it->mpq;
+		if (!mpq || !mpq->m_HashTable)
+			continue;
+
+		for (UINT i = 0U; i < mpq->m_HashNum; i++) {
+
+			INT rank = mpq->MatchEntry(i, lang);
+			if (!rank)
+				continue;
+
+			QWORD name_hash = DMpq::NameHash(mpq->m_HashTable[i]);
+
+			// 已被优先级更高的档案占有，或者同一档案中已有语言更合适的入口
+			INDEXENTRY &entry = m_Index[ProbeIndex(name_hash)];
+			if (entry.mpq && (entry.mpq != mpq || entry.rank >= rank))
+				continue;
+
+			if (!entry.mpq)
+				used_num++;
+
+			entry.name_hash = name_hash;
+			entry.mpq = mpq;
+			entry.hash_idx = i;
+			entry.rank = rank;
+		}
+	}
+
+	// 任一档案要求过滤时，为合并后的索引也建立过滤器
+	if (filter) {
+		m_Filter = new DMpq::DNameFilter;
+		DVerify(m_Filter->Create(used_num));
+		for (DIndexTable::const_iterator it = m_Index.begin(); it != m_Index.end(); ++it) {
+			if (it->mpq)
+				m_Filter->Add(it->name_hash);
+		}
+	}
+}
+
 /************************************************************************/
 
-DMpq *DArchive::SearchFile(STRCPTR file_name) CONST
+DMpq *DArchive::SearchFile(CONST DMpq::DNameKey &name_key, UINT &hash_idx) CONST
 {
-	if (!file_name)
+	if (!name_key.IsValid())
 		return NULL;
 
+	// 合并索引只需一次探测
+	if (m_IndexLocale == DMpq::GetLocale()) {
+
+		if (m_Index.empty())
+			return NULL;
+
+		QWORD name_hash = name_key.GetHash();
+		if (m_Filter && !m_Filter->MayExist(name_hash))
+			return NULL;
+
+		CONST INDEXENTRY &entry = m_Index[ProbeIndex(name_hash)];
+		if (!entry.mpq)
+			return NULL;
+
+		hash_idx = entry.hash_idx;
+		return entry.mpq;
+	}
+
+	// 索引是按建立时的语言选择入口的，语言改变后退回逐个档案查找
 	for (DArcList::const_iterator it = m_ArcList.begin(); it != m_ArcList.end(); ++it) {
-		if (it->mpq && it->mpq->FileExist(file_name))
-			return it->mpq;
+		DMpq *mpq = it->mpq;
+		if (!mpq || !mpq->FileExist(name_key))
+			continue;
+		hash_idx = mpq->Lookup(name_key) - mpq->m_HashTable;
+		return mpq;
 	}
 
 	return NULL;
@@ -142,15 +372,44 @@ DMpq *DArchive::SearchFile(STRCPTR file_name) CONST
 
 DMpq *DArchive::SearchFile(HANDLE file) CONST
 {
-	if (!file)
+	if (!file || !DMpq::s_HandleTable)
+		return NULL;
+
+	// 句柄表直接给出所属的档案，只需确认该档案属于本对象
+	DMpq *mpq = DMpq::s_HandleTable->GetOwner(file);
+	if (!mpq)
 		return NULL;
 
 	for (DArcList::const_iterator it = m_ArcList.begin(); it != m_ArcList.end(); ++it) {
-		if (it->mpq && it->mpq->FileExist(file))
-			return it->mpq;
+		if (it->mpq == mpq)
+			return mpq;
 	}
 
 	return NULL;
 }
 
+UINT DArchive::ProbeIndex(QWORD name_hash) CONST
+{
+	DAssert(!m_Index.empty());
+
+	UINT mask = m_Index.size() - 1;
+	UINT index = (UINT)name_hash & mask;
+
+	// 线性探测，表中总有空位
+	while (m_Index[index].mpq && m_Index[index].name_hash != name_hash)
+		index = (index + 1) & mask;
+
+	return index;
+}
+
+BOOL DArchive::CompareName(CONST DString &name1, CONST DString &name2)
+{
+	return name1.CompareI(name2) < 0;
+}
+
+BOOL DArchive::EqualName(CONST DString &name1, CONST DString &name2)
+{
+	return !name1.CompareI(name2);
+}
+
 /************************************************************************/
@@ -12,6 +12,7 @@
 /************************************************************************/
 
 #include <list>
+#include <vector>
 #include "data/mpq.hpp"
 
 /************************************************************************/
@@ -25,29 +26,55 @@ protected:
 		UINT priority;
 	};
 
-	typedef std::list<ARCHIVE>	DArcList;
+	struct INDEXENTRY {
+		QWORD name_hash;			// Name hash B in the high part and name hash A in the low part.
+		DMpq *mpq;					// Archive which provides the file, NULL for a free slot.
+		UINT hash_idx;				// Index into the hash table of the archive.
+		INT rank;					// Locale match of the hash entry, see DMpq::MatchEntry.
+	};
+
+	class DSubExtractor;
+
+	typedef std::list<ARCHIVE>			DArcList;
+	typedef std::vector<UINT>			DIndexList;
+	typedef std::vector<INDEXENTRY>		DIndexTable;
 
 public:
 
 	DArchive();
 	~DArchive();
 
-	DMpq *UseArchive(STRCPTR mpq_name, UINT priority = 0U);
+	DMpq *UseArchive(STRCPTR mpq_name, UINT priority = 0U, UINT flags = 0U);
 	BOOL CloseArchive(DMpq *mpq);
 	BOOL FileExist(STRCPTR file_name);
+	BOOL FileExist(CONST DMpq::DNameKey &name_key);
 	HANDLE OpenFile(STRCPTR file_name);
+	HANDLE OpenFile(CONST DMpq::DNameKey &name_key);
 	BOOL CloseFile(HANDLE file);
 	UINT GetFileSize(HANDLE file);
 	UINT ReadFile(HANDLE file, VPTR data, UINT size);
+	UINT ReadAll(HANDLE file, VPTR data, UINT size);
 	UINT SeekFile(HANDLE file, INT offset, SEEK_MODE mode = SM_BEGIN);
 	HANDLE OpenHandle(STRCPTR file_name);
+	HANDLE OpenHandle(CONST DMpq::DNameKey &name_key);
+	BOOL ListFiles(DMpq::DNameList &names);
+	UINT ExtractFiles(CONST DMpq::DNameList &names, DMpq::DExtractor &extractor);
+	UINT ExtractAll(DMpq::DExtractor &extractor);
+	VOID RebuildIndex(VOID);
 
 protected:
 
-	DMpq *SearchFile(STRCPTR file_name) CONST;
+	DMpq *SearchFile(CONST DMpq::DNameKey &name_key, UINT &hash_idx) CONST;
 	DMpq *SearchFile(HANDLE file) CONST;
+	UINT ProbeIndex(QWORD name_hash) CONST;
+
+	static BOOL CompareName(CONST DString &name1, CONST DString &name2);
+	static BOOL EqualName(CONST DString &name1, CONST DString &name2);
 
 	DArcList	m_ArcList;
+	DIndexTable	m_Index;
+	LCID		m_IndexLocale;
+	DMpq::DNameFilter	*m_Filter;
 
 };
 
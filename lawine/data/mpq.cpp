@@ -6,11 +6,21 @@
 /* Descript    : DMpq class implementation                              */
 /************************************************************************/
 
+#include <algorithm>
 #include <array.hpp>
 #include "mpq.hpp"
+#include "../misc/codec.h"
 #include "../misc/adpcm.h"
 #include "../misc/implode.h"
 #include "../misc/huffman.h"
+#include "../misc/deflate.h"
+#include "../misc/bzip2.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_CRYPT									// 批量解密时使用SSE2指令同时解密多段数据
+#define SIMD_HASH									// 批量计算文件名散列值时使用SSE2指令同时计算各种散列值
+#include <emmintrin.h>
+#endif
 
 /************************************************************************/
 
@@ -22,6 +32,8 @@ CONST DWORD SUPPORT_HEADER_SIZE = 32UL;			// sizeof(DMpq::HEADER)
 CONST WORD PHYSICAL_SECTOR_SHIFT = 9;			// 512 bytes
 
 CONST DWORD MPQ_IDENTIFIER = '\x1aQPM';			// FourCC 'MPQ\x1a'
+CONST DWORD INDEX_IDENTIFIER = DMakeDWord(DMakeWord('L', 'W'), DMakeWord('I', 'X'));	// FourCC 'LWIX'
+CONST DWORD INDEX_VERSION = 1UL;
 
 CONST DWORD HASH_ENTRY_INVALID = 0xfffffffeUL;	// Block index for deleted hash entry
 CONST DWORD HASH_ENTRY_EMPTY = 0xffffffffUL;	// Block index for free hash entry
@@ -35,40 +47,303 @@ CONST DWORD BLOCK_EXIST = 0x80000000UL;			// Set if file exists, reset when the
 
 CONST BYTE COMP_NONE = 0x00;					// Not compressed
 CONST BYTE COMP_HUFFMAN = 0x01;					// Huffman compression
+CONST BYTE COMP_DEFLATE = 0x02;					// Deflate compression (zlib format)
 CONST BYTE COMP_IMPLODE = 0x08;					// PKWARE DCL compression
 CONST BYTE COMP_ADPCM_BETA_MONO = 0x10;			// ADPCM compression for Starcraft Beta (mono)
 CONST BYTE COMP_ADPCM_BETA_STEREO = 0x20;		// ADPCM compression for Starcraft Beta (stereo)
 CONST BYTE COMP_ADPCM_MONO = 0x40;				// ADPCM compression (mono)
 CONST BYTE COMP_ADPCM_STEREO = 0x80;			// ADPCM compression (stereo)
+CONST BYTE COMP_BZIP2 = 0x10;					// Bzip2 compression, shares its code with COMP_ADPCM_BETA_MONO
+CONST BYTE COMP_LOSSY_MASK = 0xe0;				// Lossy compressions, only applied to WAVE data
+
+CONST WORD WAVE_TAG_PCM = 1;					// Format tag of PCM data in the fmt chunk of WAVE files
+CONST INT ADPCM_TYPE = 4;						// ADPCM compression type when writing (medium quality of Storm)
+CONST INT HUFF_TYPE_NORMAL = 0;					// Huffman compression type for normal data
+CONST INT HUFF_TYPE_ADPCM = ADPCM_TYPE + 2;		// Huffman compression type matching ADPCM_TYPE
 
 CONST UINT HASH_NUM_MIN = 0x00000001U;			// Minimum acceptable hash size
 CONST UINT HASH_NUM_MAX = 0x00080000U;			// Maximum acceptable hash size
 
 CONST UINT PHYSICAL_SECTOR_SIZE = 1 << PHYSICAL_SECTOR_SHIFT;
 
+CONST UINT DEFAULT_CACHE_SIZE = 0x00400000U;	// Default byte budget of the sector cache (4MB)
+CONST UINT PARALLEL_SECTOR_NUM = 8U;			// Minimum sectors for each worker thread of ReadAll
+CONST UINT READ_BATCH_NUM = 8U;					// Sectors read together by ReadAll so that their decryption and ADPCM stages are done in batches
+CONST UINT CRYPT_LANE_NUM = 4U;					// Data streams decrypted together by DecryptBatch, the number of DWORDs in an SSE2 register
+CONST UINT NAME_LANE_NUM = 4U;					// Names hashed together by DNameKey::AssignBatch to overlap their dependent hash steps
+CONST UINT MATCH_BATCH_NUM = 256U;				// Candidate names hashed in each batch of MatchNames
+
+CONST INT STAGE_BUFFER = 0;						// Codec context buffer for raw sector data and candidate outputs
+CONST INT SWAP_BUFFER = 1;						// Codec context buffer for the intermediate results of multiple compression
+CONST UINT ADD_BATCH_SIZE = 0x01000000U;		// Bytes of file data compressed in each batch of AddFiles (16MB)
+CONST UINT WRITE_BATCH_NUM = 16U;				// Sectors compressed together by the work pool for each batch of streaming writes
+
 CONST STRCPTR HASH_TABLE_KEY = "(hash table)";
 CONST STRCPTR BLOCK_TABLE_KEY = "(block table)";
+CONST STRCPTR LIST_FILE_NAME = "(listfile)";
+CONST STRCPTR INDEX_FILE_EXT = ".idx";
+
+#ifdef _WIN32
+CONST CHAR PATH_DELIMITER = '\\';
+#else
+CONST CHAR PATH_DELIMITER = '/';
+#endif
 
 CONST BYTE VALID_COMP[] = {						// In fix order!
 	COMP_ADPCM_BETA_MONO, COMP_ADPCM_BETA_STEREO,
 	COMP_ADPCM_MONO, COMP_ADPCM_STEREO,
-	COMP_HUFFMAN, COMP_IMPLODE,
+	COMP_HUFFMAN, COMP_DEFLATE, COMP_IMPLODE,
+};
+
+CONST BYTE CANDIDATE_COMP[] = {					// Lossless stages tried by the policies, in ascending decoding cost
+	COMP_NONE, COMP_DEFLATE, COMP_IMPLODE,
+	COMP_HUFFMAN, COMP_HUFFMAN | COMP_IMPLODE,
+	COMP_BZIP2,
 };
 
+CONST BYTE MODERN_COMP = COMP_DEFLATE | COMP_BZIP2;	// Stages that Storm of Starcraft cannot read, only tried when enabled by SetModernCodec
+
 /************************************************************************/
 
 LCID DMpq::s_Locale;
+UINT DMpq::s_WorkerNum;
+DMpq::COMPRESS_POLICY DMpq::s_CompressPolicy;
+BOOL DMpq::s_ModernCodec;
+DMpq::DHandleTable *DMpq::s_HandleTable;
 DString DMpq::s_BashPath;
+DString DMpq::s_IndexPath;
 DWORD DMpq::s_HashTable[HASH_TABLE_NUM][0x100];
+DWORD DMpq::s_NameTable[0x100][HASH_TYPE_NUM * 2];
+
+CONST DWORD DMpq::DIndexCache::NULL_TABLE;
+
+/************************************************************************/
+
+class DMpq::DExtractWork : public DWork {
+
+public:
+
+	DExtractWork(DAccess *archive, CONST DBlockTable &blocks, CONST DNameList &names, CONST DExtractList &items, DExtractor &extractor, UINT worker_num) :
+		m_Access(archive),
+		m_BlockTable(blocks),
+		m_NameList(names),
+		m_ItemList(items),
+		m_Extractor(extractor),
+		m_WorkerNum(worker_num)
+	{
+		DAssert(worker_num);
+
+		m_Buffer = new BUFPTR[worker_num];
+		m_BufSize = new UINT[worker_num];
+		m_Success = new UINT[worker_num];
+
+		DMemClr(m_Buffer, worker_num * sizeof(BUFPTR));
+		DMemClr(m_BufSize, worker_num * sizeof(UINT));
+		DMemClr(m_Success, worker_num * sizeof(UINT));
+	}
+
+	~DExtractWork()
+	{
+		for (UINT i = 0U; i < m_WorkerNum; i++)
+			delete [] m_Buffer[i];
+
+		delete [] m_Buffer;
+		delete [] m_BufSize;
+		delete [] m_Success;
+	}
+
+	UINT GetSuccess(VOID) CONST
+	{
+		UINT num = 0U;
+		for (UINT i = 0U; i < m_WorkerNum; i++)
+			num += m_Success[i];
+		return num;
+	}
+
+	virtual BOOL Process(UINT index, UINT worker)
+	{
+		DAssert(worker < m_WorkerNum);
+
+		CONST EXTRACTITEM &item = m_ItemList[index];
+
+		if (Extract(item, worker))
+			m_Success[worker]++;
+		else
+			m_Extractor.Fail(item.index, m_NameList[item.index]);
+
+		// 单个文件失败不中止整批
+		return TRUE;
+	}
+
+protected:
+
+	BOOL Extract(CONST EXTRACTITEM &item, UINT worker)
+	{
+		CONST BLOCKENTRY &block = m_BlockTable[item.block_idx];
+
+		// 每个文件使用独立的缓冲，不经过共享的扇区缓存
+		DFileBuffer file_buf;
+		if (!file_buf.Open(m_Access, item.block_idx, block, item.key))
+			return FALSE;
+
+		// 每个线程的输出缓冲只增不减，在整批中重复使用
+		UINT size = block.file_size;
+		if (size > m_BufSize[worker]) {
+			delete [] m_Buffer[worker];
+			m_Buffer[worker] = new BYTE[size];
+			m_BufSize[worker] = size;
+		}
+
+		// 文件之间已经并行，单个文件内不再拆分扇区
+		if (size && !file_buf.ReadAll(m_Buffer[worker], 1U))
+			return FALSE;
+
+		return m_Extractor.Output(item.index, m_NameList[item.index], m_Buffer[worker], size);
+	}
+
+	DAccess				*m_Access;
+	CONST DBlockTable	&m_BlockTable;
+	CONST DNameList		&m_NameList;
+	CONST DExtractList	&m_ItemList;
+	DExtractor			&m_Extractor;
+	UINT				m_WorkerNum;
+	BUFPTR				*m_Buffer;
+	UINT				*m_BufSize;
+	UINT				*m_Success;
+
+};
+
+/************************************************************************/
+
+class DMpq::DAddWork : public DWork {
+
+public:
+
+	explicit DAddWork(UINT sector_shift) :
+		m_SectorShift(sector_shift),
+		m_InputSize(0U),
+		m_Output(NULL)
+	{
+		DAssert(sector_shift);
+	}
+
+	~DAddWork()
+	{
+		Clear();
+	}
+
+	UINT GetInputSize(VOID) CONST
+	{
+		return m_InputSize;
+	}
+
+	UINT GetEntryNum(VOID) CONST
+	{
+		return m_EntryList.size();
+	}
+
+	UINT GetSectorNum(VOID) CONST
+	{
+		return m_SectorList.size();
+	}
+
+	ADDENTRY &GetEntry(UINT index)
+	{
+		DAssert(index < m_EntryList.size());
+		return m_EntryList[index];
+	}
+
+	VOID Push(ADDENTRY &entry)
+	{
+		// 只有压缩文件的扇区需要交给工作线程
+		entry.first = m_SectorList.size();
+		if (entry.block.flags & BLOCK_COMP_MASK) {
+			for (UINT i = 0U; i < entry.sector_num; i++)
+				m_SectorList.push_back(m_EntryList.size());
+		}
+
+		m_InputSize += entry.block.file_size;
+		m_EntryList.push_back(entry);
+	}
+
+	// 在Run之前为每个扇区分配输出缓冲
+	VOID Prepare(VOID)
+	{
+		delete [] m_Output;
+		m_Output = NULL;
+
+		m_DataSize.assign(m_SectorList.size(), 0U);
+		if (!m_SectorList.empty())
+			m_Output = new BYTE[m_SectorList.size() << m_SectorShift];
+	}
+
+	VOID Clear(VOID)
+	{
+		for (UINT i = 0U; i < m_EntryList.size(); i++)
+			delete [] m_EntryList[i].buffer;
+
+		m_EntryList.clear();
+		m_SectorList.clear();
+		m_DataSize.clear();
+		m_InputSize = 0U;
+
+		delete [] m_Output;
+		m_Output = NULL;
+	}
+
+	// 返回压缩后的扇区，未能压缩时返回NULL
+	BUFPTR GetSector(CONST ADDENTRY &entry, UINT sector, UINT &data_size)
+	{
+		UINT index = entry.first + sector;
+		DAssert(index < m_DataSize.size());
+
+		data_size = m_DataSize[index];
+		return data_size ? m_Output + (index << m_SectorShift) : NULL;
+	}
+
+	virtual BOOL Process(UINT index, UINT /* worker */)
+	{
+		CONST ADDENTRY &entry = m_EntryList[m_SectorList[index]];
+
+		UINT sector = index - entry.first;
+		UINT sector_size = 1 << m_SectorShift;
+		UINT offset = sector << m_SectorShift;
+		UINT size = DMin(entry.block.file_size - offset, sector_size);
+		UINT data_size = sector_size;
+
+		// 每个线程从缓存池中取得各自的编解码上下文
+		CODEC_CONTEXT *ctx = alloc_codec_context();
+		if (!ctx || !DFileBuffer::PackSector(entry.block, entry.comp, sector, entry.data + offset, size, m_Output + (index << m_SectorShift), data_size, ctx))
+			data_size = 0U;
+		free_codec_context(ctx);
+
+		// 无法压缩的扇区按原样写入，不算失败
+		m_DataSize[index] = data_size;
+		return TRUE;
+	}
+
+protected:
+
+	UINT					m_SectorShift;
+	UINT					m_InputSize;
+	std::vector<ADDENTRY>	m_EntryList;
+	std::vector<UINT>		m_SectorList;		// Entry index of each sector to compress.
+	std::vector<UINT>		m_DataSize;			// Compressed size of each sector, 0 if not compressed.
+	BUFPTR					m_Output;
+
+};
 
 /************************************************************************/
 
 DMpq::DMpq() :
 	m_HashNum(0U),
 	m_Access(NULL),
-	m_HashTable(NULL)
+	m_HashTable(NULL),
+	m_Filter(NULL),
+	m_FreeSpace(NULL),
+	m_Updating(FALSE)
 {
-
+	DVarClr(m_Stream);
 }
 
 DMpq::~DMpq()
@@ -103,7 +378,7 @@ BOOL DMpq::CreateArchive(STRCPTR mpq_name, UINT &max_hash_num)
 	return TRUE;
 }
 
-BOOL DMpq::OpenArchive(STRCPTR mpq_name)
+BOOL DMpq::OpenArchive(STRCPTR mpq_name, UINT flags /* = 0U */)
 {
 	if (!mpq_name)
 		return FALSE;
@@ -113,7 +388,7 @@ BOOL DMpq::OpenArchive(STRCPTR mpq_name)
 
 	m_Access = new DAccess;
 
-	if (!Load(mpq_name)) {
+	if (!Load(mpq_name, flags)) {
 		Clear();
 		return FALSE;
 	}
@@ -132,13 +407,18 @@ BOOL DMpq::CloseArchive(VOID)
 
 BOOL DMpq::FileExist(STRCPTR file_name)
 {
-	if (!file_name || !*file_name)
+	return FileExist(DNameKey(file_name));
+}
+
+BOOL DMpq::FileExist(CONST DNameKey &name_key)
+{
+	if (!name_key.IsValid())
 		return FALSE;
 
 	if (!m_Access || !m_Access->Readable())
 		return FALSE;
 
-	HASHENTRY *hash = Lookup(file_name);
+	HASHENTRY *hash = Lookup(name_key);
 	if (!hash || hash->block_index >= m_BlockTable.size())
 		return FALSE;
 
@@ -151,11 +431,10 @@ BOOL DMpq::FileExist(STRCPTR file_name)
 
 BOOL DMpq::FileExist(HANDLE file)
 {
-	if (!file)
+	if (!file || !s_HandleTable)
 		return FALSE;
 
-	DSubFile *sub = static_cast<DSubFile *>(file);
-	if (sub->GetAccess() != m_Access)
+	if (s_HandleTable->GetOwner(file) != this)
 		return FALSE;
 
 	return TRUE;
@@ -163,73 +442,54 @@ BOOL DMpq::FileExist(HANDLE file)
 
 HANDLE DMpq::OpenFile(STRCPTR file_name)
 {
-	if (!file_name || !*file_name)
-		return NULL;
-
-	if (!m_Access || !m_Access->Readable())
-		return NULL;
+	return OpenFile(DNameKey(file_name));
+}
 
-	HASHENTRY *hash = Lookup(file_name);
-	if (!hash || hash->block_index >= m_BlockTable.size())
+HANDLE DMpq::OpenFile(CONST DNameKey &name_key)
+{
+	if (!name_key.IsValid())
 		return NULL;
 
-	BLOCKENTRY *block = &m_BlockTable[hash->block_index];
-	if (!(block->flags & BLOCK_EXIST))
+	if (!m_Access || !m_Access->Readable())
 		return NULL;
 
-	DWORD key = CalcFileKey(file_name, *block);
-	DSubFile *sub = new DSubFile;
-	if (!sub->Open(m_Access, hash->block_index, *block, key)) {
-		delete sub;
+	HASHENTRY *hash = Lookup(name_key);
+	if (!hash)
 		return NULL;
-	}
 
-	m_FileList.push_back(sub);
-	return static_cast<HANDLE>(sub);
+	return OpenFile(name_key, hash - m_HashTable);
 }
 
 BOOL DMpq::CloseFile(HANDLE file)
 {
-	for (DFileList::iterator it = m_FileList.begin(); it != m_FileList.end(); ++it) {
-		DSubFile *sub = *it;
-		if (sub != file)
-			continue;
-		DVerify(sub->Close());
-		delete sub;
-		m_FileList.erase(it);
-		return TRUE;
-	}
+	if (!file || !s_HandleTable)
+		return FALSE;
 
-	return FALSE;
+	// 正在写入的文件关闭时写回档案
+	if (file == m_Stream.file)
+		return CloseStream();
+
+	return s_HandleTable->Remove(this, file);
 }
 
 HANDLE DMpq::OpenHandle(STRCPTR file_name)
 {
-	if (!file_name || !*file_name)
-		return NULL;
-
-	if (!m_Access || !m_Access->Readable())
-		return NULL;
-
-	HASHENTRY *hash = Lookup(file_name);
-	if (!hash || hash->block_index >= m_BlockTable.size())
-		return NULL;
-
-	BLOCKENTRY *block = &m_BlockTable[hash->block_index];
-
-	if (!(block->flags & BLOCK_EXIST))
-		return NULL;
+	return OpenHandle(DNameKey(file_name));
+}
 
-	if (block->flags & BLOCK_COMP_MASK)
+HANDLE DMpq::OpenHandle(CONST DNameKey &name_key)
+{
+	if (!name_key.IsValid())
 		return NULL;
 
-	if (block->flags & BLOCK_ENCRYPT)
+	if (!m_Access || !m_Access->Readable())
 		return NULL;
 
-	if (!m_Access->Seek(block->offset))
+	HASHENTRY *hash = Lookup(name_key);
+	if (!hash)
 		return NULL;
 
-	return m_Access->ShareHandle();
+	return OpenHandle(name_key, hash - m_HashTable);
 }
 
 BOOL DMpq::AddFile(STRCPTR file_name, STRCPTR real_path, BOOL compress, BOOL encrypt)
@@ -237,7 +497,7 @@ BOOL DMpq::AddFile(STRCPTR file_name, STRCPTR real_path, BOOL compress, BOOL enc
 	if (!file_name || !*file_name || !real_path)
 		return FALSE;
 
-	if (!m_Access || !m_Access->Writable())
+	if (!m_Access || !m_Access->Writable() || m_Stream.file)
 		return FALSE;
 
 	DFile file;
@@ -258,7 +518,7 @@ BOOL DMpq::NewFile(STRCPTR file_name, BUFCPTR file_data, UINT size, BOOL compres
 	if (!file_data && size)
 		return FALSE;
 
-	if (!m_Access || !m_Access->Writable())
+	if (!m_Access || !m_Access->Writable() || m_Stream.file)
 		return FALSE;
 
 	UINT block_idx;
@@ -269,14 +529,50 @@ BOOL DMpq::NewFile(STRCPTR file_name, BUFCPTR file_data, UINT size, BOOL compres
 	if (!hash)
 		return FALSE;
 
+	DSubFile sub;
+	return NewFile(&sub, hash, block_idx, block, key, comp, file_data);
+}
+
+HANDLE DMpq::OpenNewFile(STRCPTR file_name, UINT size, BOOL compress, BOOL encrypt)
+{
+	if (!file_name || !*file_name || !s_HandleTable)
+		return NULL;
+
+	// 同时只能写入一个文件，写入期间档案的其他修改都被拒绝
+	if (!m_Access || !m_Access->Writable() || m_Stream.file)
+		return NULL;
+
+	UINT block_idx;
+	DWORD key;
+	BYTE comp;
+	BLOCKENTRY block;
+	HASHENTRY *hash = PrepareAdd(file_name, size, compress, encrypt, block_idx, block, key, comp);
+	if (!hash)
+		return NULL;
+
 	DSubFile *sub = new DSubFile;
-	if (!NewFile(sub, hash, block_idx, block, key, comp, file_data)) {
+	if (!sub->Create(m_Access, block_idx, block, key, comp)) {
+		m_FreeSpace->Free(block.offset, GetReserveSize(block));
 		delete sub;
-		return FALSE;
+		return NULL;
 	}
 
-	m_FileList.push_back(sub);
-	return TRUE;
+	HANDLE file = s_HandleTable->Insert(this, sub);
+	if (!file) {
+		DVerify(sub->Close());
+		delete sub;
+		m_Access->FreeBuffer(block_idx);
+		m_FreeSpace->Free(block.offset, GetReserveSize(block));
+		return NULL;
+	}
+
+	m_Stream.file = file;
+	m_Stream.hash = hash;
+	m_Stream.block_idx = block_idx;
+	m_Stream.block = block;
+	m_Stream.key = key;
+
+	return file;
 }
 
 BOOL DMpq::DelFile(STRCPTR file_name)
@@ -284,636 +580,3491 @@ BOOL DMpq::DelFile(STRCPTR file_name)
 	if (!file_name || !*file_name)
 		return FALSE;
 
-	if (!m_Access || !m_Access->Writable())
+	if (!m_Access || !m_Access->Writable() || m_Stream.file)
 		return FALSE;
 
-	HASHENTRY *hash = Lookup(file_name);
+	HASHENTRY *hash = Lookup(DNameKey(file_name));
 	if (!hash)
 		return FALSE;
 
 	// reserve block index before delete
 	UINT block_idx = hash->block_index;
 
-	DMemSet(hash, 0xff, sizeof(HASHENTRY));
+	// 打开的句柄仍在读取块的数据，删除后空间和块表项被重新使用时会读到其他文件的数据
+	if (block_idx < m_BlockTable.size() && m_BlockTable[block_idx].data_size
+		&& s_HandleTable->IsOpen(this, m_BlockTable[block_idx].offset))
+		return FALSE;
 
 	// mark as deleted
-	UINT entry = (hash - m_HashTable + 1) & (m_HashNum - 1);
-	if (m_HashTable[entry].block_index == HASH_ENTRY_EMPTY)
-		hash->block_index = HASH_ENTRY_EMPTY;
-	else
-		hash->block_index = HASH_ENTRY_INVALID;
+	FreeHash(hash);
 
 	if (block_idx >= m_BlockTable.size())
 		return TRUE;
 
-	BLOCKENTRY *block = &m_BlockTable[hash->block_index];
+	// 磁盘上的表仍然引用块的数据，提交之后才能交给空闲空间索引，块表项可以立即重新使用
+	BLOCKENTRY *block = &m_BlockTable[block_idx];
+	if (block->data_size)
+		m_RetiredSpace.push_back(DExtent(block->offset, block->data_size));
+	DMemClr(block, sizeof(BLOCKENTRY));
+	m_KeyMap.erase(block_idx);
+	m_Access->FreeBuffer(block_idx);
 
-	if (block->data_size) {
-		block->file_size = 0UL;
-		block->flags = 0UL;
-	} else {
-		DMemClr(block, sizeof(BLOCKENTRY));
-	}
+	// 末尾的空块表项直接去掉
+	while (!m_BlockTable.empty() && !(m_BlockTable.back().flags & BLOCK_EXIST))
+		m_BlockTable.pop_back();
 
-	// TODO: 由于目前只有Create的MPQ才能进行write操作
-	// 因此只需考虑文件布局如下的情况：
-	//		Header
-	//		File Data
-	//		Hash Table
-	//		Block Table
-	// 因此File Data的末尾也是Hash Table的开始
-	return Writeback(GetEndOfFileData());
+	return AutoCommit();
 }
 
-UINT DMpq::GetFileSize(HANDLE file)
+BOOL DMpq::Compact(VOID)
 {
-	if (!file)
-		return ERROR_SIZE;
+	if (!m_Access || !m_Access->Writable() || m_Stream.file)
+		return FALSE;
 
-	DSubFile *sub = static_cast<DSubFile *>(file);
-	return sub->GetSize();
-}
+	// 移动数据会覆盖磁盘上的表仍在引用的空间，不能在事务中进行
+	if (m_Updating)
+		return FALSE;
 
-UINT DMpq::ReadFile(HANDLE file, VPTR data, UINT size)
-{
-	if (!file)
-		return 0U;
+	// 打开的句柄保存着块原来的偏移和序号，移动和重新编号之后会读到其他文件的数据
+	if (s_HandleTable->IsOpen(this))
+		return FALSE;
 
-	DSubFile *sub = static_cast<DSubFile *>(file);
-	return sub->Read(data, size);
-}
+	DAssert(m_FreeSpace);
 
-UINT DMpq::SeekFile(HANDLE file, INT offset, SEEK_MODE mode /* = SM_BEGIN */)
-{
-	if (!file)
-		return ERROR_POS;
+	// 按偏移排序存在的块
+	DExtentList extents;
+	for (UINT i = 0U; i < m_BlockTable.size(); i++) {
+		CONST BLOCKENTRY &block = m_BlockTable[i];
+		if ((block.flags & BLOCK_EXIST) && block.data_size)
+			extents.push_back(DExtent(block.offset, i));
+	}
 
-	DSubFile *sub = static_cast<DSubFile *>(file);
-	return sub->Seek(offset, mode);
-}
+	std::sort(extents.begin(), extents.end());
 
-BOOL DMpq::Initialize(VOID)
-{
-	s_Locale = 0x0409U;
-	s_BashPath = DGetCwd();
+	// 数据相互重叠的档案不能移动
+	for (UINT i = 1U; i < extents.size(); i++) {
+		CONST BLOCKENTRY &prev = m_BlockTable[extents[i - 1].second];
+		if (prev.offset + prev.data_size > extents[i].first)
+			return FALSE;
+	}
 
-	DWORD seed = 0x00100001UL;
+	// 打开的档案中加密块的密钥未知，先按列表文件中的文件名计算
+	UINT unknown = 0U;
+	for (UINT i = 0U; i < extents.size(); i++) {
+		if ((m_BlockTable[extents[i].second].flags & BLOCK_ENCRYPT) && !m_KeyMap.count(extents[i].second))
+			unknown++;
+	}
 
-	for (INT j = 0; j < 0x100; j++) {
-		for (INT i = 0; i < HASH_TABLE_NUM; i++) {
-			seed = (seed * 125 + 3) % 0x2aaaab;
-			DWORD high = seed & 0xffff;
-			seed = (seed * 125 + 3) % 0x2aaaab;
-			DWORD low = seed & 0xffff;
-			s_HashTable[i][j] = DMakeDWord(low, high);
+	DNameList names;
+	if (unknown && ListFiles(names)) {
+		names.push_back(LIST_FILE_NAME);
+		for (UINT i = 0U; i < names.size(); i++) {
+			DNameKey name_key(names[i]);
+			HASHENTRY *hash = name_key.IsValid() ? Lookup(name_key) : NULL;
+			if (!hash || hash->block_index >= m_BlockTable.size())
+				continue;
+			CONST BLOCKENTRY &block = m_BlockTable[hash->block_index];
+			if ((block.flags & BLOCK_EXIST) && (block.flags & BLOCK_ENCRYPT))
+				m_KeyMap[hash->block_index] = CalcFileKey(name_key, block);
 		}
 	}
 
-	return TRUE;
-}
+	// 磁盘上的表在文件头更新之前仍然有效，移动时保留其空间
+	BOOL ret = PackBlocks();
 
-VOID DMpq::Exit(VOID)
-{
-	DVarClr(s_HashTable);
+	// 去掉不存在的块表项，重新编号
+	std::vector<DWORD> block_map(m_BlockTable.size(), HASH_ENTRY_INVALID);
+	UINT block_num = 0U;
 
-	s_Locale = 0UL;
-}
+	for (UINT i = 0U; i < m_BlockTable.size(); i++) {
+		if (!(m_BlockTable[i].flags & BLOCK_EXIST))
+			continue;
+		block_map[i] = block_num;
+		m_BlockTable[block_num++] = m_BlockTable[i];
+	}
 
-BOOL DMpq::SetBasePath(STRCPTR path)
-{
-	if (!path || *path)
+	m_BlockTable.resize(block_num);
+
+	DKeyMap key_map;
+	for (DKeyMap::iterator it = m_KeyMap.begin(); it != m_KeyMap.end(); ++it) {
+		if (it->first < block_map.size() && block_map[it->first] != HASH_ENTRY_INVALID)
+			key_map[block_map[it->first]] = it->second;
+	}
+
+	m_KeyMap.swap(key_map);
+
+	for (UINT i = 0U; i < m_HashNum; i++) {
+		HASHENTRY *hash = m_HashTable + i;
+		if (hash->block_index < block_map.size()) {
+			if (block_map[hash->block_index] != HASH_ENTRY_INVALID)
+				hash->block_index = block_map[hash->block_index];
+			else
+				FreeHash(hash);
+		}
+	}
+
+	ResetFreeSpace();
+	m_Access->FreeBuffers();
+
+	// 即使移动失败，已经移动的块也要写回新的位置
+	if (!Writeback())
 		return FALSE;
 
-	UINT size = DFile::GetFullPath(path);
-	if (!size)
+	if (!ret)
 		return FALSE;
 
-	DArray<CHAR> str(size);
+	// 提交之后原有的表不再使用，再移动一遍并重写表，收回原有的表占用的空间
+	ret = PackBlocks();
 
-	if (DFile::GetFullPath(path, str, size) != size)
-		return FALSE;
+	ResetFreeSpace();
+	m_Access->FreeBuffers();
 
-	if (!DFile::IsDir(path))
+	if (!Writeback())
 		return FALSE;
 
-	s_BashPath.Assign(str);
-	return TRUE;
+	return ret;
 }
 
-STRCPTR DMpq::GetBasePath(VOID)
+BOOL DMpq::PackBlocks(VOID)
 {
-	return s_BashPath;
-}
+	DAssert(m_FreeSpace);
 
-VOID DMpq::SetLocale(LCID locale)
-{
-	s_Locale = locale;
-}
+	// 按偏移排序存在的块
+	DExtentList extents;
+	for (UINT i = 0U; i < m_BlockTable.size(); i++) {
+		CONST BLOCKENTRY &block = m_BlockTable[i];
+		if ((block.flags & BLOCK_EXIST) && block.data_size)
+			extents.push_back(DExtent(block.offset, i));
+	}
 
-LCID DMpq::GetLocale(VOID)
-{
-	return s_Locale;
-}
+	std::sort(extents.begin(), extents.end());
 
-/************************************************************************/
+	DExtentList tables(m_TableSpace);
+	std::sort(tables.begin(), tables.end());
 
-BOOL DMpq::Create(STRCPTR mpq_name, UINT hash_num)
-{
-	DAssert(mpq_name && hash_num);
-	DAssert(m_Access && !m_HashTable && !m_BlockTable.size());
+	BOOL ret = TRUE;
+	UINT pos = sizeof(HEADER);
 
-	if (!m_Access->Create(mpq_name))
-		return FALSE;
+	// 依次把块向前移动，无法移动的块留在原处
+	for (UINT i = 0U; ret && m_FreeSpace->GetFreeSize() && i < extents.size(); i++) {
 
-	UINT hash_size = hash_num * sizeof(HASHENTRY);
-	m_HashTable = new HASHENTRY[hash_num];
-	DMemSet(m_HashTable, 0xff, hash_size);
+		BLOCKENTRY &block = m_BlockTable[extents[i].second];
 
-	HEADER header;
-	header.identifier = MPQ_IDENTIFIER;
-	header.header_size = sizeof(header);
-	header.archive_size = sizeof(header) + hash_size;
-	header.version = SUPPORT_VERSION;
-	header.sector_shift = SUPPORT_SECTOR_SHIFT;
-	header.hash_table_offset = sizeof(header);
-	header.block_table_offset = 0UL;
-	header.hash_num = hash_num;
-	header.block_num = 0UL;
+		// 块不能移到磁盘上的表占用的空间，放不下时跳到表的后面
+		for (UINT j = 0U; j < tables.size(); j++) {
+			if (tables[j].first < pos + block.data_size && pos < tables[j].first + tables[j].second)
+				pos = tables[j].first + tables[j].second;
+		}
 
-	if (!m_Access->Write(&header, sizeof(header)))
-		return FALSE;
+		if (pos < block.offset) {
 
-	DArray<HASHENTRY> hash_table(hash_num);
-	DMemCpy(hash_table, m_HashTable, hash_size);
+			// 密钥和偏移相关的加密块需要用新的密钥重新加密
+			// 密钥未知时只能由压缩文件的偏移表推算出来
+			DWORD key = 0UL;
+			BOOL recrypt = ((block.flags & BLOCK_ENCRYPT) && (block.flags & BLOCK_FIX_KEY));
+			BOOL movable = TRUE;
 
-	DWORD key = HashString(HASH_TABLE_KEY, HASH_FILE_KEY);
-	EncryptData(hash_table, hash_size, key);
+			if (recrypt) {
+				DKeyMap::iterator it = m_KeyMap.find(extents[i].second);
+				if (it != m_KeyMap.end())
+					key = it->second;
+				else
+					movable = DetectFileKey(block, key);
+			}
 
-	if (!m_Access->Write(hash_table, hash_size))
-		return FALSE;
+			if (movable) {
+				ret = MoveBlock(block, pos, recrypt, key);
+				if (ret && recrypt)
+					m_KeyMap[extents[i].second] = key;
+			}
+		}
 
-	m_HashNum = hash_num;
-	m_BlockTable.clear();
+		pos = block.offset + block.data_size;
+	}
 
-	return TRUE;
+	return ret;
 }
 
-BOOL DMpq::Load(STRCPTR mpq_name)
+BOOL DMpq::BeginUpdate(VOID)
 {
-	DAssert(mpq_name);
-	DAssert(m_Access && !m_HashTable && !m_BlockTable.size());
-
-	if (!m_Access->Open(mpq_name))
+	if (!m_Access || !m_Access->Writable())
 		return FALSE;
 
-	HEADER header;
-	if (!m_Access->Read(&header, sizeof(header)))
+	if (m_Updating || m_Stream.file)
 		return FALSE;
 
-	if (header.version != SUPPORT_VERSION)
+	// 保存当前的表，回滚时恢复
+	m_SavedHashTable.assign(m_HashTable, m_HashTable + m_HashNum);
+	m_SavedBlockTable = m_BlockTable;
+	m_SavedKeyMap = m_KeyMap;
+
+	m_Updating = TRUE;
+	return TRUE;
+}
+
+BOOL DMpq::Commit(VOID)
+{
+	if (!m_Updating || m_Stream.file)
 		return FALSE;
 
-	if (header.hash_num < HASH_NUM_MIN || header.hash_num > HASH_NUM_MAX)
+	// 提交失败时事务保持不变，可以重试或者回滚
+	if (!Writeback())
 		return FALSE;
 
-	m_HashNum = header.hash_num;
+	m_SavedHashTable.clear();
+	m_SavedBlockTable.clear();
+	m_SavedKeyMap.clear();
 
-	if (!m_Access->Seek(header.hash_table_offset))
-		return FALSE;
+	m_Updating = FALSE;
+	return TRUE;
+}
 
-	m_HashTable = new HASHENTRY[m_HashNum];
-	UINT size = m_HashNum * sizeof(HASHENTRY);
-	if (!m_Access->Read(m_HashTable, size))
+BOOL DMpq::Rollback(VOID)
+{
+	if (!m_Updating || m_Stream.file)
 		return FALSE;
 
-	DWORD key = HashString(HASH_TABLE_KEY, HASH_FILE_KEY);
-	DecryptData(m_HashTable, size, key);
-
-	UINT block_num = header.block_num;
+	DAssert(m_SavedHashTable.size() == m_HashNum);
 
-	if (block_num) {
+	DMemCpy(m_HashTable, &m_SavedHashTable.front(), m_HashNum * sizeof(HASHENTRY));
+	m_BlockTable.swap(m_SavedBlockTable);
+	m_KeyMap.swap(m_SavedKeyMap);
 
-		if (!m_Access->Seek(header.block_table_offset))
-			return FALSE;
+	m_SavedHashTable.clear();
+	m_SavedBlockTable.clear();
+	m_SavedKeyMap.clear();
 
-		m_BlockTable.resize(block_num);
-		size = block_num * sizeof(BLOCKENTRY);
-		if (!m_Access->Read(&m_BlockTable.front(), size))
-			return FALSE;
+	// 事务中写入的数据都不再使用，被删除的块也恢复原状
+	m_RetiredSpace.clear();
+	ResetFreeSpace();
+	m_Access->FreeBuffers();
 
-		key = HashString(BLOCK_TABLE_KEY, HASH_FILE_KEY);
-		DecryptData(&m_BlockTable.front(), size, key);
-	}
+	// 截掉事务中追加在末尾的数据
+	m_Access->SetSize(m_FreeSpace->GetEnd());
 
+	m_Updating = FALSE;
 	return TRUE;
 }
 
-VOID DMpq::Clear(VOID)
+UINT DMpq::AddFiles(CONST DAddList &files, BOOL *results /* = NULL */)
 {
-	for (DFileList::iterator it = m_FileList.begin(); it != m_FileList.end(); ++it)
-		delete *it;
+	if (results) {
+		for (UINT i = 0U; i < files.size(); i++)
+			results[i] = FALSE;
+	}
 
-	m_FileList.clear();
-	m_BlockTable.clear();
+	if (!m_Access || !m_Access->Writable() || m_Stream.file)
+		return 0U;
 
-	m_HashNum = 0U;
+	UINT worker_num = GetWorkerNum();
 
-	delete [] m_HashTable;
-	m_HashTable = NULL;
+	DWorkPool pool;
+	pool.SetWorkerNum(worker_num);
 
-	delete m_Access;
-	m_Access = NULL;
+	DAddWork work(m_Access->SectorShift());
+
+	// 所有文件的数据依次写在原有数据之后，散列表和块表最后只写一次
+	typedef std::pair<HASHENTRY *, UINT> DAddedEntry;
+
+	std::vector<DAddedEntry> added;
+	UINT org_block_num = m_BlockTable.size();
+	UINT offset = m_FreeSpace->GetEnd();
+	UINT block_idx = 0U;
+	UINT success = 0U;
+	BOOL ret = TRUE;
+
+	for (UINT next = 0U; ret && next < files.size(); ) {
+
+		// 读入一批文件的数据并预留散列表项
+		work.Clear();
+		for (; next < files.size() && work.GetInputSize() < ADD_BATCH_SIZE; next++) {
+			ADDENTRY entry;
+			if (!PrepareAdd(files[next], entry))
+				continue;
+			entry.index = next;
+			work.Push(entry);
+		}
+
+		// 并行压缩这一批的全部扇区
+		work.Prepare();
+		if (work.GetSectorNum())
+			DVerify(pool.Run(work, work.GetSectorNum()));
+
+		// 在调用线程中按顺序加密并写入
+		for (UINT i = 0U; i < work.GetEntryNum(); i++) {
+
+			ADDENTRY &entry = work.GetEntry(i);
+
+			if (ret) {
+				entry.block.offset = offset;
+				ret = WriteEntry(work, entry);
+			}
+
+			// 写入失败后这一批剩余的文件都不再添加
+			if (!ret) {
+				FreeHash(entry.hash);
+				continue;
+			}
+
+			// 空闲的块表项优先使用
+			block_idx = FindFreeBlock(block_idx);
+			m_Access->FreeBuffer(block_idx);
+			entry.hash->block_index = block_idx;
+			if (block_idx < m_BlockTable.size())
+				m_BlockTable[block_idx] = entry.block;
+			else
+				m_BlockTable.push_back(entry.block);
+
+			added.push_back(DAddedEntry(entry.hash, block_idx));
+			if (entry.block.flags & BLOCK_ENCRYPT)
+				m_KeyMap[block_idx] = CalcFileKey(entry.base_key, entry.block);
+			m_FreeSpace->Append(entry.block.data_size);
+			offset += entry.block.data_size;
+
+			if (results)
+				results[entry.index] = TRUE;
+			success++;
+		}
+	}
+
+	if (!success || AutoCommit())
+		return success;
+
+	// 表写入失败时撤销全部添加
+	for (UINT i = 0U; i < added.size(); i++) {
+		BLOCKENTRY &block = m_BlockTable[added[i].second];
+		m_FreeSpace->Free(block.offset, block.data_size);
+		DMemClr(&block, sizeof(BLOCKENTRY));
+		m_KeyMap.erase(added[i].second);
+		FreeHash(added[i].first);
+	}
+
+	m_BlockTable.resize(org_block_num);
+
+	if (results) {
+		for (UINT i = 0U; i < files.size(); i++)
+			results[i] = FALSE;
+	}
+
+	return 0U;
 }
 
-BOOL DMpq::AddFile(STRCPTR file_name, BOOL compress, BOOL encrypt, DFile &file)
+BOOL DMpq::ListFiles(DNameList &names)
 {
-	DAssert(file_name && file.IsOpen());
+	names.clear();
 
-	UINT size = file.GetSize();
-	if (size == ERROR_SIZE)
-		return FALSE;
+	// 索引文件中保存了列表文件的内容
+	CONST DIndexCache *index = m_Access ? m_Access->GetIndex() : NULL;
+	if (index && index->GetNames(names))
+		return TRUE;
 
-	UINT block_idx;
-	DWORD key;
-	BYTE comp;
-	BLOCKENTRY block;
-	HASHENTRY *hash = PrepareAdd(file_name, size, compress, encrypt, block_idx, block, key, comp);
-	if (!hash)
+	HANDLE file = OpenFile(LIST_FILE_NAME);
+	if (!file)
 		return FALSE;
 
-	DSubFile *sub = new DSubFile;
-	if (!AddFile(sub, hash, block_idx, block, key, comp, file)) {
-		delete sub;
-		return FALSE;
+	UINT size = GetFileSize(file);
+	STRPTR buf = new CHAR[size + 1];
+	BOOL ret = (ReadAll(file, buf, size) == size);
+
+	DVerify(CloseFile(file));
+
+	// 文件名之间以分号或换行分隔
+	for (UINT pos = 0U; ret && pos < size; pos++) {
+		UINT beg = pos;
+		while (pos < size && buf[pos] != ';' && buf[pos] != '\r' && buf[pos] != '\n')
+			pos++;
+		if (pos > beg)
+			names.push_back(DString(buf + beg, pos - beg));
 	}
 
-	m_FileList.push_back(sub);
-	return TRUE;
+	delete [] buf;
+	return ret;
 }
 
-BOOL DMpq::AddFile(DSubFile *sub, HASHENTRY *hash, UINT block_idx, CONST BLOCKENTRY &block, DWORD key, BYTE comp, DFile &file)
+UINT DMpq::ExtractFiles(CONST DNameList &names, DExtractor &extractor)
 {
-	DAssert(sub && hash && m_Access && m_HashNum);
+	BOOL readable = (m_Access && m_Access->Readable());
 
-	if (!sub->Create(m_Access, block_idx, block, key, comp))
-		return FALSE;
+	DExtractList items;
+	items.reserve(names.size());
 
-	BOOL flag = TRUE;
-	UINT size = block.file_size;
-	UINT buf_size = 1 << (m_Access->SectorShift() + 3);
-	DArray<BYTE> rd_buf(buf_size);
+	// 先在调用线程中查找全部文件，找不到的直接报告失败
+	for (UINT i = 0U; i < names.size(); i++) {
 
-	for (UINT rd_size = 0; size && flag; size -= rd_size) {
-		rd_size = file.Read(rd_buf, buf_size);
-		if (!rd_size)
-			break;
-		if (sub->Write(rd_buf, rd_size) != rd_size)
-			flag = FALSE;
+		STRCPTR file_name = names[i];
+		DNameKey name_key(file_name);
+
+		HASHENTRY *hash = (readable && name_key.IsValid()) ? Lookup(name_key) : NULL;
+		if (!hash || hash->block_index >= m_BlockTable.size() || !(m_BlockTable[hash->block_index].flags & BLOCK_EXIST)) {
+			extractor.Fail(i, file_name);
+			continue;
+		}
+
+		CONST BLOCKENTRY &block = m_BlockTable[hash->block_index];
+
+		EXTRACTITEM item;
+		item.index = i;
+		item.block_idx = hash->block_index;
+		item.offset = block.offset;
+		item.key = CalcFileKey(name_key, block);
+
+		items.push_back(item);
 	}
-	DAssert(flag);
 
-	if (!flag)
-		return FALSE;
+	if (items.empty())
+		return 0U;
 
-	if  (!Writeback(sub, hash, block_idx))
-		return FALSE;
+	// 可写的档案中刚写入的数据可能还在缓冲中
+	if (m_Access->Writable() && !m_Access->Flush())
+		return 0U;
 
-	return TRUE;
+	// 按数据在档案中的位置排序，尽量顺序读取
+	std::sort(items.begin(), items.end(), CompareOffset);
+
+	UINT worker_num = GetWorkerNum();
+
+	DWorkPool pool;
+	pool.SetWorkerNum(worker_num);
+
+	DExtractWork work(m_Access, m_BlockTable, names, items, extractor, worker_num);
+	DVerify(pool.Run(work, items.size()));
+
+	return work.GetSuccess();
 }
 
-BOOL DMpq::NewFile(DSubFile *sub, HASHENTRY *hash, UINT block_idx, CONST BLOCKENTRY &block, DWORD key, BYTE comp, BUFCPTR file_data)
+UINT DMpq::ExtractAll(DExtractor &extractor)
 {
-	DAssert(sub && m_Access && m_HashNum);
+	DNameList names;
+	if (!ListFiles(names))
+		return 0U;
 
-	if (!sub->Create(m_Access, block_idx, block, key, comp))
-		return FALSE;
+	return ExtractFiles(names, extractor);
+}
 
-	if (sub->Write(file_data, block.file_size) != block.file_size)
-		return FALSE;
+UINT DMpq::MatchNames(CONST DNameList &names, std::vector<UINT> &hits)
+{
+	std::vector<STRCPTR> name_ptrs(names.size());
+	for (UINT i = 0U; i < names.size(); i++)
+		name_ptrs[i] = names[i];
+
+	return MatchNames(name_ptrs.size(), name_ptrs.empty() ? NULL : &name_ptrs[0], hits);
+}
+
+UINT DMpq::MatchNames(UINT num, CONST STRCPTR *names, std::vector<UINT> &hits)
+{
+	hits.clear();
+
+	if (!names || !m_Access || !m_Access->Readable())
+		return 0U;
+
+	// 没有过滤器时临时建立一个，大部分候选文件名无需遍历冲突链即可排除
+	DNameFilter local_filter;
+	CONST DNameFilter *filter = m_Filter;
+
+	if (!filter) {
+		UINT key_num = 0U;
+		for (UINT i = 0U; i < m_HashNum; i++) {
+			if (m_HashTable[i].block_index < m_BlockTable.size())
+				key_num++;
+		}
+		DVerify(local_filter.Create(key_num));
+		for (UINT i = 0U; i < m_HashNum; i++) {
+			if (m_HashTable[i].block_index < m_BlockTable.size())
+				local_filter.Add(NameHash(m_HashTable[i]));
+		}
+		filter = &local_filter;
+	}
+
+	DNameKey name_keys[MATCH_BATCH_NUM];
+
+	for (UINT i = 0U; i < num; i += MATCH_BATCH_NUM) {
+
+		UINT batch_num = DMin(num - i, MATCH_BATCH_NUM);
+		DNameKey::AssignBatch(batch_num, names + i, name_keys);
+
+		for (UINT j = 0U; j < batch_num; j++) {
+			if (!name_keys[j].IsValid() || !filter->MayExist(name_keys[j].GetHash()))
+				continue;
+			if (ProbeName(name_keys[j]))
+				hits.push_back(i + j);
+		}
+	}
+
+	return hits.size();
+}
+
+UINT DMpq::GetFileSize(HANDLE file)
+{
+	if (!file || !s_HandleTable)
+		return ERROR_SIZE;
+
+	// 持有引用期间即使其他线程关闭句柄，文件也不会被释放
+	HANDLEENTRY *entry = s_HandleTable->Acquire(file);
+	if (!entry)
+		return ERROR_SIZE;
+
+	UINT size = entry->sub->GetSize();
+	s_HandleTable->Release(entry);
+	return size;
+}
+
+UINT DMpq::ReadFile(HANDLE file, VPTR data, UINT size)
+{
+	if (!file || !s_HandleTable)
+		return 0U;
+
+	HANDLEENTRY *entry = s_HandleTable->Acquire(file);
+	if (!entry)
+		return 0U;
+
+	UINT rd_size = entry->sub->Read(data, size);
+	s_HandleTable->Release(entry);
+	return rd_size;
+}
+
+UINT DMpq::ReadAll(HANDLE file, VPTR data, UINT size)
+{
+	if (!file || !s_HandleTable)
+		return 0U;
+
+	HANDLEENTRY *entry = s_HandleTable->Acquire(file);
+	if (!entry)
+		return 0U;
+
+	UINT rd_size = entry->sub->ReadAll(data, size);
+	s_HandleTable->Release(entry);
+	return rd_size;
+}
+
+UINT DMpq::WriteFile(HANDLE file, VCPTR data, UINT size)
+{
+	if (!file || !s_HandleTable)
+		return 0U;
+
+	HANDLEENTRY *entry = s_HandleTable->Acquire(file);
+	if (!entry)
+		return 0U;
+
+	UINT wrt_size = entry->sub->Write(data, size);
+	s_HandleTable->Release(entry);
+	return wrt_size;
+}
+
+UINT DMpq::SeekFile(HANDLE file, INT offset, SEEK_MODE mode /* = SM_BEGIN */)
+{
+	if (!file || !s_HandleTable)
+		return ERROR_POS;
+
+	HANDLEENTRY *entry = s_HandleTable->Acquire(file);
+	if (!entry)
+		return ERROR_POS;
+
+	UINT pos = entry->sub->Seek(offset, mode);
+	s_HandleTable->Release(entry);
+	return pos;
+}
+
+UINT DMpq::GetCacheSize(VOID) CONST
+{
+	if (!m_Access)
+		return 0U;
 
-	if  (!Writeback(sub, hash, block_idx))
+	return m_Access->GetCache()->GetBudget();
+}
+
+BOOL DMpq::SetCacheSize(UINT size)
+{
+	if (!m_Access || !m_Access->Readable())
 		return FALSE;
 
+	m_Access->GetCache()->SetBudget(size);
 	return TRUE;
 }
 
-DMpq::HASHENTRY *DMpq::PrepareAdd(STRCPTR file_name, UINT file_size, BOOL compress, BOOL encrypt, UINT &block_idx, BLOCKENTRY &block, DWORD &key, BYTE &compression)
+BOOL DMpq::Initialize(VOID)
 {
-	DAssert(file_name && *file_name);
-
-	// TODO: 由于目前只有Create的MPQ才能进行write操作
-	// 因此只需考虑文件布局如下的情况：
-	//		Header
-	//		File Data
-	//		Hash Table
-	//		Block Table
+	s_Locale = 0x0409U;
+	s_BashPath = DGetCwd();
 
-	block_idx = AllocBlock(file_size, compress, encrypt, block);
-	if (block_idx == HASH_ENTRY_INVALID || block_idx == HASH_ENTRY_EMPTY)
-		return NULL;
+	DWORD seed = 0x00100001UL;
 
-	HASHENTRY *hash = AllocHash(file_name);
-	if (!hash)
-		return NULL;
+	for (INT j = 0; j < 0x100; j++) {
+		for (INT i = 0; i < HASH_TABLE_NUM; i++) {
+			seed = (seed * 125 + 3) % 0x2aaaab;
+			DWORD high = seed & 0xffff;
+			seed = (seed * 125 + 3) % 0x2aaaab;
+			DWORD low = seed & 0xffff;
+			s_HashTable[i][j] = DMakeDWord(low, high);
+		}
+	}
 
-	if (block.flags & BLOCK_COMPRESS) {
-		// TODO: Wave file
-		INT len = DStrLen(file_name);
-		if (len > 4 && !DStrCmpI(file_name + len - 4, ".wav"))
-			compression = COMP_ADPCM_STEREO | COMP_HUFFMAN;
-		else
-			compression = COMP_IMPLODE;
-	} else {
-		compression = COMP_NONE;
+	// 按字节排列各种散列值所用的表项和转换后的大写字符，批量计算时一次读出
+	for (INT j = 0; j < 0x100; j++) {
+		INT ch = DToUpper(j);
+		for (INT i = 0; i < HASH_TYPE_NUM; i++) {
+			s_NameTable[j][i] = s_HashTable[i][ch];
+			s_NameTable[j][HASH_TYPE_NUM + i] = ch;
+		}
 	}
 
-	key = CalcFileKey(file_name, block);
+	if (!s_HandleTable)
+		s_HandleTable = new DHandleTable;
 
-	return hash;
+	return TRUE;
 }
 
-BOOL DMpq::Writeback(DSubFile *sub, HASHENTRY *hash, UINT block_idx)
+VOID DMpq::Exit(VOID)
 {
-	DWORD org_block_idx = hash->block_index;
-	hash->block_index = block_idx;
+	// 仍未关闭的文件随句柄表一起释放
+	delete s_HandleTable;
+	s_HandleTable = NULL;
 
-	CONST BLOCKENTRY *block = sub->GetBlock();
-	DAssert(block);
-	m_BlockTable.push_back(*block);
+	DVarClr(s_HashTable);
+	DVarClr(s_NameTable);
 
-	if (Writeback(block->offset + block->data_size))
-		return TRUE;
+	// 释放编解码上下文，其中包括霍夫曼编码的树
+	exit_codec();
 
-	hash->block_index = org_block_idx;
-	m_BlockTable.pop_back();
-	return FALSE;
+	s_Locale = 0UL;
 }
 
-BOOL DMpq::Writeback(UINT hash_table_offset)
+BOOL DMpq::SetBasePath(STRCPTR path)
 {
-	DAssert(m_Access && m_HashNum && m_HashTable && m_BlockTable.size());
-	DAssert(m_Access->Writable());
+	if (!path || *path)
+		return FALSE;
 
-	UINT hash_size =  m_HashNum * sizeof(HASHENTRY);
-	UINT block_size = m_BlockTable.size() * sizeof(BLOCKENTRY);
+	UINT size = DFile::GetFullPath(path);
+	if (!size)
+		return FALSE;
+
+	DArray<CHAR> str(size);
+
+	if (DFile::GetFullPath(path, str, size) != size)
+		return FALSE;
+
+	if (!DFile::IsDir(path))
+		return FALSE;
+
+	s_BashPath.Assign(str);
+	return TRUE;
+}
+
+STRCPTR DMpq::GetBasePath(VOID)
+{
+	return s_BashPath;
+}
+
+VOID DMpq::SetLocale(LCID locale)
+{
+	s_Locale = locale;
+}
+
+LCID DMpq::GetLocale(VOID)
+{
+	return s_Locale;
+}
+
+VOID DMpq::SetWorkerNum(UINT num)
+{
+	s_WorkerNum = num;
+}
+
+UINT DMpq::GetWorkerNum(VOID)
+{
+	// 0表示使用全部CPU
+	return s_WorkerNum ? s_WorkerNum : DGetCpuNum();
+}
+
+VOID DMpq::SetCompressPolicy(COMPRESS_POLICY policy)
+{
+	s_CompressPolicy = policy;
+}
+
+DMpq::COMPRESS_POLICY DMpq::GetCompressPolicy(VOID)
+{
+	return s_CompressPolicy;
+}
+
+VOID DMpq::SetModernCodec(BOOL enable)
+{
+	s_ModernCodec = enable;
+}
+
+BOOL DMpq::GetModernCodec(VOID)
+{
+	return s_ModernCodec;
+}
+
+BOOL DMpq::SetIndexPath(STRCPTR path)
+{
+	// 空路径表示将索引文件放在档案旁边
+	if (!path || !*path) {
+		s_IndexPath.Clear();
+		return TRUE;
+	}
+
+	if (!DFile::CreateDir(path))
+		return FALSE;
+
+	UINT size = DFile::GetFullPath(path);
+	if (!size)
+		return FALSE;
+
+	DArray<CHAR> str(size);
+
+	if (!DFile::GetFullPath(path, str, size))
+		return FALSE;
+
+	s_IndexPath.Assign(str);
+	return TRUE;
+}
+
+STRCPTR DMpq::GetIndexPath(VOID)
+{
+	return s_IndexPath;
+}
+
+/************************************************************************/
+
+BOOL DMpq::Create(STRCPTR mpq_name, UINT hash_num)
+{
+	DAssert(mpq_name && hash_num);
+	DAssert(m_Access && !m_HashTable && !m_BlockTable.size());
+
+	if (!m_Access->Create(mpq_name))
+		return FALSE;
+
+	UINT hash_size = hash_num * sizeof(HASHENTRY);
+
+	// 散列表紧接在文件头之后
+	m_TableSpace.assign(1U, DExtent(sizeof(HEADER), hash_size));
+	m_FreeSpace = new DFreeSpace;
+	ResetFreeSpace();
+
+	m_HashTable = new HASHENTRY[hash_num];
+	DMemSet(m_HashTable, 0xff, hash_size);
 
-	// 更新文件头并写入
 	HEADER header;
 	header.identifier = MPQ_IDENTIFIER;
 	header.header_size = sizeof(header);
-	header.hash_table_offset = hash_table_offset;
-	header.block_table_offset = hash_table_offset + hash_size;
-	header.archive_size = header.block_table_offset + block_size;
+	header.archive_size = sizeof(header) + hash_size;
 	header.version = SUPPORT_VERSION;
 	header.sector_shift = SUPPORT_SECTOR_SHIFT;
-	header.hash_num = m_HashNum;
-	header.block_num = m_BlockTable.size();
+	header.hash_table_offset = sizeof(header);
+	header.block_table_offset = 0UL;
+	header.hash_num = hash_num;
+	header.block_num = 0UL;
+
+	if (!m_Access->Write(&header, sizeof(header)))
+		return FALSE;
+
+	DArray<HASHENTRY> hash_table(hash_num);
+	DMemCpy(hash_table, m_HashTable, hash_size);
+
+	DWORD key = HashString(HASH_TABLE_KEY, HASH_FILE_KEY);
+	EncryptData(hash_table, hash_size, key);
+
+	if (!m_Access->Write(hash_table, hash_size))
+		return FALSE;
+
+	m_HashNum = hash_num;
+	m_BlockTable.clear();
+
+	return TRUE;
+}
+
+BOOL DMpq::Load(STRCPTR mpq_name, UINT flags)
+{
+	DAssert(mpq_name);
+	DAssert(m_Access && !m_HashTable && !m_BlockTable.size());
+
+	// 在打开档案之前取得档案的状态，之后的修改会使索引文件失效
+	DString index_name;
+	INDEXHEADER stamp;
+	// 可写的档案随时会被修改，不使用索引文件
+	BOOL use_index = (flags & OF_INDEX_CACHE) && !(flags & OF_WRITE) && GetIndexName(mpq_name, index_name, stamp);
+
+	if (!m_Access->Open(mpq_name, flags))
+		return FALSE;
+
+	HEADER header;
+	if (!m_Access->Read(&header, sizeof(header)))
+		return FALSE;
+
+	if (header.version != SUPPORT_VERSION)
+		return FALSE;
+
+	if (header.hash_num < HASH_NUM_MIN || header.hash_num > HASH_NUM_MAX)
+		return FALSE;
+
+	// 写入时文件头会被改写为标准大小
+	if (m_Access->Writable() && header.header_size != sizeof(header))
+		return FALSE;
+
+	m_HashNum = header.hash_num;
+	m_HashTable = new HASHENTRY[m_HashNum];
+
+	UINT block_num = header.block_num;
+	UINT size = m_HashNum * sizeof(HASHENTRY);
+
+	if (use_index) {
+		stamp.hash_num = m_HashNum;
+		stamp.block_num = block_num;
+	}
+
+	// 索引文件有效时直接复制其中已解密的表
+	if (use_index && m_Access->LoadIndex(index_name, stamp)) {
+
+		CONST DIndexCache *index = m_Access->GetIndex();
+
+		DMemCpy(m_HashTable, index->GetHashTable(), size);
+
+		if (block_num)
+			m_BlockTable.assign(index->GetBlockTable(), index->GetBlockTable() + block_num);
+
+	} else {
+
+		if (!m_Access->Seek(header.hash_table_offset))
+			return FALSE;
+
+		if (!m_Access->Read(m_HashTable, size))
+			return FALSE;
+
+		DWORD key = HashString(HASH_TABLE_KEY, HASH_FILE_KEY);
+		DecryptData(m_HashTable, size, key);
+
+		if (block_num) {
+
+			if (!m_Access->Seek(header.block_table_offset))
+				return FALSE;
+
+			m_BlockTable.resize(block_num);
+			size = block_num * sizeof(BLOCKENTRY);
+			if (!m_Access->Read(&m_BlockTable.front(), size))
+				return FALSE;
+
+			key = HashString(BLOCK_TABLE_KEY, HASH_FILE_KEY);
+			DecryptData(&m_BlockTable.front(), size, key);
+		}
+
+		// 索引文件无法写入时仍可正常使用档案
+		if (use_index && SaveIndex(index_name, stamp))
+			m_Access->LoadIndex(index_name, stamp);
+	}
+
+	if (flags & OF_NAME_FILTER)
+		BuildFilter();
+
+	// 记录磁盘上的表所在的位置，提交新的表之前不能被覆盖
+	if (m_Access->Writable()) {
+		m_TableSpace.push_back(DExtent(header.hash_table_offset, m_HashNum * sizeof(HASHENTRY)));
+		if (block_num)
+			m_TableSpace.push_back(DExtent(header.block_table_offset, block_num * sizeof(BLOCKENTRY)));
+		m_FreeSpace = new DFreeSpace;
+		ResetFreeSpace();
+	}
+
+	return TRUE;
+}
+
+VOID DMpq::Clear(VOID)
+{
+	if (m_Stream.file)
+		CloseStream();
+
+	if (s_HandleTable)
+		s_HandleTable->RemoveAll(this);
+
+	m_BlockTable.clear();
+	m_KeyMap.clear();
+	m_TableSpace.clear();
+	m_RetiredSpace.clear();
+
+	// 未提交的修改被放弃
+	m_SavedHashTable.clear();
+	m_SavedBlockTable.clear();
+	m_SavedKeyMap.clear();
+	m_Updating = FALSE;
+
+	m_HashNum = 0U;
+
+	delete [] m_HashTable;
+	m_HashTable = NULL;
+
+	delete m_Filter;
+	m_Filter = NULL;
+
+	delete m_FreeSpace;
+	m_FreeSpace = NULL;
+
+	delete m_Access;
+	m_Access = NULL;
+}
+
+BOOL DMpq::AddFile(STRCPTR file_name, BOOL compress, BOOL encrypt, DFile &file)
+{
+	DAssert(file_name && file.IsOpen());
+
+	UINT size = file.GetSize();
+	if (size == ERROR_SIZE)
+		return FALSE;
+
+	UINT block_idx;
+	DWORD key;
+	BYTE comp;
+	BLOCKENTRY block;
+	HASHENTRY *hash = PrepareAdd(file_name, size, compress, encrypt, block_idx, block, key, comp);
+	if (!hash)
+		return FALSE;
+
+	DSubFile sub;
+	return AddFile(&sub, hash, block_idx, block, key, comp, file);
+}
+
+BOOL DMpq::AddFile(DSubFile *sub, HASHENTRY *hash, UINT block_idx, CONST BLOCKENTRY &block, DWORD key, BYTE comp, DFile &file)
+{
+	DAssert(sub && hash && m_Access && m_HashNum);
+
+	if (!sub->Create(m_Access, block_idx, block, key, comp)) {
+		m_FreeSpace->Free(block.offset, GetReserveSize(block));
+		return FALSE;
+	}
+
+	BOOL flag = TRUE;
+	UINT size = block.file_size;
+	UINT buf_size = 1 << (m_Access->SectorShift() + 3);
+	DArray<BYTE> rd_buf(buf_size);
+
+	for (UINT rd_size = 0; size && flag; size -= rd_size) {
+		rd_size = file.Read(rd_buf, buf_size);
+		if (!rd_size)
+			break;
+		if (sub->Write(rd_buf, rd_size) != rd_size)
+			flag = FALSE;
+	}
+	DAssert(flag);
+
+	if (!flag) {
+		m_FreeSpace->Free(block.offset, GetReserveSize(block));
+		return FALSE;
+	}
+
+	if  (!Writeback(sub, hash, block_idx, key))
+		return FALSE;
+
+	return TRUE;
+}
+
+BOOL DMpq::NewFile(DSubFile *sub, HASHENTRY *hash, UINT block_idx, CONST BLOCKENTRY &block, DWORD key, BYTE comp, BUFCPTR file_data)
+{
+	DAssert(sub && m_Access && m_HashNum);
+
+	if (!sub->Create(m_Access, block_idx, block, key, comp)
+		|| sub->Write(file_data, block.file_size) != block.file_size) {
+		m_FreeSpace->Free(block.offset, GetReserveSize(block));
+		return FALSE;
+	}
+
+	if  (!Writeback(sub, hash, block_idx, key))
+		return FALSE;
+
+	return TRUE;
+}
+
+DMpq::HASHENTRY *DMpq::PrepareAdd(STRCPTR file_name, UINT file_size, BOOL compress, BOOL encrypt, UINT &block_idx, BLOCKENTRY &block, DWORD &key, BYTE &compression)
+{
+	DAssert(file_name && *file_name);
+
+	// 新建的和以OF_WRITE打开的档案都可以写入，文件数据优先使用空闲区，否则追加在档案末尾，
+	// 散列表和块表由Writeback另找空间写入，因此不必考虑原有的文件布局
+
+	block_idx = AllocBlock(file_size, compress, encrypt, block);
+	if (block_idx == HASH_ENTRY_INVALID || block_idx == HASH_ENTRY_EMPTY)
+		return NULL;
+
+	DNameKey name_key(file_name);
+
+	HASHENTRY *hash = AllocHash(name_key);
+	if (!hash) {
+		m_FreeSpace->Free(block.offset, GetReserveSize(block));
+		return NULL;
+	}
+
+	compression = GetCompression(file_name, block);
+
+	key = CalcFileKey(name_key, block);
+
+	return hash;
+}
+
+BOOL DMpq::Writeback(DSubFile *sub, HASHENTRY *hash, UINT block_idx, DWORD key)
+{
+	DWORD org_block_idx = hash->block_index;
+	hash->block_index = block_idx;
+
+	DAssert(sub->GetBlock() && block_idx <= m_BlockTable.size());
+	BLOCKENTRY block = *sub->GetBlock();
+
+	// 写入已经完成，读取时另行打开
+	sub->Close();
+	m_Access->FreeBuffer(block_idx);
+
+	BOOL append = (block_idx == m_BlockTable.size());
+	if (append)
+		m_BlockTable.push_back(block);
+	else
+		m_BlockTable[block_idx] = block;
+
+	// 归还预留空间中没有用到的部分
+	m_FreeSpace->Free(block.offset + block.data_size, GetReserveSize(block) - block.data_size);
+
+	if (block.flags & BLOCK_ENCRYPT)
+		m_KeyMap[block_idx] = key;
+
+	if (AutoCommit())
+		return TRUE;
+
+	m_FreeSpace->Free(block.offset, block.data_size);
+	m_KeyMap.erase(block_idx);
+
+	hash->block_index = org_block_idx;
+	if (append)
+		m_BlockTable.pop_back();
+	else
+		DMemClr(&m_BlockTable[block_idx], sizeof(BLOCKENTRY));
+
+	return FALSE;
+}
+
+BOOL DMpq::Writeback(VOID)
+{
+	DAssert(m_Access && m_HashNum && m_HashTable && m_FreeSpace);
+	DAssert(m_Access->Writable());
+
+	UINT hash_size =  m_HashNum * sizeof(HASHENTRY);
+	UINT block_size = m_BlockTable.size() * sizeof(BLOCKENTRY);
+
+	// 新的表写在磁盘上的表没有引用的空间，文件头更新之前原有的档案始终完整
+	UINT table_offset = m_FreeSpace->Alloc(hash_size + block_size);
+
+	// 原有的表和被删除的块在文件头更新之后就不再使用，不计入新的档案大小
+	for (UINT i = 0U; i < m_TableSpace.size(); i++)
+		m_FreeSpace->Free(m_TableSpace[i].first, m_TableSpace[i].second);
+	for (UINT i = 0U; i < m_RetiredSpace.size(); i++)
+		m_FreeSpace->Free(m_RetiredSpace[i].first, m_RetiredSpace[i].second);
+
+	HEADER header;
+	header.identifier = MPQ_IDENTIFIER;
+	header.header_size = sizeof(header);
+	header.hash_table_offset = table_offset;
+	header.block_table_offset = table_offset + hash_size;
+	header.archive_size = m_FreeSpace->GetEnd();
+	header.version = SUPPORT_VERSION;
+	header.sector_shift = m_Access->SectorShift() - PHYSICAL_SECTOR_SHIFT;
+	header.hash_num = m_HashNum;
+	header.block_num = m_BlockTable.size();
+
+	if (!WriteTables(header)) {
+		// 写入失败时原有的表仍然有效，恢复空闲空间
+		for (UINT i = 0U; i < m_TableSpace.size(); i++)
+			m_FreeSpace->Reserve(m_TableSpace[i].first, m_TableSpace[i].second);
+		for (UINT i = 0U; i < m_RetiredSpace.size(); i++)
+			m_FreeSpace->Reserve(m_RetiredSpace[i].first, m_RetiredSpace[i].second);
+
+		// 文件头写入之后的刷新失败时无法确定磁盘上是哪一份表，新的表也保留到下次提交
+		m_TableSpace.push_back(DExtent(table_offset, hash_size + block_size));
+		return FALSE;
+	}
+
+	m_TableSpace.assign(1U, DExtent(table_offset, hash_size + block_size));
+	m_RetiredSpace.clear();
+
+	// 截掉末尾不再使用的数据，失败也不影响档案
+	m_Access->SetSize(header.archive_size);
+
+	return TRUE;
+}
+
+BOOL DMpq::WriteTables(CONST HEADER &header)
+{
+	DAssert(m_Access && m_HashNum && m_HashTable);
+
+	UINT hash_size = header.hash_num * sizeof(HASHENTRY);
+	UINT block_size = header.block_num * sizeof(BLOCKENTRY);
+
+	// 依次写入文件数据、表和文件头，前一步写入磁盘之后才进行下一步
+	// 文件头只有一个物理扇区，写入中断时档案仍是修改之前或之后的状态
+	if (!m_Access->Flush())
+		return FALSE;
+
+	// 写散列表
+	if (!m_Access->Seek(header.hash_table_offset))
+		return FALSE;
+
+	DArray<HASHENTRY> hash_table(m_HashNum);
+	DMemCpy(hash_table, m_HashTable, hash_size);
+
+	DWORD key = HashString(HASH_TABLE_KEY, HASH_FILE_KEY);
+	EncryptData(hash_table, hash_size, key);
+
+	if (!m_Access->Write(hash_table, hash_size))
+		return FALSE;
+
+	// 写块表，文件全部被删除时块表为空
+	if (block_size) {
+
+		if (!m_Access->Seek(header.block_table_offset))
+			return FALSE;
+
+		DArray<BLOCKENTRY> block_table(header.block_num);
+		DMemCpy(block_table, &m_BlockTable.front(), block_size);
+
+		key = HashString(BLOCK_TABLE_KEY, HASH_FILE_KEY);
+		EncryptData(block_table, block_size, key);
+
+		if (!m_Access->Write(block_table, block_size))
+			return FALSE;
+	}
+
+	if (!m_Access->Flush())
+		return FALSE;
+
+	// 最后更新文件头
+	if (!m_Access->Seek(0U))
+		return FALSE;
+
+	if (!m_Access->Write(&header, sizeof(header)))
+		return FALSE;
+
+	return m_Access->Flush();
+}
+
+BOOL DMpq::AutoCommit(VOID)
+{
+	// 事务中的修改在Commit时一起写入，否则每次修改都立即提交
+	if (m_Updating)
+		return TRUE;
+
+	return Writeback();
+}
+
+VOID DMpq::ResetFreeSpace(VOID)
+{
+	DAssert(m_FreeSpace);
+
+	// 存在的块和磁盘上的表之外都是空闲空间
+	m_FreeSpace->Build(m_BlockTable, sizeof(HEADER));
+
+	for (UINT i = 0U; i < m_TableSpace.size(); i++)
+		m_FreeSpace->Reserve(m_TableSpace[i].first, m_TableSpace[i].second);
+}
+
+BOOL DMpq::PrepareAdd(CONST ADDITEM &item, ADDENTRY &entry)
+{
+	DAssert(m_Access && m_Access->Writable());
+
+	if (!item.file_name || !*item.file_name)
+		return FALSE;
+
+	DNameKey name_key(item.file_name);
+	if (!name_key.IsValid())
+		return FALSE;
+
+	BUFPTR buffer = NULL;
+	BUFCPTR data = item.file_data;
+	UINT size = item.size;
+
+	if (item.real_path) {
+
+		DFile file;
+		if (!file.Open(item.real_path))
+			return FALSE;
+
+		size = file.GetSize();
+		if (size == ERROR_SIZE)
+			return FALSE;
+
+		if (size) {
+			buffer = new BYTE[size];
+			if (file.Read(buffer, size) != size) {
+				delete [] buffer;
+				return FALSE;
+			}
+		}
+
+		data = buffer;
+
+	} else if (!data && size) {
+		return FALSE;
+	}
+
+	HASHENTRY *hash = AllocHash(name_key);
+	if (!hash) {
+		delete [] buffer;
+		return FALSE;
+	}
+
+	// 写入之前先占用散列表项，同一批中同名的文件不会被重复添加
+	hash->block_index = HASH_ENTRY_INVALID;
+
+	UINT sector_shift = m_Access->SectorShift();
+
+	entry.index = 0U;
+	entry.hash = hash;
+	entry.block.offset = 0UL;
+	entry.block.data_size = 0UL;
+	entry.block.file_size = size;
+	entry.block.flags = BLOCK_EXIST | BLOCK_FIX_KEY;
+	entry.sector_num = (size + (1 << sector_shift) - 1) >> sector_shift;
+	entry.first = 0U;
+
+	if (item.compress)
+		entry.block.flags |= BLOCK_COMPRESS;
+	if (item.encrypt)
+		entry.block.flags |= BLOCK_ENCRYPT;
+
+	// 与DFileBuffer::Create一致，空文件不压缩也不加密
+	if (!entry.sector_num)
+		entry.block.flags = BLOCK_EXIST;
+
+	entry.base_key = name_key.m_FileKey;
+	entry.comp = CheckWave(GetCompression(item.file_name, entry.block), data, size);
+	entry.data = data;
+	entry.buffer = buffer;
+
+	return TRUE;
+}
+
+BOOL DMpq::WriteEntry(DAddWork &work, ADDENTRY &entry)
+{
+	DAssert(m_Access && entry.hash);
+
+	BLOCKENTRY &block = entry.block;
+	UINT sector_num = entry.sector_num;
+
+	if (!sector_num) {
+		block.data_size = 0UL;
+		return TRUE;
+	}
+
+	if (!m_Access->Seek(block.offset))
+		return FALSE;
+
+	UINT sector_shift = m_Access->SectorShift();
+	UINT sector_size = 1 << sector_shift;
+	BOOL compress = DBoolean(block.flags & BLOCK_COMP_MASK);
+	BOOL encrypt = DBoolean(block.flags & BLOCK_ENCRYPT);
+
+	// 偏移已经确定，可以计算密钥了
+	DWORD key = CalcFileKey(entry.base_key, block);
+
+	if (!compress && !encrypt) {
+		block.data_size = block.file_size;
+		return m_Access->Write(entry.data, block.file_size);
+	}
+
+	BUFPTR sector_buf = m_Access->SectorBuffer();
+	if (!sector_buf)
+		return FALSE;
+
+	// 压缩文件先写偏移表
+	if (compress) {
+
+		UINT tab_size = (sector_num + 1) * sizeof(DWORD);
+		DArray<DWORD> off_table(sector_num + 1);
+		DWORD *table = off_table;
+
+		table[0] = tab_size;
+		for (UINT i = 0U; i < sector_num; i++) {
+			UINT data_size;
+			if (!work.GetSector(entry, i, data_size))
+				data_size = DMin(block.file_size - (i << sector_shift), sector_size);
+			table[i + 1] = table[i] + data_size;
+		}
+
+		block.data_size = table[sector_num];
+
+		if (encrypt)
+			EncryptData(table, tab_size, key - 1);
+
+		if (!m_Access->Write(table, tab_size))
+			return FALSE;
+
+	} else {
+		block.data_size = block.file_size;
+	}
+
+	for (UINT i = 0U; i < sector_num; i++) {
+
+		UINT offset = i << sector_shift;
+		UINT data_size = 0U;
+		BUFPTR data = compress ? work.GetSector(entry, i, data_size) : NULL;
+
+		// 无法压缩的扇区按原样存放
+		if (!data) {
+			data_size = DMin(block.file_size - offset, sector_size);
+			if (!encrypt) {
+				if (!m_Access->Write(entry.data + offset, data_size))
+					return FALSE;
+				continue;
+			}
+			DMemCpy(sector_buf, entry.data + offset, data_size);
+			data = sector_buf;
+		}
+
+		if (encrypt)
+			EncryptData(data, data_size, key + i);
+
+		if (!m_Access->Write(data, data_size))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL DMpq::CloseStream(VOID)
+{
+	DAssert(m_Stream.file && s_HandleTable);
+
+	BOOL ret = FALSE;
+	HANDLEENTRY *entry = s_HandleTable->Acquire(m_Stream.file);
+
+	if (entry) {
+
+		DSubFile *sub = entry->sub;
+		CONST BLOCKENTRY &block = m_Stream.block;
+
+		// 最后一个扇区写入之后数据大小才确定，没有写完的文件被丢弃
+		if (!block.file_size || sub->GetBlock()->data_size) {
+			ret = Writeback(sub, m_Stream.hash, m_Stream.block_idx, m_Stream.key);
+		} else {
+			DVerify(sub->Close());
+			m_Access->FreeBuffer(m_Stream.block_idx);
+			m_FreeSpace->Free(block.offset, GetReserveSize(block));
+		}
+
+		s_HandleTable->Release(entry);
+	}
+
+	s_HandleTable->Remove(this, m_Stream.file);
+	DVarClr(m_Stream);
+
+	return ret;
+}
+
+HANDLE DMpq::OpenFile(CONST DNameKey &name_key, UINT hash_idx)
+{
+	DAssert(name_key.IsValid());
+
+	if (!m_Access || !m_Access->Readable())
+		return NULL;
+
+	HASHENTRY *hash = VerifyHash(name_key, hash_idx);
+	if (!hash)
+		return NULL;
+
+	BLOCKENTRY *block = &m_BlockTable[hash->block_index];
+	if (!(block->flags & BLOCK_EXIST))
+		return NULL;
+
+	if (!s_HandleTable)
+		return NULL;
+
+	DWORD key = CalcFileKey(name_key, *block);
+	DSubFile *sub = new DSubFile;
+
+	{
+		DAutoLock lock(m_Lock);
+
+		if (!sub->Open(m_Access, hash->block_index, *block, key)) {
+			delete sub;
+			return NULL;
+		}
+	}
+
+	HANDLE file = s_HandleTable->Insert(this, sub);
+	if (!file) {
+		DVerify(sub->Close());
+		delete sub;
+		return NULL;
+	}
+
+	return file;
+}
+
+HANDLE DMpq::OpenHandle(CONST DNameKey &name_key, UINT hash_idx)
+{
+	DAssert(name_key.IsValid());
+
+	if (!m_Access || !m_Access->Readable())
+		return NULL;
+
+	HASHENTRY *hash = VerifyHash(name_key, hash_idx);
+	if (!hash)
+		return NULL;
+
+	BLOCKENTRY *block = &m_BlockTable[hash->block_index];
+
+	if (!(block->flags & BLOCK_EXIST))
+		return NULL;
+
+	if (block->flags & BLOCK_COMP_MASK)
+		return NULL;
+
+	if (block->flags & BLOCK_ENCRYPT)
+		return NULL;
+
+	// 并发读取时其他线程可能正在使用同一个档案访问对象
+	DAutoLock lock(m_Lock);
+
+	return m_Access->ShareHandle(block->offset);
+}
+
+DMpq::HASHENTRY *DMpq::VerifyHash(CONST DNameKey &name_key, UINT hash_idx)
+{
+	DAssert(name_key.IsValid());
+
+	// 外部给出的位置可能已经过时，名字的散列值和语言都符合时才使用，否则重新查找
+	if (hash_idx < m_HashNum) {
+		HASHENTRY *hash = m_HashTable + hash_idx;
+		if (hash->hash_low == name_key.m_HashLow && hash->hash_high == name_key.m_HashHigh && MatchEntry(hash_idx, DLoc2Lang(GetLocale())))
+			return hash;
+	}
+
+	HASHENTRY *hash = Lookup(name_key);
+	if (!hash || hash->block_index >= m_BlockTable.size())
+		return NULL;
+
+	return hash;
+}
+
+INT DMpq::MatchEntry(UINT hash_idx, LANGID lang) CONST
+{
+	DAssert(hash_idx < m_HashNum);
+
+	CONST HASHENTRY *hash = m_HashTable + hash_idx;
+
+	// 空闲和已删除的入口都超出块表范围
+	if (hash->block_index >= m_BlockTable.size())
+		return 0;
+	if (!(m_BlockTable[hash->block_index].flags & BLOCK_EXIST))
+		return 0;
+
+	// 与Lookup的规则一致：当前语言优先，其次是中性语言
+	if (hash->platform != SUPPORT_PLATFORM)
+		return 0;
+	if (hash->language == lang)
+		return 2;
+	if (hash->language == LANG_NEUTRAL)
+		return 1;
+
+	return 0;
+}
+
+VOID DMpq::BuildFilter(VOID)
+{
+	DAssert(m_HashTable && !m_Filter);
+
+	UINT num = 0U;
+	for (UINT i = 0U; i < m_HashNum; i++) {
+		if (m_HashTable[i].block_index < m_BlockTable.size())
+			num++;
+	}
+
+	m_Filter = new DNameFilter;
+	DVerify(m_Filter->Create(num));
+
+	// 不区分语言，所有语言版本的文件名都加入过滤器
+	for (UINT i = 0U; i < m_HashNum; i++) {
+		if (m_HashTable[i].block_index < m_BlockTable.size())
+			m_Filter->Add(NameHash(m_HashTable[i]));
+	}
+}
+
+BOOL DMpq::SaveIndex(STRCPTR index_name, INDEXHEADER &header)
+{
+	DAssert(index_name && m_HashTable);
+
+	typedef std::map<QWORD, DNameKey> DKeyMap;
+
+	UINT block_num = m_BlockTable.size();
+
+	// 加密的偏移表需要用列表文件中的文件名计算密钥
+	DNameList names;
+	ListFiles(names);
+
+	DKeyMap key_map;
+	std::vector<DWORD> name_pos(names.size());
+	std::vector<CHAR> name_data;
+
+	for (UINT i = 0U; i < names.size(); i++) {
+		STRCPTR name = names[i];
+		name_pos[i] = name_data.size();
+		name_data.insert(name_data.end(), name, name + names[i].Length() + 1);
+		DNameKey name_key(name);
+		if (name_key.IsValid())
+			key_map[name_key.GetHash()] = name_key;
+	}
+
+	std::vector<DWORD> keys(block_num);
+	std::vector<BOOL> known(block_num, FALSE);
+
+	// 不区分语言，同名文件的所有语言版本都能确定密钥
+	for (UINT i = 0U; i < m_HashNum; i++) {
+		CONST HASHENTRY &hash = m_HashTable[i];
+		if (hash.block_index >= block_num || !(m_BlockTable[hash.block_index].flags & BLOCK_EXIST))
+			continue;
+		DKeyMap::const_iterator it = key_map.find(NameHash(hash));
+		if (it == key_map.end())
+			continue;
+		keys[hash.block_index] = CalcFileKey(it->second, m_BlockTable[hash.block_index]);
+		known[hash.block_index] = TRUE;
+	}
+
+	UINT sector_shift = m_Access->SectorShift();
+	std::vector<DWORD> table_pos(block_num, DIndexCache::NULL_TABLE);
+	std::vector<DWORD> tables;
+
+	for (UINT i = 0U; i < block_num; i++) {
+
+		CONST BLOCKENTRY &block = m_BlockTable[i];
+		if (!(block.flags & BLOCK_EXIST) || !(block.flags & BLOCK_COMP_MASK))
+			continue;
+		if ((block.flags & BLOCK_ENCRYPT) && !known[i])
+			continue;
+
+		UINT sector_num = (block.file_size + (1 << sector_shift) - 1) >> sector_shift;
+		if (!sector_num)
+			continue;
+
+		UINT pos = tables.size();
+		UINT size = (sector_num + 1) * sizeof(DWORD);
+		tables.resize(pos + sector_num + 1);
+
+		if (!m_Access->ReadAt(block.offset, &tables[pos], size)) {
+			tables.resize(pos);
+			continue;
+		}
+
+		if (block.flags & BLOCK_ENCRYPT)
+			DecryptData(&tables[pos], size, keys[i] - 1);
+
+		table_pos[i] = pos;
+	}
+
+	header.table_size = tables.size();
+	header.name_num = names.size();
+	header.name_size = name_data.size();
+	header.reserved = 0UL;
+
+	VCPTR data[] = {
+		m_HashTable,
+		block_num ? &m_BlockTable.front() : NULL,
+		block_num ? &table_pos.front() : NULL,
+		tables.empty() ? NULL : &tables.front(),
+		name_pos.empty() ? NULL : &name_pos.front(),
+		name_data.empty() ? NULL : &name_data.front(),
+	};
+
+	UINT size[] = {
+		(UINT)(m_HashNum * sizeof(HASHENTRY)),
+		(UINT)(block_num * sizeof(BLOCKENTRY)),
+		(UINT)(block_num * sizeof(DWORD)),
+		(UINT)(tables.size() * sizeof(DWORD)),
+		(UINT)(name_pos.size() * sizeof(DWORD)),
+		(UINT)name_data.size(),
+	};
+
+	// 先删除旧文件，已经映射了旧文件的进程不受影响
+	if (DFile::IsExist(index_name) && !DFile::Remove(index_name))
+		return FALSE;
+
+	DFile file;
+	if (!file.Open(index_name, DFile::OM_WRITE | DFile::OM_CREATE | DFile::OM_TRUNCATE))
+		return FALSE;
+
+	// 文件头最后写入，写入中断的索引文件不会被当作有效
+	INDEXHEADER empty;
+	DVarClr(empty);
+	BOOL ret = (file.Write(&empty, sizeof(empty)) == sizeof(empty));
+
+	for (UINT i = 0U; ret && i < DCount(data); i++) {
+		if (size[i] && file.Write(data[i], size[i]) != size[i])
+			ret = FALSE;
+	}
+
+	if (ret)
+		ret = (file.Seek(0) != ERROR_POS && file.Write(&header, sizeof(header)) == sizeof(header));
+
+	file.Close();
+
+	if (!ret)
+		DFile::Remove(index_name);
+
+	return ret;
+}
+
+DMpq::HASHENTRY *DMpq::Lookup(CONST DNameKey &name_key)
+{
+	DAssert(name_key.IsValid());
+	DAssert(m_HashNum && m_HashTable);
+
+	// 过滤器确定不存在的文件无需遍历冲突链
+	if (m_Filter && !m_Filter->MayExist(name_key.GetHash()))
+		return NULL;
+
+	// 散列值已经在DNameKey中算好
+	DWORD entry = name_key.m_Entry;
+	DWORD hash_low = name_key.m_HashLow;
+	DWORD hash_high = name_key.m_HashHigh;
+
+	LANGID lang = DLoc2Lang(GetLocale());
+
+	INT start = entry & (m_HashNum - 1);
+	INT index = start;
+
+	HASHENTRY *best = NULL;
+
+	// 循环查找
+	do {
+
+		HASHENTRY *hash = m_HashTable + index;
+		index = ++entry & (m_HashNum - 1);
+
+		if (hash->block_index == HASH_ENTRY_EMPTY)
+			break;
+		if (hash->block_index == HASH_ENTRY_INVALID)
+			continue;
+		if (hash->hash_low != hash_low || hash->hash_high != hash_high)
+			continue;
+
+		if (hash->language != lang && hash->language != LANG_NEUTRAL)
+			continue;
+		if (hash->platform != SUPPORT_PLATFORM)
+			continue;
+
+		if (hash->language == lang && hash->platform == SUPPORT_PLATFORM)
+			return hash;
+
+		best = hash;
+
+	} while (index != start);
+
+	// 已经到达末尾
+	return best;
+}
+
+BOOL DMpq::ProbeName(CONST DNameKey &name_key) CONST
+{
+	DAssert(name_key.IsValid());
+	DAssert(m_HashNum && m_HashTable);
+
+	DWORD entry = name_key.m_Entry;
+	INT start = entry & (m_HashNum - 1);
+	INT index = start;
+
+	// 与Lookup相同的冲突链，但不区分语言和平台
+	do {
+
+		CONST HASHENTRY *hash = m_HashTable + index;
+		index = ++entry & (m_HashNum - 1);
+
+		if (hash->block_index == HASH_ENTRY_EMPTY)
+			break;
+		if (hash->block_index >= m_BlockTable.size())
+			continue;
+		if (hash->hash_low != name_key.m_HashLow || hash->hash_high != name_key.m_HashHigh)
+			continue;
+
+		if (m_BlockTable[hash->block_index].flags & BLOCK_EXIST)
+			return TRUE;
+
+	} while (index != start);
+
+	return FALSE;
+}
+
+DMpq::HASHENTRY *DMpq::AllocHash(CONST DNameKey &name_key)
+{
+	DAssert(name_key.IsValid());
+	DAssert(m_HashNum && m_HashTable);
+
+	// 散列值已经在DNameKey中算好
+	DWORD entry = name_key.m_Entry;
+	DWORD hash_low = name_key.m_HashLow;
+	DWORD hash_high = name_key.m_HashHigh;
+
+	LANGID lang = DLoc2Lang(GetLocale());
+
+	INT start = entry & (m_HashNum - 1);
+	INT index = start;
+
+	// 循环查找
+	do {
+
+		HASHENTRY *hash = m_HashTable + index;
+		index = ++entry & (m_HashNum - 1);
+
+		if (hash->block_index == HASH_ENTRY_EMPTY) {
+			hash->hash_low = hash_low;
+			hash->hash_high = hash_high;
+			hash->language = lang;
+			hash->platform = SUPPORT_PLATFORM;
+			if (m_Filter)
+				m_Filter->Add(name_key.GetHash());
+			return hash;
+		}
+
+		if (hash->hash_low != hash_low || hash->hash_high != hash_high)
+			continue;
+		if (hash->language != lang || hash->platform != SUPPORT_PLATFORM)
+			continue;
+
+		// 文件已存在
+		return NULL;
+
+	} while (index != start);
+
+
+	// 已经到达末尾
+	return NULL;
+}
+
+VOID DMpq::FreeHash(HASHENTRY *hash)
+{
+	DAssert(hash && m_HashNum && m_HashTable);
+
+	DMemSet(hash, 0xff, sizeof(HASHENTRY));
+
+	// 下一项为空时冲突链在此结束，否则只能标记为已删除
+	UINT entry = (hash - m_HashTable + 1) & (m_HashNum - 1);
+	if (m_HashTable[entry].block_index == HASH_ENTRY_EMPTY)
+		hash->block_index = HASH_ENTRY_EMPTY;
+	else
+		hash->block_index = HASH_ENTRY_INVALID;
+}
+
+UINT DMpq::AllocBlock(UINT file_size, BOOL compress, BOOL encrypt, BLOCKENTRY &block)
+{
+	DAssert(m_FreeSpace);
+
+	block.data_size = 0UL;
+	block.file_size = file_size;
+	block.flags = BLOCK_EXIST | BLOCK_FIX_KEY;
+
+	if (compress)
+		block.flags |= BLOCK_COMPRESS;
+
+	if (encrypt)
+		block.flags |= BLOCK_ENCRYPT;
+
+	// 按最坏情况预留空间，优先使用被删除文件留下的空闲区，写完后再归还多余的部分
+	block.offset = m_FreeSpace->Alloc(GetReserveSize(block));
+
+	// 被删除的块表项也可以重新使用，丢弃之前留下的文件缓冲
+	UINT block_idx = FindFreeBlock(0U);
+	m_Access->FreeBuffer(block_idx);
+
+	return block_idx;
+}
+
+UINT DMpq::FindFreeBlock(UINT from) CONST
+{
+	for (UINT i = from; i < m_BlockTable.size(); i++) {
+		if (!(m_BlockTable[i].flags & BLOCK_EXIST))
+			return i;
+	}
+
+	return m_BlockTable.size();
+}
+
+UINT DMpq::GetReserveSize(CONST BLOCKENTRY &block) CONST
+{
+	DAssert(m_Access);
+
+	if (!block.file_size)
+		return 0U;
+
+	if (!(block.flags & BLOCK_COMP_MASK))
+		return block.file_size;
+
+	// 压缩后没有变小的扇区按原样存放，所以最多是偏移表加上全部原始数据
+	UINT sector_shift = m_Access->SectorShift();
+	UINT sector_num = (block.file_size + (1 << sector_shift) - 1) >> sector_shift;
+
+	return (sector_num + 1) * sizeof(DWORD) + block.file_size;
+}
+
+BOOL DMpq::DetectFileKey(CONST BLOCKENTRY &block, DWORD &key)
+{
+	DAssert(m_Access);
+
+	// 只有压缩文件的偏移表首项是已知的，可以由此推算出密钥
+	if (!(block.flags & BLOCK_COMP_MASK) || !block.file_size)
+		return FALSE;
+
+	UINT sector_shift = m_Access->SectorShift();
+	UINT sector_size = 1 << sector_shift;
+	UINT sector_num = (block.file_size + sector_size - 1) >> sector_shift;
+	UINT table_size = (sector_num + 1) * sizeof(DWORD);
+	if (table_size > block.data_size)
+		return FALSE;
+
+	DArray<DWORD> encrypted(sector_num + 1);
+	if (!m_Access->ReadBack(block.offset, encrypted, table_size))
+		return FALSE;
+
+	// 首项解密时：明文 ^ 密文 = 密钥 + 0xeeeeeeee + 密码表[密钥低8位]
+	DWORD sum = (encrypted[0] ^ table_size) - 0xeeeeeeeeUL;
+
+	DArray<DWORD> off_table(sector_num + 1);
+
+	for (UINT i = 0U; i < 0x100; i++) {
+
+		DWORD cand = sum - s_HashTable[CRYPT_TABLE_INDEX][i];
+		if ((cand & 0xff) != i)
+			continue;
+
+		DMemCpy(off_table, encrypted, table_size);
+		DecryptData(off_table, table_size, cand);
+
+		// 解密后的偏移表必须递增，且每个扇区都不超过扇区大小
+		UINT j = 0U;
+		for (; j < sector_num; j++) {
+			if (off_table[j + 1] < off_table[j] || off_table[j + 1] - off_table[j] > sector_size)
+				break;
+		}
+
+		if (j < sector_num || off_table[sector_num] != block.data_size)
+			continue;
+
+		// 偏移表用文件密钥减一加密
+		key = cand + 1;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+BOOL DMpq::MoveBlock(BLOCKENTRY &block, UINT offset, BOOL recrypt, DWORD &key)
+{
+	DAssert(m_Access && block.data_size);
+
+	DArray<BYTE> data(block.data_size);
+	if (!m_Access->ReadBack(block.offset, data, block.data_size))
+		return FALSE;
+
+	BLOCKENTRY moved = block;
+	moved.offset = offset;
+
+	DWORD new_key = key;
+
+	if (recrypt) {
+
+		// 由旧密钥还原出基础密钥，再用新的偏移算出新密钥
+		DWORD base_key = (key ^ block.file_size) - block.offset;
+		new_key = CalcFileKey(base_key, moved);
+
+		UINT sector_shift = m_Access->SectorShift();
+		UINT sector_size = 1 << sector_shift;
+		UINT sector_num = (block.file_size + sector_size - 1) >> sector_shift;
+
+		if (block.flags & BLOCK_COMP_MASK) {
+
+			UINT table_size = (sector_num + 1) * sizeof(DWORD);
+
+			DWORD *off_table = reinterpret_cast<DWORD *>(static_cast<BUFPTR>(data));
+			DecryptData(off_table, table_size, key - 1);
+
+			// 扇区在块中的偏移不一定对齐，复制到对齐的缓冲中再解密和加密
+			DArray<DWORD> sector((sector_size + sizeof(DWORD) - 1) / sizeof(DWORD));
+
+			for (UINT i = 0U; i < sector_num; i++) {
+				UINT size = off_table[i + 1] - off_table[i];
+				if (off_table[i + 1] < off_table[i] || size > sector_size || off_table[i + 1] > block.data_size)
+					return FALSE;
+				DMemCpy(sector, data + off_table[i], size);
+				DecryptData(sector, size, key + i);
+				EncryptData(sector, size, new_key + i);
+				DMemCpy(data + off_table[i], sector, size);
+			}
+
+			EncryptData(off_table, table_size, new_key - 1);
+
+		} else {
+
+			for (UINT i = 0U; i < sector_num; i++) {
+				UINT pos = i << sector_shift;
+				UINT size = DMin(sector_size, block.data_size - pos);
+				DecryptData(data + pos, size, key + i);
+				EncryptData(data + pos, size, new_key + i);
+			}
+		}
+	}
+
+	if (!m_Access->Seek(offset))
+		return FALSE;
+
+	if (!m_Access->Write(data, block.data_size))
+		return FALSE;
+
+	block.offset = offset;
+	key = new_key;
+	return TRUE;
+}
+
+BOOL DMpq::GetIndexName(STRCPTR mpq_name, DString &index_name, INDEXHEADER &stamp)
+{
+	DAssert(mpq_name);
+
+	UINT size = DFile::GetFullPath(mpq_name);
+	if (!size)
+		return FALSE;
+
+	DArray<CHAR> path(size);
+
+	if (!DFile::GetFullPath(mpq_name, path, size))
+		return FALSE;
+
+	DVarClr(stamp);
+
+	UINT archive_size;
+	if (!DFile::GetStatus(path, archive_size, stamp.archive_time))
+		return FALSE;
+
+	stamp.identifier = INDEX_IDENTIFIER;
+	stamp.version = INDEX_VERSION;
+	stamp.archive_size = archive_size;
+	stamp.path_hash = HashString(path, HASH_NAME_LOW);
+
+	// 集中存放时用完整路径的散列值作为文件名
+	if (s_IndexPath.Empty())
+		index_name = DString(path) + INDEX_FILE_EXT;
+	else
+		index_name.Format("%s%c%08X%08X%s", s_IndexPath.GetString(), PATH_DELIMITER, stamp.path_hash, HashString(path, HASH_NAME_HIGH), INDEX_FILE_EXT);
+
+	return TRUE;
+}
+
+BYTE DMpq::GetCompression(STRCPTR file_name, CONST BLOCKENTRY &block)
+{
+	DAssert(file_name);
+
+	if (!(block.flags & BLOCK_COMPRESS))
+		return COMP_NONE;
+
+	// WAVE文件先假定为立体声，拿到数据后再由CheckWave根据文件头确定
+	INT len = DStrLen(file_name);
+	if (len > 4 && !DStrCmpI(file_name + len - 4, ".wav"))
+		return COMP_ADPCM_STEREO | COMP_HUFFMAN;
+
+	return COMP_IMPLODE;
+}
+
+BYTE DMpq::CheckWave(BYTE comp, BUFCPTR data, UINT size)
+{
+	if (!(comp & (COMP_ADPCM_MONO | COMP_ADPCM_STEREO)))
+		return comp;
+
+	// 只有单声道和立体声的16位PCM数据才能使用ADPCM压缩，其他的都使用无损压缩
+	if (!data || size < 12 || DMemCmp(data, "RIFF", 4) || DMemCmp(data + 8, "WAVE", 4))
+		return COMP_IMPLODE;
+
+	// 依次查找fmt块
+	for (UINT pos = 12U; pos + 8 <= size; ) {
+
+		DWORD chunk_size;
+		DMemCpy(&chunk_size, data + pos + 4, sizeof(chunk_size));
+
+		if (DMemCmp(data + pos, "fmt ", 4)) {
+			if (chunk_size > size - pos - 8)
+				break;
+			pos += 8 + chunk_size + (chunk_size & 1);
+			continue;
+		}
+
+		if (chunk_size < 16 || pos + 8 + 16 > size)
+			break;
+
+		WORD format, channels, bits;
+		DMemCpy(&format, data + pos + 8, sizeof(format));
+		DMemCpy(&channels, data + pos + 10, sizeof(channels));
+		DMemCpy(&bits, data + pos + 22, sizeof(bits));
+
+		if (format != WAVE_TAG_PCM || bits != 16)
+			break;
+		if (channels == 1)
+			return COMP_ADPCM_MONO | COMP_HUFFMAN;
+		if (channels == 2)
+			return COMP_ADPCM_STEREO | COMP_HUFFMAN;
+		break;
+	}
+
+	return COMP_IMPLODE;
+}
+
+QWORD DMpq::NameHash(CONST HASHENTRY &hash)
+{
+	return ((QWORD)hash.hash_high << 32) | hash.hash_low;
+}
+
+BOOL DMpq::CompareOffset(CONST EXTRACTITEM &item1, CONST EXTRACTITEM &item2)
+{
+	return item1.offset < item2.offset;
+}
+
+DWORD DMpq::CalcFileKey(CONST DNameKey &name_key, CONST BLOCKENTRY &block)
+{
+	DAssert(name_key.IsValid());
+
+	// 文件名部分的散列值即为基础密钥
+	return CalcFileKey(name_key.m_FileKey, block);
+}
+
+DWORD DMpq::CalcFileKey(DWORD base_key, CONST BLOCKENTRY &block)
+{
+	DAssert(block.flags & BLOCK_EXIST);
+
+	DWORD key = base_key;
+
+	// 必要时用偏移调整密钥
+	if (block.flags & BLOCK_FIX_KEY)
+		key = (key + block.offset) ^ block.file_size;
+
+	return key;
+}
+
+DWORD DMpq::HashString(STRCPTR str, INT hash_type)
+{
+	INT ch;
+	DWORD seed1, seed2;
+
+	DAssert(str && DBetween(hash_type, 0, HASH_TYPE_NUM));
+
+	seed1 = 0x7fed7fedUL;
+	seed2 = 0xeeeeeeeeUL;
+
+	while (*str) {
+
+		ch = DToUpper(static_cast<BYTE>(*str++));
+
+		seed1 = s_HashTable[hash_type][ch] ^ (seed1 + seed2);
+		seed2 = ch + seed1 + seed2 + (seed2 << 5) + 3;
+	}
+
+	return seed1;
+}
+
+VOID DMpq::EncryptData(VPTR buf, UINT size, DWORD key)
+{
+	DAssert(buf && size);
+
+	DWORD seed = 0xeeeeeeeeUL;
+	DWORD *cur = static_cast<DWORD *>(buf);
+
+	for (size /= sizeof(DWORD); size > 0; size--, cur++) {
+
+		seed += s_HashTable[CRYPT_TABLE_INDEX][key & 0xff];
+		DWORD val = *cur;
+		*cur ^= key + seed;
+
+		key = ((~key << 21) + 0x11111111) | (key >> 11);
+		seed = val + seed + (seed << 5) + 3;
+	}
+}
+
+VOID DMpq::DecryptData(VPTR buf, UINT size, DWORD key)
+{
+	DAssert(buf && size);
+
+	DWORD seed = 0xeeeeeeeeUL;
+	DecryptStream(static_cast<DWORD *>(buf), size / sizeof(DWORD), key, seed);
+}
+
+VOID DMpq::DecryptBatch(UINT num, CONST VPTR *buf, CONST UINT *size, CONST DWORD *key)
+{
+	DAssert(buf && size && key);
+
+	DWORD *data[CRYPT_LANE_NUM];
+	UINT left[CRYPT_LANE_NUM];
+	DWORD lane_key[CRYPT_LANE_NUM];
+	DWORD seed[CRYPT_LANE_NUM];
+
+	// 每次取CRYPT_LANE_NUM段数据，各段的密钥不同，相互之间没有依赖关系
+	for (UINT i = 0U; i < num; i += CRYPT_LANE_NUM) {
+
+		UINT lane_num = DMin(num - i, CRYPT_LANE_NUM);
+		UINT common = ~0U;
+
+		for (UINT j = 0U; j < lane_num; j++) {
+			DAssert(buf[i + j]);
+			data[j] = static_cast<DWORD *>(buf[i + j]);
+			left[j] = size[i + j] / sizeof(DWORD);
+			lane_key[j] = key[i + j];
+			seed[j] = 0xeeeeeeeeUL;
+			common = DMin(common, left[j]);
+		}
+
+#ifdef SIMD_CRYPT
+		// 凑齐时先用SIMD指令同时解密各段的共同部分，各段的密钥和种子随之推进
+		if (lane_num == CRYPT_LANE_NUM) {
+			common &= ~(CRYPT_LANE_NUM - 1);
+			DecryptLanes(data, common, lane_key, seed);
+			for (UINT j = 0U; j < lane_num; j++) {
+				data[j] += common;
+				left[j] -= common;
+			}
+		}
+#endif
+
+		// 剩余部分逐段解密
+		for (UINT j = 0U; j < lane_num; j++)
+			DecryptStream(data[j], left[j], lane_key[j], seed[j]);
+	}
+}
+
+VOID DMpq::DecryptStream(DWORD *data, UINT num, DWORD &key, DWORD &seed)
+{
+	DAssert(data || !num);
+
+	for (; num > 0; num--, data++) {
+
+		seed += s_HashTable[CRYPT_TABLE_INDEX][key & 0xff];
+		*data ^= key + seed;
+
+		key = ((~key << 21) + 0x11111111) | (key >> 11);
+		seed = *data + seed + (seed << 5) + 3;
+	}
+}
+
+#ifdef SIMD_CRYPT
+
+VOID DMpq::DecryptLanes(DWORD *CONST *data, UINT num, DWORD *key, DWORD *seed)
+{
+	DAssert(data && key && seed && !(num & (CRYPT_LANE_NUM - 1)));
+
+	CONST DWORD *table = s_HashTable[CRYPT_TABLE_INDEX];
+	CONST __m128i ones = _mm_set1_epi32(-1);
+	CONST __m128i magic = _mm_set1_epi32(0x11111111);
+	CONST __m128i three = _mm_set1_epi32(3);
+
+	// 每个32位通道对应一段数据的密钥和种子
+	__m128i k = _mm_loadu_si128(reinterpret_cast<CONST __m128i *>(key));
+	__m128i s = _mm_loadu_si128(reinterpret_cast<CONST __m128i *>(seed));
+
+	for (UINT i = 0U; i < num; i += CRYPT_LANE_NUM) {
+
+		// 各段各取4个DWORD，转置后每个寄存器中是各段同一位置的数据
+		__m128i d0 = _mm_loadu_si128(reinterpret_cast<CONST __m128i *>(data[0] + i));
+		__m128i d1 = _mm_loadu_si128(reinterpret_cast<CONST __m128i *>(data[1] + i));
+		__m128i d2 = _mm_loadu_si128(reinterpret_cast<CONST __m128i *>(data[2] + i));
+		__m128i d3 = _mm_loadu_si128(reinterpret_cast<CONST __m128i *>(data[3] + i));
+
+		__m128i t0 = _mm_unpacklo_epi32(d0, d1);
+		__m128i t1 = _mm_unpacklo_epi32(d2, d3);
+		__m128i t2 = _mm_unpackhi_epi32(d0, d1);
+		__m128i t3 = _mm_unpackhi_epi32(d2, d3);
+
+		__m128i d[CRYPT_LANE_NUM];
+		d[0] = _mm_unpacklo_epi64(t0, t1);
+		d[1] = _mm_unpackhi_epi64(t0, t1);
+		d[2] = _mm_unpacklo_epi64(t2, t3);
+		d[3] = _mm_unpackhi_epi64(t2, t3);
+
+		for (UINT j = 0U; j < CRYPT_LANE_NUM; j++) {
+
+			// SSE2没有gather指令，按通道逐个查表
+			__m128i t = _mm_set_epi32(
+				table[_mm_cvtsi128_si32(_mm_shuffle_epi32(k, 3)) & 0xff],
+				table[_mm_cvtsi128_si32(_mm_shuffle_epi32(k, 2)) & 0xff],
+				table[_mm_cvtsi128_si32(_mm_shuffle_epi32(k, 1)) & 0xff],
+				table[_mm_cvtsi128_si32(k) & 0xff]);
+
+			// 与DecryptStream相同的运算
+			s = _mm_add_epi32(s, t);
+			d[j] = _mm_xor_si128(d[j], _mm_add_epi32(k, s));
+
+			k = _mm_or_si128(_mm_add_epi32(_mm_slli_epi32(_mm_xor_si128(k, ones), 21), magic), _mm_srli_epi32(k, 11));
+			s = _mm_add_epi32(_mm_add_epi32(d[j], s), _mm_add_epi32(_mm_slli_epi32(s, 5), three));
+		}
+
+		// 转置回各段的数据
+		t0 = _mm_unpacklo_epi32(d[0], d[1]);
+		t1 = _mm_unpacklo_epi32(d[2], d[3]);
+		t2 = _mm_unpackhi_epi32(d[0], d[1]);
+		t3 = _mm_unpackhi_epi32(d[2], d[3]);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data[0] + i), _mm_unpacklo_epi64(t0, t1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data[1] + i), _mm_unpackhi_epi64(t0, t1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data[2] + i), _mm_unpacklo_epi64(t2, t3));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data[3] + i), _mm_unpackhi_epi64(t2, t3));
+	}
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(key), k);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(seed), s);
+}
+
+#endif
+
+/************************************************************************/
+
+DMpq::DNameKey::DNameKey() :
+	m_Valid(FALSE),
+	m_Entry(0UL),
+	m_HashLow(0UL),
+	m_HashHigh(0UL),
+	m_FileKey(0UL)
+{
+
+}
+
+DMpq::DNameKey::DNameKey(STRCPTR file_name)
+{
+	Assign(file_name);
+}
+
+BOOL DMpq::DNameKey::IsValid(VOID) CONST
+{
+	return m_Valid;
+}
+
+QWORD DMpq::DNameKey::GetHash(VOID) CONST
+{
+	return ((QWORD)m_HashHigh << 32) | m_HashLow;
+}
+
+BOOL DMpq::DNameKey::Assign(STRCPTR file_name)
+{
+	DWORD seed1[HASH_TYPE_NUM];
+	DWORD seed2[HASH_TYPE_NUM];
+
+	for (INT i = 0; i < HASH_TYPE_NUM; i++) {
+		seed1[i] = 0x7fed7fedUL;
+		seed2[i] = 0xeeeeeeeeUL;
+	}
+
+	m_Valid = (file_name && *file_name);
+
+	// 一次遍历同时计算全部散列值，算法同HashString
+	for (STRCPTR str = m_Valid ? file_name : ""; *str; str++) {
+
+		INT ch = DToUpper(static_cast<BYTE>(*str));
+
+		for (INT i = 0; i < HASH_TYPE_NUM; i++) {
+			seed1[i] = s_HashTable[i][ch] ^ (seed1[i] + seed2[i]);
+			seed2[i] = ch + seed1[i] + seed2[i] + (seed2[i] << 5) + 3;
+		}
+
+		// 文件密钥只取路径中的文件名部分
+		if (ch == '\\') {
+			seed1[HASH_FILE_KEY] = 0x7fed7fedUL;
+			seed2[HASH_FILE_KEY] = 0xeeeeeeeeUL;
+		}
+	}
+
+	m_Entry = seed1[HASH_TABLE_ENTRY];
+	m_HashLow = seed1[HASH_NAME_LOW];
+	m_HashHigh = seed1[HASH_NAME_HIGH];
+	m_FileKey = seed1[HASH_FILE_KEY];
+
+	return m_Valid;
+}
+
+#ifdef SIMD_HASH
+
+// 一个文件名前进一个字符，每个32位通道对应一种散列值，算法同HashString
+static VOID HashLanes(__m128i &seed1, __m128i &seed2, CONST DWORD *row, BOOL reset)
+{
+	__m128i table = _mm_loadu_si128(reinterpret_cast<CONST __m128i *>(row));
+	__m128i upper = _mm_loadu_si128(reinterpret_cast<CONST __m128i *>(row + 4));
+
+	seed1 = _mm_xor_si128(table, _mm_add_epi32(seed1, seed2));
+	seed2 = _mm_add_epi32(_mm_add_epi32(upper, seed1), _mm_add_epi32(_mm_add_epi32(seed2, _mm_slli_epi32(seed2, 5)), _mm_set1_epi32(3)));
+
+	// 文件密钥只取路径中的文件名部分，位于最高的通道
+	if (reset) {
+		CONST __m128i keep_mask = _mm_set_epi32(0, -1, -1, -1);
+		seed1 = _mm_or_si128(_mm_and_si128(seed1, keep_mask), _mm_set_epi32(0x7fed7fed, 0, 0, 0));
+		seed2 = _mm_or_si128(_mm_and_si128(seed2, keep_mask), _mm_set_epi32(0xeeeeeeee, 0, 0, 0));
+	}
+}
+
+#endif
+
+VOID DMpq::DNameKey::AssignBatch(UINT num, CONST STRCPTR *file_names, DNameKey *name_keys)
+{
+	DAssert(file_names && name_keys);
+
+#ifdef SIMD_HASH
+
+	// 每个32位通道计算一种散列值，多个文件名交错计算，掩盖每一步之间的依赖
+	CONST __m128i init1 = _mm_set1_epi32(0x7fed7fed);
+	CONST __m128i init2 = _mm_set1_epi32(0xeeeeeeee);
+
+	for (UINT i = 0U; i < num; i += NAME_LANE_NUM) {
+
+		UINT lane_num = DMin(num - i, NAME_LANE_NUM);
+		CONST BYTE *str[NAME_LANE_NUM];
+		UINT len[NAME_LANE_NUM];
+		__m128i seed1[NAME_LANE_NUM];
+		__m128i seed2[NAME_LANE_NUM];
+		UINT common = ~0U;
+
+		for (UINT j = 0U; j < lane_num; j++) {
+			STRCPTR file_name = file_names[i + j];
+			name_keys[i + j].m_Valid = (file_name && *file_name);
+			str[j] = reinterpret_cast<CONST BYTE *>(file_name ? file_name : "");
+			len[j] = DStrLen(reinterpret_cast<STRCPTR>(str[j]));
+			seed1[j] = init1;
+			seed2[j] = init2;
+			common = DMin(common, len[j]);
+		}
+
+		// 先交错计算各文件名的共同长度部分，再分别计算剩余部分
+		for (UINT pos = 0U; pos < common; pos++) {
+			for (UINT j = 0U; j < lane_num; j++)
+				HashLanes(seed1[j], seed2[j], s_NameTable[str[j][pos]], str[j][pos] == '\\');
+		}
+
+		for (UINT j = 0U; j < lane_num; j++) {
+			for (UINT pos = common; pos < len[j]; pos++)
+				HashLanes(seed1[j], seed2[j], s_NameTable[str[j][pos]], str[j][pos] == '\\');
+		}
+
+		for (UINT j = 0U; j < lane_num; j++) {
+
+			DWORD hash[HASH_TYPE_NUM];
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(hash), seed1[j]);
+
+			DNameKey &name_key = name_keys[i + j];
+			name_key.m_Entry = hash[HASH_TABLE_ENTRY];
+			name_key.m_HashLow = hash[HASH_NAME_LOW];
+			name_key.m_HashHigh = hash[HASH_NAME_HIGH];
+			name_key.m_FileKey = hash[HASH_FILE_KEY];
+		}
+	}
+
+#else
+
+	for (UINT i = 0U; i < num; i++)
+		name_keys[i].Assign(file_names[i]);
+
+#endif
+}
+
+/************************************************************************/
+
+DMpq::DNameFilter::DNameFilter() :
+	m_Mask(0U),
+	m_Bits(NULL)
+{
+
+}
+
+DMpq::DNameFilter::~DNameFilter()
+{
+	Clear();
+}
+
+BOOL DMpq::DNameFilter::Create(UINT key_num)
+{
+	Clear();
+
+	// 每个名字约16位，4次探测的误判率约为0.2%
+	UINT bit_num = 64U;
+	while (bit_num < key_num * BITS_PER_KEY)
+		bit_num <<= 1;
+
+	m_Bits = new DWORD[bit_num >> 5];
+	DMemClr(m_Bits, (bit_num >> 5) * sizeof(DWORD));
+	m_Mask = bit_num - 1;
+
+	return TRUE;
+}
+
+VOID DMpq::DNameFilter::Clear(VOID)
+{
+	delete [] m_Bits;
+	m_Bits = NULL;
+	m_Mask = 0U;
+}
+
+VOID DMpq::DNameFilter::Add(QWORD name_hash)
+{
+	DAssert(m_Bits);
+
+	// 两个名字散列值本身分布均匀，用双重散列生成各个探测位置
+	DWORD pos = (DWORD)name_hash;
+	DWORD step = (DWORD)(name_hash >> 32) | 1UL;
+
+	for (INT i = 0; i < PROBE_NUM; i++) {
+		UINT bit = pos & m_Mask;
+		m_Bits[bit >> 5] |= 1UL << (bit & 31);
+		pos += step;
+	}
+}
+
+BOOL DMpq::DNameFilter::MayExist(QWORD name_hash) CONST
+{
+	DAssert(m_Bits);
+
+	DWORD pos = (DWORD)name_hash;
+	DWORD step = (DWORD)(name_hash >> 32) | 1UL;
+
+	for (INT i = 0; i < PROBE_NUM; i++) {
+		UINT bit = pos & m_Mask;
+		if (!(m_Bits[bit >> 5] & (1UL << (bit & 31))))
+			return FALSE;
+		pos += step;
+	}
+
+	return TRUE;
+}
+
+/************************************************************************/
+
+DMpq::DDirExtractor::DDirExtractor(STRCPTR dest_path, BOOL *results /* = NULL */) :
+	m_Path(dest_path ? dest_path : ""),
+	m_Results(results)
+{
+
+}
+
+BOOL DMpq::DDirExtractor::Output(UINT index, STRCPTR file_name, BUFCPTR data, UINT size)
+{
+	DAssert(file_name && *file_name);
+
+	// 不允许写到目标目录之外：以分隔符开头的是绝对路径，冒号可以指定驱动器或者NTFS数据流
+	if (*file_name == '\\' || *file_name == '/' || DStrChr(file_name, ':'))
+		return FALSE;
+
+	// 目标目录本身不存在时也一并创建
+	UINT path_len = m_Path.Length();
+	if (path_len && !DFile::CreateDir(m_Path))
+		return FALSE;
+
+	UINT len = path_len + DStrLen(file_name) + 2;
+	DArray<CHAR> path(len);
+
+	if (path_len)
+		DSprintf(path, len, "%s%c%s", m_Path.GetString(), PATH_DELIMITER, file_name);
+	else
+		DStrCpy(path, file_name);
+
+	// 逐级创建子目录，同时把档案内的路径分隔符换成本地的
+	STRPTR part = path + (path_len ? path_len + 1 : 0);
+	for (STRPTR p = part; ; p++) {
+
+		BOOL end = !*p;
+		if (!end && *p != '\\' && *p != '/')
+			continue;
+
+		// 也不允许上一级目录
+		if (p - part == 2 && part[0] == '.' && part[1] == '.')
+			return FALSE;
+
+		if (end)
+			break;
+
+		*p = '\0';
+		BOOL ret = (p == part) || DFile::CreateDir(path);
+		*p = PATH_DELIMITER;
+
+		if (!ret)
+			return FALSE;
+
+		part = p + 1;
+	}
+
+	DFile file;
+	if (!file.Open(path, DFile::OM_WRITE | DFile::OM_CREATE | DFile::OM_TRUNCATE))
+		return FALSE;
+
+	if (size && file.Write(data, size) != size)
+		return FALSE;
+
+	if (m_Results)
+		m_Results[index] = TRUE;
+
+	return TRUE;
+}
+
+VOID DMpq::DDirExtractor::Fail(UINT index, STRCPTR /* file_name */)
+{
+	if (m_Results)
+		m_Results[index] = FALSE;
+}
+
+/************************************************************************/
+
+DMpq::DHandleTable::DHandleTable() :
+	m_SlotNum(0U),
+	m_FreeSlot(NULL_SLOT)
+{
+	DVarClr(m_Page);
+}
+
+DMpq::DHandleTable::~DHandleTable()
+{
+	for (UINT i = 0U; i < m_SlotNum; i++) {
+		HANDLEENTRY *entry = m_Page[i >> PAGE_SHIFT] + (i & (PAGE_SIZE - 1));
+		if (!entry->sub)
+			continue;
+		DVerify(entry->sub->Close());
+		delete entry->sub;
+	}
+
+	for (UINT i = 0U; i < PAGE_NUM; i++)
+		delete [] m_Page[i];
+}
+
+HANDLE DMpq::DHandleTable::Insert(DMpq *mpq, DSubFile *sub)
+{
+	DAssert(mpq && sub);
+
+	DAutoLock lock(m_Lock);
+
+	UINT slot = m_FreeSlot;
+	HANDLEENTRY *entry;
+
+	if (slot != NULL_SLOT) {
+
+		entry = m_Page[slot >> PAGE_SHIFT] + (slot & (PAGE_SIZE - 1));
+		m_FreeSlot = entry->next;
+
+	} else {
+
+		// 句柄的低位保存槽号加一，因此可用的槽数比掩码少一
+		slot = m_SlotNum;
+		if (slot >= SLOT_MASK)
+			return NULL;
+
+		// 按页分配，已分配的槽位置不再移动，查找时无需加锁
+		HANDLEENTRY *&page = m_Page[slot >> PAGE_SHIFT];
+		if (!page) {
+			page = new HANDLEENTRY[PAGE_SIZE];
+			DMemClr(page, PAGE_SIZE * sizeof(HANDLEENTRY));
+		}
+
+		entry = page + (slot & (PAGE_SIZE - 1));
+		entry->slot = slot;
+		m_SlotNum++;
+	}
+
+	DAssert(!GetRef(entry->state));
+
+	entry->mpq = mpq;
+	entry->sub = sub;
+	entry->generation = GetGeneration(entry->state);
+	entry->next = NULL_SLOT;
+
+	// 原子操作同时发布以上的修改，句柄表本身持有一个引用
+	DAtomicInc(&entry->state);
+
+	return MakeHandle(slot, entry->generation);
+}
+
+BOOL DMpq::DHandleTable::Remove(DMpq *mpq, HANDLE handle)
+{
+	HANDLEENTRY *entry = Acquire(handle);
+	if (!entry)
+		return FALSE;
+
+	if (entry->mpq != mpq) {
+		Release(entry);
+		return FALSE;
+	}
+
+	// 增加代数使句柄失效，同时去掉句柄表持有的引用
+	// 先假设只有句柄表和自己持有引用
+	LONG state = (LONG)((entry->generation << SLOT_BITS) | 2U);
+	for (;;) {
+		UINT generation = GetGeneration(state);
+		if (generation != entry->generation || GetRef(state) < 2U) {
+			// 已经被其他线程关闭
+			Release(entry);
+			return FALSE;
+		}
+		LONG next = (LONG)((((generation + 1U) & GEN_MASK) << SLOT_BITS) | (GetRef(state) - 1U));
+		LONG prev = DAtomicCas(&entry->state, state, next);
+		if (prev == state)
+			break;
+		state = prev;
+	}
+
+	// 最后一个引用释放时才真正关闭文件
+	Release(entry);
+	return TRUE;
+}
+
+VOID DMpq::DHandleTable::RemoveAll(DMpq *mpq)
+{
+	std::vector<HANDLE> handles;
+
+	{
+		DAutoLock lock(m_Lock);
+
+		for (UINT i = 0U; i < m_SlotNum; i++) {
+			HANDLEENTRY *entry = m_Page[i >> PAGE_SHIFT] + (i & (PAGE_SIZE - 1));
+			if (entry->mpq == mpq)
+				handles.push_back(MakeHandle(i, entry->generation));
+		}
+	}
+
+	// 已经关闭但仍被引用的句柄会在Remove中被忽略
+	for (UINT i = 0U; i < handles.size(); i++)
+		Remove(mpq, handles[i]);
+}
+
+BOOL DMpq::DHandleTable::IsOpen(DMpq *mpq)
+{
+	DAutoLock lock(m_Lock);
+
+	for (UINT i = 0U; i < m_SlotNum; i++) {
+		if (m_Page[i >> PAGE_SHIFT][i & (PAGE_SIZE - 1)].mpq == mpq)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+BOOL DMpq::DHandleTable::IsOpen(DMpq *mpq, UINT offset)
+{
+	std::vector<HANDLE> handles;
+
+	{
+		DAutoLock lock(m_Lock);
+
+		for (UINT i = 0U; i < m_SlotNum; i++) {
+			HANDLEENTRY *entry = m_Page[i >> PAGE_SHIFT] + (i & (PAGE_SIZE - 1));
+			if (entry->mpq == mpq)
+				handles.push_back(MakeHandle(i, entry->generation));
+		}
+	}
+
+	// 持有引用之后才能访问文件，以免文件同时被关闭
+	for (UINT i = 0U; i < handles.size(); i++) {
+
+		HANDLEENTRY *entry = Acquire(handles[i]);
+		if (!entry)
+			continue;
+
+		CONST BLOCKENTRY *block = entry->sub->GetBlock();
+		BOOL found = (entry->mpq == mpq && block && block->offset == offset);
+		Release(entry);
+
+		if (found)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+DMpq::HANDLEENTRY *DMpq::DHandleTable::Acquire(HANDLE handle)
+{
+	UINT generation;
+	HANDLEENTRY *entry = Find(handle, generation);
+	if (!entry)
+		return NULL;
+
+	// 先假设只有句柄表持有引用，比较失败时使用返回的实际状态重试
+	LONG state = (LONG)((generation << SLOT_BITS) | 1U);
+	for (;;) {
+		if (GetGeneration(state) != generation || !GetRef(state))
+			return NULL;
+		LONG prev = DAtomicCas(&entry->state, state, state + 1);
+		if (prev == state)
+			return entry;
+		state = prev;
+	}
+}
+
+VOID DMpq::DHandleTable::Release(HANDLEENTRY *entry)
+{
+	DAssert(entry);
+
+	if (!GetRef(DAtomicDec(&entry->state)))
+		Destroy(entry);
+}
+
+DMpq *DMpq::DHandleTable::GetOwner(HANDLE handle)
+{
+	HANDLEENTRY *entry = Acquire(handle);
+	if (!entry)
+		return NULL;
+
+	DMpq *mpq = entry->mpq;
+	Release(entry);
+	return mpq;
+}
+
+DMpq::HANDLEENTRY *DMpq::DHandleTable::Find(HANDLE handle, UINT &generation) CONST
+{
+	// 合法的句柄只使用低32位
+	UINT value = (UINT)(size_t)handle;
+	if ((size_t)value != (size_t)handle)
+		return NULL;
+
+	UINT slot = (value & SLOT_MASK) - 1;
+	if (slot >= SLOT_MASK)
+		return NULL;
+
+	HANDLEENTRY *page = m_Page[slot >> PAGE_SHIFT];
+	if (!page)
+		return NULL;
+
+	generation = value >> SLOT_BITS;
+	return page + (slot & (PAGE_SIZE - 1));
+}
+
+VOID DMpq::DHandleTable::Destroy(HANDLEENTRY *entry)
+{
+	DAssert(entry && entry->sub);
+
+	// 写入的文件在写回档案时已经关闭
+	entry->sub->Close();
+	delete entry->sub;
+
+	DAutoLock lock(m_Lock);
+
+	entry->mpq = NULL;
+	entry->sub = NULL;
+	entry->next = m_FreeSlot;
+	m_FreeSlot = entry->slot;
+}
+
+HANDLE DMpq::DHandleTable::MakeHandle(UINT slot, UINT generation)
+{
+	return (HANDLE)(size_t)(((generation & GEN_MASK) << SLOT_BITS) | (slot + 1U));
+}
+
+UINT DMpq::DHandleTable::GetGeneration(LONG state)
+{
+	// 状态的低位是引用计数，与句柄中槽号的位数相同
+	return ((UINT)state >> SLOT_BITS) & GEN_MASK;
+}
+
+UINT DMpq::DHandleTable::GetRef(LONG state)
+{
+	return (UINT)state & SLOT_MASK;
+}
+
+/************************************************************************/
+
+DMpq::DSectorCache::DSectorCache() :
+	m_SectorShift(0U),
+	m_Budget(0U),
+	m_ShardLimit(0U)
+{
+	for (INT i = 0; i < SHARD_NUM; i++) {
+		SHARD &shard = m_Shard[i];
+		shard.used_num = 0U;
+		shard.free_num = 0U;
+		shard.bucket_num = 0U;
+		shard.bucket = NULL;
+		shard.head = NULL;
+		shard.tail = NULL;
+		shard.free = NULL;
+	}
+}
+
+DMpq::DSectorCache::~DSectorCache()
+{
+	Clear();
+}
+
+BOOL DMpq::DSectorCache::Create(UINT sector_shift, UINT budget)
+{
+	DAssert(sector_shift);
+
+	if (m_SectorShift)
+		return FALSE;
+
+	m_SectorShift = sector_shift;
+
+	for (INT i = 0; i < SHARD_NUM; i++)
+		Rehash(m_Shard[i], MIN_BUCKET_NUM);
+
+	SetBudget(budget);
+	return TRUE;
+}
+
+VOID DMpq::DSectorCache::Clear(VOID)
+{
+	for (INT i = 0; i < SHARD_NUM; i++) {
+
+		SHARD &shard = m_Shard[i];
+
+		for (UINT j = 0U; j < shard.bucket_num; j++) {
+			for (CACHEENTRY *entry = shard.bucket[j]; entry; ) {
+				DAssert(!entry->pin);
+				CACHEENTRY *next = entry->link;
+				delete [] reinterpret_cast<BUFPTR>(entry);
+				entry = next;
+			}
+		}
+
+		for (CACHEENTRY *entry = shard.free; entry; ) {
+			CACHEENTRY *next = entry->link;
+			delete [] reinterpret_cast<BUFPTR>(entry);
+			entry = next;
+		}
+
+		delete [] shard.bucket;
+
+		shard.used_num = 0U;
+		shard.free_num = 0U;
+		shard.bucket_num = 0U;
+		shard.bucket = NULL;
+		shard.head = NULL;
+		shard.tail = NULL;
+		shard.free = NULL;
+	}
+
+	m_SectorShift = 0U;
+	m_Budget = 0U;
+	m_ShardLimit = 0U;
+}
+
+UINT DMpq::DSectorCache::GetBudget(VOID) CONST
+{
+	return m_Budget;
+}
+
+VOID DMpq::DSectorCache::SetBudget(UINT budget)
+{
+	DAssert(m_SectorShift);
+
+	// 预算按扇区个数平均分配到各个分片，有预算时每个分片至少能缓存一个扇区
+	UINT limit = (budget >> m_SectorShift) / SHARD_NUM;
+	if (!limit && budget)
+		limit = 1U;
+
+	m_Budget = budget;
+	m_ShardLimit = limit;
+
+	for (INT i = 0; i < SHARD_NUM; i++) {
+
+		SHARD &shard = m_Shard[i];
+		DAutoLock lock(shard.lock);
+
+		UINT bucket_num = shard.bucket_num;
+		while (bucket_num < limit)
+			bucket_num <<= 1;
+		if (bucket_num != shard.bucket_num)
+			Rehash(shard, bucket_num);
+
+		Evict(shard);
+
+		// 释放超出预算的空闲缓冲
+		while (shard.free && shard.used_num + shard.free_num > limit) {
+			CACHEENTRY *entry = shard.free;
+			shard.free = entry->link;
+			shard.free_num--;
+			delete [] reinterpret_cast<BUFPTR>(entry);
+		}
+	}
+}
+
+DMpq::CACHEENTRY *DMpq::DSectorCache::Find(UINT block_idx, UINT sector)
+{
+	DAssert(m_SectorShift);
+
+	UINT hash = Hash(block_idx, sector);
+	SHARD &shard = GetShard(hash);
+	DAutoLock lock(shard.lock);
+
+	CACHEENTRY *entry = *Search(shard, hash, block_idx, sector);
+	if (!entry)
+		return NULL;
+
+	// 被引用的扇区不在LRU链表中，因此不会被淘汰
+	if (!entry->pin++)
+		Detach(shard, entry);
+
+	return entry;
+}
+
+DMpq::CACHEENTRY *DMpq::DSectorCache::Alloc(UINT block_idx, UINT sector)
+{
+	DAssert(m_SectorShift);
+
+	UINT hash = Hash(block_idx, sector);
+	SHARD &shard = GetShard(hash);
+
+	CACHEENTRY *entry = NULL;
+
+	{
+		DAutoLock lock(shard.lock);
+		entry = shard.free;
+		if (entry) {
+			shard.free = entry->link;
+			shard.free_num--;
+		}
+	}
+
+	// 扇区数据紧跟在缓存项之后，一次分配
+	if (!entry) {
+		BUFPTR buf = new BYTE[sizeof(CACHEENTRY) + (1 << m_SectorShift)];
+		entry = reinterpret_cast<CACHEENTRY *>(buf);
+		entry->data = buf + sizeof(CACHEENTRY);
+	}
+
+	entry->block = block_idx;
+	entry->sector = sector;
+	entry->size = 0U;
+	entry->pin = 1U;
+	entry->link = NULL;
+	entry->prev = NULL;
+	entry->next = NULL;
+
+	return entry;
+}
+
+DMpq::CACHEENTRY *DMpq::DSectorCache::Insert(CACHEENTRY *entry)
+{
+	DAssert(m_SectorShift && entry && entry->pin == 1U);
+
+	UINT hash = Hash(entry->block, entry->sector);
+	SHARD &shard = GetShard(hash);
+	DAutoLock lock(shard.lock);
+
+	CACHEENTRY **ptr = Search(shard, hash, entry->block, entry->sector);
+
+	// 其他线程已经读取了同一扇区，则使用已有的缓存
+	if (*ptr) {
+		Recycle(shard, entry);
+		entry = *ptr;
+		if (!entry->pin++)
+			Detach(shard, entry);
+		return entry;
+	}
+
+	*ptr = entry;
+	shard.used_num++;
+
+	Evict(shard);
+	return entry;
+}
+
+VOID DMpq::DSectorCache::Release(CACHEENTRY *entry)
+{
+	DAssert(m_SectorShift && entry);
+
+	UINT hash = Hash(entry->block, entry->sector);
+	SHARD &shard = GetShard(hash);
+	DAutoLock lock(shard.lock);
+
+	DAssert(entry->pin);
+	if (--entry->pin)
+		return;
+
+	Attach(shard, entry);
+	Evict(shard);
+}
+
+VOID DMpq::DSectorCache::Free(CACHEENTRY *entry)
+{
+	DAssert(m_SectorShift && entry && entry->pin == 1U);
+
+	UINT hash = Hash(entry->block, entry->sector);
+	SHARD &shard = GetShard(hash);
+	DAutoLock lock(shard.lock);
+
+	Recycle(shard, entry);
+}
+
+VOID DMpq::DSectorCache::Invalidate(UINT block_idx)
+{
+	// 仅在写操作时调用，此时不应有被引用的扇区
+	for (INT i = 0; i < SHARD_NUM; i++) {
+
+		SHARD &shard = m_Shard[i];
+		DAutoLock lock(shard.lock);
+
+		for (UINT j = 0U; j < shard.bucket_num; j++) {
+			CACHEENTRY **ptr = &shard.bucket[j];
+			while (*ptr) {
+				CACHEENTRY *entry = *ptr;
+				if (entry->block != block_idx) {
+					ptr = &entry->link;
+					continue;
+				}
+				DAssert(!entry->pin);
+				*ptr = entry->link;
+				Detach(shard, entry);
+				shard.used_num--;
+				Recycle(shard, entry);
+			}
+		}
+	}
+}
+
+VOID DMpq::DSectorCache::Invalidate(VOID)
+{
+	// 块表被重新编号或者恢复时丢弃全部扇区
+	for (INT i = 0; i < SHARD_NUM; i++) {
+
+		SHARD &shard = m_Shard[i];
+		DAutoLock lock(shard.lock);
+
+		for (UINT j = 0U; j < shard.bucket_num; j++) {
+			while (CACHEENTRY *entry = shard.bucket[j]) {
+				DAssert(!entry->pin);
+				shard.bucket[j] = entry->link;
+				Detach(shard, entry);
+				shard.used_num--;
+				Recycle(shard, entry);
+			}
+		}
+	}
+}
+
+UINT DMpq::DSectorCache::Hash(UINT block_idx, UINT sector)
+{
+	UINT hash = block_idx * 0x9e3779b1U + sector * 0x85ebca6bU;
+	return hash ^ (hash >> 15);
+}
+
+DMpq::DSectorCache::SHARD &DMpq::DSectorCache::GetShard(UINT hash)
+{
+	// 高位选分片，低位选散列桶
+	return m_Shard[hash >> 28 & (SHARD_NUM - 1)];
+}
+
+DMpq::CACHEENTRY **DMpq::DSectorCache::Search(SHARD &shard, UINT hash, UINT block_idx, UINT sector)
+{
+	DAssert(shard.bucket_num);
+
+	CACHEENTRY **ptr = &shard.bucket[hash & (shard.bucket_num - 1)];
+
+	for (; *ptr; ptr = &(*ptr)->link) {
+		if ((*ptr)->block == block_idx && (*ptr)->sector == sector)
+			break;
+	}
+
+	return ptr;
+}
+
+VOID DMpq::DSectorCache::Rehash(SHARD &shard, UINT bucket_num)
+{
+	DAssert(bucket_num && !(bucket_num & (bucket_num - 1)));
+
+	CACHEENTRY **bucket = new CACHEENTRY *[bucket_num];
+	DMemClr(bucket, bucket_num * sizeof(CACHEENTRY *));
+
+	for (UINT i = 0U; i < shard.bucket_num; i++) {
+		for (CACHEENTRY *entry = shard.bucket[i]; entry; ) {
+			CACHEENTRY *next = entry->link;
+			UINT index = Hash(entry->block, entry->sector) & (bucket_num - 1);
+			entry->link = bucket[index];
+			bucket[index] = entry;
+			entry = next;
+		}
+	}
+
+	delete [] shard.bucket;
+	shard.bucket = bucket;
+	shard.bucket_num = bucket_num;
+}
+
+VOID DMpq::DSectorCache::Remove(SHARD &shard, CACHEENTRY *entry)
+{
+	DAssert(entry && !entry->pin);
+
+	UINT hash = Hash(entry->block, entry->sector);
+	CACHEENTRY **ptr = Search(shard, hash, entry->block, entry->sector);
+	DAssert(*ptr == entry);
+
+	*ptr = entry->link;
+	Detach(shard, entry);
+	shard.used_num--;
+}
+
+VOID DMpq::DSectorCache::Recycle(SHARD &shard, CACHEENTRY *entry)
+{
+	DAssert(entry);
 
-	if (!m_Access->Seek(0U))
-		return FALSE;
+	// 空闲缓冲也计入预算
+	if (shard.used_num + shard.free_num >= m_ShardLimit) {
+		delete [] reinterpret_cast<BUFPTR>(entry);
+		return;
+	}
 
-	if (!m_Access->Write(&header, sizeof(header)))
-		return FALSE;
+	entry->pin = 0U;
+	entry->link = shard.free;
+	shard.free = entry;
+	shard.free_num++;
+}
 
-	// 写散列表
-	if (!m_Access->Seek(header.hash_table_offset))
-		return FALSE;
+VOID DMpq::DSectorCache::Evict(SHARD &shard)
+{
+	// 从LRU链表末尾开始淘汰，被引用的扇区不在链表中
+	while (shard.used_num > m_ShardLimit && shard.tail) {
+		CACHEENTRY *entry = shard.tail;
+		Remove(shard, entry);
+		Recycle(shard, entry);
+	}
+}
 
-	DArray<HASHENTRY> hash_table(m_HashNum * sizeof(HASHENTRY));
-	DMemCpy(hash_table, m_HashTable, hash_size);
+VOID DMpq::DSectorCache::Attach(SHARD &shard, CACHEENTRY *entry)
+{
+	DAssert(entry && !entry->prev && !entry->next);
 
-	DWORD key = HashString(HASH_TABLE_KEY, HASH_FILE_KEY);
-	EncryptData(hash_table, hash_size, key);
+	entry->next = shard.head;
+	if (shard.head)
+		shard.head->prev = entry;
+	else
+		shard.tail = entry;
 
-	BOOL ret = m_Access->Write(hash_table, hash_size);
-	if (!ret)
-		return FALSE;
+	shard.head = entry;
+}
 
-	// 写块表
-	if (!m_Access->Seek(header.block_table_offset))
-		return FALSE;
+VOID DMpq::DSectorCache::Detach(SHARD &shard, CACHEENTRY *entry)
+{
+	DAssert(entry);
+
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else if (shard.head == entry)
+		shard.head = entry->next;
+	else
+		return;
 
-	DArray<BLOCKENTRY> block_table(m_BlockTable.size());
-	DMemCpy(block_table, &m_BlockTable.front(), block_size);
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		shard.tail = entry->prev;
 
-	key = HashString(BLOCK_TABLE_KEY, HASH_FILE_KEY);
-	EncryptData(block_table, block_size, key);
+	entry->prev = NULL;
+	entry->next = NULL;
+}
 
-	ret = m_Access->Write(block_table, block_size);
-	if (!ret)
-		return FALSE;
+/************************************************************************/
+
+DMpq::DIndexCache::DIndexCache() :
+	m_Header(NULL),
+	m_HashTable(NULL),
+	m_BlockTable(NULL),
+	m_TablePos(NULL),
+	m_OffTable(NULL),
+	m_NamePos(NULL),
+	m_NameData(NULL)
+{
 
-	return TRUE;
 }
 
-DMpq::HASHENTRY *DMpq::Lookup(STRCPTR file_name)
+DMpq::DIndexCache::~DIndexCache()
 {
-	DAssert(file_name && *file_name);
-	DAssert(m_HashNum && m_HashTable);
+	Clear();
+}
 
-	// 根据散列值计算文件的起始入口
-	DWORD entry = HashString(file_name, HASH_TABLE_ENTRY);
+BOOL DMpq::DIndexCache::IsLoaded(VOID) CONST
+{
+	return m_Header != NULL;
+}
 
-	// 计算散列值，用以比较散列表入口冲突
-	DWORD hash_low = HashString(file_name, HASH_NAME_LOW);
-	DWORD hash_high = HashString(file_name, HASH_NAME_HIGH);
+BOOL DMpq::DIndexCache::Load(STRCPTR index_name, CONST INDEXHEADER &stamp)
+{
+	DAssert(index_name);
 
-	LANGID lang = DLoc2Lang(GetLocale());
+	if (m_Header)
+		return FALSE;
 
-	INT start = entry & (m_HashNum - 1);
-	INT index = start;
+	if (!m_MapFile.Open(index_name))
+		return FALSE;
 
-	HASHENTRY *best = NULL;
+	UINT file_size = m_MapFile.GetSize();
+	CONST INDEXHEADER *header = (CONST INDEXHEADER *)m_MapFile.GetData(0U, sizeof(INDEXHEADER));
 
-	// 循环查找
-	do {
+	// 档案的路径、大小、修改时间和表的大小都一致时索引文件才有效
+	if (!header || header->identifier != stamp.identifier || header->version != stamp.version
+		|| header->archive_time != stamp.archive_time || header->archive_size != stamp.archive_size
+		|| header->path_hash != stamp.path_hash || header->hash_num != stamp.hash_num
+		|| header->block_num != stamp.block_num || header->reserved) {
+		Clear();
+		return FALSE;
+	}
 
-		HASHENTRY *hash = m_HashTable + index;
-		index = ++entry & (m_HashNum - 1);
+	// 用64位计算，损坏的文件头不会导致溢出
+	QWORD size = sizeof(INDEXHEADER);
+	size += (QWORD)header->hash_num * sizeof(HASHENTRY);
+	size += (QWORD)header->block_num * (sizeof(BLOCKENTRY) + sizeof(DWORD));
+	size += (QWORD)header->table_size * sizeof(DWORD);
+	size += (QWORD)header->name_num * sizeof(DWORD);
+	size += header->name_size;
 
-		if (hash->block_index == HASH_ENTRY_EMPTY)
-			break;
-		if (hash->block_index == HASH_ENTRY_INVALID)
-			continue;
-		if (hash->hash_low != hash_low || hash_high != hash_high)
-			continue;
+	if (size != file_size) {
+		Clear();
+		return FALSE;
+	}
 
-		if (hash->language != lang && hash->language != LANG_NEUTRAL)
-			continue;
-		if (hash->platform != SUPPORT_PLATFORM)
-			continue;
+	BUFCPTR data = (BUFCPTR)(header + 1);
+
+	m_HashTable = (CONST HASHENTRY *)data;
+	data += header->hash_num * sizeof(HASHENTRY);
+	m_BlockTable = (CONST BLOCKENTRY *)data;
+	data += header->block_num * sizeof(BLOCKENTRY);
+	m_TablePos = (CONST DWORD *)data;
+	data += header->block_num * sizeof(DWORD);
+	m_OffTable = (CONST DWORD *)data;
+	data += header->table_size * sizeof(DWORD);
+	m_NamePos = (CONST DWORD *)data;
+	data += header->name_num * sizeof(DWORD);
+	m_NameData = (STRCPTR)data;
+
+	// 文件名必须以0结尾，否则读取时可能越界
+	if (header->name_size && m_NameData[header->name_size - 1]) {
+		Clear();
+		return FALSE;
+	}
 
-		if (hash->language == lang && hash->platform == SUPPORT_PLATFORM)
-			return hash;
+	m_Header = header;
+	return TRUE;
+}
 
-		best = hash;
+VOID DMpq::DIndexCache::Clear(VOID)
+{
+	m_Header = NULL;
+	m_HashTable = NULL;
+	m_BlockTable = NULL;
+	m_TablePos = NULL;
+	m_OffTable = NULL;
+	m_NamePos = NULL;
+	m_NameData = NULL;
 
-	} while (index != start);
+	m_MapFile.Close();
+}
 
-	// 已经到达末尾
-	return best;
+CONST DMpq::HASHENTRY *DMpq::DIndexCache::GetHashTable(VOID) CONST
+{
+	return m_HashTable;
 }
 
-DMpq::HASHENTRY *DMpq::AllocHash(STRCPTR file_name)
+CONST DMpq::BLOCKENTRY *DMpq::DIndexCache::GetBlockTable(VOID) CONST
 {
-	DAssert(file_name && *file_name);
-	DAssert(m_HashNum && m_HashTable);
+	return m_BlockTable;
+}
 
-	// 根据散列值计算文件的起始入口
-	DWORD entry = HashString(file_name, HASH_TABLE_ENTRY);
+CONST DWORD *DMpq::DIndexCache::GetOffTable(UINT block_idx, UINT sector_num) CONST
+{
+	if (!m_Header || block_idx >= m_Header->block_num)
+		return NULL;
 
-	// 计算散列值，用以比较散列表入口冲突
-	DWORD hash_low = HashString(file_name, HASH_NAME_LOW);
-	DWORD hash_high = HashString(file_name, HASH_NAME_HIGH);
+	DWORD pos = m_TablePos[block_idx];
+	if (pos == NULL_TABLE)
+		return NULL;
 
-	LANGID lang = DLoc2Lang(GetLocale());
+	if (pos > m_Header->table_size || sector_num >= m_Header->table_size - pos)
+		return NULL;
 
-	INT start = entry & (m_HashNum - 1);
-	INT index = start;
+	return m_OffTable + pos;
+}
 
-	// 循环查找
-	do {
+BOOL DMpq::DIndexCache::GetNames(DNameList &names) CONST
+{
+	if (!m_Header || !m_Header->name_num)
+		return FALSE;
 
-		HASHENTRY *hash = m_HashTable + index;
-		index = ++entry & (m_HashNum - 1);
+	names.clear();
+	names.reserve(m_Header->name_num);
 
-		if (hash->block_index == HASH_ENTRY_EMPTY) {
-			hash->hash_low = hash_low;
-			hash->hash_high = hash_high;
-			hash->language = lang;
-			hash->platform = SUPPORT_PLATFORM;
-			return hash;
+	for (UINT i = 0U; i < m_Header->name_num; i++) {
+		DWORD pos = m_NamePos[i];
+		if (pos >= m_Header->name_size) {
+			names.clear();
+			return FALSE;
 		}
+		names.push_back(m_NameData + pos);
+	}
 
-		if (hash->hash_low != hash_low || hash_high != hash_high)
-			continue;
-		if (hash->language != lang || hash->platform != SUPPORT_PLATFORM)
-			continue;
+	return TRUE;
+}
 
-		// 文件已存在
-		return NULL;
+/************************************************************************/
 
-	} while (index != start);
+DMpq::DFreeSpace::DFreeSpace() :
+	m_End(0U),
+	m_FreeSize(0U)
+{
 
+}
 
-	// 已经到达末尾
-	return NULL;
+DMpq::DFreeSpace::~DFreeSpace()
+{
+	Clear();
 }
 
-UINT DMpq::AllocBlock(UINT file_size, BOOL compress, BOOL encrypt, BLOCKENTRY &block)
+VOID DMpq::DFreeSpace::Build(CONST DBlockTable &blocks, UINT start)
 {
-	// TODO: 如果有已被删除的块，可以回收利用
-	// 难点在于合并几个相邻的小块来凑空间
-	// 以及如果最后一个块是被删除了话的则再小也够，但优先用前面的删除块
+	Clear();
 
-	block.data_size = 0UL;
-	block.file_size = file_size;
-	block.flags = BLOCK_EXIST | BLOCK_FIX_KEY;
-	block.offset = GetEndOfFileData();
+	DExtentList extents;
+	for (UINT i = 0U; i < blocks.size(); i++) {
+		CONST BLOCKENTRY &block = blocks[i];
+		if ((block.flags & BLOCK_EXIST) && block.data_size)
+			extents.push_back(DExtent(block.offset, block.offset + block.data_size));
+	}
 
-	if (compress)
-		block.flags |= BLOCK_COMPRESS;
+	std::sort(extents.begin(), extents.end());
 
-	if (encrypt)
-		block.flags |= BLOCK_ENCRYPT;
+	// 存在的块之间的空隙都是空闲区
+	UINT pos = start;
+	for (UINT i = 0U; i < extents.size(); i++) {
+		if (extents[i].first > pos)
+			Insert(pos, extents[i].first - pos);
+		pos = DMax(pos, extents[i].second);
+	}
 
-	return m_BlockTable.size();
+	m_End = pos;
 }
 
-UINT DMpq::GetEndOfFileData(VOID)
+VOID DMpq::DFreeSpace::Clear(VOID)
 {
-	// 寻找文件数据的末尾
-	UINT offset = sizeof(HEADER);
-	for (UINT i = 0U; i < m_BlockTable.size(); i++) {
-		if (!(m_BlockTable[i].flags & BLOCK_EXIST))
-			continue;
-		UINT end_pos = m_BlockTable[i].offset + m_BlockTable[i].data_size;
-		if (offset < end_pos)
-			offset = end_pos;
-	}
-
-	return offset;
+	m_OffsetMap.clear();
+	m_SizeMap.clear();
+	m_End = 0U;
+	m_FreeSize = 0U;
 }
 
-DWORD DMpq::CalcFileKey(STRCPTR path_name, CONST BLOCKENTRY &block)
+UINT DMpq::DFreeSpace::Alloc(UINT size)
 {
-	DAssert(path_name && (block.flags & BLOCK_EXIST));
+	if (!size)
+		return m_End;
 
-	// 从路径中找出文件名部分
-	STRCPTR name = DStrRChr(path_name, '\\');
-	name = name ? ++name : path_name;
+	// 选用足够大的空闲区中最小的一个
+	DSizeMap::iterator it = m_SizeMap.lower_bound(size);
+	if (it == m_SizeMap.end())
+		return Append(size);
 
-	// 计算文件名的散列值，得到基础密钥
-	DWORD key = HashString(name, HASH_FILE_KEY);
+	UINT offset = it->second;
+	UINT free_size = it->first;
 
-	// 必要时用偏移调整密钥
-	if (block.flags & BLOCK_FIX_KEY)
-		key = (key + block.offset) ^ block.file_size;
+	Erase(m_OffsetMap.find(offset));
 
-	return key;
+	// 剩余的部分仍然空闲
+	if (free_size > size)
+		Insert(offset + size, free_size - size);
+
+	return offset;
 }
 
-DWORD DMpq::HashString(STRCPTR str, INT hash_type)
+UINT DMpq::DFreeSpace::Append(UINT size)
 {
-	INT ch;
-	DWORD seed1, seed2;
+	UINT offset = m_End;
+	m_End += size;
+	return offset;
+}
 
-	DAssert(str && DBetween(hash_type, 0, HASH_TYPE_NUM));
+VOID DMpq::DFreeSpace::Free(UINT offset, UINT size)
+{
+	if (!size)
+		return;
 
-	seed1 = 0x7fed7fedUL;
-	seed2 = 0xeeeeeeeeUL;
+	DAssert(offset + size <= m_End);
 
-	while (*str) {
+	// 与前后相邻的空闲区合并
+	DOffsetMap::iterator next = m_OffsetMap.lower_bound(offset);
 
-		ch = DToUpper(*str++);
+	if (next != m_OffsetMap.begin()) {
+		DOffsetMap::iterator prev = next;
+		--prev;
+		if (prev->first + prev->second == offset) {
+			offset = prev->first;
+			size += prev->second;
+			Erase(prev);
+		}
+	}
 
-		seed1 = s_HashTable[hash_type][ch] ^ (seed1 + seed2);
-		seed2 = ch + seed1 + seed2 + (seed2 << 5) + 3;
+	if (next != m_OffsetMap.end() && offset + size == next->first) {
+		size += next->second;
+		Erase(next);
 	}
 
-	return seed1;
+	// 末尾的空闲区直接并入文件数据之后
+	if (offset + size == m_End)
+		m_End = offset;
+	else
+		Insert(offset, size);
 }
 
-VOID DMpq::EncryptData(VPTR buf, UINT size, DWORD key)
+VOID DMpq::DFreeSpace::Reserve(UINT offset, UINT size)
 {
-	DAssert(buf && size);
+	if (!size)
+		return;
 
-	DWORD seed = 0xeeeeeeeeUL;
-	DWORD *cur = static_cast<DWORD *>(buf);
+	UINT end = offset + size;
 
-	for (size /= sizeof(DWORD); size > 0; size--, cur++) {
+	// 去掉与之重叠的空闲区，两端剩余的部分仍然空闲
+	DOffsetMap::iterator it = m_OffsetMap.lower_bound(offset);
+	if (it != m_OffsetMap.begin()) {
+		DOffsetMap::iterator prev = it;
+		--prev;
+		if (prev->first + prev->second > offset)
+			it = prev;
+	}
 
-		seed += s_HashTable[CRYPT_TABLE_INDEX][key & 0xff];
-		DWORD val = *cur;
-		*cur ^= key + seed;
+	while (it != m_OffsetMap.end() && it->first < end) {
+		UINT free_offset = it->first;
+		UINT free_end = it->first + it->second;
+		Erase(it++);
+		if (free_offset < offset)
+			Insert(free_offset, offset - free_offset);
+		if (free_end > end)
+			Insert(end, free_end - end);
+	}
 
-		key = ((~key << 21) + 0x11111111) | (key >> 11);
-		seed = val + seed + (seed << 5) + 3;
+	// 超出末尾时末尾之后的空隙也是空闲的
+	if (end > m_End) {
+		if (offset > m_End)
+			Insert(m_End, offset - m_End);
+		m_End = end;
 	}
 }
 
-VOID DMpq::DecryptData(VPTR buf, UINT size, DWORD key)
+UINT DMpq::DFreeSpace::GetEnd(VOID) CONST
 {
-	DAssert(buf && size);
+	return m_End;
+}
 
-	DWORD seed = 0xeeeeeeeeUL;
-	DWORD *cur = static_cast<DWORD *>(buf);
+UINT DMpq::DFreeSpace::GetFreeSize(VOID) CONST
+{
+	return m_FreeSize;
+}
 
-	for (size /= sizeof(DWORD); size > 0; size--, cur++) {
+VOID DMpq::DFreeSpace::Insert(UINT offset, UINT size)
+{
+	DAssert(size);
 
-		seed += s_HashTable[CRYPT_TABLE_INDEX][key & 0xff];
-		*cur ^= key + seed;
+	m_OffsetMap[offset] = size;
+	m_SizeMap.insert(DSizeMap::value_type(size, offset));
+	m_FreeSize += size;
+}
 
-		key = ((~key << 21) + 0x11111111) | (key >> 11);
-		seed = *cur + seed + (seed << 5) + 3;
+VOID DMpq::DFreeSpace::Erase(DOffsetMap::iterator it)
+{
+	DAssert(it != m_OffsetMap.end());
+
+	std::pair<DSizeMap::iterator, DSizeMap::iterator> range = m_SizeMap.equal_range(it->second);
+	for (DSizeMap::iterator i = range.first; i != range.second; ++i) {
+		if (i->second == it->first) {
+			m_SizeMap.erase(i);
+			break;
+		}
 	}
+
+	m_FreeSize -= it->second;
+	m_OffsetMap.erase(it);
 }
 
 /************************************************************************/
 
 DMpq::DAccess::DAccess() :
+	m_MapPos(0U),
 	m_ReadAccess(FALSE),
 	m_WriteAccess(FALSE),
+	m_Dirty(FALSE),
+	m_Concurrent(FALSE),
 	m_ArchiveOff(0U),
 	m_SectorShift(0U),
 	m_SectorBuffer(NULL)
@@ -936,6 +4087,16 @@ BOOL DMpq::DAccess::Writable(VOID) CONST
 	return m_WriteAccess;
 }
 
+BOOL DMpq::DAccess::Mapped(VOID) CONST
+{
+	return m_MapFile.IsOpen();
+}
+
+BOOL DMpq::DAccess::Concurrent(VOID) CONST
+{
+	return m_Concurrent;
+}
+
 UINT DMpq::DAccess::SectorShift(VOID) CONST
 {
 	return m_SectorShift;
@@ -946,63 +4107,148 @@ BOOL DMpq::DAccess::Create(STRCPTR mpq_name)
 	if (!mpq_name)
 		return FALSE;
 
-	if (m_File.IsOpen())
+	if (m_File.IsOpen() || m_MapFile.IsOpen())
 		return FALSE;
 
-	if (!m_File.Open(mpq_name, DFile::OM_WRITE | DFile::OM_CREATE | DFile::OM_TRUNCATE))
+	// 新建的档案同样可以读取
+	if (!m_File.Open(mpq_name, DFile::OM_READWRITE | DFile::OM_CREATE | DFile::OM_TRUNCATE))
 		return FALSE;
 
-	m_ReadAccess = FALSE;
+	m_ReadAccess = TRUE;
 	m_WriteAccess = TRUE;
 	m_ArchiveOff = 0U;
 	m_SectorShift = SUPPORT_SECTOR_SHIFT + PHYSICAL_SECTOR_SHIFT;
 
+	if (!m_Cache.Create(m_SectorShift, DEFAULT_CACHE_SIZE)) {
+		Clear();
+		return FALSE;
+	}
+
 	return TRUE;
 }
 
-BOOL DMpq::DAccess::Open(STRCPTR mpq_name)
+BOOL DMpq::DAccess::Open(STRCPTR mpq_name, UINT flags)
 {
 	if (!mpq_name)
 		return FALSE;
 
-	if (m_File.IsOpen())
+	if (m_File.IsOpen() || m_MapFile.IsOpen())
+		return FALSE;
+
+	// 写入时不能映射文件
+	if (flags & OF_WRITE) {
+		if (!m_File.Open(mpq_name, DFile::OM_READWRITE))
+			return FALSE;
+	} else if (flags & OF_MAP_FILE) {
+		if (!m_MapFile.Open(mpq_name))
+			return FALSE;
+	} else {
+		if (!m_File.Open(mpq_name))
+			return FALSE;
+	}
+
+	if (!Load()) {
+		Clear();
+		return FALSE;
+	}
+
+	m_WriteAccess = DBoolean(flags & OF_WRITE);
+	m_Concurrent = DBoolean(flags & OF_CONCURRENT);
+
+	return TRUE;
+}
+
+BOOL DMpq::DAccess::Close(VOID)
+{
+	if (!m_File.IsOpen() && !m_MapFile.IsOpen())
+		return FALSE;
+
+	Clear();
+	return TRUE;
+}
+
+BOOL DMpq::DAccess::Read(VPTR buf, UINT size)
+{
+	if (!buf || !size)
+		return FALSE;
+
+	if (m_MapFile.IsOpen()) {
+		if (!m_ReadAccess)
+			return FALSE;
+		BUFCPTR data = m_MapFile.GetData(m_MapPos, size);
+		if (!data)
+			return FALSE;
+		DMemCpy(buf, data, size);
+		m_MapPos += size;
+		return TRUE;
+	}
+
+	if (!m_File.IsOpen() || !m_ReadAccess)
+		return FALSE;
+
+	if (m_File.Read(buf, size) != size)
+		return FALSE;
+
+	return TRUE;
+}
+
+BOOL DMpq::DAccess::Write(VCPTR buf, UINT size)
+{
+	if (!buf || !size)
 		return FALSE;
 
-	if (!m_File.Open(mpq_name))
+	if (!m_File.IsOpen() || !m_WriteAccess)
 		return FALSE;
 
-	if (!Load()) {
-		Clear();
+	m_Dirty = TRUE;
+
+	if (m_File.Write(buf, size) != size)
 		return FALSE;
-	}
 
 	return TRUE;
 }
 
-BOOL DMpq::DAccess::Close(VOID)
+BOOL DMpq::DAccess::Seek(UINT pos)
 {
-	if (!m_File.IsOpen())
+	if (m_MapFile.IsOpen()) {
+		if (!m_ReadAccess || m_ArchiveOff + pos > m_MapFile.GetSize())
+			return FALSE;
+		m_MapPos = m_ArchiveOff + pos;
+		return TRUE;
+	}
+
+	if (!m_File.IsOpen() || (!m_WriteAccess && !m_ReadAccess))
+		return FALSE;
+
+	if (m_File.Seek(m_ArchiveOff + pos) == ERROR_POS)
 		return FALSE;
 
-	Clear();
 	return TRUE;
 }
 
-BOOL DMpq::DAccess::Read(VPTR buf, UINT size)
+BOOL DMpq::DAccess::ReadAt(UINT pos, VPTR buf, UINT size) CONST
 {
 	if (!buf || !size)
 		return FALSE;
 
-	if (!m_File.IsOpen() || !m_ReadAccess)
+	if (!m_ReadAccess)
 		return FALSE;
 
-	if (m_File.Read(buf, size) != size)
+	if (m_MapFile.IsOpen()) {
+		BUFCPTR data = m_MapFile.GetData(m_ArchiveOff + pos, size);
+		if (!data)
+			return FALSE;
+		DMemCpy(buf, data, size);
+		return TRUE;
+	}
+
+	if (m_File.ReadAt(m_ArchiveOff + pos, buf, size) != size)
 		return FALSE;
 
 	return TRUE;
 }
 
-BOOL DMpq::DAccess::Write(VCPTR buf, UINT size)
+BOOL DMpq::DAccess::ReadBack(UINT pos, VPTR buf, UINT size)
 {
 	if (!buf || !size)
 		return FALSE;
@@ -1010,37 +4256,69 @@ BOOL DMpq::DAccess::Write(VCPTR buf, UINT size)
 	if (!m_File.IsOpen() || !m_WriteAccess)
 		return FALSE;
 
-	if (m_File.Write(buf, size) != size)
+	// 通过同一个文件对象读取，不必先把缓冲中的数据写入磁盘
+	if (m_File.Seek(m_ArchiveOff + pos) == ERROR_POS)
+		return FALSE;
+
+	if (m_File.Read(buf, size) != size)
 		return FALSE;
 
 	return TRUE;
 }
 
-BOOL DMpq::DAccess::Seek(UINT pos)
+BUFCPTR DMpq::DAccess::Map(UINT pos, UINT size) CONST
 {
-	if (!m_File.IsOpen() || !m_WriteAccess && !m_ReadAccess)
-		return FALSE;
+	if (!m_MapFile.IsOpen() || !m_ReadAccess)
+		return NULL;
 
-	if (m_File.Seek(m_ArchiveOff + pos) == ERROR_POS)
+	return m_MapFile.GetData(m_ArchiveOff + pos, size);
+}
+
+BOOL DMpq::DAccess::Flush(VOID)
+{
+	if (!m_File.IsOpen() || !m_WriteAccess)
 		return FALSE;
 
+	// 写入磁盘失败时保留修改标记，调用者不能继续写入依赖这些数据的文件头
+	if (m_Dirty) {
+		if (!m_File.Flush())
+			return FALSE;
+		m_Dirty = FALSE;
+	}
+
 	return TRUE;
 }
 
-HANDLE DMpq::DAccess::ShareHandle(VOID)
+BOOL DMpq::DAccess::SetSize(UINT size)
 {
-	if (!m_File.IsOpen())
-		return NULL;
+	if (!m_File.IsOpen() || !m_WriteAccess)
+		return FALSE;
+
+	return m_File.SetSize(m_ArchiveOff + size);
+}
 
-	UINT pos = m_File.Position();
-	if (pos == ERROR_POS)
+HANDLE DMpq::DAccess::ShareHandle(UINT pos)
+{
+	STRCPTR name;
+
+	// 直接使用给定的位置，不依赖共享的文件位置，按位置读取在Windows下也会移动它
+	if (m_MapFile.IsOpen()) {
+		if (!m_ReadAccess || m_ArchiveOff + pos > m_MapFile.GetSize())
+			return NULL;
+		name = m_MapFile.GetName();
+	} else if (m_File.IsOpen()) {
+		if (m_WriteAccess && !Flush())
+			return NULL;
+		name = m_File.GetName();
+	} else {
 		return NULL;
+	}
 
 	DFile file;
-	if (!file.Open(m_File.GetName()))
+	if (!file.Open(name))
 		return NULL;
 
-	if (file.Seek(pos) == ERROR_POS)
+	if (file.Seek(m_ArchiveOff + pos) == ERROR_POS)
 		return NULL;
 
 	return file.Detach();
@@ -1069,34 +4347,51 @@ VOID DMpq::DAccess::SetBuffer(UINT block_idx, DFileBuffer *buf)
 	}
 }
 
+VOID DMpq::DAccess::FreeBuffer(UINT block_idx)
+{
+	DBufferMap::iterator it = m_BufferMap.find(block_idx);
+
+	if (it != m_BufferMap.end()) {
+		delete it->second;
+		m_BufferMap.erase(it);
+	}
+
+	// 块被删除或重新使用，之前缓存的扇区都已失效
+	m_Cache.Invalidate(block_idx);
+}
+
+VOID DMpq::DAccess::FreeBuffers(VOID)
+{
+	for (DBufferMap::iterator it = m_BufferMap.begin(); it != m_BufferMap.end(); ++it)
+		delete it->second;
+	m_BufferMap.clear();
+
+	m_Cache.Invalidate();
+}
+
 /************************************************************************/
 
 BOOL DMpq::DAccess::Load(VOID)
 {
-	DAssert(m_File.IsOpen());
+	DAssert(m_File.IsOpen() || m_MapFile.IsOpen());
 
 	BOOL found = FALSE;
 	UINT arc_offset = 0U;
 	HEADER header;
 
 	// SC仅要求MPQ头大小不小于32字节即可
-	while (m_File.Read(&header, SUPPORT_HEADER_SIZE) == SUPPORT_HEADER_SIZE) {
+	while (Fetch(arc_offset, &header, SUPPORT_HEADER_SIZE)) {
 		if (header.identifier == MPQ_IDENTIFIER && header.header_size >= SUPPORT_HEADER_SIZE) {
 			found = TRUE;
 			break;
 		}
 		arc_offset += PHYSICAL_SECTOR_SIZE;
-		if (m_File.Seek(arc_offset) == ERROR_POS)
-			return FALSE;
 	}
 
 	if (!found)
 		return FALSE;
 
-	if (m_File.Seek(arc_offset) == ERROR_POS)
-		return FALSE;
-
-	UINT size = m_File.GetSize();
+	UINT size = m_MapFile.IsOpen() ? m_MapFile.GetSize() : m_File.GetSize();
 	if (size == ERROR_SIZE)
 		return FALSE;
 
@@ -1108,7 +4403,10 @@ BOOL DMpq::DAccess::Load(VOID)
 	m_ReadAccess = TRUE;
 	m_WriteAccess = FALSE;
 
-	return TRUE;
+	if (!m_Cache.Create(m_SectorShift, DEFAULT_CACHE_SIZE))
+		return FALSE;
+
+	return Seek(0U);
 }
 
 VOID DMpq::DAccess::Clear(VOID)
@@ -1117,8 +4415,13 @@ VOID DMpq::DAccess::Clear(VOID)
 		delete it->second;
 	m_BufferMap.clear();
 
+	m_Cache.Clear();
+	m_Index.Clear();
+
 	m_ReadAccess = FALSE;
 	m_WriteAccess = FALSE;
+	m_Dirty = FALSE;
+	m_Concurrent = FALSE;
 	m_ArchiveOff = 0U;
 	m_SectorShift = 0U;
 
@@ -1126,6 +4429,26 @@ VOID DMpq::DAccess::Clear(VOID)
 	m_SectorBuffer = NULL;
 
 	m_File.Close();
+	m_MapFile.Close();
+	m_MapPos = 0U;
+}
+
+BOOL DMpq::DAccess::Fetch(UINT offset, VPTR buf, UINT size)
+{
+	DAssert(buf && size);
+
+	if (m_MapFile.IsOpen()) {
+		BUFCPTR data = m_MapFile.GetData(offset, size);
+		if (!data)
+			return FALSE;
+		DMemCpy(buf, data, size);
+		return TRUE;
+	}
+
+	if (m_File.ReadAt(offset, buf, size) != size)
+		return FALSE;
+
+	return TRUE;
 }
 
 BUFPTR DMpq::DAccess::SectorBuffer(VOID)
@@ -1139,11 +4462,35 @@ BUFPTR DMpq::DAccess::SectorBuffer(VOID)
 	return m_SectorBuffer;
 }
 
+DMpq::DSectorCache *DMpq::DAccess::GetCache(VOID)
+{
+	return &m_Cache;
+}
+
+BOOL DMpq::DAccess::LoadIndex(STRCPTR index_name, CONST INDEXHEADER &stamp)
+{
+	if (!m_ReadAccess)
+		return FALSE;
+
+	m_Index.Clear();
+
+	return m_Index.Load(index_name, stamp);
+}
+
+CONST DMpq::DIndexCache *DMpq::DAccess::GetIndex(VOID) CONST
+{
+	if (!m_Index.IsLoaded())
+		return NULL;
+
+	return &m_Index;
+}
+
 /************************************************************************/
 
 DMpq::DSubFile::DSubFile() :
 	m_FileSize(0U),
 	m_Position(0U),
+	m_Private(FALSE),
 	m_FileBuffer(NULL)
 {
 
@@ -1151,7 +4498,8 @@ DMpq::DSubFile::DSubFile() :
 
 DMpq::DSubFile::~DSubFile()
 {
-
+	if (m_Private)
+		delete m_FileBuffer;
 }
 
 DMpq::DAccess *DMpq::DSubFile::GetAccess(VOID) CONST
@@ -1189,7 +4537,7 @@ BOOL DMpq::DSubFile::Create(DAccess *archive, UINT block_idx, CONST BLOCKENTRY &
 		return FALSE;
 
 	DFileBuffer *buf = new DFileBuffer;
-	if (!buf->Create(archive, block, key, comp)) {
+	if (!buf->Create(archive, block_idx, block, key, comp)) {
 		DAssert(FALSE);
 		delete buf;
 		return FALSE;
@@ -1213,12 +4561,34 @@ BOOL DMpq::DSubFile::Open(DAccess *archive, UINT block_idx, CONST BLOCKENTRY &bl
 	if (m_FileBuffer)
 		return FALSE;
 
+	// 可写的档案中刚写入的数据可能还在缓冲中
+	if (archive->Writable() && !archive->Flush())
+		return FALSE;
+
+	// 并发模式下每个句柄使用独立的缓冲，以免多个线程同时修改扇区缓存
+	// 可写的档案中块表项会被重新使用，句柄也要使用独立的缓冲
+	if (archive->Concurrent() || archive->Writable()) {
+
+		DFileBuffer *buf = new DFileBuffer;
+		if (!buf->Open(archive, block_idx, block, key)) {
+			delete buf;
+			return FALSE;
+		}
+
+		m_FileBuffer = buf;
+		m_Private = TRUE;
+		m_FileSize = block.file_size;
+		m_Position = 0U;
+
+		return TRUE;
+	}
+
 	m_FileBuffer = archive->GetBuffer(block_idx);
 
 	if (!m_FileBuffer) {
 
 		DFileBuffer *buf = new DFileBuffer;
-		if (!buf->Open(archive, block, key)) {
+		if (!buf->Open(archive, block_idx, block, key)) {
 			DAssert(FALSE);
 			delete buf;
 			return FALSE;
@@ -1239,7 +4609,11 @@ BOOL DMpq::DSubFile::Close(VOID)
 	if (!m_FileBuffer)
 		return FALSE;
 
+	if (m_Private)
+		delete m_FileBuffer;
+
 	m_FileBuffer = NULL;
+	m_Private = FALSE;
 	m_FileSize = 0U;
 	m_Position = 0U;
 
@@ -1278,19 +4652,22 @@ UINT DMpq::DSubFile::Read(VPTR buf, UINT size)
 	for (UINT i = sector_beg; i <= sector_end; i++) {
 
 		UINT data_size;
-		BUFCPTR sector_data = m_FileBuffer->GetSector(i, data_size);
+		CACHEENTRY *entry;
+		BUFCPTR sector_data = m_FileBuffer->GetSector(i, data_size, entry);
 		if (!sector_data)
 			break;
 
 		UINT sector_pos = m_Position + rd_size - sector_offset;
 		if (sector_pos + size < data_size) {
 			DMemCpy(data, sector_data + sector_pos, size);
+			m_FileBuffer->PutSector(entry);
 			rd_size += size;
 			break;
 		}
 
 		UINT copy_size = data_size - sector_pos;
 		DMemCpy(data, sector_data + sector_pos, copy_size);
+		m_FileBuffer->PutSector(entry);
 		sector_offset += data_size;
 		size -= copy_size;
 		rd_size += copy_size;
@@ -1301,37 +4678,35 @@ UINT DMpq::DSubFile::Read(VPTR buf, UINT size)
 	return rd_size;
 }
 
-UINT DMpq::DSubFile::Write(VCPTR data, UINT size)
+UINT DMpq::DSubFile::ReadAll(VPTR buf, UINT size)
 {
-	if (!data || !size || !m_FileBuffer)
+	if (!buf || !m_FileBuffer)
 		return 0U;
 
-	if (!GetAccess()->Writable())
+	if (!GetAccess()->Readable())
 		return 0U;
 
-	UINT sector_shift = m_FileBuffer->SectorShift();
+	// 缓冲区必须能容纳整个文件
+	if (size < m_FileSize)
+		return 0U;
 
-	// TODO: 目前因为没有写缓冲，所以必须写在sector边界上
-	DAssert(!(m_Position & ((1 << sector_shift) - 1)));
+	if (!m_FileBuffer->ReadAll(static_cast<BUFPTR>(buf), GetWorkerNum()))
+		return 0U;
 
-	UINT sector_beg = m_Position >> sector_shift;
-	UINT sector_end = (m_Position + size - 1) >> sector_shift;
+	m_Position = m_FileSize;
+	return m_FileSize;
+}
 
-	// Overflow
-	if (sector_end < sector_beg)
-		sector_end = (m_FileSize - 1) >> sector_shift;
+UINT DMpq::DSubFile::Write(VCPTR data, UINT size)
+{
+	if (!data || !size || !m_FileBuffer)
+		return 0U;
 
-	UINT wrt_size = 0U;
-	BUFCPTR sector_data = static_cast<BUFCPTR>(data);
+	if (!GetAccess()->Writable())
+		return 0U;
 
-	for (UINT i = sector_beg; i <= sector_end; i++) {
-		UINT data_size;
-		if (!m_FileBuffer->SetSector(i, sector_data, size, data_size))
-			break;
-		sector_data += data_size;
-		size -= data_size;
-		wrt_size += data_size;
-	}
+	// 数据先积累在写缓冲中，凑满一批扇区后在后台压缩，因此只能从当前位置顺序写入
+	UINT wrt_size = m_FileBuffer->Write(m_Position, static_cast<BUFCPTR>(data), size);
 
 	m_Position += wrt_size;
 	return wrt_size;
@@ -1367,17 +4742,176 @@ UINT DMpq::DSubFile::Seek(INT offset, SEEK_MODE mode)
 
 /************************************************************************/
 
+class DMpq::DFileBuffer::DReadWork : public DWork {
+
+public:
+
+	DReadWork(DFileBuffer *file_buf, UINT batch, BUFCPTR src, BUFPTR dest) :
+		m_FileBuffer(file_buf),
+		m_Batch(batch),
+		m_Src(src),
+		m_Dest(dest)
+	{
+
+	}
+
+	virtual BOOL Process(UINT index, UINT /* worker */)
+	{
+		// 各线程的临时缓冲都在编解码上下文中，稳定之后读取扇区不再分配内存
+		CODEC_CONTEXT *ctx = alloc_codec_context();
+		if (!ctx)
+			return FALSE;
+
+		BOOL ret = m_FileBuffer->ReadSectors(index * m_Batch, m_Batch, m_Src, m_Dest, ctx);
+		free_codec_context(ctx);
+
+		return ret;
+	}
+
+protected:
+
+	DFileBuffer	*m_FileBuffer;
+	UINT		m_Batch;
+	BUFCPTR		m_Src;
+	BUFPTR		m_Dest;
+
+};
+
+/************************************************************************/
+
+class DMpq::DFileBuffer::DPackWork : public DWork {
+
+public:
+
+	explicit DPackWork(DFileBuffer *file_buf) :
+		m_FileBuffer(file_buf),
+		m_Src(NULL),
+		m_Dest(NULL),
+		m_First(0U),
+		m_SectorNum(0U),
+		m_Size(0U),
+		m_PackSize(0U)
+	{
+		DMemClr(m_DataSize, sizeof(m_DataSize));
+	}
+
+	VOID Setup(UINT first, BUFCPTR src, UINT size, BUFPTR dest)
+	{
+		DAssert(src && size && dest);
+
+		UINT sector_shift = m_FileBuffer->SectorShift();
+
+		m_Src = src;
+		m_Dest = dest;
+		m_First = first;
+		m_SectorNum = (size + (1 << sector_shift) - 1) >> sector_shift;
+		m_Size = size;
+		m_PackSize = 0U;
+
+		DAssert(m_SectorNum <= WRITE_BATCH_NUM);
+	}
+
+	VOID Reset(VOID)
+	{
+		m_SectorNum = 0U;
+		m_PackSize = 0U;
+	}
+
+	// 各扇区压缩后的数据先放在输出缓冲中各自的位置，全部完成后再连接起来
+	VOID Join(VOID)
+	{
+		UINT sector_shift = m_FileBuffer->SectorShift();
+
+		m_PackSize = 0U;
+		for (UINT i = 0U; i < m_SectorNum; i++) {
+			if (m_PackSize != (i << sector_shift))
+				DMemMov(m_Dest + m_PackSize, m_Dest + (i << sector_shift), m_DataSize[i]);
+			m_PackSize += m_DataSize[i];
+		}
+	}
+
+	UINT GetFirst(VOID) CONST
+	{
+		return m_First;
+	}
+
+	UINT GetSectorNum(VOID) CONST
+	{
+		return m_SectorNum;
+	}
+
+	UINT GetDataSize(UINT index) CONST
+	{
+		DAssert(index < m_SectorNum);
+		return m_DataSize[index];
+	}
+
+	UINT GetPackSize(VOID) CONST
+	{
+		return m_PackSize;
+	}
+
+	virtual BOOL Process(UINT index, UINT /* worker */)
+	{
+		DAssert(index < m_SectorNum);
+
+		CONST BLOCKENTRY &block = m_FileBuffer->m_Block;
+		UINT sector_shift = m_FileBuffer->SectorShift();
+		UINT offset = index << sector_shift;
+		UINT sector = m_First + index;
+		UINT size = DMin(m_Size - offset, 1U << sector_shift);
+		UINT data_size = 1 << sector_shift;
+		BUFCPTR src = m_Src + offset;
+		BUFPTR dest = m_Dest + offset;
+
+		// 各线程使用各自的编解码上下文
+		CODEC_CONTEXT *ctx = alloc_codec_context();
+
+		// 压缩后没有变小的扇区和未压缩的文件都按原样存放
+		if (!(block.flags & BLOCK_COMP_MASK) || !ctx || !PackSector(block, m_FileBuffer->m_Compression, sector, src, size, dest, data_size, ctx)) {
+			DMemCpy(dest, src, size);
+			data_size = size;
+		}
+
+		free_codec_context(ctx);
+
+		if (block.flags & BLOCK_ENCRYPT)
+			EncryptData(dest, data_size, m_FileBuffer->m_Key + sector);
+
+		m_DataSize[index] = data_size;
+		return TRUE;
+	}
+
+protected:
+
+	DFileBuffer	*m_FileBuffer;
+	BUFCPTR		m_Src;
+	BUFPTR		m_Dest;
+	UINT		m_First;
+	UINT		m_SectorNum;
+	UINT		m_Size;
+	UINT		m_PackSize;
+	UINT		m_DataSize[WRITE_BATCH_NUM];
+
+};
+
+/************************************************************************/
+
 DMpq::DFileBuffer::DFileBuffer() :
 	m_Access(NULL),
+	m_BlockIdx(0U),
 	m_SectorNum(0U),
 	m_Key(0UL),
 	m_Compression(COMP_NONE),
 	m_OffTable(NULL),
-	m_CurCache(0),
-	m_SwapBuffer(NULL)
+	m_WritePos(0U),
+	m_BatchPos(0U),
+	m_BatchIdx(0U),
+	m_BatchBuffer(NULL),
+	m_PackWork(NULL),
+	m_PackPool(NULL)
 {
 	DVarClr(m_Block);
-	DVarClr(m_Cache);
 }
 
 DMpq::DFileBuffer::~DFileBuffer()
@@ -1403,7 +4937,7 @@ UINT DMpq::DFileBuffer::SectorShift(VOID) CONST
 	return m_Access->SectorShift();
 }
 
-BOOL DMpq::DFileBuffer::Create(DAccess *archive, CONST BLOCKENTRY &block, DWORD key, BYTE comp)
+BOOL DMpq::DFileBuffer::Create(DAccess *archive, UINT block_idx, CONST BLOCKENTRY &block, DWORD key, BYTE comp)
 {
 	DAssert(archive && (block.flags & BLOCK_EXIST));
 	DAssert(archive->Writable());
@@ -1430,8 +4964,12 @@ BOOL DMpq::DFileBuffer::Create(DAccess *archive, CONST BLOCKENTRY &block, DWORD
 		m_Key = 0UL;
 	}
 
+	// 块被重写，丢弃之前缓存的扇区
+	archive->GetCache()->Invalidate(block_idx);
+
 	m_Compression = comp;
 	m_Access = archive;
+	m_BlockIdx = block_idx;
 	m_SectorNum = sector_num;
 
 	if (!Create()) {
@@ -1442,7 +4980,7 @@ BOOL DMpq::DFileBuffer::Create(DAccess *archive, CONST BLOCKENTRY &block, DWORD
 	return TRUE;
 }
 
-BOOL DMpq::DFileBuffer::Open(DAccess *archive, CONST BLOCKENTRY &block, DWORD key)
+BOOL DMpq::DFileBuffer::Open(DAccess *archive, UINT block_idx, CONST BLOCKENTRY &block, DWORD key)
 {
 	DAssert(archive && (block.flags & BLOCK_EXIST));
 	DAssert(archive->Readable());
@@ -1456,23 +4994,29 @@ BOOL DMpq::DFileBuffer::Open(DAccess *archive, CONST BLOCKENTRY &block, DWORD ke
 
 	if (sector_num && (block.flags & BLOCK_COMP_MASK)) {
 
-		if (!archive->Seek(block.offset))
-			return FALSE;
-
 		DWORD *off_table = new DWORD[sector_num + 1];
 		UINT size = (sector_num + 1) * sizeof(DWORD);
-		if (!archive->Read(off_table, size)) {
-			delete [] off_table;
-			return FALSE;
-		}
 
-		if (block.flags & BLOCK_ENCRYPT)
-			DecryptData(off_table, size, key - 1);
+		// 索引文件中的偏移表已经解密
+		CONST DIndexCache *index = archive->GetIndex();
+		CONST DWORD *cached = index ? index->GetOffTable(block_idx, sector_num) : NULL;
+
+		if (cached) {
+			DMemCpy(off_table, cached, size);
+		} else {
+			if (!archive->ReadAt(block.offset, off_table, size)) {
+				delete [] off_table;
+				return FALSE;
+			}
+			if (block.flags & BLOCK_ENCRYPT)
+				DecryptData(off_table, size, key - 1);
+		}
 
 		m_OffTable = off_table;
 	}
 
 	m_Access = archive;
+	m_BlockIdx = block_idx;
 	m_Block = block;
 	m_Key = key;
 	m_SectorNum = sector_num;
@@ -1482,121 +5026,185 @@ BOOL DMpq::DFileBuffer::Open(DAccess *archive, CONST BLOCKENTRY &block, DWORD ke
 
 VOID DMpq::DFileBuffer::Clear(VOID)
 {
-	for (INT i = 0; i < MAX_CACHE_SECTOR; i++)
-		delete [] m_Cache[i].data;
-	DVarClr(m_Cache);
+	FreeBatch();
 
-	delete [] m_SwapBuffer;
-	m_SwapBuffer = NULL;
+	m_WritePos = 0U;
+	m_BatchPos = 0U;
+	m_BatchIdx = 0U;
 
 	delete [] m_OffTable;
 	m_OffTable = NULL;
 
 	m_Access = NULL;
+	m_BlockIdx = 0U;
 	m_SectorNum = 0U;
 	m_Key = 0UL;
 	m_Compression = COMP_NONE;
-	m_CurCache = 0;
 	DVarClr(m_Block);
 }
 
-BUFCPTR DMpq::DFileBuffer::GetSector(UINT sector, UINT &size)
+BUFCPTR DMpq::DFileBuffer::GetSector(UINT sector, UINT &size, CACHEENTRY *&entry)
 {
 	DAssert(m_Access);
 
+	entry = NULL;
+
 	if (sector >= m_SectorNum)
 		return NULL;
 
-	for (INT i = 0; i < MAX_CACHE_SECTOR; i++) {
-		CACHESECTOR *cs = &m_Cache[i];
-		if (cs->data && cs->sector == sector) {
-			size = cs->size;
-			return cs->data;
-		}
+	size = SectorSize(sector);
+	DAssert(size);
+
+	// 未加密且未压缩的扇区直接返回映射内存
+	BUFCPTR map_data = MapSector(sector, size);
+	if (map_data)
+		return map_data;
+
+	// 在整个MPQ共享的扇区缓存中查找，返回的缓存项在PutSector之前不会被淘汰
+	DSectorCache *cache = m_Access->GetCache();
+
+	entry = cache->Find(m_BlockIdx, sector);
+	if (entry) {
+		DAssert(entry->size == size);
+		return entry->data;
 	}
 
-	UINT sector_size = 1 << SectorShift();
-	if (sector == m_SectorNum - 1 && (m_Block.file_size & (sector_size - 1)))
-		size = m_Block.file_size & (sector_size - 1);
-	else
-		size = sector_size;
+	// 解压使用缓存池中的编解码上下文，读取的线程之间互不影响
+	entry = cache->Alloc(m_BlockIdx, sector);
+	CODEC_CONTEXT *ctx = alloc_codec_context();
+	BOOL ret = ctx && ReadSector(sector, entry->data, size, ctx);
+	free_codec_context(ctx);
 
-	DAssert(size);
-	BUFPTR data = new BYTE[size];
-	if (!ReadSector(sector, data, size)) {
-		delete [] data;
+	if (!ret) {
+		cache->Free(entry);
+		entry = NULL;
 		return NULL;
 	}
 
-	DAssert(DBetween(m_CurCache, 0, MAX_CACHE_SECTOR));
+	entry->size = size;
+	entry = cache->Insert(entry);
 
-	CACHESECTOR *cs = &m_Cache[m_CurCache];
-	delete [] cs->data;
-	cs->sector = sector;
-	cs->size = size;
-	cs->data = data;
+	return entry->data;
+}
 
-	m_CurCache = (m_CurCache + 1) % MAX_CACHE_SECTOR;
+VOID DMpq::DFileBuffer::PutSector(CACHEENTRY *entry)
+{
+	DAssert(m_Access);
 
-	return data;
+	if (entry)
+		m_Access->GetCache()->Release(entry);
 }
 
-BOOL DMpq::DFileBuffer::SetSector(UINT sector, BUFCPTR buf, UINT buf_size, UINT &size)
+UINT DMpq::DFileBuffer::Write(UINT pos, BUFCPTR buf, UINT size)
 {
 	DAssert(m_Access);
 
-	if (sector >= m_SectorNum || !buf || !buf_size)
-		return FALSE;
+	// 只能在已写入的数据之后追加，写入失败之后m_WritePos为ERROR_POS，不再接受数据
+	if (!buf || !size || pos != m_WritePos || pos >= m_Block.file_size)
+		return 0U;
 
-	// 对于压缩文件来说，每个扇区只能写一次，并且必需按顺序写
-	if (m_OffTable && (!m_OffTable[sector] || m_OffTable[sector + 1]))
-		return FALSE;
+	if (size > m_Block.file_size - pos)
+		size = m_Block.file_size - pos;
 
-	UINT sector_size = 1 << SectorShift();
-	if (sector == m_SectorNum - 1 && (m_Block.file_size & (sector_size - 1)))
-		size = m_Block.file_size & (sector_size - 1);
-	else
-		size = sector_size;
+	UINT batch_size = WRITE_BATCH_NUM << SectorShift();
 
-	if (buf_size < size)
-		return FALSE;
+	// 两个输入缓冲轮流积累数据，另有一个输出缓冲存放压缩加密后的扇区
+	// 工作线程在整个写入过程中常驻，压缩一批的同时积累下一批的数据
+	if (!m_BatchBuffer) {
+		m_BatchBuffer = new BYTE[batch_size * 3];
+		m_PackWork = new DPackWork(this);
+		m_PackPool = new DWorkPool;
+		m_PackPool->SetWorkerNum(GetWorkerNum());
+	}
 
-	UINT data_size;
-	if (!WriteSector(sector, buf, size, data_size))
-		return FALSE;
+	BUFCPTR data = buf;
+	UINT wrt_size = 0U;
 
-	if (m_OffTable)
-		m_OffTable[sector + 1] = m_OffTable[sector] + data_size;
+	while (wrt_size < size) {
 
-	if (sector != m_SectorNum - 1)
-		return TRUE;
+		UINT offset = m_WritePos - m_BatchPos;
+		UINT copy_size = DMin(size - wrt_size, batch_size - offset);
 
-	if (!m_OffTable) {
-		m_Block.data_size = m_Block.file_size;
-		return TRUE;
+		DMemCpy(m_BatchBuffer + m_BatchIdx * batch_size + offset, data, copy_size);
+		m_WritePos += copy_size;
+		wrt_size += copy_size;
+		data += copy_size;
+
+		BOOL last = (m_WritePos == m_Block.file_size);
+		if (offset + copy_size < batch_size && !last)
+			continue;
+
+		if (!SubmitBatch(last)) {
+			FreeBatch();
+			m_WritePos = ERROR_POS;
+			return 0U;
+		}
 	}
 
-	// 写回Offset Table
-	if (!m_Access->Seek(m_Block.offset))
-		return FALSE;
+	return wrt_size;
+}
 
-	UINT tab_size = (m_SectorNum + 1) * sizeof(DWORD);
+BOOL DMpq::DFileBuffer::ReadAll(BUFPTR buf, UINT max_worker)
+{
+	DAssert(m_Access && buf);
 
-	// 必要时加密
-	if (m_Block.flags & BLOCK_ENCRYPT) {
-		DArray<DWORD> off_table(m_SectorNum + 1);
-		DMemCpy(off_table, m_OffTable, tab_size);
-		EncryptData(off_table, tab_size, m_Key - 1);
-		if (!m_Access->Write(off_table, tab_size))
+	if (!m_SectorNum)
+		return TRUE;
+
+	BUFCPTR src = NULL;
+	CODEC_CONTEXT *ctx = NULL;
+
+	if (m_Block.flags & BLOCK_COMP_MASK) {
+
+		DAssert(m_OffTable);
+
+		// 各扇区的数据是连续存放的，一次全部读入
+		UINT beg = m_OffTable[0];
+		UINT end = m_OffTable[m_SectorNum];
+		if (end <= beg)
 			return FALSE;
+
+		src = m_Access->Map(m_Block.offset + beg, end - beg);
+		if (!src) {
+			// 读入编解码上下文的缓冲，稳定之后不再为每个文件分配内存，各线程解压时使用各自的上下文
+			ctx = alloc_codec_context();
+			BUFPTR data = get_codec_buffer(ctx, SWAP_BUFFER, end - beg);
+			if (!data || !m_Access->ReadAt(m_Block.offset + beg, data, end - beg)) {
+				free_codec_context(ctx);
+				return FALSE;
+			}
+			src = data;
+		}
+
 	} else {
-		if (!m_Access->Write(m_OffTable, tab_size))
+
+		// 未压缩的文件直接读入目标缓冲，必要时再逐扇区解密
+		if (!m_Access->ReadAt(m_Block.offset, buf, m_Block.file_size))
 			return FALSE;
+
+		if (!(m_Block.flags & BLOCK_ENCRYPT))
+			return TRUE;
 	}
 
-	m_Block.data_size = m_OffTable[m_SectorNum];
+	// 扇区太少时不值得使用多个线程
+	UINT worker_num = m_SectorNum / PARALLEL_SECTOR_NUM;
+	if (worker_num > max_worker)
+		worker_num = max_worker;
+	if (!worker_num)
+		worker_num = 1U;
 
-	return TRUE;
+	// 多重压缩的文件可能含有ADPCM压缩的扇区，加密文件的各扇区密钥不同，相互独立，每次读取多个扇区以便批量处理
+	UINT batch = (m_Block.flags & (BLOCK_COMPRESS | BLOCK_ENCRYPT)) ? READ_BATCH_NUM : 1U;
+
+	DWorkPool pool;
+	pool.SetWorkerNum(worker_num);
+
+	DReadWork work(this, batch, src, buf);
+	BOOL ret = pool.Run(work, (m_SectorNum + batch - 1) / batch);
+
+	free_codec_context(ctx);
+
+	return ret;
 }
 
 BOOL DMpq::DFileBuffer::Create(VOID)
@@ -1627,16 +5235,50 @@ BOOL DMpq::DFileBuffer::Create(VOID)
 	return TRUE;
 }
 
-BOOL DMpq::DFileBuffer::ReadSector(UINT sector, BUFPTR buf, UINT size)
+UINT DMpq::DFileBuffer::SectorSize(UINT sector) CONST
+{
+	DAssert(sector < m_SectorNum);
+
+	// 只有最后一个扇区可能不满
+	UINT sector_size = 1 << SectorShift();
+	if (sector == m_SectorNum - 1 && (m_Block.file_size & (sector_size - 1)))
+		return m_Block.file_size & (sector_size - 1);
+
+	return sector_size;
+}
+
+BUFCPTR DMpq::DFileBuffer::MapSector(UINT sector, UINT size)
+{
+	DAssert(sector < m_SectorNum && size);
+
+	if (!m_Access->Mapped())
+		return NULL;
+
+	if (m_Block.flags & BLOCK_ENCRYPT)
+		return NULL;
+
+	if (!(m_Block.flags & BLOCK_COMP_MASK))
+		return m_Access->Map(m_Block.offset + (sector << SectorShift()), size);
+
+	DAssert(m_OffTable);
+
+	// 压缩文件中无法压缩的扇区是按原样存放的
+	if (m_OffTable[sector + 1] <= m_OffTable[sector])
+		return NULL;
+	if (m_OffTable[sector + 1] - m_OffTable[sector] < size)
+		return NULL;
+
+	return m_Access->Map(m_Block.offset + m_OffTable[sector], size);
+}
+
+BOOL DMpq::DFileBuffer::ReadSector(UINT sector, BUFPTR buf, UINT size, CODEC_CONTEXT *ctx)
 {
-	DAssert(sector < m_SectorNum && buf && size);
+	DAssert(sector < m_SectorNum && buf && size && ctx);
 
 	if (m_Block.flags & BLOCK_COMP_MASK) {
 
 		DAssert(m_OffTable);
 		UINT offset = m_OffTable[sector];
-		if (!m_Access->Seek(m_Block.offset + offset))
-			return FALSE;
 
 		if (m_OffTable[sector + 1] <= m_OffTable[sector])
 			return FALSE;
@@ -1646,27 +5288,33 @@ BOOL DMpq::DFileBuffer::ReadSector(UINT sector, BUFPTR buf, UINT size)
 			return FALSE;
 
 		if (data_size >= size) {
-			if (!m_Access->Read(buf, size))
+			if (!m_Access->ReadAt(m_Block.offset + offset, buf, size))
 				return FALSE;
 			if (m_Block.flags & BLOCK_ENCRYPT)
 				DecryptData(buf, size, m_Key + sector);
+		} else if (m_Access->Mapped() && !(m_Block.flags & BLOCK_ENCRYPT)) {
+			// 直接从映射内存中解压，省去一次复制
+			BUFCPTR data = m_Access->Map(m_Block.offset + offset, data_size);
+			if (!data)
+				return FALSE;
+			if (!Decompress(data, data_size, buf, size, ctx))
+				return FALSE;
 		} else {
-			DArray<BYTE> data(data_size);
-			if (!m_Access->Read(data, data_size))
+			BUFPTR data = get_codec_buffer(ctx, STAGE_BUFFER, data_size);
+			if (!data)
+				return FALSE;
+			if (!m_Access->ReadAt(m_Block.offset + offset, data, data_size))
 				return FALSE;
 			if (m_Block.flags & BLOCK_ENCRYPT)
 				DecryptData(data, data_size, m_Key + sector);
-			if (!Decompress(data, data_size, buf, size))
+			if (!Decompress(data, data_size, buf, size, ctx))
 				return FALSE;
 		}
 
 	} else {
 
 		UINT offset = m_Block.offset + (sector << SectorShift());
-		if (!m_Access->Seek(offset))
-			return FALSE;
-
-		if (!m_Access->Read(buf, size))
+		if (!m_Access->ReadAt(offset, buf, size))
 			return FALSE;
 
 		if (m_Block.flags & BLOCK_ENCRYPT)
@@ -1676,72 +5324,260 @@ BOOL DMpq::DFileBuffer::ReadSector(UINT sector, BUFPTR buf, UINT size)
 	return TRUE;
 }
 
-BOOL DMpq::DFileBuffer::WriteSector(UINT sector, BUFCPTR buf, UINT size, UINT &data_size)
+BOOL DMpq::DFileBuffer::ReadSector(UINT sector, BUFCPTR src, BUFPTR dest, BUFPTR scratch, CODEC_CONTEXT *ctx, ADPCMENTRY *adpcm /* = NULL */)
 {
-	DAssert(sector < m_SectorNum && buf);
-	DAssert(size <= (1U << SectorShift()));
+	DAssert(sector < m_SectorNum && dest && scratch && ctx);
 
-	if (m_Block.flags & BLOCK_COMP_MASK) {
+	if (adpcm)
+		adpcm->channels = 0;
 
-		DAssert(m_OffTable);
+	UINT sector_size = 1 << SectorShift();
+	UINT size = SectorSize(sector);
 
-		BUFPTR sector_buf = m_Access->SectorBuffer();
-		if (!sector_buf)
-			return FALSE;
+	dest += sector << SectorShift();
 
-		UINT offset = m_OffTable[sector];
-		if (!m_Access->Seek(m_Block.offset + offset))
-			return FALSE;
+	// 加密的扇区已由ReadSectors放到StageSector所定的位置解密
+	if (!(m_Block.flags & BLOCK_COMP_MASK)) {
+		DAssert(m_Block.flags & BLOCK_ENCRYPT);
+		return TRUE;
+	}
 
-		data_size = 1 << SectorShift();
+	DAssert(m_OffTable && src);
 
-		BYTE comp = m_Compression;
+	if (m_OffTable[sector + 1] <= m_OffTable[sector])
+		return FALSE;
 
-		// 由于ADPCM是有损压缩，为了避免WAVE文件头被其破坏，仅第一个段强制使用Implode无损压缩
-		if (!sector && (comp & (COMP_ADPCM_MONO | COMP_ADPCM_STEREO)))
-			comp = COMP_IMPLODE;
+	UINT data_size = m_OffTable[sector + 1] - m_OffTable[sector];
+	src += m_OffTable[sector] - m_OffTable[0];
 
-		if (Compress(comp, buf, size, sector_buf, data_size) && data_size < size) {
-			DAssert(data_size);
-			if (m_Block.flags & BLOCK_ENCRYPT)
-				EncryptData(sector_buf, data_size, m_Key + sector);
-			if (!m_Access->Write(sector_buf, data_size))
+	if (data_size >= size) {
+		if (!(m_Block.flags & BLOCK_ENCRYPT))
+			DMemCpy(dest, src, size);
+		return TRUE;
+	}
+
+	if (m_Block.flags & BLOCK_ENCRYPT)
+		src = scratch;
+
+	return Decompress(src, data_size, dest, size, ctx, scratch + sector_size, adpcm);
+}
+
+BOOL DMpq::DFileBuffer::StageSector(UINT sector, BUFCPTR src, BUFPTR dest, BUFPTR scratch, BUFPTR &data, UINT &data_size)
+{
+	DAssert(sector < m_SectorNum && dest && scratch && (m_Block.flags & BLOCK_ENCRYPT));
+
+	UINT size = SectorSize(sector);
+
+	dest += sector << SectorShift();
+
+	// 未压缩的文件已全部读入目标缓冲，就地解密
+	if (!(m_Block.flags & BLOCK_COMP_MASK)) {
+		data = dest;
+		data_size = size;
+		return TRUE;
+	}
+
+	DAssert(m_OffTable && src);
+
+	if (m_OffTable[sector + 1] <= m_OffTable[sector])
+		return FALSE;
+
+	data_size = m_OffTable[sector + 1] - m_OffTable[sector];
+	src += m_OffTable[sector] - m_OffTable[0];
+
+	// 按原样存放的扇区复制到目标位置解密，其余的复制到临时缓冲解密后再解压
+	if (data_size >= size) {
+		data = dest;
+		data_size = size;
+	} else {
+		data = scratch;
+	}
+
+	DMemCpy(data, src, data_size);
+
+	return TRUE;
+}
+
+BOOL DMpq::DFileBuffer::ReadSectors(UINT sector, UINT num, BUFCPTR src, BUFPTR dest, CODEC_CONTEXT *ctx)
+{
+	DAssert(sector < m_SectorNum && num && num <= READ_BATCH_NUM && dest && ctx);
+
+	if (num > m_SectorNum - sector)
+		num = m_SectorNum - sector;
+
+	// 每个扇区使用两个扇区大小的临时缓冲，分别用于解密和多重解压
+	BUFPTR scratch = get_codec_buffer(ctx, STAGE_BUFFER, num << (SectorShift() + 1));
+	if (!scratch)
+		return FALSE;
+
+	// 加密的扇区先全部放到各自解密的位置，然后一起解密
+	if (m_Block.flags & BLOCK_ENCRYPT) {
+
+		VPTR crypt_buf[READ_BATCH_NUM];
+		UINT crypt_size[READ_BATCH_NUM];
+		DWORD crypt_key[READ_BATCH_NUM];
+
+		for (UINT i = 0; i < num; i++) {
+			BUFPTR data = NULL;
+			if (!StageSector(sector + i, src, dest, scratch + (i << (SectorShift() + 1)), data, crypt_size[i]))
 				return FALSE;
-		} else {
-			if (m_Block.flags & BLOCK_ENCRYPT) {
-				DMemCpy(sector_buf, buf, size);
-				EncryptData(sector_buf, size, m_Key + sector);
-				if (!m_Access->Write(sector_buf, size))
-					return FALSE;
-			} else {
-				if (!m_Access->Write(buf, size))
-					return FALSE;
-			}
-			data_size = size;
+			crypt_buf[i] = data;
+			crypt_key[i] = m_Key + sector + i;
 		}
 
-	} else {
+		DecryptBatch(num, crypt_buf, crypt_size, crypt_key);
+	}
 
-		UINT offset = m_Block.offset + (sector << SectorShift());
-		if (!m_Access->Seek(offset))
+	// 再完成各扇区ADPCM之前的各步解压，每个扇区使用各自的临时缓冲，ADPCM解压的输入可能就在其中
+	ADPCMENTRY adpcm[READ_BATCH_NUM];
+	for (UINT i = 0; i < num; i++) {
+		if (!ReadSector(sector + i, src, dest, scratch + (i << (SectorShift() + 1)), ctx, &adpcm[i]))
 			return FALSE;
+	}
 
-		if (m_Block.flags & BLOCK_ENCRYPT) {
-			BUFPTR sector_buf = m_Access->SectorBuffer();
-			if (!sector_buf)
-				return FALSE;
-			DMemCpy(sector_buf, buf, size);
-			EncryptData(sector_buf, size, m_Key + sector);
-			if (!m_Access->Write(sector_buf, size))
-				return FALSE;
-		} else {
-			if (!m_Access->Write(buf, size))
-				return FALSE;
+	// 声道数相同的扇区一起进行ADPCM解压
+	VCPTR data[READ_BATCH_NUM];
+	UINT data_size[READ_BATCH_NUM];
+	VPTR buf[READ_BATCH_NUM];
+	UINT buf_size[READ_BATCH_NUM];
+
+	for (INT channels = ADPCM_MONO; channels <= ADPCM_STEREO; channels++) {
+
+		UINT cnt = 0;
+		for (UINT i = 0; i < num; i++) {
+			if (adpcm[i].channels != channels)
+				continue;
+			data[cnt] = adpcm[i].data;
+			data_size[cnt] = adpcm[i].size;
+			buf[cnt] = adpcm[i].dest;
+			buf_size[cnt] = adpcm[i].dest_size;
+			cnt++;
 		}
 
-		data_size = size;
+		if (cnt && !adpcm_decode_batch(channels, cnt, data, data_size, buf, buf_size))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL DMpq::DFileBuffer::SubmitBatch(BOOL last)
+{
+	DAssert(m_BatchBuffer && m_PackWork && m_PackPool);
+
+	// 同时只有一批扇区在后台压缩，先把上一批写入档案
+	if (!FlushBatch())
+		return FALSE;
+
+	UINT batch_size = WRITE_BATCH_NUM << SectorShift();
+
+	// 第一批数据中有WAVE文件头，据此确定所有扇区的压缩方法
+	if (!m_BatchPos)
+		m_Compression = CheckWave(m_Compression, m_BatchBuffer, m_WritePos);
+
+	m_PackWork->Setup(m_BatchPos >> SectorShift(), m_BatchBuffer + m_BatchIdx * batch_size, m_WritePos - m_BatchPos, m_BatchBuffer + batch_size * 2);
+	m_BatchPos = m_WritePos;
+	m_BatchIdx ^= 1U;
+
+	// 一批中的各扇区相互独立，由工作线程同时压缩，不等待完成就返回
+	if (!m_PackPool->Post(*m_PackWork, m_PackWork->GetSectorNum()))
+		return FALSE;
+
+	// 最后一批没有可以同时进行的工作，直接等待完成
+	return !last || (FlushBatch() && Finish());
+}
+
+BOOL DMpq::DFileBuffer::FlushBatch(VOID)
+{
+	DAssert(m_PackWork);
+
+	UINT sector_num = m_PackWork->GetSectorNum();
+	if (!sector_num)
+		return TRUE;
+
+	// 等待工作线程压缩完这一批
+	if (!m_PackPool->Join()) {
+		m_PackWork->Reset();
+		return FALSE;
+	}
+
+	m_PackWork->Join();
+
+	UINT first = m_PackWork->GetFirst();
+
+	// 一批扇区在档案中是连续的，一次写入
+	UINT offset = m_OffTable ? m_OffTable[first] : (first << SectorShift());
+	BOOL ret = m_Access->Seek(m_Block.offset + offset) && m_Access->Write(m_BatchBuffer + (WRITE_BATCH_NUM << SectorShift()) * 2, m_PackWork->GetPackSize());
+
+	if (ret && m_OffTable) {
+		for (UINT i = 0U; i < sector_num; i++)
+			m_OffTable[first + i + 1] = m_OffTable[first + i] + m_PackWork->GetDataSize(i);
+	}
+
+	m_PackWork->Reset();
+	return ret;
+}
+
+BOOL DMpq::DFileBuffer::Finish(VOID)
+{
+	// 写入完成，释放写缓冲
+	FreeBatch();
+
+	if (!m_OffTable) {
+		m_Block.data_size = m_Block.file_size;
+		return TRUE;
+	}
+
+	// 写回Offset Table
+	if (!m_Access->Seek(m_Block.offset))
+		return FALSE;
+
+	UINT tab_size = (m_SectorNum + 1) * sizeof(DWORD);
+
+	// 必要时加密
+	if (m_Block.flags & BLOCK_ENCRYPT) {
+		DArray<DWORD> off_table(m_SectorNum + 1);
+		DMemCpy(off_table, m_OffTable, tab_size);
+		EncryptData(off_table, tab_size, m_Key - 1);
+		if (!m_Access->Write(off_table, tab_size))
+			return FALSE;
+	} else {
+		if (!m_Access->Write(m_OffTable, tab_size))
+			return FALSE;
 	}
 
+	m_Block.data_size = m_OffTable[m_SectorNum];
+
+	return TRUE;
+}
+
+VOID DMpq::DFileBuffer::FreeBatch(VOID)
+{
+	// 先等待工作线程结束，再释放它们使用的缓冲
+	delete m_PackPool;
+	m_PackPool = NULL;
+
+	delete m_PackWork;
+	m_PackWork = NULL;
+
+	delete [] m_BatchBuffer;
+	m_BatchBuffer = NULL;
+}
+
+BOOL DMpq::DFileBuffer::PackSector(CONST BLOCKENTRY &block, BYTE comp, UINT sector, BUFCPTR buf, UINT size, BUFPTR dest, UINT &data_size, CODEC_CONTEXT *ctx)
+{
+	DAssert(buf && size && dest && data_size && ctx);
+	DAssert(block.flags & BLOCK_COMP_MASK);
+
+	// 由于ADPCM是有损压缩，为了避免WAVE文件头被其破坏，仅第一个段强制使用Implode无损压缩
+	if (!sector && (comp & (COMP_ADPCM_MONO | COMP_ADPCM_STEREO)))
+		comp = COMP_IMPLODE;
+
+	// 压缩后没有变小的扇区按原样存放
+	if (!Compress(block.flags, comp, buf, size, dest, data_size, ctx) || data_size >= size)
+		return FALSE;
+
+	DAssert(data_size);
 	return TRUE;
 }
 
@@ -1753,7 +5589,7 @@ INT DMpq::DFileBuffer::CheckCompression(BYTE comp)
 	INT cnt = 0;
 	BYTE test = comp;
 
-	for (INT i = 0; i < DCount(VALID_COMP); i++) {
+	for (UINT i = 0U; i < DCount(VALID_COMP); i++) {
 		BYTE code = comp & VALID_COMP[i];
 		if (!code)
 			continue;
@@ -1765,17 +5601,13 @@ INT DMpq::DFileBuffer::CheckCompression(BYTE comp)
 	if (test)
 		return -1;
 
-	if (cnt > 1 && !m_SwapBuffer)
-		m_SwapBuffer = new BYTE[1 << SectorShift()];
-
 	return cnt;
 }
 
-BOOL DMpq::DFileBuffer::Compress(BYTE comp, BUFCPTR src, UINT src_size, BUFPTR dest, UINT &dest_size)
+BOOL DMpq::DFileBuffer::Compress(DWORD flags, BYTE comp, BUFCPTR src, UINT src_size, BUFPTR dest, UINT &dest_size, CODEC_CONTEXT *ctx)
 {
-	DAssert(src && src_size && dest && dest_size);
-	DAssert(m_Block.flags & BLOCK_COMP_MASK);
-	DAssert(dest_size <= (1U << SectorShift()));
+	DAssert(src && src_size && dest && dest_size && ctx);
+	DAssert(flags & BLOCK_COMP_MASK);
 
 	INT dict;
 
@@ -1792,42 +5624,151 @@ BOOL DMpq::DFileBuffer::Compress(BYTE comp, BUFCPTR src, UINT src_size, BUFPTR d
 		break;
 	}
 
-	if (m_Block.flags & BLOCK_IMPLODE)
-		return implode(IMPLODE_BINARY, dict, src, src_size, dest, &dest_size);
+	// 只有追求最小结果时才使用较慢的最优解析
+	COMPRESS_POLICY policy = GetCompressPolicy();
+	INT level = (policy == CP_SMALLEST) ? IMPLODE_LEVEL_BEST : IMPLODE_LEVEL_NORMAL;
 
-	if (!(m_Block.flags & BLOCK_COMPRESS))
+	if (flags & BLOCK_IMPLODE)
+		return implode_ctx(ctx, IMPLODE_BINARY, dict, level, src, src_size, dest, &dest_size);
+
+	if (!(flags & BLOCK_COMPRESS))
 		return FALSE;
 
 	INT cnt = CheckCompression(comp);
 	if (cnt < 0)
 		return FALSE;
 
-	*dest++ = comp;
-	dest_size--;
-
 	if (!cnt) {
-		if (dest_size < src_size)
+		if (dest_size <= src_size)
 			return FALSE;
-		DMemCpy(dest, src, src_size);
+		*dest = comp;
+		DMemCpy(dest + 1, src, src_size);
 		dest_size = src_size + 1;
 		return TRUE;
 	}
 
-	// TODO:
-	if (comp == COMP_IMPLODE) {
-		if (!implode(IMPLODE_BINARY, dict, src, src_size, dest, &dest_size))
+	if (policy == CP_FIXED)
+		return Compress(comp, dict, level, src, src_size, dest, dest_size, ctx);
+
+	// 有损压缩的部分保持不变，只在其后的无损压缩中挑选
+	BYTE lossy = comp & COMP_LOSSY_MASK;
+	UINT size[DCount(CANDIDATE_COMP)];
+	UINT best = 0U;
+	UINT best_size = 0U;
+
+	BUFPTR output = get_codec_buffer(ctx, STAGE_BUFFER, DCount(CANDIDATE_COMP) * dest_size);
+	if (!output)
+		return FALSE;
+
+	// 默认只使用游戏能够读取的压缩方法
+	BOOL modern = GetModernCodec();
+
+	for (UINT i = 0U; i < DCount(CANDIDATE_COMP); i++) {
+		BYTE test = lossy | CANDIDATE_COMP[i];
+		size[i] = dest_size;
+		if (!test || (!modern && (CANDIDATE_COMP[i] & MODERN_COMP)) || !Compress(test, dict, level, src, src_size, output + i * dest_size, size[i], ctx))
+			size[i] = 0U;
+		else if (!best_size || size[i] < best_size)
+			best_size = size[i];
+	}
+
+	if (!best_size)
+		return FALSE;
+
+	// 候选方式按解压的开销排列，选出最小的，或者大小在预算之内并且解压最快的
+	UINT budget = (policy == CP_FAST_DECODE) ? best_size + (best_size >> 3) : best_size;
+	for (best = 0U; best < DCount(CANDIDATE_COMP); best++) {
+		if (size[best] && size[best] <= budget)
+			break;
+	}
+
+	DAssert(best < DCount(CANDIDATE_COMP));
+	DMemCpy(dest, output + best * dest_size, size[best]);
+	dest_size = size[best];
+
+	return TRUE;
+}
+
+BOOL DMpq::DFileBuffer::Compress(BYTE comp, INT dict, INT level, BUFCPTR src, UINT src_size, BUFPTR dest, UINT &dest_size, CODEC_CONTEXT *ctx)
+{
+	DAssert(src && src_size && dest && dest_size && ctx);
+
+	INT cnt = CheckCompression(comp);
+	if (cnt <= 0 || dest_size < 2)
+		return FALSE;
+
+	*dest++ = comp;
+	dest_size--;
+
+	// ADPCM压缩只接受完整的样本帧
+	INT channels = (comp & (COMP_ADPCM_STEREO | COMP_ADPCM_BETA_STEREO)) ? ADPCM_STEREO : ADPCM_MONO;
+	if ((comp & COMP_LOSSY_MASK) && (src_size % (channels * sizeof(SHORT))))
+		return FALSE;
+
+	INT huff_type = (comp & COMP_LOSSY_MASK) ? HUFF_TYPE_ADPCM : HUFF_TYPE_NORMAL;
+
+	// 写入时0x10总是表示bzip2，它在最外层，最后才进行
+	BOOL bzip2 = DBoolean(comp & COMP_BZIP2);
+	comp &= ~COMP_BZIP2;
+
+	// 与解压的顺序相反，依次进行各步压缩，两个缓冲交替使用，最后一步的结果正好在目标缓冲中
+	BUFPTR swap = get_codec_buffer(ctx, SWAP_BUFFER, dest_size);
+	if (!swap)
+		return FALSE;
+
+	UINT size = dest_size;
+
+	for (UINT i = 0U; i < DCount(VALID_COMP); i++) {
+
+		BYTE code = comp & VALID_COMP[i];
+		if (!code)
+			continue;
+
+		BUFPTR work = (cnt-- & 1) ? dest : swap;
+		dest_size = size;
+
+		switch (code) {
+		case COMP_ADPCM_BETA_STEREO:
+			if (!adpcm_beta_encode(ADPCM_TYPE, channels, src, src_size, work, &dest_size))
+				return FALSE;
+			break;
+		case COMP_ADPCM_MONO:
+		case COMP_ADPCM_STEREO:
+			if (!adpcm_encode(ADPCM_TYPE, channels, src, src_size, work, &dest_size))
+				return FALSE;
+			break;
+		case COMP_HUFFMAN:
+			if (!huff_encode_ctx(ctx, huff_type, src, src_size, work, &dest_size))
+				return FALSE;
+			break;
+		case COMP_DEFLATE:
+			if (!zlib_encode_ctx(ctx, src, src_size, work, &dest_size))
+				return FALSE;
+			break;
+		case COMP_IMPLODE:
+			if (!implode_ctx(ctx, IMPLODE_BINARY, dict, level, src, src_size, work, &dest_size))
+				return FALSE;
+			break;
+		}
+
+		src = work;
+		src_size = dest_size;
+	}
+
+	if (bzip2) {
+		DAssert(cnt == 1);
+		dest_size = size;
+		if (!bz2_encode_ctx(ctx, src, src_size, dest, &dest_size))
 			return FALSE;
-	} else {
-		DAssert(FALSE);
 	}
 
 	dest_size++;
 	return TRUE;
 }
 
-BOOL DMpq::DFileBuffer::Decompress(BUFCPTR src, UINT src_size, BUFPTR dest, UINT dest_size)
+BOOL DMpq::DFileBuffer::Decompress(BUFCPTR src, UINT src_size, BUFPTR dest, UINT dest_size, CODEC_CONTEXT *ctx, BUFPTR swap /* = NULL */, ADPCMENTRY *adpcm /* = NULL */)
 {
-	DAssert(src && src_size && dest && dest_size);
+	DAssert(src && src_size && dest && dest_size && ctx);
 	DAssert(m_Block.flags & BLOCK_COMP_MASK);
 	DAssert(src_size < dest_size && dest_size <= (1U << SectorShift()));
 
@@ -1851,15 +5792,45 @@ BOOL DMpq::DFileBuffer::Decompress(BUFCPTR src, UINT src_size, BUFPTR dest, UINT
 		return TRUE;
 	}
 
+	// 未指定交换缓冲时使用编解码上下文中的缓冲，批量读取时由调用者为每个扇区分别提供
+	if (!swap && cnt > 1) {
+		swap = get_codec_buffer(ctx, SWAP_BUFFER, 1 << SectorShift());
+		if (!swap)
+			return FALSE;
+	}
+
 	UINT size = dest_size;
 
+	// 0x10也可能是后来的bzip2，它在最外层，数据总是以"BZh"开头，而测试版ADPCM数据以类型值开头
+	if ((comp & COMP_BZIP2) && src_size >= 3 && src[0] == 'B' && src[1] == 'Z' && src[2] == 'h') {
+
+		BUFPTR work = (cnt-- & 1) ? dest : swap;
+
+		if (!bz2_decode_ctx(ctx, src, src_size, work, &dest_size))
+			return FALSE;
+
+		src = work;
+		src_size = dest_size;
+		comp &= ~COMP_BZIP2;
+	}
+
 	for (INT i = DCount(VALID_COMP) - 1; i >= 0; i--) {
 
 		BYTE code = comp & VALID_COMP[i];
 		if (!code)
 			continue;
 
-		BUFPTR work = (cnt-- & 1) ? dest : m_SwapBuffer;
+		// 最后一步是ADPCM解压时，可以交给调用者与其他扇区一起批量进行
+		if (adpcm && cnt == 1 && (code & (COMP_ADPCM_MONO | COMP_ADPCM_STEREO))) {
+			adpcm->channels = (code == COMP_ADPCM_STEREO) ? ADPCM_STEREO : ADPCM_MONO;
+			adpcm->data = src;
+			adpcm->size = src_size;
+			adpcm->dest = dest;
+			adpcm->dest_size = size;
+			return TRUE;
+		}
+
+		BUFPTR work = (cnt-- & 1) ? dest : swap;
 		dest_size = size;
 
 		switch (code) {
@@ -1867,8 +5838,12 @@ BOOL DMpq::DFileBuffer::Decompress(BUFCPTR src, UINT src_size, BUFPTR dest, UINT
 			if (!explode(src, src_size, work, &dest_size))
 				return FALSE;
 			break;
+		case COMP_DEFLATE:
+			if (!zlib_decode(src, src_size, work, &dest_size))
+				return FALSE;
+			break;
 		case COMP_HUFFMAN:
-			if (!huff_decode(src, src_size, work, &dest_size))
+			if (!huff_decode_ctx(ctx, src, src_size, work, &dest_size))
 				return FALSE;
 			break;
 		case COMP_ADPCM_STEREO:
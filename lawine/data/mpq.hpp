@@ -12,49 +12,125 @@
 /************************************************************************/
 
 #include <vector>
-#include <list>
 #include <map>
 #include <common.h>
 #include <ref.hpp>
 #include <file.hpp>
+#include <mapfile.hpp>
 #include <mutex.hpp>
+#include <workpool.hpp>
+
+/************************************************************************/
+
+struct CODEC_CONTEXT;
 
 /************************************************************************/
 
 class DMpq {
 
+public:
+
+	enum OPEN_FLAG {
+		OF_MAP_FILE		= 0x00000001,		// Map the whole archive into memory (read only)
+		OF_CONCURRENT	= 0x00000002,		// Allow reading different files from multiple threads
+		OF_NAME_FILTER	= 0x00000004,		// Build a filter to reject missing file names without probing the hash table
+		OF_INDEX_CACHE	= 0x00000008,		// Load the decrypted tables from an index file, create it if missing or outdated
+		OF_WRITE		= 0x00000010,		// Allow modifying the archive in place, OF_MAP_FILE and OF_INDEX_CACHE are ignored
+	};
+
+	enum COMPRESS_POLICY {
+		CP_FIXED,							// Use the compression methods chosen by the file type
+		CP_SMALLEST,						// Try the candidate methods on each sector and keep the smallest output
+		CP_FAST_DECODE,						// Keep the fastest method to decode whose output is within 1/8 of the smallest
+	};
+
+	typedef std::vector<DString>	DNameList;
+
+	// Receiver of the extracted files, called from worker threads so it must be thread safe.
+	class DExtractor {
+	public:
+		virtual BOOL Output(UINT index, STRCPTR file_name, BUFCPTR data, UINT size) = 0;
+		virtual VOID Fail(UINT index, STRCPTR file_name) = 0;
+	};
+
+	// A file to add in bulk, the data is read from real_path if it is not NULL.
+	struct ADDITEM {
+		STRCPTR		file_name;		// Name of the file in the archive.
+		STRCPTR		real_path;		// Path of the file on disk, or NULL to use file_data.
+		BUFCPTR		file_data;		// Data of the file, only used when real_path is NULL.
+		UINT		size;			// Size of file_data.
+		BOOL		compress;
+		BOOL		encrypt;
+	};
+
+	typedef std::vector<ADDITEM>	DAddList;
+
+	class DNameKey;
+	class DDirExtractor;
+
 public:
 
 	DMpq();
 	~DMpq();
 
 	BOOL CreateArchive(STRCPTR mpq_name, UINT &hash_num);
-	BOOL OpenArchive(STRCPTR mpq_name);
+	BOOL OpenArchive(STRCPTR mpq_name, UINT flags = 0U);
 	BOOL CloseArchive(VOID);
 
 	BOOL FileExist(STRCPTR file_name);
+	BOOL FileExist(CONST DNameKey &name_key);
 	BOOL FileExist(HANDLE file);
 	HANDLE OpenFile(STRCPTR file_name);
+	HANDLE OpenFile(CONST DNameKey &name_key);
 	BOOL CloseFile(HANDLE file);
 	HANDLE OpenHandle(STRCPTR file_name);
+	HANDLE OpenHandle(CONST DNameKey &name_key);
 
 	BOOL AddFile(STRCPTR file_name, STRCPTR real_path, BOOL compress, BOOL encrypt);
 	BOOL NewFile(STRCPTR file_name, BUFCPTR file_data, UINT size, BOOL compress, BOOL encrypt);
+	HANDLE OpenNewFile(STRCPTR file_name, UINT size, BOOL compress, BOOL encrypt);
 	BOOL DelFile(STRCPTR file_name);
+	UINT AddFiles(CONST DAddList &files, BOOL *results = NULL);
+	BOOL Compact(VOID);
+
+	BOOL BeginUpdate(VOID);
+	BOOL Commit(VOID);
+	BOOL Rollback(VOID);
+
+	BOOL ListFiles(DNameList &names);
+	UINT ExtractFiles(CONST DNameList &names, DExtractor &extractor);
+	UINT ExtractAll(DExtractor &extractor);
+	UINT MatchNames(CONST DNameList &names, std::vector<UINT> &hits);
+	UINT MatchNames(UINT num, CONST STRCPTR *names, std::vector<UINT> &hits);
 
 	static UINT GetFileSize(HANDLE file);
 	static UINT ReadFile(HANDLE file, VPTR data, UINT size);
+	static UINT ReadAll(HANDLE file, VPTR data, UINT size);
+	static UINT WriteFile(HANDLE file, VCPTR data, UINT size);
 	static UINT SeekFile(HANDLE file, INT offset, SEEK_MODE mode = SM_BEGIN);
 
+	UINT GetCacheSize(VOID) CONST;
+	BOOL SetCacheSize(UINT size);
+
 	static BOOL Initialize(VOID);
 	static VOID Exit(VOID);
 	static BOOL SetBasePath(STRCPTR path);
 	static STRCPTR GetBasePath(VOID);
 	static VOID SetLocale(LCID locale);
 	static LCID GetLocale(VOID);
+	static VOID SetWorkerNum(UINT num);
+	static UINT GetWorkerNum(VOID);
+	static VOID SetCompressPolicy(COMPRESS_POLICY policy);
+	static COMPRESS_POLICY GetCompressPolicy(VOID);
+	static VOID SetModernCodec(BOOL enable);
+	static BOOL GetModernCodec(VOID);
+	static BOOL SetIndexPath(STRCPTR path);
+	static STRCPTR GetIndexPath(VOID);
 
 protected:
 
+	friend class DArchive;
+
 	enum HASH_TYPE {
 		HASH_TABLE_ENTRY,
 		HASH_NAME_LOW,
@@ -93,42 +169,423 @@ protected:
 		DWORD block_index;			// The index into the block table of the file.
 	};
 
+	struct CACHEENTRY {
+		UINT		block;			// Block index of the cached sector.
+		UINT		sector;			// Sector index in the block.
+		UINT		size;			// Size of the sector data.
+		UINT		pin;			// Reference count, pinned entries can not be evicted.
+		BUFPTR		data;			// Sector data, allocated along with the entry.
+		CACHEENTRY	*link;			// Next entry in the hash bucket or in the free list.
+		CACHEENTRY	*prev;			// Previous (more recently used) entry in the LRU list.
+		CACHEENTRY	*next;			// Next (less recently used) entry in the LRU list.
+	};
+
+	struct EXTRACTITEM {
+		UINT		index;			// Index in the name list.
+		UINT		block_idx;		// Index into the block table.
+		DWORD		offset;			// Offset of the block, used for sorting.
+		DWORD		key;			// File decryption key.
+	};
+
+	struct ADDENTRY {
+		UINT		index;			// Index in the add list.
+		HASHENTRY	*hash;			// Reserved hash entry.
+		BLOCKENTRY	block;			// Block of the file, the offset is decided when writing.
+		DWORD		base_key;		// Hash of the name part of the path, used as the base file key.
+		BYTE		comp;			// Compression methods.
+		BUFCPTR		data;			// Data of the file.
+		BUFPTR		buffer;			// Data read from the real file, owned by the entry.
+		UINT		sector_num;		// Number of sectors.
+		UINT		first;			// Index of the first compressed sector in the batch.
+	};
+
+	struct STREAMENTRY {
+		HANDLE		file;			// Handle of the file being written, NULL if none.
+		HASHENTRY	*hash;			// Reserved hash entry.
+		UINT		block_idx;		// Reserved block index.
+		BLOCKENTRY	block;			// Block of the file with the reserved space.
+		DWORD		key;			// File key.
+	};
+
+	struct ADPCMENTRY {
+		INT			channels;		// Channels of the deferred ADPCM stage, zero if none.
+		BUFCPTR		data;			// Input of the ADPCM stage.
+		UINT		size;			// Size of the input.
+		BUFPTR		dest;			// Output buffer of the sector.
+		UINT		dest_size;		// Size of the output buffer.
+	};
+
+	struct INDEXHEADER {
+		DWORD identifier;			// Must be ASCII "LWIX".
+		DWORD version;				// Format version of the index file.
+		QWORD archive_time;			// Last modified time of the archive file.
+		DWORD archive_size;			// Size of the archive file.
+		DWORD path_hash;			// Hash of the full path of the archive file.
+		DWORD hash_num;				// Number of entries in the hash table.
+		DWORD block_num;			// Number of entries in the block table.
+		DWORD table_size;			// Number of DWORDs of all the sector offset tables.
+		DWORD name_num;				// Number of names in the list file.
+		DWORD name_size;			// Size of the name strings, including terminators.
+		DWORD reserved;				// Must be zero.
+	};
+
+	class DNameFilter;
+	class DHandleTable;
+	class DSectorCache;
+	class DIndexCache;
+	class DFreeSpace;
 	class DAccess;
 	class DSubFile;
 	class DFileBuffer;
+	class DExtractWork;
+	class DAddWork;
+
+	struct HANDLEENTRY {
+		DMpq			*mpq;		// Owner archive, NULL for a free slot.
+		DSubFile		*sub;		// The opened file.
+		volatile LONG	state;		// Generation in the high bits and reference count in the low bits.
+		UINT			generation;	// Generation when the file was opened.
+		UINT			slot;		// Index of this slot.
+		UINT			next;		// Next slot in the free list.
+	};
 
 	typedef std::vector<BLOCKENTRY>			DBlockTable;
-	typedef std::list<DSubFile *>			DFileList;
 	typedef std::map<UINT, DFileBuffer *>	DBufferMap;
+	typedef std::map<UINT, DWORD>			DKeyMap;
+	typedef std::pair<UINT, UINT>			DExtent;
+	typedef std::vector<DExtent>			DExtentList;
+	typedef std::vector<EXTRACTITEM>		DExtractList;
 
 	BOOL Create(STRCPTR mpq_name, UINT hash_num);
-	BOOL Load(STRCPTR mpq_name);
+	BOOL Load(STRCPTR mpq_name, UINT flags);
 	VOID Clear(VOID);
 	BOOL AddFile(STRCPTR file_name, BOOL compress, BOOL encrypt, DFile &file);
 	BOOL AddFile(DSubFile *sub, HASHENTRY *hash, UINT block_idx, CONST BLOCKENTRY &block, DWORD key, BYTE comp, DFile &file);
 	BOOL NewFile(DSubFile *sub, HASHENTRY *hash, UINT block_idx, CONST BLOCKENTRY &block, DWORD key, BYTE comp, BUFCPTR file_data);
 	HASHENTRY *PrepareAdd(STRCPTR file_name, UINT file_size, BOOL compress, BOOL encrypt, UINT &block_idx, BLOCKENTRY &block, DWORD &key, BYTE &compression);
-	BOOL Writeback(DSubFile *sub, HASHENTRY *hash, UINT block_idx);
-	BOOL Writeback(UINT hash_table_offset);
-	HASHENTRY *Lookup(STRCPTR file_name);
-	HASHENTRY *AllocHash(STRCPTR file_name);
+	BOOL Writeback(DSubFile *sub, HASHENTRY *hash, UINT block_idx, DWORD key);
+	BOOL Writeback(VOID);
+	BOOL WriteTables(CONST HEADER &header);
+	BOOL AutoCommit(VOID);
+	VOID ResetFreeSpace(VOID);
+	BOOL PrepareAdd(CONST ADDITEM &item, ADDENTRY &entry);
+	BOOL WriteEntry(DAddWork &work, ADDENTRY &entry);
+	BOOL CloseStream(VOID);
+	HANDLE OpenFile(CONST DNameKey &name_key, UINT hash_idx);
+	HANDLE OpenHandle(CONST DNameKey &name_key, UINT hash_idx);
+	HASHENTRY *VerifyHash(CONST DNameKey &name_key, UINT hash_idx);
+	INT MatchEntry(UINT hash_idx, LANGID lang) CONST;
+	VOID BuildFilter(VOID);
+	BOOL SaveIndex(STRCPTR index_name, INDEXHEADER &header);
+	HASHENTRY *Lookup(CONST DNameKey &name_key);
+	BOOL ProbeName(CONST DNameKey &name_key) CONST;
+	HASHENTRY *AllocHash(CONST DNameKey &name_key);
+	VOID FreeHash(HASHENTRY *hash);
 	UINT AllocBlock(UINT file_size, BOOL compress, BOOL encrypt, BLOCKENTRY &block);
-	UINT GetEndOfFileData(VOID);
-
-	static DWORD CalcFileKey(STRCPTR path_name, CONST BLOCKENTRY &block);
+	UINT FindFreeBlock(UINT from) CONST;
+	UINT GetReserveSize(CONST BLOCKENTRY &block) CONST;
+	BOOL DetectFileKey(CONST BLOCKENTRY &block, DWORD &key);
+	BOOL PackBlocks(VOID);
+	BOOL MoveBlock(BLOCKENTRY &block, UINT offset, BOOL recrypt, DWORD &key);
+
+	static BOOL GetIndexName(STRCPTR mpq_name, DString &index_name, INDEXHEADER &stamp);
+	static QWORD NameHash(CONST HASHENTRY &hash);
+	static BYTE GetCompression(STRCPTR file_name, CONST BLOCKENTRY &block);
+	static BYTE CheckWave(BYTE comp, BUFCPTR data, UINT size);
+	static BOOL CompareOffset(CONST EXTRACTITEM &item1, CONST EXTRACTITEM &item2);
+	static DWORD CalcFileKey(CONST DNameKey &name_key, CONST BLOCKENTRY &block);
+	static DWORD CalcFileKey(DWORD base_key, CONST BLOCKENTRY &block);
 	static DWORD HashString(STRCPTR str, INT hash_type);
 	static VOID EncryptData(VPTR buf, UINT size, DWORD key);
 	static VOID DecryptData(VPTR buf, UINT size, DWORD key);
+	static VOID DecryptBatch(UINT num, CONST VPTR *buf, CONST UINT *size, CONST DWORD *key);
+	static VOID DecryptStream(DWORD *data, UINT num, DWORD &key, DWORD &seed);
+	static VOID DecryptLanes(DWORD *CONST *data, UINT num, DWORD *key, DWORD *seed);
 
 	UINT			m_HashNum;
-	DFileList		m_FileList;
 	DBlockTable		m_BlockTable;
+	DKeyMap			m_KeyMap;
 	DAccess			*m_Access;
 	HASHENTRY		*m_HashTable;
+	DNameFilter		*m_Filter;
+	DFreeSpace		*m_FreeSpace;
+	DExtentList		m_TableSpace;
+	DExtentList		m_RetiredSpace;
+	BOOL			m_Updating;
+	DBlockTable		m_SavedBlockTable;
+	DKeyMap			m_SavedKeyMap;
+	std::vector<HASHENTRY>	m_SavedHashTable;
+	STREAMENTRY		m_Stream;
+	DMutex			m_Lock;
 
 	static LCID		s_Locale;
+	static UINT		s_WorkerNum;
+	static COMPRESS_POLICY	s_CompressPolicy;
+	static BOOL		s_ModernCodec;
+	static DHandleTable	*s_HandleTable;
 	static DString	s_BashPath;
+	static DString	s_IndexPath;
 	static DWORD	s_HashTable[HASH_TABLE_NUM][0x100];
+	static DWORD	s_NameTable[0x100][HASH_TYPE_NUM * 2];	// Entries of each hash type and the upper case character, indexed by byte.
+
+};
+
+/************************************************************************/
+
+// Hash values of a file name, computed once and usable with any archive.
+// Must be constructed after DMpq::Initialize().
+class DMpq::DNameKey {
+
+public:
+
+	DNameKey();
+	explicit DNameKey(STRCPTR file_name);
+
+	BOOL IsValid(VOID) CONST;
+	QWORD GetHash(VOID) CONST;
+	BOOL Assign(STRCPTR file_name);
+	static VOID AssignBatch(UINT num, CONST STRCPTR *file_names, DNameKey *name_keys);
+
+protected:
+
+	friend class DMpq;
+
+	BOOL		m_Valid;
+	DWORD		m_Entry;		// Hash of the path, used as the start entry of the hash table.
+	DWORD		m_HashLow;		// Hash of the path, using method A.
+	DWORD		m_HashHigh;		// Hash of the path, using method B.
+	DWORD		m_FileKey;		// Hash of the name part of the path, used as the base file key.
+
+};
+
+/************************************************************************/
+
+// Bloom filter of name hashes, no false negatives.
+class DMpq::DNameFilter {
+
+public:
+
+	DNameFilter();
+	~DNameFilter();
+
+	BOOL Create(UINT key_num);
+	VOID Clear(VOID);
+	VOID Add(QWORD name_hash);
+	BOOL MayExist(QWORD name_hash) CONST;
+
+protected:
+
+	static CONST UINT BITS_PER_KEY = 16U;
+	static CONST INT PROBE_NUM = 4;
+
+	UINT		m_Mask;
+	DWORD		*m_Bits;
+
+};
+
+/************************************************************************/
+
+class DMpq::DDirExtractor : public DMpq::DExtractor {
+
+public:
+
+	DDirExtractor(STRCPTR dest_path, BOOL *results = NULL);
+
+	virtual BOOL Output(UINT index, STRCPTR file_name, BUFCPTR data, UINT size);
+	virtual VOID Fail(UINT index, STRCPTR file_name);
+
+protected:
+
+	DString		m_Path;
+	BOOL		*m_Results;
+
+};
+
+/************************************************************************/
+
+// Slot map of the opened files, handles are slot indices tagged with generations.
+class DMpq::DHandleTable {
+
+public:
+
+	DHandleTable();
+	~DHandleTable();
+
+	HANDLE Insert(DMpq *mpq, DSubFile *sub);
+	BOOL Remove(DMpq *mpq, HANDLE handle);
+	VOID RemoveAll(DMpq *mpq);
+	BOOL IsOpen(DMpq *mpq);
+	BOOL IsOpen(DMpq *mpq, UINT offset);
+	HANDLEENTRY *Acquire(HANDLE handle);
+	VOID Release(HANDLEENTRY *entry);
+	DMpq *GetOwner(HANDLE handle);
+
+protected:
+
+	static CONST UINT SLOT_BITS = 18U;
+	static CONST UINT SLOT_MASK = (1U << SLOT_BITS) - 1;
+	static CONST UINT GEN_MASK = (1U << (32 - SLOT_BITS)) - 1;
+	static CONST UINT PAGE_SHIFT = 10U;
+	static CONST UINT PAGE_SIZE = 1U << PAGE_SHIFT;
+	static CONST UINT PAGE_NUM = (SLOT_MASK + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	static CONST UINT NULL_SLOT = 0xffffffffU;
+
+	HANDLEENTRY *Find(HANDLE handle, UINT &generation) CONST;
+	VOID Destroy(HANDLEENTRY *entry);
+
+	static HANDLE MakeHandle(UINT slot, UINT generation);
+	static UINT GetGeneration(LONG state);
+	static UINT GetRef(LONG state);
+
+	DMutex			m_Lock;
+	UINT			m_SlotNum;
+	UINT			m_FreeSlot;
+	HANDLEENTRY		*m_Page[PAGE_NUM];
+
+private:
+
+	DHandleTable(CONST DHandleTable &table);
+
+	DHandleTable &operator = (CONST DHandleTable &table);
+
+};
+
+/************************************************************************/
+
+class DMpq::DSectorCache {
+
+public:
+
+	DSectorCache();
+	~DSectorCache();
+
+	BOOL Create(UINT sector_shift, UINT budget);
+	VOID Clear(VOID);
+	UINT GetBudget(VOID) CONST;
+	VOID SetBudget(UINT budget);
+
+	CACHEENTRY *Find(UINT block_idx, UINT sector);
+	CACHEENTRY *Alloc(UINT block_idx, UINT sector);
+	CACHEENTRY *Insert(CACHEENTRY *entry);
+	VOID Release(CACHEENTRY *entry);
+	VOID Free(CACHEENTRY *entry);
+	VOID Invalidate(UINT block_idx);
+	VOID Invalidate(VOID);
+
+protected:
+
+	static CONST INT SHARD_NUM = 16;
+	static CONST UINT MIN_BUCKET_NUM = 16U;
+
+	struct SHARD {
+		DMutex		lock;
+		UINT		used_num;		// Entries in the hash table (pinned or in the LRU list)
+		UINT		free_num;		// Entries in the free list
+		UINT		bucket_num;
+		CACHEENTRY	**bucket;
+		CACHEENTRY	*head;			// Most recently used
+		CACHEENTRY	*tail;			// Least recently used
+		CACHEENTRY	*free;
+	};
+
+	static UINT Hash(UINT block_idx, UINT sector);
+
+	SHARD &GetShard(UINT hash);
+	CACHEENTRY **Search(SHARD &shard, UINT hash, UINT block_idx, UINT sector);
+	VOID Rehash(SHARD &shard, UINT bucket_num);
+	VOID Remove(SHARD &shard, CACHEENTRY *entry);
+	VOID Recycle(SHARD &shard, CACHEENTRY *entry);
+	VOID Evict(SHARD &shard);
+	VOID Attach(SHARD &shard, CACHEENTRY *entry);
+	VOID Detach(SHARD &shard, CACHEENTRY *entry);
+
+	UINT		m_SectorShift;
+	UINT		m_Budget;
+	UINT		m_ShardLimit;
+	SHARD		m_Shard[SHARD_NUM];
+
+};
+
+/************************************************************************/
+
+// Index file of an archive, mapped to memory.
+// Holds the decrypted tables, the names in the list file and the decrypted sector offset tables.
+class DMpq::DIndexCache {
+
+public:
+
+	static CONST DWORD NULL_TABLE = 0xffffffffUL;
+
+	DIndexCache();
+	~DIndexCache();
+
+	BOOL IsLoaded(VOID) CONST;
+	BOOL Load(STRCPTR index_name, CONST INDEXHEADER &stamp);
+	VOID Clear(VOID);
+
+	CONST HASHENTRY *GetHashTable(VOID) CONST;
+	CONST BLOCKENTRY *GetBlockTable(VOID) CONST;
+	CONST DWORD *GetOffTable(UINT block_idx, UINT sector_num) CONST;
+	BOOL GetNames(DNameList &names) CONST;
+
+protected:
+
+	DMapFile			m_MapFile;
+	CONST INDEXHEADER	*m_Header;
+	CONST HASHENTRY		*m_HashTable;
+	CONST BLOCKENTRY	*m_BlockTable;
+	CONST DWORD			*m_TablePos;		// Position of each block in the offset table pool, or NULL_TABLE.
+	CONST DWORD			*m_OffTable;
+	CONST DWORD			*m_NamePos;
+	STRCPTR				m_NameData;
+
+private:
+
+	DIndexCache(CONST DIndexCache &index);
+
+	DIndexCache &operator = (CONST DIndexCache &index);
+
+};
+
+/************************************************************************/
+
+// Free extents of the file data in a writable archive, indexed both by offset and by size.
+class DMpq::DFreeSpace {
+
+public:
+
+	DFreeSpace();
+	~DFreeSpace();
+
+	VOID Build(CONST DBlockTable &blocks, UINT start);
+	VOID Clear(VOID);
+
+	UINT Alloc(UINT size);
+	UINT Append(UINT size);
+	VOID Free(UINT offset, UINT size);
+	VOID Reserve(UINT offset, UINT size);
+
+	UINT GetEnd(VOID) CONST;
+	UINT GetFreeSize(VOID) CONST;
+
+protected:
+
+	typedef std::map<UINT, UINT>		DOffsetMap;
+	typedef std::multimap<UINT, UINT>	DSizeMap;
+
+	VOID Insert(UINT offset, UINT size);
+	VOID Erase(DOffsetMap::iterator it);
+
+	DOffsetMap	m_OffsetMap;		// Offset to size of each free extent.
+	DSizeMap	m_SizeMap;			// Size to offset of each free extent.
+	UINT		m_End;				// End of the file data, nothing is used behind it.
+	UINT		m_FreeSize;
+
+private:
+
+	DFreeSpace(CONST DFreeSpace &space);
+
+	DFreeSpace &operator = (CONST DFreeSpace &space);
 
 };
 
@@ -143,35 +600,54 @@ public:
 
 	BOOL Readable(VOID) CONST;
 	BOOL Writable(VOID) CONST;
+	BOOL Mapped(VOID) CONST;
+	BOOL Concurrent(VOID) CONST;
 	UINT SectorShift(VOID) CONST;
 
 	BOOL Create(STRCPTR mpq_name);
-	BOOL Open(STRCPTR mpq_name);
+	BOOL Open(STRCPTR mpq_name, UINT flags);
 	BOOL Close(VOID);
 
 	BOOL Read(VPTR buf, UINT size);
 	BOOL Write(VCPTR buf, UINT size);
 	BOOL Seek(UINT pos);
+	BOOL ReadAt(UINT pos, VPTR buf, UINT size) CONST;
+	BOOL ReadBack(UINT pos, VPTR buf, UINT size);
+	BUFCPTR Map(UINT pos, UINT size) CONST;
+	BOOL Flush(VOID);
+	BOOL SetSize(UINT size);
 
-	HANDLE ShareHandle(VOID);
+	HANDLE ShareHandle(UINT pos);
 
 	DFileBuffer *GetBuffer(UINT block_idx);
 	VOID SetBuffer(UINT block_idx, DFileBuffer *buf);
+	VOID FreeBuffer(UINT block_idx);
+	VOID FreeBuffers(VOID);
 
 	BUFPTR SectorBuffer(VOID);
+	DSectorCache *GetCache(VOID);
+	BOOL LoadIndex(STRCPTR index_name, CONST INDEXHEADER &stamp);
+	CONST DIndexCache *GetIndex(VOID) CONST;
 
 protected:
 
 	BOOL Load(VOID);
 	VOID Clear(VOID);
+	BOOL Fetch(UINT offset, VPTR buf, UINT size);
 
 	DFile		m_File;
+	DMapFile	m_MapFile;
+	UINT		m_MapPos;
 	BOOL		m_ReadAccess;
 	BOOL		m_WriteAccess;
+	BOOL		m_Dirty;
+	BOOL		m_Concurrent;
 	UINT		m_ArchiveOff;
 	UINT		m_SectorShift;
 	BUFPTR		m_SectorBuffer;
 	DBufferMap	m_BufferMap;
+	DSectorCache	m_Cache;
+	DIndexCache		m_Index;
 
 };
 
@@ -191,6 +667,7 @@ public:
 	BOOL Open(DAccess *archive, UINT block_idx, CONST BLOCKENTRY &block, DWORD key);
 	BOOL Close(VOID);
 	UINT Read(VPTR buf, UINT size);
+	UINT ReadAll(VPTR buf, UINT size);
 	UINT Write(VCPTR data, UINT size);
 	UINT Seek(INT offset, SEEK_MODE mode);
 
@@ -198,6 +675,7 @@ protected:
 
 	UINT		m_FileSize;
 	UINT		m_Position;
+	BOOL		m_Private;
 	DFileBuffer	*m_FileBuffer;
 
 };
@@ -214,39 +692,51 @@ public:
 	DAccess *GetAccess(VOID) CONST;
 	CONST BLOCKENTRY &GetBlock(VOID) CONST;
 	UINT SectorShift(VOID) CONST;
-	BOOL Create(DAccess *archive, CONST BLOCKENTRY &block, DWORD key, BYTE comp);
-	BOOL Open(DAccess *archive, CONST BLOCKENTRY &block, DWORD key);
+	BOOL Create(DAccess *archive, UINT block_idx, CONST BLOCKENTRY &block, DWORD key, BYTE comp);
+	BOOL Open(DAccess *archive, UINT block_idx, CONST BLOCKENTRY &block, DWORD key);
 	VOID Clear(VOID);
-	BUFCPTR GetSector(UINT sector, UINT &size);
-	BOOL SetSector(UINT sector, BUFCPTR buf, UINT buf_size, UINT &size);
+	BUFCPTR GetSector(UINT sector, UINT &size, CACHEENTRY *&entry);
+	VOID PutSector(CACHEENTRY *entry);
+	UINT Write(UINT pos, BUFCPTR buf, UINT size);
+	BOOL ReadAll(BUFPTR buf, UINT max_worker);
 
-protected:
+	static BOOL PackSector(CONST BLOCKENTRY &block, BYTE comp, UINT sector, BUFCPTR buf, UINT size, BUFPTR dest, UINT &data_size, CODEC_CONTEXT *ctx);
 
-	static CONST INT MAX_CACHE_SECTOR = 16;
+protected:
 
-	struct CACHESECTOR {
-		UINT		sector;
-		UINT		size;
-		BUFPTR		data;
-	};
+	class DReadWork;
+	class DPackWork;
 
 	BOOL Create(VOID);
-	BOOL ReadSector(UINT sector, BUFPTR buf, UINT size);
-	BOOL WriteSector(UINT sector, BUFCPTR buf, UINT size, UINT &data_size);
-	INT CheckCompression(BYTE comp);
-	BOOL Compress(BYTE comp, BUFCPTR src, UINT src_size, BUFPTR dest, UINT &dest_size);
-	BOOL Decompress(BUFCPTR src, UINT src_size, BUFPTR dest, UINT dest_size);
+	UINT SectorSize(UINT sector) CONST;
+	BUFCPTR MapSector(UINT sector, UINT size);
+	BOOL ReadSector(UINT sector, BUFPTR buf, UINT size, CODEC_CONTEXT *ctx);
+	BOOL ReadSector(UINT sector, BUFCPTR src, BUFPTR dest, BUFPTR scratch, CODEC_CONTEXT *ctx, ADPCMENTRY *adpcm = NULL);
+	BOOL StageSector(UINT sector, BUFCPTR src, BUFPTR dest, BUFPTR scratch, BUFPTR &data, UINT &data_size);
+	BOOL ReadSectors(UINT sector, UINT num, BUFCPTR src, BUFPTR dest, CODEC_CONTEXT *ctx);
+	BOOL SubmitBatch(BOOL last);
+	BOOL FlushBatch(VOID);
+	BOOL Finish(VOID);
+	VOID FreeBatch(VOID);
+	BOOL Decompress(BUFCPTR src, UINT src_size, BUFPTR dest, UINT dest_size, CODEC_CONTEXT *ctx, BUFPTR swap = NULL, ADPCMENTRY *adpcm = NULL);
+
+	static INT CheckCompression(BYTE comp);
+	static BOOL Compress(DWORD flags, BYTE comp, BUFCPTR src, UINT src_size, BUFPTR dest, UINT &dest_size, CODEC_CONTEXT *ctx);
+	static BOOL Compress(BYTE comp, INT dict, INT level, BUFCPTR src, UINT src_size, BUFPTR dest, UINT &dest_size, CODEC_CONTEXT *ctx);
 
 	DAccess		*m_Access;
+	UINT		m_BlockIdx;
 	UINT		m_SectorNum;
 	DWORD		m_Key;
 	BYTE		m_Compression;
 	BLOCKENTRY	m_Block;
 	DWORD		*m_OffTable;
-	BUFPTR		m_SwapBuffer;
-
-	INT			m_CurCache;
-	CACHESECTOR	m_Cache[MAX_CACHE_SECTOR];
+	UINT		m_WritePos;
+	UINT		m_BatchPos;
+	UINT		m_BatchIdx;
+	BUFPTR		m_BatchBuffer;
+	DPackWork	*m_PackWork;
+	DWorkPool	*m_PackPool;
 
 };
 
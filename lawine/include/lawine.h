@@ -80,17 +80,27 @@ CAPI extern BOOL LAWINE_API LGetUserColor(PALPTR pal, INT user);
 
 CAPI extern LHMPQ LAWINE_API LMpqCreate(STRCPTR name, UINT *hash_num);
 CAPI extern LHMPQ LAWINE_API LMpqOpen(STRCPTR name);
+CAPI extern LHMPQ LAWINE_API LMpqOpenEx(STRCPTR name, UINT flags);
 CAPI extern BOOL LAWINE_API LMpqClose(LHMPQ mpq);
 CAPI extern BOOL LAWINE_API LMpqFileExist(LHMPQ mpq, STRCPTR file_name);
 CAPI extern BOOL LAWINE_API LMpqAddFile(LHMPQ mpq, STRCPTR file_name, STRCPTR real_path, BOOL compress, BOOL encrypt);
 CAPI extern BOOL LAWINE_API LMpqNewFile(LHMPQ mpq, STRCPTR file_name, BUFCPTR file_data, UINT size, BOOL compress, BOOL encrypt);
+CAPI extern LHFILE LAWINE_API LMpqOpenNewFile(LHMPQ mpq, STRCPTR file_name, UINT size, BOOL compress, BOOL encrypt);
 CAPI extern BOOL LAWINE_API LMpqDelFile(LHMPQ mpq, STRCPTR file_name);
 CAPI extern LHFILE LAWINE_API LMpqOpenFile(LHMPQ mpq, STRCPTR file_name);
 CAPI extern BOOL LAWINE_API LMpqCloseFile(LHMPQ mpq, LHFILE file);
 CAPI extern HANDLE LAWINE_API LMpqOpenHandle(LHMPQ mpq, STRCPTR file_name);
 CAPI extern UINT LAWINE_API LMpqGetFileSize(LHFILE file);
 CAPI extern UINT LAWINE_API LMpqReadFile(LHFILE file, VPTR data, UINT size);
+CAPI extern UINT LAWINE_API LMpqReadAll(LHFILE file, VPTR data, UINT size);
+CAPI extern UINT LAWINE_API LMpqWriteFile(LHFILE file, VCPTR data, UINT size);
 CAPI extern UINT LAWINE_API LMpqSeekFile(LHFILE file, INT offset, SEEK_MODE mode);
+CAPI extern UINT LAWINE_API LMpqExtract(LHMPQ mpq, CONST STRCPTR *file_names, UINT file_num, STRCPTR dest_path, BOOL *results);
+CAPI extern UINT LAWINE_API LMpqAddFiles(LHMPQ mpq, CONST STRCPTR *file_names, CONST STRCPTR *real_paths, UINT file_num, BOOL compress, BOOL encrypt, BOOL *results);
+CAPI extern BOOL LAWINE_API LMpqCompact(LHMPQ mpq);
+CAPI extern BOOL LAWINE_API LMpqBeginUpdate(LHMPQ mpq);
+CAPI extern BOOL LAWINE_API LMpqCommit(LHMPQ mpq);
+CAPI extern BOOL LAWINE_API LMpqRollback(LHMPQ mpq);
 
 CAPI extern LHMPQ LAWINE_API LArcUseArchive(STRCPTR arc_name, UINT priority);
 CAPI extern BOOL LAWINE_API LArcClose(LHMPQ arc);
@@ -98,6 +108,7 @@ CAPI extern BOOL LAWINE_API LArcFileExist(STRCPTR file_name);
 CAPI extern LHFILE LAWINE_API LArcOpenFile(STRCPTR file_name);
 CAPI extern BOOL LAWINE_API LArcCloseFile(LHFILE file);
 CAPI extern HANDLE LAWINE_API LArcOpenHandle(STRCPTR file_name);
+CAPI extern UINT LAWINE_API LArcExtract(CONST STRCPTR *file_names, UINT file_num, STRCPTR dest_path, BOOL *results);
 
 CAPI extern LHTBL LAWINE_API LTblOpen(STRCPTR name);
 CAPI extern BOOL LAWINE_API LTblClose(LHTBL tbl);
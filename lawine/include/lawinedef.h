@@ -31,6 +31,12 @@
 #define L_SPK_WIDTH				640
 #define L_SPK_HEIGHT			480
 
+#define L_MPQ_OPEN_MAP_FILE		0x00000001
+#define L_MPQ_OPEN_CONCURRENT	0x00000002
+#define L_MPQ_OPEN_NAME_FILTER	0x00000004
+#define L_MPQ_OPEN_INDEX_CACHE	0x00000008
+#define L_MPQ_OPEN_WRITE		0x00000010
+
 enum {
 	L_BRUSH_BADLANDS_DIRT,
 	L_BRUSH_BADLANDS_MUD,
@@ -108,6 +108,28 @@ CAPI LHMPQ LAWINE_API LMpqOpen(STRCPTR name)
 	return NULL;
 }
 
+CAPI LHMPQ LAWINE_API LMpqOpenEx(STRCPTR name, UINT flags)
+{
+	UINT open_flags = 0U;
+	if (flags & L_MPQ_OPEN_MAP_FILE)
+		open_flags |= DMpq::OF_MAP_FILE;
+	if (flags & L_MPQ_OPEN_CONCURRENT)
+		open_flags |= DMpq::OF_CONCURRENT;
+	if (flags & L_MPQ_OPEN_NAME_FILTER)
+		open_flags |= DMpq::OF_NAME_FILTER;
+	if (flags & L_MPQ_OPEN_INDEX_CACHE)
+		open_flags |= DMpq::OF_INDEX_CACHE;
+	if (flags & L_MPQ_OPEN_WRITE)
+		open_flags |= DMpq::OF_WRITE;
+
+	DMpq *mpq = new DMpq;
+	if (mpq->OpenArchive(name, open_flags))
+		return mpq;
+
+	delete mpq;
+	return NULL;
+}
+
 CAPI BOOL LAWINE_API LMpqClose(LHMPQ mpq)
 {
 	if (!mpq)
@@ -142,6 +164,14 @@ CAPI BOOL LAWINE_API LMpqNewFile(LHMPQ mpq, STRCPTR file_name, BUFCPTR file_data
 	return mpq->NewFile(file_name, file_data, size, compress, encrypt);
 }
 
+CAPI LHFILE LAWINE_API LMpqOpenNewFile(LHMPQ mpq, STRCPTR file_name, UINT size, BOOL compress, BOOL encrypt)
+{
+	if (!mpq)
+		return NULL;
+
+	return mpq->OpenNewFile(file_name, size, compress, encrypt);
+}
+
 CAPI BOOL LAWINE_API LMpqDelFile(LHMPQ mpq, STRCPTR file_name)
 {
 	if (!mpq)
@@ -184,11 +214,89 @@ CAPI UINT LAWINE_API LMpqReadFile(LHFILE file, VPTR data, UINT size)
 	return DMpq::ReadFile(file, data, size);
 }
 
+CAPI UINT LAWINE_API LMpqReadAll(LHFILE file, VPTR data, UINT size)
+{
+	return DMpq::ReadAll(file, data, size);
+}
+
+CAPI UINT LAWINE_API LMpqWriteFile(LHFILE file, VCPTR data, UINT size)
+{
+	return DMpq::WriteFile(file, data, size);
+}
+
 CAPI UINT LAWINE_API LMpqSeekFile(LHFILE file, INT offset, SEEK_MODE mode)
 {
 	return DMpq::SeekFile(file, offset, mode);
 }
 
+CAPI UINT LAWINE_API LMpqExtract(LHMPQ mpq, CONST STRCPTR *file_names, UINT file_num, STRCPTR dest_path, BOOL *results)
+{
+	// 目标目录为空时档案中的文件名会被当作当前目录下的路径，不允许
+	if (!mpq || !dest_path || !*dest_path)
+		return 0U;
+
+	// 不指定文件名时解压(listfile)中列出的全部文件
+	if (!file_names) {
+		DMpq::DDirExtractor extractor(dest_path);
+		return mpq->ExtractAll(extractor);
+	}
+
+	DMpq::DNameList names(file_names, file_names + file_num);
+	DMpq::DDirExtractor extractor(dest_path, results);
+	return mpq->ExtractFiles(names, extractor);
+}
+
+CAPI UINT LAWINE_API LMpqAddFiles(LHMPQ mpq, CONST STRCPTR *file_names, CONST STRCPTR *real_paths, UINT file_num, BOOL compress, BOOL encrypt, BOOL *results)
+{
+	if (!mpq || !file_names || !real_paths)
+		return 0U;
+
+	DMpq::DAddList files(file_num);
+	for (UINT i = 0U; i < file_num; i++) {
+		DMpq::ADDITEM &item = files[i];
+		item.file_name = file_names[i];
+		item.real_path = real_paths[i];
+		item.file_data = NULL;
+		item.size = 0U;
+		item.compress = compress;
+		item.encrypt = encrypt;
+	}
+
+	return mpq->AddFiles(files, results);
+}
+
+CAPI BOOL LAWINE_API LMpqCompact(LHMPQ mpq)
+{
+	if (!mpq)
+		return FALSE;
+
+	return mpq->Compact();
+}
+
+CAPI BOOL LAWINE_API LMpqBeginUpdate(LHMPQ mpq)
+{
+	if (!mpq)
+		return FALSE;
+
+	return mpq->BeginUpdate();
+}
+
+CAPI BOOL LAWINE_API LMpqCommit(LHMPQ mpq)
+{
+	if (!mpq)
+		return FALSE;
+
+	return mpq->Commit();
+}
+
+CAPI BOOL LAWINE_API LMpqRollback(LHMPQ mpq)
+{
+	if (!mpq)
+		return FALSE;
+
+	return mpq->Rollback();
+}
+
 /************************************************************************/
 
 CAPI LHMPQ LAWINE_API LArcUseArchive(STRCPTR arc_name, UINT priority)
@@ -221,6 +329,21 @@ CAPI HANDLE LAWINE_API LArcOpenHandle(STRCPTR file_name)
 	return ::g_Archive.OpenHandle(file_name);
 }
 
+CAPI UINT LAWINE_API LArcExtract(CONST STRCPTR *file_names, UINT file_num, STRCPTR dest_path, BOOL *results)
+{
+	if (!dest_path || !*dest_path)
+		return 0U;
+
+	if (!file_names) {
+		DMpq::DDirExtractor extractor(dest_path);
+		return ::g_Archive.ExtractAll(extractor);
+	}
+
+	DMpq::DNameList names(file_names, file_names + file_num);
+	DMpq::DDirExtractor extractor(dest_path, results);
+	return ::g_Archive.ExtractFiles(names, extractor);
+}
+
 /************************************************************************/
 
 CAPI LHTBL LAWINE_API LTblOpen(STRCPTR name)
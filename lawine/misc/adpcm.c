@@ -8,6 +8,11 @@
 
 #include "adpcm.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_DECODE								/* 批量解压时使用SSE2指令同时解压多段数据 */
+#include <emmintrin.h>
+#endif
+
 /*
 		暴雪对WAVE格式的数据采用了ADPCM压缩以减小存储空间。该算法可能是暴雪自创的，
 	我并没有找到该压缩算法所对应的标准。它具有以下特点：
@@ -72,6 +77,8 @@
 #define BETA_SIGN			0x01				/* 符号标志位 */
 #define BETA_DIFF_MAX		0x20000				/* 差值上限 */
 
+#define DECODE_LANE_NUM		8U					/* 批量解压时同时处理的段数，即SSE2寄存器所能容纳的16位整数个数 */
+
 /************************************************************************/
 
 /* 暴雪ADPCM算法所使用的独特的索引表 */
@@ -107,6 +114,30 @@ static CONST INT s_BetaTab6[] = {
 
 /************************************************************************/
 
+/* 解压处理状态，多段同时解压时每段各有一个 */
+struct ADPCM_STATE {
+	BUFCPTR rd_ptr;								/* 当前读取位置 */
+	BUFCPTR rd_end_ptr;							/* 输入结束位置 */
+	SHORT *wrt_ptr;								/* 当前写入位置 */
+	SHORT *wrt_end_ptr;							/* 输出结束位置 */
+	INT type;									/* 压缩类型（位移偏移量） */
+	INT ch;										/* 当前声道 */
+	INT index[2];								/* 各声道的阶索引 */
+	INT pcm_buf[2];								/* 各声道的前一样本值 */
+};
+
+/************************************************************************/
+
+static BOOL init_state(struct ADPCM_STATE *st, INT channels, VCPTR src, UINT src_size, VPTR dest, UINT dest_size);
+static BOOL decode_state(struct ADPCM_STATE *st, INT channels);
+#ifdef SIMD_DECODE
+static VOID decode_lanes(struct ADPCM_STATE *st, INT channels);
+static __m128i gather_step(__m128i index);
+static __m128i gather_index(__m128i byte);
+#endif
+
+/************************************************************************/
+
 BOOL adpcm_encode(INT type, INT channels, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 {
 	INT i, num, bits, ch, sample, raw_diff, step, base, diff;
@@ -260,135 +291,55 @@ BOOL adpcm_encode(INT type, INT channels, VCPTR src, UINT src_size, VPTR dest, U
 
 BOOL adpcm_decode(INT channels, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 {
-	INT i, num, ch, type, sample, diff, step;
-	BYTE byte, mask;
-	BUFCPTR rd_ptr, rd_end_ptr;
-	SHORT *wrt_ptr, *wrt_end_ptr;
-	CONST SHORT *raw_ptr;
-	INT index[2], pcm_buf[2];
+	struct ADPCM_STATE st;
 
 	/* 参数有效性检查 */
-	if (!src || !dest || !dest_size || (channels != ADPCM_MONO && channels != ADPCM_STEREO))
+	if (!dest_size || !init_state(&st, channels, src, src_size, dest, *dest_size))
 		return FALSE;
 
-	/* 压缩数据最小4或6字节 */
-	if (src_size < 2 + channels * SAMPLE_SIZE)
-		return FALSE;
-
-	/* 计算输出缓冲所能容纳的最大样本数 */
-	num = *dest_size / SAMPLE_SIZE;
-
-	/* 输出缓冲至少要能存的下一个完整帧 */
-	if (num < channels)
+	/* 逐字节解压全部数据 */
+	if (!decode_state(&st, channels))
 		return FALSE;
 
-	rd_ptr = src;
-	rd_end_ptr = rd_ptr + src_size;
-	wrt_ptr = dest;
-	wrt_end_ptr = wrt_ptr + num;
-
-	/* 获得压缩类型并跳过数据头 */
-	type = *++rd_ptr;
-	raw_ptr = (CONST SHORT *)(++rd_ptr);
-
-	/* 开头先是一帧的无压缩数据 */
-	for (ch = 0; ch < channels; ch++, raw_ptr++) {
-		*wrt_ptr++ = *raw_ptr;
-		index[ch] = INDEX_INIT;
-		pcm_buf[ch] = *raw_ptr;
-	}
-
-	rd_ptr = (BUFCPTR)raw_ptr;
-
-	/* 主循环，每次处理压缩码的一个字节 */
-	for (ch = 0; rd_ptr < rd_end_ptr; ) {
-
-		byte = *rd_ptr++;
-
-		/* 判断是否命令码 */
-		if (byte & MASK_CMD) {
-
-			switch (byte) {
+	/* 计算输出数据的大小 */
+	*dest_size = (UINT)(st.wrt_ptr - (SHORT *)dest) * SAMPLE_SIZE;
 
-			/* 忽略 */
-			case CMD_IGN:
-				break;
+	return TRUE;
+}
 
-			/* 重复前一次的样本 */
-			case CMD_REP:
-				if (wrt_ptr >= wrt_end_ptr)
-					return FALSE;
-				if (index[ch])
-					index[ch]--;
-				*wrt_ptr++ = pcm_buf[ch];
-				break;
+BOOL adpcm_decode_batch(INT channels, UINT num, CONST VCPTR *src, CONST UINT *src_size, CONST VPTR *dest, UINT *dest_size)
+{
+	UINT i, j, lane_cnt;
+	struct ADPCM_STATE st[DECODE_LANE_NUM];
 
-			/* 跳增阶 */
-			case CMD_STEP:
-				index[ch] += INDEX_STEP;
-				if (index[ch] > INDEX_MAX)
-					index[ch] = INDEX_MAX;
-				/* 跳阶后的下一个处理并不需要切换声道 */
-				continue;
+	/* 参数有效性检查 */
+	if (!src || !src_size || !dest || !dest_size)
+		return FALSE;
 
-			/* 跳降阶 */
-			default:
-				index[ch] -= INDEX_STEP;
-				if (index[ch] < INDEX_MIN)
-					index[ch] = INDEX_MIN;
-				/* 跳阶后的下一个处理并不需要切换声道 */
-				continue;
-			}
+	/* 每次取DECODE_LANE_NUM段数据，各段之间没有依赖关系 */
+	for (i = 0; i < num; i += lane_cnt) {
 
-		} else {
+		lane_cnt = DMin(num - i, DECODE_LANE_NUM);
 
-			/* 写缓冲不足，失败 */
-			if (wrt_ptr >= wrt_end_ptr)
+		for (j = 0; j < lane_cnt; j++) {
+			if (!init_state(&st[j], channels, src[i + j], src_size[i + j], dest[i + j], dest_size[i + j]))
 				return FALSE;
+		}
 
-			/* 差值还原处理 */
-			step = s_StepTab[index[ch]];
-			diff = step >> type;
-
-			/* 注意：下面这个循环的代码的执行效率直接影响到解压速度 */
-			for (i = 0, mask = 0x01; i < 6; i++, mask <<= 1, step >>= 1) {
-				if (byte & mask)
-					diff += step;
-			}
-
-			sample = pcm_buf[ch];
-
-			/* 通过补回差值还原样本波形，由于ADPCM是有损压缩，该样本值可能与原始值不同 */
-			if (byte & MASK_SIGN) {
-				sample -= diff;
-				if (sample < SAMPLE_MIN)
-					sample = SAMPLE_MIN;
-			} else {
-				sample += diff;
-				if (sample > SAMPLE_MAX)
-					sample = SAMPLE_MAX;
-			}
-
-			/* 写样本数据到输出缓冲 */
-			*wrt_ptr++ = sample;
+#ifdef SIMD_DECODE
+		/* 凑齐时先用SIMD指令同时解压各段的共同部分 */
+		if (lane_cnt == DECODE_LANE_NUM)
+			decode_lanes(st, channels);
+#endif
 
-			/* 更新该声道各压缩参数 */
-			pcm_buf[ch] = sample;
-			index[ch] += s_IndexTab[byte & 0x1f];
-			if (index[ch] < INDEX_MIN)
-				index[ch] = INDEX_MIN;
-			else if (index[ch] > INDEX_MAX)
-				index[ch] = INDEX_MAX;
+		/* 各段剩余的部分逐段解压 */
+		for (j = 0; j < lane_cnt; j++) {
+			if (!decode_state(&st[j], channels))
+				return FALSE;
+			dest_size[i + j] = (UINT)(st[j].wrt_ptr - (SHORT *)dest[i + j]) * SAMPLE_SIZE;
 		}
-
-		/* 在多个声道间来回切换 */
-		if (++ch >= channels)
-			ch = 0;
 	}
 
-	/* 计算输出数据的大小 */
-	*dest_size = (UINT)(wrt_ptr - (SHORT *)dest) * SAMPLE_SIZE;
-
 	return TRUE;
 }
 
@@ -734,3 +685,412 @@ BOOL adpcm_beta_decode(INT channels, VCPTR src, UINT src_size, VPTR dest, UINT *
 }
 
 /************************************************************************/
+
+static BOOL init_state(struct ADPCM_STATE *st, INT channels, VCPTR src, UINT src_size, VPTR dest, UINT dest_size)
+{
+	INT ch, num;
+	CONST SHORT *raw_ptr;
+
+	DAssert(st);
+
+	/* 参数有效性检查 */
+	if (!src || !dest || (channels != ADPCM_MONO && channels != ADPCM_STEREO))
+		return FALSE;
+
+	/* 压缩数据最小4或6字节 */
+	if (src_size < 2 + channels * SAMPLE_SIZE)
+		return FALSE;
+
+	/* 计算输出缓冲所能容纳的最大样本数 */
+	num = dest_size / SAMPLE_SIZE;
+
+	/* 输出缓冲至少要能存的下一个完整帧 */
+	if (num < channels)
+		return FALSE;
+
+	st->rd_ptr = src;
+	st->rd_end_ptr = st->rd_ptr + src_size;
+	st->wrt_ptr = dest;
+	st->wrt_end_ptr = st->wrt_ptr + num;
+
+	/* 获得压缩类型并跳过数据头 */
+	st->type = *++st->rd_ptr;
+	raw_ptr = (CONST SHORT *)(++st->rd_ptr);
+
+	/* 开头先是一帧的无压缩数据 */
+	for (ch = 0; ch < channels; ch++, raw_ptr++) {
+		*st->wrt_ptr++ = *raw_ptr;
+		st->index[ch] = INDEX_INIT;
+		st->pcm_buf[ch] = *raw_ptr;
+	}
+
+	st->rd_ptr = (BUFCPTR)raw_ptr;
+	st->ch = 0;
+
+	return TRUE;
+}
+
+static BOOL decode_state(struct ADPCM_STATE *st, INT channels)
+{
+	INT ch, type, index, sample, diff, step, tmp;
+	INT other_index, other_sample;
+	BYTE byte;
+	BUFCPTR rd_ptr, rd_end_ptr;
+	SHORT *wrt_ptr, *wrt_end_ptr;
+
+	DAssert(st);
+
+	/* 解压参数放在局部变量中，当前声道与另一声道的参数在切换声道时互换 */
+	rd_ptr = st->rd_ptr;
+	rd_end_ptr = st->rd_end_ptr;
+	wrt_ptr = st->wrt_ptr;
+	wrt_end_ptr = st->wrt_end_ptr;
+	type = st->type;
+	ch = st->ch;
+	index = st->index[ch];
+	sample = st->pcm_buf[ch];
+	other_index = st->index[channels - 1 - ch];
+	other_sample = st->pcm_buf[channels - 1 - ch];
+
+	/* 主循环，每次处理压缩码的一个字节 */
+	while (rd_ptr < rd_end_ptr) {
+
+		byte = *rd_ptr++;
+
+		/* 判断是否命令码 */
+		if (byte & MASK_CMD) {
+
+			switch (byte) {
+
+			/* 忽略 */
+			case CMD_IGN:
+				break;
+
+			/* 重复前一次的样本 */
+			case CMD_REP:
+				if (wrt_ptr >= wrt_end_ptr)
+					return FALSE;
+				if (index)
+					index--;
+				*wrt_ptr++ = sample;
+				break;
+
+			/* 跳增阶 */
+			case CMD_STEP:
+				index += INDEX_STEP;
+				if (index > INDEX_MAX)
+					index = INDEX_MAX;
+				/* 跳阶后的下一个处理并不需要切换声道 */
+				continue;
+
+			/* 跳降阶 */
+			default:
+				index -= INDEX_STEP;
+				if (index < INDEX_MIN)
+					index = INDEX_MIN;
+				/* 跳阶后的下一个处理并不需要切换声道 */
+				continue;
+			}
+
+		} else {
+
+			/* 写缓冲不足，失败 */
+			if (wrt_ptr >= wrt_end_ptr)
+				return FALSE;
+
+			/* 差值还原处理，各数据位所对应的差值用掩码累加，避免难以预测的分支 */
+			step = s_StepTab[index];
+			diff = step >> type;
+			diff += step & -(byte & 0x01);
+			diff += (step >> 1) & -((byte >> 1) & 0x01);
+			diff += (step >> 2) & -((byte >> 2) & 0x01);
+			diff += (step >> 3) & -((byte >> 3) & 0x01);
+			diff += (step >> 4) & -((byte >> 4) & 0x01);
+			diff += (step >> 5) & -((byte >> 5) & 0x01);
+
+			/* 通过补回差值还原样本波形，由于ADPCM是有损压缩，该样本值可能与原始值不同 */
+			if (byte & MASK_SIGN)
+				diff = -diff;
+
+			sample += diff;
+			if (sample < SAMPLE_MIN)
+				sample = SAMPLE_MIN;
+			else if (sample > SAMPLE_MAX)
+				sample = SAMPLE_MAX;
+
+			/* 写样本数据到输出缓冲 */
+			*wrt_ptr++ = sample;
+
+			/* 更新该声道的阶索引 */
+			index += s_IndexTab[byte & 0x1f];
+			if (index < INDEX_MIN)
+				index = INDEX_MIN;
+			else if (index > INDEX_MAX)
+				index = INDEX_MAX;
+		}
+
+		/* 在两个声道间来回切换 */
+		if (channels == ADPCM_STEREO) {
+			tmp = index;
+			index = other_index;
+			other_index = tmp;
+			tmp = sample;
+			sample = other_sample;
+			other_sample = tmp;
+			ch ^= 1;
+		}
+	}
+
+	/* 保存解压参数 */
+	st->rd_ptr = rd_ptr;
+	st->wrt_ptr = wrt_ptr;
+	st->ch = ch;
+	st->index[ch] = index;
+	st->pcm_buf[ch] = sample;
+	st->index[channels - 1 - ch] = other_index;
+	st->pcm_buf[channels - 1 - ch] = other_sample;
+
+	return TRUE;
+}
+
+#ifdef SIMD_DECODE
+static VOID decode_lanes(struct ADPCM_STATE *st, INT channels)
+{
+	UINT i, j, cnt, rest, mask;
+	INT ch, done[DECODE_LANE_NUM];
+	SHORT buf[DECODE_LANE_NUM];
+	__m128i shift, byte, cmd, rep, step, ign, other, delta, diff, bits, tmp, sign, sample, keep, swap;
+	__m128i index, sample_vec, other_index, other_sample, chan;
+	__m128i in[DECODE_LANE_NUM], out[DECODE_LANE_NUM], t[DECODE_LANE_NUM];
+	__m128i zero, one, sign_bit, cmd_min, code_rep, code_step, code_ign, eight, minus_eight, index_max;
+
+	DAssert(st);
+
+	/* 各段的压缩类型（位移偏移量）必须一致，否则无法一起处理 */
+	for (i = 1; i < DECODE_LANE_NUM; i++) {
+		if (st[i].type != st[0].type)
+			return;
+	}
+
+	/* 类型值过大时移位结果与普通处理不同，交给普通处理 */
+	if ((UINT)st[0].type >= 16)
+		return;
+
+	/* 各段剩余输入字节数及输出样本数中的最小值，每个字节最多输出一个样本，在此范围内无需检查输出缓冲 */
+	cnt = 0xffffffffU;
+
+	for (i = 0; i < DECODE_LANE_NUM; i++) {
+		rest = (UINT)(st[i].rd_end_ptr - st[i].rd_ptr);
+		cnt = DMin(cnt, rest);
+		rest = (UINT)(st[i].wrt_end_ptr - st[i].wrt_ptr);
+		cnt = DMin(cnt, rest);
+	}
+
+	/* 每次处理各段的DECODE_LANE_NUM个字节 */
+	cnt &= ~(DECODE_LANE_NUM - 1);
+	if (!cnt)
+		return;
+
+	zero = _mm_setzero_si128();
+	one = _mm_set1_epi16(1);
+	sign_bit = _mm_set1_epi16(-0x8000);
+	cmd_min = _mm_set1_epi16(MASK_CMD - 1);
+	code_rep = _mm_set1_epi16(CMD_REP);
+	code_step = _mm_set1_epi16(CMD_STEP);
+	code_ign = _mm_set1_epi16(CMD_IGN);
+	eight = _mm_set1_epi16(INDEX_STEP);
+	minus_eight = _mm_set1_epi16(-INDEX_STEP);
+	index_max = _mm_set1_epi16(INDEX_MAX);
+	shift = _mm_cvtsi32_si128(st[0].type);
+
+	/* 每个16位整数对应一段，当前声道与另一声道的参数分别放在两个寄存器中，chan为各段的当前声道 */
+	index = _mm_setr_epi16(
+		st[0].index[st[0].ch], st[1].index[st[1].ch], st[2].index[st[2].ch], st[3].index[st[3].ch],
+		st[4].index[st[4].ch], st[5].index[st[5].ch], st[6].index[st[6].ch], st[7].index[st[7].ch]);
+	sample_vec = _mm_setr_epi16(
+		st[0].pcm_buf[st[0].ch], st[1].pcm_buf[st[1].ch], st[2].pcm_buf[st[2].ch], st[3].pcm_buf[st[3].ch],
+		st[4].pcm_buf[st[4].ch], st[5].pcm_buf[st[5].ch], st[6].pcm_buf[st[6].ch], st[7].pcm_buf[st[7].ch]);
+	other_index = index;
+	other_sample = sample_vec;
+	chan = zero;
+
+	if (channels == ADPCM_STEREO) {
+		other_index = _mm_setr_epi16(
+			st[0].index[!st[0].ch], st[1].index[!st[1].ch], st[2].index[!st[2].ch], st[3].index[!st[3].ch],
+			st[4].index[!st[4].ch], st[5].index[!st[5].ch], st[6].index[!st[6].ch], st[7].index[!st[7].ch]);
+		other_sample = _mm_setr_epi16(
+			st[0].pcm_buf[!st[0].ch], st[1].pcm_buf[!st[1].ch], st[2].pcm_buf[!st[2].ch], st[3].pcm_buf[!st[3].ch],
+			st[4].pcm_buf[!st[4].ch], st[5].pcm_buf[!st[5].ch], st[6].pcm_buf[!st[6].ch], st[7].pcm_buf[!st[7].ch]);
+		chan = _mm_setr_epi16(
+			-st[0].ch, -st[1].ch, -st[2].ch, -st[3].ch, -st[4].ch, -st[5].ch, -st[6].ch, -st[7].ch);
+	}
+
+	for (; cnt; cnt -= DECODE_LANE_NUM) {
+
+		/* 读入各段接下来的8个字节并转置，使in[j]为各段的第j个字节 */
+		for (i = 0; i < DECODE_LANE_NUM; i++) {
+			t[i] = _mm_loadl_epi64((CONST __m128i *)st[i].rd_ptr);
+			st[i].rd_ptr += DECODE_LANE_NUM;
+		}
+
+		t[0] = _mm_unpacklo_epi8(t[0], t[1]);
+		t[1] = _mm_unpacklo_epi8(t[2], t[3]);
+		t[2] = _mm_unpacklo_epi8(t[4], t[5]);
+		t[3] = _mm_unpacklo_epi8(t[6], t[7]);
+		t[4] = _mm_unpacklo_epi16(t[0], t[1]);
+		t[5] = _mm_unpackhi_epi16(t[0], t[1]);
+		t[6] = _mm_unpacklo_epi16(t[2], t[3]);
+		t[7] = _mm_unpackhi_epi16(t[2], t[3]);
+		t[0] = _mm_unpacklo_epi32(t[4], t[6]);
+		t[1] = _mm_unpackhi_epi32(t[4], t[6]);
+		t[2] = _mm_unpacklo_epi32(t[5], t[7]);
+		t[3] = _mm_unpackhi_epi32(t[5], t[7]);
+
+		for (i = 0; i < 4; i++) {
+			in[i * 2] = _mm_unpacklo_epi8(t[i], zero);
+			in[i * 2 + 1] = _mm_unpackhi_epi8(t[i], zero);
+		}
+
+		mask = 0xffffU;
+
+		for (j = 0; j < DECODE_LANE_NUM; j++) {
+
+			byte = in[j];
+
+			/* 区分各种命令码 */
+			cmd = _mm_cmpgt_epi16(byte, cmd_min);
+			rep = _mm_cmpeq_epi16(byte, code_rep);
+			step = _mm_cmpeq_epi16(byte, code_step);
+			ign = _mm_cmpeq_epi16(byte, code_ign);
+			other = _mm_andnot_si128(_mm_or_si128(_mm_or_si128(rep, step), ign), cmd);
+
+			/* 阶索引的变化量：数据字节查表，重复命令-1，增阶命令+8，降阶命令-8，忽略命令不变 */
+			delta = _mm_or_si128(rep, _mm_or_si128(_mm_and_si128(step, eight), _mm_and_si128(other, minus_eight)));
+			delta = _mm_or_si128(_mm_and_si128(cmd, delta), _mm_andnot_si128(cmd, gather_index(byte)));
+
+			/* 差值还原处理，差值超过16位时饱和，这不会影响之后的样本值上下限处理的结果 */
+			tmp = gather_step(index);
+			diff = _mm_srl_epi16(tmp, shift);
+			bits = byte;
+
+			for (i = 0; i < 6; i++) {
+				diff = _mm_adds_epu16(diff, _mm_and_si128(tmp, _mm_sub_epi16(zero, _mm_and_si128(bits, one))));
+				bits = _mm_srli_epi16(bits, 1);
+				tmp = _mm_srli_epi16(tmp, 1);
+			}
+
+			/* 将样本值偏移到无符号范围内，用饱和加减法实现上下限处理 */
+			sign = _mm_cmpeq_epi16(_mm_and_si128(byte, _mm_set1_epi16(MASK_SIGN)), zero);
+			sample = _mm_xor_si128(sample_vec, sign_bit);
+			sample = _mm_or_si128(_mm_and_si128(sign, _mm_adds_epu16(sample, diff)), _mm_andnot_si128(sign, _mm_subs_epu16(sample, diff)));
+			sample = _mm_xor_si128(sample, sign_bit);
+
+			/* 只有数据字节更新样本值，重复命令输出原样本值 */
+			sample_vec = _mm_or_si128(_mm_and_si128(cmd, sample_vec), _mm_andnot_si128(cmd, sample));
+			index = _mm_max_epi16(_mm_min_epi16(_mm_add_epi16(index, delta), index_max), zero);
+			out[j] = sample_vec;
+
+			/* 数据字节和重复命令输出样本 */
+			keep = _mm_andnot_si128(rep, cmd);
+			mask &= ~_mm_movemask_epi8(keep);
+
+			/* 除跳阶命令外都要切换声道 */
+			if (channels == ADPCM_STEREO) {
+				swap = _mm_andnot_si128(_mm_or_si128(step, other), _mm_cmpeq_epi16(zero, zero));
+				tmp = _mm_and_si128(_mm_xor_si128(index, other_index), swap);
+				index = _mm_xor_si128(index, tmp);
+				other_index = _mm_xor_si128(other_index, tmp);
+				tmp = _mm_and_si128(_mm_xor_si128(sample_vec, other_sample), swap);
+				sample_vec = _mm_xor_si128(sample_vec, tmp);
+				other_sample = _mm_xor_si128(other_sample, tmp);
+				chan = _mm_xor_si128(chan, swap);
+			}
+
+			done[j] = _mm_movemask_epi8(keep);
+		}
+
+		/* 转置输出结果，使t[i]为第i段的8个样本 */
+		t[0] = _mm_unpacklo_epi16(out[0], out[1]);
+		t[1] = _mm_unpackhi_epi16(out[0], out[1]);
+		t[2] = _mm_unpacklo_epi16(out[2], out[3]);
+		t[3] = _mm_unpackhi_epi16(out[2], out[3]);
+		t[4] = _mm_unpacklo_epi16(out[4], out[5]);
+		t[5] = _mm_unpackhi_epi16(out[4], out[5]);
+		t[6] = _mm_unpacklo_epi16(out[6], out[7]);
+		t[7] = _mm_unpackhi_epi16(out[6], out[7]);
+		out[0] = _mm_unpacklo_epi32(t[0], t[2]);
+		out[1] = _mm_unpackhi_epi32(t[0], t[2]);
+		out[2] = _mm_unpacklo_epi32(t[1], t[3]);
+		out[3] = _mm_unpackhi_epi32(t[1], t[3]);
+		out[4] = _mm_unpacklo_epi32(t[4], t[6]);
+		out[5] = _mm_unpackhi_epi32(t[4], t[6]);
+		out[6] = _mm_unpacklo_epi32(t[5], t[7]);
+		out[7] = _mm_unpackhi_epi32(t[5], t[7]);
+		t[0] = _mm_unpacklo_epi64(out[0], out[4]);
+		t[1] = _mm_unpackhi_epi64(out[0], out[4]);
+		t[2] = _mm_unpacklo_epi64(out[1], out[5]);
+		t[3] = _mm_unpackhi_epi64(out[1], out[5]);
+		t[4] = _mm_unpacklo_epi64(out[2], out[6]);
+		t[5] = _mm_unpackhi_epi64(out[2], out[6]);
+		t[6] = _mm_unpacklo_epi64(out[3], out[7]);
+		t[7] = _mm_unpackhi_epi64(out[3], out[7]);
+
+		/* 通常各段的8个字节都输出了样本，可以整体写入 */
+		if (mask == 0xffffU) {
+			for (i = 0; i < DECODE_LANE_NUM; i++) {
+				_mm_storeu_si128((__m128i *)st[i].wrt_ptr, t[i]);
+				st[i].wrt_ptr += DECODE_LANE_NUM;
+			}
+			continue;
+		}
+
+		/* 否则逐段只写出输出了样本的部分 */
+		for (i = 0; i < DECODE_LANE_NUM; i++) {
+			_mm_storeu_si128((__m128i *)buf, t[i]);
+			for (j = 0; j < DECODE_LANE_NUM; j++) {
+				if (!(done[j] & (1 << (i * 2))))
+					*st[i].wrt_ptr++ = buf[j];
+			}
+		}
+	}
+
+	/* 保存各段的解压参数 */
+	for (i = 0; i < DECODE_LANE_NUM; i++) {
+		_mm_storeu_si128((__m128i *)buf, chan);
+		ch = buf[i] & 1;
+		st[i].ch = ch;
+		_mm_storeu_si128((__m128i *)buf, index);
+		st[i].index[ch] = buf[i];
+		_mm_storeu_si128((__m128i *)buf, sample_vec);
+		st[i].pcm_buf[ch] = buf[i];
+		if (channels == ADPCM_STEREO) {
+			_mm_storeu_si128((__m128i *)buf, other_index);
+			st[i].index[!ch] = buf[i];
+			_mm_storeu_si128((__m128i *)buf, other_sample);
+			st[i].pcm_buf[!ch] = buf[i];
+		}
+	}
+}
+
+static __m128i gather_step(__m128i index)
+{
+	/* SSE2没有查表指令，逐个取出阶索引查表 */
+	return _mm_setr_epi16(
+		s_StepTab[_mm_extract_epi16(index, 0)], s_StepTab[_mm_extract_epi16(index, 1)],
+		s_StepTab[_mm_extract_epi16(index, 2)], s_StepTab[_mm_extract_epi16(index, 3)],
+		s_StepTab[_mm_extract_epi16(index, 4)], s_StepTab[_mm_extract_epi16(index, 5)],
+		s_StepTab[_mm_extract_epi16(index, 6)], s_StepTab[_mm_extract_epi16(index, 7)]);
+}
+
+static __m128i gather_index(__m128i byte)
+{
+	/* 同上，命令码的查表结果无意义，之后会被替换 */
+	return _mm_setr_epi16(
+		s_IndexTab[_mm_extract_epi16(byte, 0) & 0x1f], s_IndexTab[_mm_extract_epi16(byte, 1) & 0x1f],
+		s_IndexTab[_mm_extract_epi16(byte, 2) & 0x1f], s_IndexTab[_mm_extract_epi16(byte, 3) & 0x1f],
+		s_IndexTab[_mm_extract_epi16(byte, 4) & 0x1f], s_IndexTab[_mm_extract_epi16(byte, 5) & 0x1f],
+		s_IndexTab[_mm_extract_epi16(byte, 6) & 0x1f], s_IndexTab[_mm_extract_epi16(byte, 7) & 0x1f]);
+}
+#endif
+
+/************************************************************************/
@@ -22,6 +22,7 @@
 
 CAPI extern BOOL adpcm_encode(INT type, INT channels, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
 CAPI extern BOOL adpcm_decode(INT channels, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL adpcm_decode_batch(INT channels, UINT num, CONST VCPTR *src, CONST UINT *src_size, CONST VPTR *dest, UINT *dest_size);
 
 CAPI extern BOOL adpcm_beta_encode(INT type, INT channels, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
 CAPI extern BOOL adpcm_beta_decode(INT channels, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
@@ -0,0 +1,1147 @@
+﻿/************************************************************************/
+/* File Name   : bzip2.c                                                */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Lawine library                                         */
+/* Descript    : Bzip2 compression API implementation                   */
+/************************************************************************/
+
+#include "bzip2.h"
+
+/*
+		这是bzip2的压缩格式，即MPQ中压缩类型0x10所使用的格式。每个块依次经过了游程编码、
+	Burrows-Wheeler变换、MTF变换和零的游程编码，最后用多组霍夫曼编码输出。
+
+		MPQ的扇区很小，为了不分配内存，不使用编解码上下文时所有状态都放在栈上：解压时每块最多DEC_BLOCK_MAX个字节
+	（16KB的扇区经过游程编码以后不会超过这个大小），压缩时每块最多ENC_BLOCK_MAX个字节，较大的
+	输入会被分成多个块。
+
+		压缩时的Burrows-Wheeler变换使用前缀倍增法对循环移位排序，完全相同的循环移位之间的
+	顺序不影响结果。
+*/
+
+/************************************************************************/
+
+#define MAX_GROUPS			6							/* 霍夫曼编码组的最大个数 */
+#define MIN_GROUPS			2							/* 霍夫曼编码组的最小个数 */
+#define MAX_ALPHA			258							/* 符号的最大个数 */
+#define MAX_CODE_LEN		20							/* 解码时允许的最大码长 */
+#define ENC_CODE_LEN		17							/* 编码时生成的最大码长 */
+#define GROUP_SIZE			50							/* 每组符号的个数 */
+#define ITER_NUM			4							/* 优化编码组的迭代次数 */
+
+#define RUN_A				0							/* 零游程的符号 */
+#define RUN_B				1
+#define MAX_RUN				255							/* 块的游程编码中一次游程的最大长度 */
+
+#define DEC_BLOCK_MAX		0x5000						/* 解压时每块的最大字节数 */
+#define ENC_BLOCK_MAX		0x2000						/* 压缩时每块的最大字节数 */
+#define DEC_SELECTOR_MAX	(DEC_BLOCK_MAX / GROUP_SIZE + 2)	/* 解压时编码组选择的最大个数 */
+#define ENC_SELECTOR_MAX	(ENC_BLOCK_MAX / GROUP_SIZE + 2)	/* 压缩时编码组选择的最大个数 */
+
+#define BLOCK_MAGIC_HI		0x314159UL					/* 块的标识（圆周率） */
+#define BLOCK_MAGIC_LO		0x265359UL
+#define END_MAGIC_HI		0x177245UL					/* 流结束的标识（根号圆周率） */
+#define END_MAGIC_LO		0x385090UL
+
+/************************************************************************/
+
+/* 读位数据流（高位在前） */
+struct BIT_READER {
+	BUFCPTR cur_ptr;								/* 当前数据指针 */
+	BUFCPTR end_ptr;								/* 结束位置指针 */
+	UINT bit_cnt;									/* 缓冲位数 */
+	DWORD bit_buf;									/* 缓冲数据 */
+	UINT pad_cnt;									/* 超出输入末尾而补上的零字节数 */
+};
+
+/* 写位数据流（高位在前） */
+struct BIT_WRITER {
+	BUFPTR cur_ptr;									/* 当前数据指针 */
+	BUFPTR end_ptr;									/* 结束位置指针 */
+	UINT bit_cnt;									/* 缓冲位数 */
+	DWORD bit_buf;									/* 缓冲数据 */
+	BOOL overflow;									/* 输出缓冲是否已经不足 */
+};
+
+/* 解码用的霍夫曼编码组 */
+struct HUFF_GROUP {
+	INT limit[MAX_CODE_LEN + 2];					/* 各码长的最大编码值 */
+	INT base[MAX_CODE_LEN + 2];						/* 各码长的编码值到符号序号的偏移 */
+	INT perm[MAX_ALPHA];							/* 按编码顺序排列的符号 */
+	INT min_len;									/* 最小码长 */
+	INT max_len;									/* 最大码长 */
+};
+
+/* 解压状态 */
+struct BZ_DECODER {
+	DWORD tt[DEC_BLOCK_MAX];						/* 块数据，低8位为字节，其上为逆变换的链接 */
+	struct HUFF_GROUP group[MAX_GROUPS];			/* 霍夫曼编码组 */
+	BYTE selector[DEC_SELECTOR_MAX];				/* 每组符号所使用的编码组 */
+	BYTE seq_to_unseq[0x100];						/* 符号序号到字节值的映射 */
+	UINT unzftab[0x100];							/* 各字节值的出现次数 */
+	UINT nblock;									/* 块的字节数 */
+	UINT orig_ptr;									/* 原始数据在排序后的位置 */
+};
+
+/* 压缩状态 */
+struct BZ_ENCODER {
+	BYTE block[ENC_BLOCK_MAX];						/* 经过游程编码的块数据 */
+	WORD sa[ENC_BLOCK_MAX];							/* 排序后的循环移位起点 */
+	WORD rank[ENC_BLOCK_MAX];						/* 各循环移位的排名 */
+	WORD tmp[ENC_BLOCK_MAX + 1];					/* 排序时的临时数据，之后存放MTF变换的结果 */
+	WORD count[ENC_BLOCK_MAX];						/* 计数排序用的计数 */
+	UINT freq[MAX_GROUPS][MAX_ALPHA];				/* 各编码组的符号频率 */
+	BYTE len[MAX_GROUPS][MAX_ALPHA];				/* 各编码组的码长 */
+	DWORD code[MAX_GROUPS][MAX_ALPHA];				/* 各编码组的编码 */
+	BYTE selector[ENC_SELECTOR_MAX];				/* 每组符号所使用的编码组 */
+	BYTE unseq_to_seq[0x100];						/* 字节值到符号序号的映射 */
+	BOOL in_use[0x100];								/* 字节值是否出现过 */
+	UINT mtf_freq[MAX_ALPHA];						/* MTF变换后各符号的频率 */
+	UINT nblock;									/* 块的字节数 */
+	UINT orig_ptr;									/* 原始数据在排序后的位置 */
+	UINT nmtf;										/* MTF变换后的符号个数 */
+	UINT nin_use;									/* 出现过的字节值个数 */
+};
+
+/************************************************************************/
+
+/* bzip2使用的CRC32（多项式0x04c11db7，高位在前） */
+static CONST DWORD s_CrcTable[0x100] = {
+    0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
+    0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd,
+    0x4c11db70, 0x48d0c6c7, 0x4593e01e, 0x4152fda9, 0x5f15adac, 0x5bd4b01b, 0x569796c2, 0x52568b75,
+    0x6a1936c8, 0x6ed82b7f, 0x639b0da6, 0x675a1011, 0x791d4014, 0x7ddc5da3, 0x709f7b7a, 0x745e66cd,
+    0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039, 0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5,
+    0xbe2b5b58, 0xbaea46ef, 0xb7a96036, 0xb3687d81, 0xad2f2d84, 0xa9ee3033, 0xa4ad16ea, 0xa06c0b5d,
+    0xd4326d90, 0xd0f37027, 0xddb056fe, 0xd9714b49, 0xc7361b4c, 0xc3f706fb, 0xceb42022, 0xca753d95,
+    0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1, 0xe13ef6f4, 0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d,
+    0x34867077, 0x30476dc0, 0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5, 0x2ac12072,
+    0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16, 0x018aeb13, 0x054bf6a4, 0x0808d07d, 0x0cc9cdca,
+    0x7897ab07, 0x7c56b6b0, 0x71159069, 0x75d48dde, 0x6b93dddb, 0x6f52c06c, 0x6211e6b5, 0x66d0fb02,
+    0x5e9f46bf, 0x5a5e5b08, 0x571d7dd1, 0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
+    0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e, 0xbfa1b04b, 0xbb60adfc, 0xb6238b25, 0xb2e29692,
+    0x8aad2b2f, 0x8e6c3698, 0x832f1041, 0x87ee0df6, 0x99a95df3, 0x9d684044, 0x902b669d, 0x94ea7b2a,
+    0xe0b41de7, 0xe4750050, 0xe9362689, 0xedf73b3e, 0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2,
+    0xc6bcf05f, 0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34, 0xdc3abded, 0xd8fba05a,
+    0x690ce0ee, 0x6dcdfd59, 0x608edb80, 0x644fc637, 0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb,
+    0x4f040d56, 0x4bc510e1, 0x46863638, 0x42472b8f, 0x5c007b8a, 0x58c1663d, 0x558240e4, 0x51435d53,
+    0x251d3b9e, 0x21dc2629, 0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5, 0x3f9b762c, 0x3b5a6b9b,
+    0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff, 0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623,
+    0xf12f560e, 0xf5ee4bb9, 0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65, 0xeba91bbc, 0xef68060b,
+    0xd727bbb6, 0xd3e6a601, 0xdea580d8, 0xda649d6f, 0xc423cd6a, 0xc0e2d0dd, 0xcda1f604, 0xc960ebb3,
+    0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7, 0xae3afba2, 0xaafbe615, 0xa7b8c0cc, 0xa379dd7b,
+    0x9b3660c6, 0x9ff77d71, 0x92b45ba8, 0x9675461f, 0x8832161a, 0x8cf30bad, 0x81b02d74, 0x857130c3,
+    0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640, 0x4e8ee645, 0x4a4ffbf2, 0x470cdd2b, 0x43cdc09c,
+    0x7b827d21, 0x7f436096, 0x7200464f, 0x76c15bf8, 0x68860bfd, 0x6c47164a, 0x61043093, 0x65c52d24,
+    0x119b4be9, 0x155a565e, 0x18197087, 0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
+    0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d, 0x2056cd3a, 0x2d15ebe3, 0x29d4f654,
+    0xc5a92679, 0xc1683bce, 0xcc2b1d17, 0xc8ea00a0, 0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb, 0xdbee767c,
+    0xe3a1cbc1, 0xe760d676, 0xea23f0af, 0xeee2ed18, 0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4,
+    0x89b8fd09, 0x8d79e0be, 0x803ac667, 0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662, 0x933eb0bb, 0x97ffad0c,
+    0xafb010b1, 0xab710d06, 0xa6322bdf, 0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4,
+};
+
+/************************************************************************/
+
+/* 压缩解压处理 */
+static BOOL encode_stream(struct BZ_ENCODER *enc, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+static BOOL decode_stream(struct BZ_DECODER *dec, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+
+/* 位数据流操作函数 */
+static VOID init_reader(struct BIT_READER *br, VCPTR start, VCPTR end);
+static UINT get_bits(struct BIT_READER *br, UINT num);
+static VOID init_writer(struct BIT_WRITER *bw, VPTR start, VPTR end);
+static VOID put_bits(struct BIT_WRITER *bw, UINT bits, UINT num);
+static VOID flush_writer(struct BIT_WRITER *bw);
+
+/* 解压处理函数 */
+static BOOL read_block(struct BIT_READER *br, struct BZ_DECODER *dec);
+static BOOL make_decode_table(struct HUFF_GROUP *group, CONST BYTE *lens, INT alpha_size);
+static BOOL output_block(struct BZ_DECODER *dec, BUFPTR *wrt_ptr, BUFPTR wrt_end_ptr, DWORD *crc);
+
+/* 压缩处理函数 */
+static UINT fill_block(struct BZ_ENCODER *enc, BUFCPTR src, UINT src_size, DWORD *crc);
+static VOID sort_block(struct BZ_ENCODER *enc);
+static VOID mtf_block(struct BZ_ENCODER *enc);
+static VOID write_block(struct BZ_ENCODER *enc, struct BIT_WRITER *bw, DWORD crc);
+static VOID make_lengths(CONST UINT *freq, INT num, INT limit, BYTE *lens);
+
+/* 辅助函数 */
+static DWORD crc_update(DWORD crc, BUFCPTR buf, UINT size);
+
+/************************************************************************/
+
+BOOL bz2_encode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	struct BZ_ENCODER enc;
+
+	/* 不使用上下文时工作状态在栈上 */
+	return encode_stream(&enc, src, src_size, dest, dest_size);
+}
+
+BOOL bz2_decode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	struct BZ_DECODER dec;
+
+	return decode_stream(&dec, src, src_size, dest, dest_size);
+}
+
+BOOL bz2_encode_ctx(struct CODEC_CONTEXT *ctx, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	struct BZ_ENCODER *enc;
+
+	/* 工作状态由上下文持有，每个块开始时都会重新初始化 */
+	enc = get_codec_work(ctx, CODEC_WORK_BZ2_ENC, sizeof(struct BZ_ENCODER));
+	if (!enc)
+		return FALSE;
+
+	return encode_stream(enc, src, src_size, dest, dest_size);
+}
+
+BOOL bz2_decode_ctx(struct CODEC_CONTEXT *ctx, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	struct BZ_DECODER *dec;
+
+	/* 同上 */
+	dec = get_codec_work(ctx, CODEC_WORK_BZ2_DEC, sizeof(struct BZ_DECODER));
+	if (!dec)
+		return FALSE;
+
+	return decode_stream(dec, src, src_size, dest, dest_size);
+}
+
+/************************************************************************/
+
+static BOOL encode_stream(struct BZ_ENCODER *enc, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	UINT size;
+	DWORD crc, combined_crc;
+	BUFCPTR rd_ptr;
+	BUFPTR wrt_ptr;
+	struct BIT_WRITER bw;
+
+	DAssert(enc);
+
+	/* 参数有效性检查 */
+	if (!src || !src_size || !dest || !dest_size || *dest_size < 4)
+		return FALSE;
+
+	/* 流头部，块都很小，标为最小的块大小即可 */
+	wrt_ptr = dest;
+	*wrt_ptr++ = 'B';
+	*wrt_ptr++ = 'Z';
+	*wrt_ptr++ = 'h';
+	*wrt_ptr++ = '1';
+
+	init_writer(&bw, wrt_ptr, (BUFPTR)dest + *dest_size);
+
+	combined_crc = 0UL;
+
+	for (rd_ptr = src; src_size; rd_ptr += size, src_size -= size) {
+
+		size = fill_block(enc, rd_ptr, src_size, &crc);
+
+		sort_block(enc);
+		mtf_block(enc);
+		write_block(enc, &bw, crc);
+
+		combined_crc = (((combined_crc << 1) | (combined_crc >> 31)) ^ crc) & 0xffffffffUL;
+
+		if (bw.overflow)
+			return FALSE;
+	}
+
+	/* 流结束标识和整个流的校验值 */
+	put_bits(&bw, END_MAGIC_HI, 24);
+	put_bits(&bw, END_MAGIC_LO, 24);
+	put_bits(&bw, combined_crc >> 16, 16);
+	put_bits(&bw, combined_crc & 0xffff, 16);
+	flush_writer(&bw);
+
+	if (bw.overflow)
+		return FALSE;
+
+	/* 计算输出数据的大小 */
+	*dest_size = (UINT)(bw.cur_ptr - (BUFPTR)dest);
+
+	return TRUE;
+}
+
+static BOOL decode_stream(struct BZ_DECODER *dec, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	DWORD magic_hi, magic_lo, block_crc, crc, combined_crc;
+	BUFCPTR rd_ptr;
+	BUFPTR wrt_ptr, wrt_end_ptr;
+	struct BIT_READER br;
+
+	DAssert(dec);
+
+	/* 参数有效性检查 */
+	if (!src || src_size < 4 || !dest || !dest_size)
+		return FALSE;
+
+	/* 检查流头部 */
+	rd_ptr = src;
+	if (rd_ptr[0] != 'B' || rd_ptr[1] != 'Z' || rd_ptr[2] != 'h' || !DBetween(rd_ptr[3], '1', '9' + 1))
+		return FALSE;
+
+	init_reader(&br, rd_ptr + 4, rd_ptr + src_size);
+
+	wrt_ptr = dest;
+	wrt_end_ptr = wrt_ptr + *dest_size;
+	combined_crc = 0UL;
+
+	for (;;) {
+
+		magic_hi = get_bits(&br, 24);
+		magic_lo = get_bits(&br, 24);
+		block_crc = get_bits(&br, 16) << 16;
+		block_crc |= get_bits(&br, 16);
+
+		if (br.pad_cnt)
+			return FALSE;
+
+		/* 流结束 */
+		if (magic_hi == END_MAGIC_HI && magic_lo == END_MAGIC_LO)
+			break;
+
+		if (magic_hi != BLOCK_MAGIC_HI || magic_lo != BLOCK_MAGIC_LO)
+			return FALSE;
+
+		if (!read_block(&br, dec))
+			return FALSE;
+
+		if (!output_block(dec, &wrt_ptr, wrt_end_ptr, &crc))
+			return FALSE;
+
+		if (crc != block_crc)
+			return FALSE;
+
+		combined_crc = (((combined_crc << 1) | (combined_crc >> 31)) ^ crc) & 0xffffffffUL;
+	}
+
+	if (block_crc != combined_crc)
+		return FALSE;
+
+	/* 计算输出数据的大小 */
+	*dest_size = (UINT)(wrt_ptr - (BUFPTR)dest);
+
+	return TRUE;
+}
+
+static VOID init_reader(struct BIT_READER *br, VCPTR start, VCPTR end)
+{
+	DAssert(br && start && end && start <= end);
+
+	br->cur_ptr = start;
+	br->end_ptr = end;
+	br->bit_cnt = 0U;
+	br->bit_buf = 0UL;
+	br->pad_cnt = 0U;
+}
+
+static UINT get_bits(struct BIT_READER *br, UINT num)
+{
+	DAssert(br && num <= 24);
+
+	/* 输入结束之后补零，由调用者根据pad_cnt判断是否读过了头 */
+	while (br->bit_cnt < num) {
+		br->bit_buf <<= 8;
+		if (br->cur_ptr < br->end_ptr)
+			br->bit_buf |= *br->cur_ptr++;
+		else
+			br->pad_cnt++;
+		br->bit_cnt += 8;
+	}
+
+	br->bit_cnt -= num;
+
+	return (br->bit_buf >> br->bit_cnt) & ((1UL << num) - 1);
+}
+
+static VOID init_writer(struct BIT_WRITER *bw, VPTR start, VPTR end)
+{
+	DAssert(bw && start && end && start <= end);
+
+	bw->cur_ptr = start;
+	bw->end_ptr = end;
+	bw->bit_cnt = 0U;
+	bw->bit_buf = 0UL;
+	bw->overflow = FALSE;
+}
+
+static VOID put_bits(struct BIT_WRITER *bw, UINT bits, UINT num)
+{
+	DAssert(bw && num <= 24);
+
+	bw->bit_buf = (bw->bit_buf << num) | bits;
+	bw->bit_cnt += num;
+
+	while (bw->bit_cnt >= 8) {
+
+		bw->bit_cnt -= 8;
+
+		/* 缓冲不足时继续消耗位数据，只是不再写入 */
+		if (bw->cur_ptr < bw->end_ptr)
+			*bw->cur_ptr++ = (BYTE)(bw->bit_buf >> bw->bit_cnt);
+		else
+			bw->overflow = TRUE;
+	}
+}
+
+static VOID flush_writer(struct BIT_WRITER *bw)
+{
+	DAssert(bw);
+
+	/* 补齐到字节边界 */
+	if (bw->bit_cnt)
+		put_bits(bw, 0U, 8 - bw->bit_cnt);
+}
+
+/************************************************************************/
+
+static BOOL read_block(struct BIT_READER *br, struct BZ_DECODER *dec)
+{
+	INT i, j, t, v, sym, curr, zn, zvec, group_pos, alpha_size, nin_use, ngroups, end_of_block;
+	UINT nselectors, group_no, run, run_mul;
+	WORD used;
+	BYTE tmp;
+	BYTE pos[MAX_GROUPS];
+	BYTE yy[0x100];
+	BYTE lens[MAX_ALPHA];
+	CONST struct HUFF_GROUP *group;
+
+	DAssert(br && dec);
+
+	/* 不支持旧版本的随机化块 */
+	if (get_bits(br, 1))
+		return FALSE;
+
+	dec->orig_ptr = get_bits(br, 24);
+
+	/* 出现过的字节值 */
+	nin_use = 0;
+	used = (WORD)get_bits(br, 16);
+	for (i = 0; i < 16; i++) {
+		if (!(used & (0x8000 >> i)))
+			continue;
+		v = get_bits(br, 16);
+		for (j = 0; j < 16; j++) {
+			if (v & (0x8000 >> j))
+				dec->seq_to_unseq[nin_use++] = (BYTE)(i * 16 + j);
+		}
+	}
+
+	if (!nin_use)
+		return FALSE;
+
+	alpha_size = nin_use + 2;
+
+	ngroups = get_bits(br, 3);
+	if (!DBetween(ngroups, MIN_GROUPS, MAX_GROUPS + 1))
+		return FALSE;
+
+	nselectors = get_bits(br, 15);
+	if (!nselectors)
+		return FALSE;
+
+	/* 编码组选择经过了MTF变换，超出上限的部分不可能被用到 */
+	for (i = 0; i < ngroups; i++)
+		pos[i] = (BYTE)i;
+
+	for (group_no = 0; group_no < nselectors; group_no++) {
+
+		for (j = 0; get_bits(br, 1); j++) {
+			if (j + 1 >= ngroups)
+				return FALSE;
+		}
+
+		for (tmp = pos[j]; j > 0; j--)
+			pos[j] = pos[j - 1];
+		pos[0] = tmp;
+
+		if (group_no < DEC_SELECTOR_MAX)
+			dec->selector[group_no] = tmp;
+
+		if (br->pad_cnt)
+			return FALSE;
+	}
+
+	nselectors = DMin(nselectors, DEC_SELECTOR_MAX);
+
+	/* 各编码组的码长经过了差分编码 */
+	for (t = 0; t < ngroups; t++) {
+
+		curr = get_bits(br, 5);
+
+		for (i = 0; i < alpha_size; i++) {
+			for (;;) {
+				if (!DBetween(curr, 1, MAX_CODE_LEN + 1))
+					return FALSE;
+				if (!get_bits(br, 1))
+					break;
+				if (get_bits(br, 1))
+					curr--;
+				else
+					curr++;
+			}
+			lens[i] = (BYTE)curr;
+		}
+
+		if (!make_decode_table(&dec->group[t], lens, alpha_size))
+			return FALSE;
+	}
+
+	if (br->pad_cnt)
+		return FALSE;
+
+	/* 解码霍夫曼编码、零的游程编码和MTF变换 */
+	for (i = 0; i < nin_use; i++)
+		yy[i] = (BYTE)i;
+
+	DMemClr(dec->unzftab, sizeof(dec->unzftab));
+
+	end_of_block = nin_use + 1;
+	group_no = 0U;
+	group_pos = 0;
+	group = NULL;
+	run = 0U;
+	run_mul = 1U;
+	dec->nblock = 0U;
+
+	for (;;) {
+
+		/* 每GROUP_SIZE个符号换一次编码组 */
+		if (!group_pos) {
+			if (group_no >= nselectors)
+				return FALSE;
+			group = &dec->group[dec->selector[group_no++]];
+			group_pos = GROUP_SIZE;
+		}
+		group_pos--;
+
+		zn = group->min_len;
+		zvec = get_bits(br, zn);
+		while (zvec > group->limit[zn]) {
+			if (++zn > group->max_len)
+				return FALSE;
+			zvec = (zvec << 1) | get_bits(br, 1);
+		}
+
+		zvec -= group->base[zn];
+		if (!DBetween(zvec, 0, alpha_size))
+			return FALSE;
+		sym = group->perm[zvec];
+
+		if (br->pad_cnt)
+			return FALSE;
+
+		/* 零的游程用RUN_A和RUN_B组成的双射二进制数表示 */
+		if (sym == RUN_A || sym == RUN_B) {
+			run += (sym + 1) * run_mul;
+			run_mul <<= 1;
+			if (run > DEC_BLOCK_MAX)
+				return FALSE;
+			continue;
+		}
+
+		if (run) {
+			if (dec->nblock + run > DEC_BLOCK_MAX)
+				return FALSE;
+			tmp = dec->seq_to_unseq[yy[0]];
+			dec->unzftab[tmp] += run;
+			while (run--)
+				dec->tt[dec->nblock++] = tmp;
+			run = 0U;
+			run_mul = 1U;
+		}
+
+		if (sym == end_of_block)
+			break;
+
+		if (dec->nblock >= DEC_BLOCK_MAX)
+			return FALSE;
+
+		/* MTF变换的逆变换 */
+		v = sym - 1;
+		tmp = yy[v];
+		for (; v > 0; v--)
+			yy[v] = yy[v - 1];
+		yy[0] = tmp;
+
+		tmp = dec->seq_to_unseq[tmp];
+		dec->unzftab[tmp]++;
+		dec->tt[dec->nblock++] = tmp;
+	}
+
+	if (dec->orig_ptr >= dec->nblock)
+		return FALSE;
+
+	return TRUE;
+}
+
+static BOOL make_decode_table(struct HUFF_GROUP *group, CONST BYTE *lens, INT alpha_size)
+{
+	INT i, j, pp, vec, left;
+
+	DAssert(group && lens);
+
+	group->min_len = MAX_CODE_LEN;
+	group->max_len = 0;
+	for (i = 0; i < alpha_size; i++) {
+		group->min_len = DMin(group->min_len, lens[i]);
+		group->max_len = DMax(group->max_len, lens[i]);
+	}
+
+	/* 编码超额的树无效 */
+	left = 1;
+	for (i = 1; i <= MAX_CODE_LEN; i++) {
+		left <<= 1;
+		for (j = 0; j < alpha_size; j++) {
+			if (lens[j] == i)
+				left--;
+		}
+		if (left < 0)
+			return FALSE;
+	}
+
+	/* 按码长和符号的顺序排列符号 */
+	pp = 0;
+	for (i = group->min_len; i <= group->max_len; i++) {
+		for (j = 0; j < alpha_size; j++) {
+			if (lens[j] == i)
+				group->perm[pp++] = j;
+		}
+	}
+
+	DMemClr(group->base, sizeof(group->base));
+	for (i = 0; i < alpha_size; i++)
+		group->base[lens[i] + 1]++;
+	for (i = 1; i < (INT)DCount(group->base); i++)
+		group->base[i] += group->base[i - 1];
+
+	/* 范式霍夫曼编码：各码长的最大编码值和编码值到符号序号的偏移 */
+	vec = 0;
+	for (i = group->min_len; i <= group->max_len; i++) {
+		vec += group->base[i + 1] - group->base[i];
+		group->limit[i] = vec - 1;
+		vec <<= 1;
+	}
+
+	for (i = group->min_len + 1; i <= group->max_len; i++)
+		group->base[i] = ((group->limit[i - 1] + 1) << 1) - group->base[i];
+
+	return TRUE;
+}
+
+static BOOL output_block(struct BZ_DECODER *dec, BUFPTR *wrt_ptr, BUFPTR wrt_end_ptr, DWORD *crc)
+{
+	UINT i, n, cnt, sum, pos;
+	DWORD cs;
+	BYTE ch, prev;
+	BUFPTR wrt;
+	UINT cftab[0x100];
+
+	DAssert(dec && wrt_ptr && wrt_end_ptr && crc);
+
+	/* 各字节值在排序后的起始位置 */
+	for (sum = 0, i = 0; i < 0x100; i++) {
+		cftab[i] = sum;
+		sum += dec->unzftab[i];
+	}
+
+	/* Burrows-Wheeler变换的逆变换：在高位建立链接 */
+	for (i = 0; i < dec->nblock; i++) {
+		ch = (BYTE)dec->tt[i];
+		dec->tt[cftab[ch]++] |= i << 8;
+	}
+
+	wrt = *wrt_ptr;
+	cs = 0xffffffffUL;
+	cnt = 0U;
+	prev = 0;
+	pos = dec->tt[dec->orig_ptr] >> 8;
+
+	for (n = 0; n < dec->nblock; n++) {
+
+		pos = dec->tt[pos];
+		ch = (BYTE)pos;
+		pos >>= 8;
+
+		/* 连续4个相同字节之后是重复次数 */
+		if (cnt == 4) {
+			if (ch > (UINT)(wrt_end_ptr - wrt))
+				return FALSE;
+			for (i = 0; i < ch; i++)
+				*wrt++ = prev;
+			cs = crc_update(cs, wrt - ch, ch);
+			cnt = 0U;
+			continue;
+		}
+
+		if (ch == prev && cnt) {
+			cnt++;
+		} else {
+			prev = ch;
+			cnt = 1U;
+		}
+
+		if (wrt >= wrt_end_ptr)
+			return FALSE;
+		*wrt++ = ch;
+		cs = crc_update(cs, wrt - 1, 1);
+	}
+
+	*wrt_ptr = wrt;
+	*crc = ~cs & 0xffffffffUL;
+
+	return TRUE;
+}
+
+/************************************************************************/
+
+static UINT fill_block(struct BZ_ENCODER *enc, BUFCPTR src, UINT src_size, DWORD *crc)
+{
+	UINT pos, run;
+	BYTE ch;
+
+	DAssert(enc && src && src_size && crc);
+
+	DMemClr(enc->in_use, sizeof(enc->in_use));
+	enc->nblock = 0U;
+
+	/* 游程编码，一次游程最多占5字节，块中放不下时结束 */
+	for (pos = 0; pos < src_size && enc->nblock + 5 <= ENC_BLOCK_MAX; pos += run) {
+
+		ch = src[pos];
+		for (run = 1; pos + run < src_size && src[pos + run] == ch && run < MAX_RUN; run++)
+			;
+
+		enc->in_use[ch] = TRUE;
+
+		if (run < 4) {
+			DMemSet(enc->block + enc->nblock, ch, run);
+			enc->nblock += run;
+		} else {
+			DMemSet(enc->block + enc->nblock, ch, 4);
+			enc->nblock += 4;
+			enc->block[enc->nblock++] = (BYTE)(run - 4);
+			enc->in_use[run - 4] = TRUE;
+		}
+	}
+
+	*crc = ~crc_update(0xffffffffUL, src, pos) & 0xffffffffUL;
+
+	return pos;
+}
+
+static VOID sort_block(struct BZ_ENCODER *enc)
+{
+	UINT i, k, n, r, a, b, sum, max_rank;
+	WORD *sa, *rank, *tmp, *count;
+
+	DAssert(enc && enc->nblock);
+
+	n = enc->nblock;
+	sa = enc->sa;
+	rank = enc->rank;
+	tmp = enc->tmp;
+	count = enc->count;
+
+	/* 先按第一个字节计数排序 */
+	DMemClr(count, 0x100 * sizeof(WORD));
+	for (i = 0; i < n; i++)
+		count[enc->block[i]]++;
+	for (sum = 0, i = 0; i < 0x100; i++) {
+		r = count[i];
+		count[i] = (WORD)sum;
+		sum += r;
+	}
+	for (i = 0; i < n; i++)
+		sa[count[enc->block[i]]++] = (WORD)i;
+
+	max_rank = 0U;
+	rank[sa[0]] = 0;
+	for (i = 1; i < n; i++) {
+		if (enc->block[sa[i]] != enc->block[sa[i - 1]])
+			max_rank++;
+		rank[sa[i]] = (WORD)max_rank;
+	}
+
+	/* 前缀倍增：按(前k个字节的排名, 其后k个字节的排名)排序，直到排名各不相同 */
+	for (k = 1; max_rank + 1 < n && k < n; k <<= 1) {
+
+		/* 按第二关键字排好的顺序 */
+		for (i = 0; i < n; i++)
+			tmp[i] = (WORD)((sa[i] + n - k) % n);
+
+		/* 再按第一关键字稳定排序 */
+		DMemClr(count, (max_rank + 1) * sizeof(WORD));
+		for (i = 0; i < n; i++)
+			count[rank[i]]++;
+		for (sum = 0, i = 0; i <= max_rank; i++) {
+			r = count[i];
+			count[i] = (WORD)sum;
+			sum += r;
+		}
+		for (i = 0; i < n; i++)
+			sa[count[rank[tmp[i]]]++] = tmp[i];
+
+		/* 重新计算排名 */
+		max_rank = 0U;
+		tmp[sa[0]] = 0;
+		for (i = 1; i < n; i++) {
+			a = sa[i];
+			b = sa[i - 1];
+			if (rank[a] != rank[b] || rank[(a + k) % n] != rank[(b + k) % n])
+				max_rank++;
+			tmp[a] = (WORD)max_rank;
+		}
+
+		DMemCpy(rank, tmp, n * sizeof(WORD));
+	}
+
+	/* 找到原始数据的位置 */
+	for (i = 0; sa[i]; i++)
+		;
+	enc->orig_ptr = i;
+}
+
+static VOID mtf_block(struct BZ_ENCODER *enc)
+{
+	UINT i, j, n, zpend, alpha_size;
+	BYTE ch = 0, tmp, prev;
+	WORD *mtfv;
+	BYTE yy[0x100];
+
+	DAssert(enc);
+
+	/* 只给出现过的字节值编号 */
+	enc->nin_use = 0U;
+	for (i = 0; i < 0x100; i++) {
+		if (enc->in_use[i])
+			enc->unseq_to_seq[i] = (BYTE)enc->nin_use++;
+	}
+
+	alpha_size = enc->nin_use + 2;
+	DMemClr(enc->mtf_freq, alpha_size * sizeof(UINT));
+
+	for (i = 0; i < enc->nin_use; i++)
+		yy[i] = (BYTE)i;
+
+	/* 排序数组已经用不到了，借用来存放MTF变换的结果 */
+	mtfv = enc->tmp;
+	n = enc->nblock;
+	zpend = 0U;
+	enc->nmtf = 0U;
+
+	for (i = 0; i <= n; i++) {
+
+		/* 变换结果的每个字节是循环移位的前一个字节 */
+		if (i < n) {
+			ch = enc->unseq_to_seq[enc->block[(enc->sa[i] + n - 1) % n]];
+			if (yy[0] == ch) {
+				zpend++;
+				continue;
+			}
+		}
+
+		/* 零的游程用RUN_A和RUN_B组成的双射二进制数表示 */
+		if (zpend) {
+			zpend--;
+			for (;;) {
+				j = (zpend & 1) ? RUN_B : RUN_A;
+				mtfv[enc->nmtf++] = (WORD)j;
+				enc->mtf_freq[j]++;
+				if (zpend < 2)
+					break;
+				zpend = (zpend - 2) / 2;
+			}
+			zpend = 0U;
+		}
+
+		if (i == n)
+			break;
+
+		/* MTF变换 */
+		prev = yy[0];
+		yy[0] = ch;
+		for (j = 1; prev != ch; j++) {
+			tmp = yy[j];
+			yy[j] = prev;
+			prev = tmp;
+		}
+
+		mtfv[enc->nmtf++] = (WORD)j;
+		enc->mtf_freq[j]++;
+	}
+
+	/* 块结束符号 */
+	mtfv[enc->nmtf++] = (WORD)(alpha_size - 1);
+	enc->mtf_freq[alpha_size - 1]++;
+}
+
+static VOID write_block(struct BZ_ENCODER *enc, struct BIT_WRITER *bw, DWORD crc)
+{
+	INT t, bt, ngroups, npart, gs, ge, curr, min_len, max_len, n;
+	UINT i, j, v, iter, nselectors, alpha_size, rem_freq, part_freq, cur_freq, best_cost;
+	DWORD vec;
+	BYTE tmp, prev;
+	WORD used;
+	WORD *mtfv;
+	UINT cost[MAX_GROUPS];
+	BYTE pos[MAX_GROUPS];
+
+	DAssert(enc && bw);
+
+	mtfv = enc->tmp;
+	alpha_size = enc->nin_use + 2;
+
+	/* 符号越多，编码组越多 */
+	if (enc->nmtf < 200)
+		ngroups = 2;
+	else if (enc->nmtf < 600)
+		ngroups = 3;
+	else if (enc->nmtf < 1200)
+		ngroups = 4;
+	else if (enc->nmtf < 2400)
+		ngroups = 5;
+	else
+		ngroups = 6;
+
+	/* 初始时按频率把符号分成若干段，每个编码组偏向其中一段 */
+	rem_freq = enc->nmtf;
+	gs = 0;
+	for (npart = ngroups; npart > 0; npart--) {
+
+		part_freq = rem_freq / npart;
+		ge = gs - 1;
+		cur_freq = 0U;
+		while (cur_freq < part_freq && ge < (INT)alpha_size - 1) {
+			ge++;
+			cur_freq += enc->mtf_freq[ge];
+		}
+
+		if (ge > gs && npart != ngroups && npart != 1 && ((ngroups - npart) & 1)) {
+			cur_freq -= enc->mtf_freq[ge];
+			ge--;
+		}
+
+		for (v = 0; v < alpha_size; v++)
+			enc->len[npart - 1][v] = (DBetween((INT)v, gs, ge + 1)) ? 0 : 15;
+
+		gs = ge + 1;
+		rem_freq -= cur_freq;
+	}
+
+	/* 反复为每组符号选择代价最小的编码组，并用选择的结果重新生成编码组 */
+	for (iter = 0; iter < ITER_NUM; iter++) {
+
+		DMemClr(enc->freq, sizeof(enc->freq));
+		nselectors = 0U;
+
+		for (i = 0; i < enc->nmtf; i += GROUP_SIZE) {
+
+			n = DMin(GROUP_SIZE, enc->nmtf - i);
+
+			for (t = 0; t < ngroups; t++) {
+				cost[t] = 0U;
+				for (j = 0; j < (UINT)n; j++)
+					cost[t] += enc->len[t][mtfv[i + j]];
+			}
+
+			bt = 0;
+			best_cost = cost[0];
+			for (t = 1; t < ngroups; t++) {
+				if (cost[t] < best_cost) {
+					best_cost = cost[t];
+					bt = t;
+				}
+			}
+
+			enc->selector[nselectors++] = (BYTE)bt;
+			for (j = 0; j < (UINT)n; j++)
+				enc->freq[bt][mtfv[i + j]]++;
+		}
+
+		for (t = 0; t < ngroups; t++)
+			make_lengths(enc->freq[t], alpha_size, ENC_CODE_LEN, enc->len[t]);
+	}
+
+	/* 范式霍夫曼编码 */
+	for (t = 0; t < ngroups; t++) {
+		min_len = ENC_CODE_LEN;
+		max_len = 0;
+		for (v = 0; v < alpha_size; v++) {
+			min_len = DMin(min_len, enc->len[t][v]);
+			max_len = DMax(max_len, enc->len[t][v]);
+		}
+		vec = 0UL;
+		for (n = min_len; n <= max_len; n++) {
+			for (v = 0; v < alpha_size; v++) {
+				if (enc->len[t][v] == n)
+					enc->code[t][v] = vec++;
+			}
+			vec <<= 1;
+		}
+	}
+
+	/* 块头 */
+	put_bits(bw, BLOCK_MAGIC_HI, 24);
+	put_bits(bw, BLOCK_MAGIC_LO, 24);
+	put_bits(bw, crc >> 16, 16);
+	put_bits(bw, crc & 0xffff, 16);
+	put_bits(bw, 0, 1);
+	put_bits(bw, enc->orig_ptr, 24);
+
+	/* 出现过的字节值 */
+	used = 0;
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < 16; j++) {
+			if (enc->in_use[i * 16 + j])
+				used |= 0x8000 >> i;
+		}
+	}
+	put_bits(bw, used, 16);
+
+	for (i = 0; i < 16; i++) {
+		if (!(used & (0x8000 >> i)))
+			continue;
+		for (v = 0, j = 0; j < 16; j++) {
+			if (enc->in_use[i * 16 + j])
+				v |= 0x8000 >> j;
+		}
+		put_bits(bw, v, 16);
+	}
+
+	/* 编码组选择经过MTF变换后用一元码表示 */
+	put_bits(bw, ngroups, 3);
+	put_bits(bw, nselectors, 15);
+
+	for (t = 0; t < ngroups; t++)
+		pos[t] = (BYTE)t;
+
+	for (i = 0; i < nselectors; i++) {
+		prev = pos[0];
+		pos[0] = enc->selector[i];
+		for (j = 0; prev != enc->selector[i]; j++) {
+			tmp = pos[j + 1];
+			pos[j + 1] = prev;
+			prev = tmp;
+		}
+		while (j--)
+			put_bits(bw, 1, 1);
+		put_bits(bw, 0, 1);
+	}
+
+	/* 码长用差分编码表示 */
+	for (t = 0; t < ngroups; t++) {
+		curr = enc->len[t][0];
+		put_bits(bw, curr, 5);
+		for (v = 0; v < alpha_size; v++) {
+			for (; curr < enc->len[t][v]; curr++)
+				put_bits(bw, 2, 2);
+			for (; curr > enc->len[t][v]; curr--)
+				put_bits(bw, 3, 2);
+			put_bits(bw, 0, 1);
+		}
+	}
+
+	/* 符号数据 */
+	for (i = 0; i < enc->nmtf; i++) {
+		t = enc->selector[i / GROUP_SIZE];
+		v = mtfv[i];
+		put_bits(bw, enc->code[t][v], enc->len[t][v]);
+	}
+}
+
+static VOID make_lengths(CONST UINT *freq, INT num, INT limit, BYTE *lens)
+{
+	INT i, k, n, a, b, len, max_len, heap_num, node_num, child, shift;
+	INT heap[MAX_ALPHA + 1];
+	INT parent[MAX_ALPHA * 2];
+	UINT weight[MAX_ALPHA * 2];
+
+	DAssert(freq && lens && num >= 2 && num <= MAX_ALPHA);
+
+	/* 所有符号都必须有编码，码长超过限制时降低频率的差距后重新生成 */
+	for (shift = 0; ; shift++) {
+
+		heap_num = 0;
+		node_num = num;
+
+		for (i = 0; i < num; i++) {
+
+			weight[i] = 1 + (freq[i] >> shift);
+			parent[i] = -1;
+
+			/* 加入最小堆（下标从1开始） */
+			k = ++heap_num;
+			while (k > 1 && weight[heap[k >> 1]] > weight[i]) {
+				heap[k] = heap[k >> 1];
+				k >>= 1;
+			}
+			heap[k] = i;
+		}
+
+		while (heap_num > 1) {
+
+			weight[node_num] = 0;
+
+			/* 依次取出权重最小的两个节点，合并成新节点 */
+			for (n = 0; n < 2; n++) {
+
+				a = heap[1];
+				b = heap[heap_num--];
+
+				for (k = 1; (child = k << 1) <= heap_num; k = child) {
+					if (child < heap_num && weight[heap[child + 1]] < weight[heap[child]])
+						child++;
+					if (weight[b] <= weight[heap[child]])
+						break;
+					heap[k] = heap[child];
+				}
+				heap[k] = b;
+
+				weight[node_num] += weight[a];
+				parent[a] = node_num;
+			}
+
+			/* 新节点放回堆中 */
+			parent[node_num] = -1;
+			k = ++heap_num;
+			while (k > 1 && weight[heap[k >> 1]] > weight[node_num]) {
+				heap[k] = heap[k >> 1];
+				k >>= 1;
+			}
+			heap[k] = node_num;
+			node_num++;
+		}
+
+		max_len = 0;
+		for (i = 0; i < num; i++) {
+			for (len = 0, k = i; parent[k] >= 0; k = parent[k])
+				len++;
+			lens[i] = len;
+			max_len = DMax(max_len, len);
+		}
+
+		if (max_len <= limit)
+			break;
+	}
+}
+
+/************************************************************************/
+
+static DWORD crc_update(DWORD crc, BUFCPTR buf, UINT size)
+{
+	DAssert(buf || !size);
+
+	while (size--)
+		crc = (crc << 8) ^ s_CrcTable[((crc >> 24) ^ *buf++) & 0xff];
+
+	return crc & 0xffffffffUL;
+}
+
+/************************************************************************/
@@ -0,0 +1,26 @@
+﻿/************************************************************************/
+/* File Name   : bzip2.h                                                */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Lawine library                                         */
+/* Descript    : Bzip2 compression API definition                       */
+/************************************************************************/
+
+#ifndef __SD_LAWINE_MISC_BZIP2_H__
+#define __SD_LAWINE_MISC_BZIP2_H__
+
+/************************************************************************/
+
+#include <common.h>
+#include "codec.h"
+
+/************************************************************************/
+
+CAPI extern BOOL bz2_encode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL bz2_decode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL bz2_encode_ctx(struct CODEC_CONTEXT *ctx, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL bz2_decode_ctx(struct CODEC_CONTEXT *ctx, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+
+/************************************************************************/
+
+#endif	/* __SD_LAWINE_MISC_BZIP2_H__ */
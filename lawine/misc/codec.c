@@ -0,0 +1,205 @@
+﻿/************************************************************************/
+/* File Name   : codec.c                                                */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Lawine library                                         */
+/* Descript    : Codec context API implementation                       */
+/************************************************************************/
+
+#include "codec.h"
+
+/*
+		各压缩算法的工作状态都比较大，放在栈上会占用大量栈空间，每次调用时分配则会在多线程处理时
+	造成内存分配器的争用。编解码上下文持有这些工作状态以及调用者所需的临时缓冲，在各次调用间重复使用，
+	因此稳定之后的压缩解压处理不再分配任何内存。
+
+		上下文中的工作状态由各压缩算法在第一次使用时自行分配，其内容只有该算法才知道。一个上下文同一时间
+	只能被一个线程使用，一般每个线程从上下文缓存池中取得一个，用完后归还。
+*/
+
+/************************************************************************/
+
+#define POOL_NONE			0						/* 上下文缓存池尚未分配 */
+#define POOL_INIT			1						/* 上下文缓存池正在分配 */
+#define POOL_READY			2						/* 上下文缓存池已经分配 */
+
+/************************************************************************/
+
+/* 上下文缓存池，池中的上下文连同其中已分配的内存都在各次使用间保留 */
+static struct CODEC_CONTEXT **s_ContextPool;
+static volatile LONG *s_PoolBusy;
+static INT s_PoolSize;
+static volatile LONG s_PoolState;
+
+/************************************************************************/
+
+static BOOL init_pool(VOID);
+static struct CODEC_CONTEXT *new_context(VOID);
+static VOID delete_context(struct CODEC_CONTEXT *ctx);
+
+/************************************************************************/
+
+struct CODEC_CONTEXT *alloc_codec_context(VOID)
+{
+	INT i;
+
+	if (!init_pool())
+		return new_context();
+
+	/* 在缓存池中查找空闲的上下文，池中的位置在第一次使用时才分配内存 */
+	for (i = 0; i < s_PoolSize; i++) {
+
+		if (DAtomicCas(&s_PoolBusy[i], 0, 1))
+			continue;
+
+		if (!s_ContextPool[i]) {
+			s_ContextPool[i] = new_context();
+			if (!s_ContextPool[i]) {
+				DAtomicDec(&s_PoolBusy[i]);
+				return NULL;
+			}
+			s_ContextPool[i]->pool = i;
+		}
+
+		return s_ContextPool[i];
+	}
+
+	/* 缓存池已全部被占用，临时分配一个 */
+	return new_context();
+}
+
+VOID free_codec_context(struct CODEC_CONTEXT *ctx)
+{
+	if (!ctx)
+		return;
+
+	/* 属于缓存池的上下文只需归还，否则释放内存 */
+	if (ctx->pool >= 0)
+		DAtomicDec(&s_PoolBusy[ctx->pool]);
+	else
+		delete_context(ctx);
+}
+
+VPTR get_codec_work(struct CODEC_CONTEXT *ctx, INT index, UINT size)
+{
+	if (!ctx || !DBetween(index, 0, CODEC_WORK_NUM))
+		return NULL;
+
+	/* 工作状态在第一次使用时分配，内容未初始化，由各压缩算法自行处理 */
+	if (!ctx->work[index])
+		ctx->work[index] = DAlloc(size);
+
+	return ctx->work[index];
+}
+
+BUFPTR get_codec_buffer(struct CODEC_CONTEXT *ctx, INT index, UINT size)
+{
+	BUFPTR buf;
+
+	if (!ctx || !DBetween(index, 0, CODEC_BUF_NUM))
+		return NULL;
+
+	/* 缓冲只会增大，不会缩小 */
+	if (ctx->buf[index] && ctx->buf_size[index] >= size)
+		return ctx->buf[index];
+
+	buf = DAlloc(size);
+	if (!buf)
+		return NULL;
+
+	DFree(ctx->buf[index]);
+	ctx->buf[index] = buf;
+	ctx->buf_size[index] = size;
+
+	return buf;
+}
+
+VOID exit_codec(VOID)
+{
+	INT i;
+
+	if (s_PoolState != POOL_READY)
+		return;
+
+	/* 释放缓存池中的所有上下文，调用时不能再有正在使用的上下文 */
+	for (i = 0; i < s_PoolSize; i++) {
+		DAssert(!s_PoolBusy[i]);
+		if (s_ContextPool[i])
+			delete_context(s_ContextPool[i]);
+	}
+
+	DFree(s_ContextPool);
+	DFree((VPTR)s_PoolBusy);
+	s_ContextPool = NULL;
+	s_PoolBusy = NULL;
+	s_PoolSize = 0;
+	s_PoolState = POOL_NONE;
+}
+
+/************************************************************************/
+
+static BOOL init_pool(VOID)
+{
+	INT size;
+
+	/* 缓存池在第一次使用时分配，同时进入的其他线程等待分配完成 */
+	while (s_PoolState != POOL_READY) {
+
+		if (DAtomicCas(&s_PoolState, POOL_NONE, POOL_INIT) != POOL_NONE)
+			continue;
+
+		/* 工作线程数默认与CPU数相同，调用线程以及其他档案上同时进行的处理也要使用上下文，留出一倍的余量 */
+		size = (INT)DGetCpuNum() * 2;
+
+		s_ContextPool = DAlloc(size * sizeof(struct CODEC_CONTEXT *));
+		s_PoolBusy = DAlloc(size * sizeof(LONG));
+
+		if (!s_ContextPool || !s_PoolBusy) {
+			DFree(s_ContextPool);
+			DFree((VPTR)s_PoolBusy);
+			s_ContextPool = NULL;
+			s_PoolBusy = NULL;
+			DAtomicDec(&s_PoolState);
+			return FALSE;
+		}
+
+		DMemClr(s_ContextPool, size * sizeof(struct CODEC_CONTEXT *));
+		DMemClr((VPTR)s_PoolBusy, size * sizeof(LONG));
+		s_PoolSize = size;
+
+		DAtomicInc(&s_PoolState);
+	}
+
+	return TRUE;
+}
+
+static struct CODEC_CONTEXT *new_context(VOID)
+{
+	struct CODEC_CONTEXT *ctx;
+
+	ctx = DAlloc(sizeof(struct CODEC_CONTEXT));
+	if (!ctx)
+		return NULL;
+
+	DMemClr(ctx, sizeof(struct CODEC_CONTEXT));
+	ctx->pool = -1;
+
+	return ctx;
+}
+
+static VOID delete_context(struct CODEC_CONTEXT *ctx)
+{
+	INT i;
+
+	DAssert(ctx);
+
+	for (i = 0; i < CODEC_WORK_NUM; i++)
+		DFree(ctx->work[i]);
+
+	for (i = 0; i < CODEC_BUF_NUM; i++)
+		DFree(ctx->buf[i]);
+
+	DFree(ctx);
+}
+
+/************************************************************************/
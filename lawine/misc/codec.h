@@ -0,0 +1,47 @@
+﻿/************************************************************************/
+/* File Name   : codec.h                                                */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Lawine library                                         */
+/* Descript    : Codec context API definition                           */
+/************************************************************************/
+
+#ifndef __SD_LAWINE_MISC_CODEC_H__
+#define __SD_LAWINE_MISC_CODEC_H__
+
+/************************************************************************/
+
+#include <common.h>
+
+/************************************************************************/
+
+#define CODEC_WORK_HUFFMAN		0			/* Huffman tree */
+#define CODEC_WORK_IMPLODE		1			/* Hash chains and parsing state of implode */
+#define CODEC_WORK_ZLIB_ENC		2			/* Hash chains and block codes of zlib_encode */
+#define CODEC_WORK_BZ2_ENC		3			/* Block sorting state of bz2_encode */
+#define CODEC_WORK_BZ2_DEC		4			/* Block state of bz2_decode */
+#define CODEC_WORK_NUM			5
+
+#define CODEC_BUF_NUM			2			/* Number of scratch buffers kept for the caller */
+
+/************************************************************************/
+
+/* Scratch memory of the codecs, which must not be used by multiple threads at the same time */
+struct CODEC_CONTEXT {
+	VPTR work[CODEC_WORK_NUM];				/* Working state of each codec, allocated by the codec on first use */
+	BUFPTR buf[CODEC_BUF_NUM];				/* Scratch buffers of the caller */
+	UINT buf_size[CODEC_BUF_NUM];			/* Sizes of the scratch buffers */
+	INT pool;								/* Index in the context pool, -1 if not in the pool */
+};
+
+/************************************************************************/
+
+CAPI extern struct CODEC_CONTEXT *alloc_codec_context(VOID);
+CAPI extern VOID free_codec_context(struct CODEC_CONTEXT *ctx);
+CAPI extern VPTR get_codec_work(struct CODEC_CONTEXT *ctx, INT index, UINT size);
+CAPI extern BUFPTR get_codec_buffer(struct CODEC_CONTEXT *ctx, INT index, UINT size);
+CAPI extern VOID exit_codec(VOID);
+
+/************************************************************************/
+
+#endif	/* __SD_LAWINE_MISC_CODEC_H__ */
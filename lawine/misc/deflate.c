@@ -0,0 +1,1091 @@
+﻿/************************************************************************/
+/* File Name   : deflate.c                                              */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Lawine library                                         */
+/* Descript    : Deflate (zlib format) compression API implementation   */
+/************************************************************************/
+
+#include "deflate.h"
+
+/*
+		这是RFC 1951所定义的Deflate压缩算法，外面包有RFC 1950所定义的zlib格式的头部和Adler-32校验值，
+	即MPQ中压缩类型0x02所使用的格式。
+
+		解压时使用查找表，码长不超过FAST_BITS位的编码查一次表即可得到符号，更长的编码再按照范式霍夫曼
+	编码逐位比较。
+
+		压缩时使用散列链查找重复数据。每个块扫描两遍，第一遍统计各符号的频率并生成动态霍夫曼树，
+	第二遍按照同样的方式重新扫描并输出编码，因此不需要缓存中间结果。
+
+		不使用编解码上下文时，压缩和解压的所有状态都在栈上，不分配任何内存。
+*/
+
+/************************************************************************/
+
+#define MAX_BITS			15							/* 编码的最大位数 */
+#define MAX_CL_BITS			7							/* 码长编码的最大位数 */
+
+#define LIT_NUM				288							/* 字符/长度符号总数（286和287不使用） */
+#define DIST_NUM			30							/* 距离符号总数 */
+#define CL_NUM				19							/* 码长符号总数 */
+#define LEN_SYM_NUM			29							/* 长度符号个数 */
+
+#define END_BLOCK			256							/* 块结束符号 */
+#define LEN_SYM_BASE		257							/* 第一个长度符号 */
+
+#define FAST_BITS			9							/* 快速解码查找表的位数 */
+#define FAST_SIZE			(1 << FAST_BITS)			/* 快速解码查找表的大小 */
+
+#define WINDOW_SIZE			0x8000						/* 滑动窗口大小，即最大距离 */
+#define WINDOW_MASK			(WINDOW_SIZE - 1)
+#define HASH_BITS			12							/* 散列值位数 */
+#define HASH_SIZE			(1 << HASH_BITS)			/* 散列表大小 */
+#define MIN_MATCH			3							/* 最短重复长度 */
+#define MAX_MATCH			258							/* 最长重复长度 */
+#define MAX_CHAIN			64							/* 每次查找时最多比较的位置数 */
+#define BLOCK_SIZE			0x10000						/* 每个块的最大输入字节数 */
+
+#define ADLER_BASE			65521						/* Adler-32的模数 */
+#define ADLER_NMAX			5552						/* Adler-32累加不会溢出的最大字节数 */
+
+/************************************************************************/
+
+/* 读位数据流 */
+struct BIT_READER {
+	BUFCPTR cur_ptr;								/* 当前数据指针 */
+	BUFCPTR end_ptr;								/* 结束位置指针 */
+	UINT bit_cnt;									/* 缓冲位数 */
+	DWORD bit_buf;									/* 缓冲数据 */
+	UINT pad_cnt;									/* 超出输入末尾而补上的零字节数 */
+};
+
+/* 写位数据流 */
+struct BIT_WRITER {
+	BUFPTR cur_ptr;									/* 当前数据指针 */
+	BUFPTR end_ptr;									/* 结束位置指针 */
+	UINT bit_cnt;									/* 缓冲位数 */
+	DWORD bit_buf;									/* 缓冲数据 */
+	BOOL overflow;									/* 输出缓冲是否已经不足 */
+};
+
+/* 解码表 */
+struct HUFF_TABLE {
+	WORD fast[FAST_SIZE];							/* 快速解码查找表，低9位为符号，其上为码长，0表示需要逐位解码 */
+	WORD count[MAX_BITS + 1];						/* 各码长的编码个数 */
+	WORD symbol[LIT_NUM];							/* 按编码顺序排列的符号 */
+};
+
+/* 压缩时的散列链 */
+struct LZ_STATE {
+	UINT head[HASH_SIZE];							/* 各散列值最近一次出现的位置加一，0表示没有出现过 */
+	WORD prev[WINDOW_SIZE];							/* 同一散列值上一次出现的位置之间的距离，0表示没有 */
+};
+
+/* 压缩时一个块的编码 */
+struct CODE_BLOCK {
+	UINT lit_freq[LIT_NUM];							/* 字符/长度符号频率 */
+	UINT dist_freq[DIST_NUM];						/* 距离符号频率 */
+	UINT cl_freq[CL_NUM];							/* 码长符号频率 */
+	BYTE lit_len[LIT_NUM];							/* 字符/长度符号码长 */
+	BYTE dist_len[DIST_NUM];						/* 距离符号码长 */
+	BYTE cl_len[CL_NUM];							/* 码长符号码长 */
+	WORD lit_code[LIT_NUM];							/* 字符/长度符号编码（已按位反转） */
+	WORD dist_code[DIST_NUM];						/* 距离符号编码（已按位反转） */
+	WORD cl_code[CL_NUM];							/* 码长符号编码（已按位反转） */
+};
+
+/* 压缩时的工作状态 */
+struct DEFLATE_WORK {
+	struct LZ_STATE lz;								/* 散列链 */
+	struct CODE_BLOCK blk;							/* 当前块的编码 */
+};
+
+/************************************************************************/
+
+/* 长度符号对应的基础长度和附加位数 */
+static CONST WORD s_LenBase[LEN_SYM_NUM] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+
+static CONST BYTE s_LenExtra[LEN_SYM_NUM] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+
+/* 距离符号对应的基础距离和附加位数 */
+static CONST WORD s_DistBase[DIST_NUM] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+
+static CONST BYTE s_DistExtra[DIST_NUM] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+/* 码长符号的码长在块头中的排列顺序 */
+static CONST BYTE s_ClOrder[CL_NUM] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+/************************************************************************/
+
+/* 压缩处理 */
+static BOOL encode_work(struct DEFLATE_WORK *work, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+
+/* 位数据流操作函数 */
+static VOID init_reader(struct BIT_READER *br, VCPTR start, VCPTR end);
+static VOID need_bits(struct BIT_READER *br, UINT num);
+static UINT get_bits(struct BIT_READER *br, UINT num);
+static VOID init_writer(struct BIT_WRITER *bw, VPTR start, VPTR end);
+static VOID put_bits(struct BIT_WRITER *bw, UINT bits, UINT num);
+static VOID flush_writer(struct BIT_WRITER *bw);
+
+/* 解压处理函数 */
+static BOOL build_table(struct HUFF_TABLE *tab, CONST BYTE *lens, INT num);
+static INT decode_symbol(struct BIT_READER *br, CONST struct HUFF_TABLE *tab);
+static BOOL read_tables(struct BIT_READER *br, struct HUFF_TABLE *lit, struct HUFF_TABLE *dist);
+static VOID fixed_tables(struct HUFF_TABLE *lit, struct HUFF_TABLE *dist);
+static BOOL inflate_block(struct BIT_READER *br, CONST struct HUFF_TABLE *lit, CONST struct HUFF_TABLE *dist, BUFPTR dest, BUFPTR *wrt_ptr, BUFPTR wrt_end_ptr);
+static BOOL stored_block(struct BIT_READER *br, BUFPTR *wrt_ptr, BUFPTR wrt_end_ptr);
+
+/* 压缩处理函数 */
+static VOID reset_window(struct LZ_STATE *lz, BUFCPTR src, UINT src_size, UINT start);
+static VOID insert_string(struct LZ_STATE *lz, BUFCPTR src, UINT pos);
+static UINT longest_match(CONST struct LZ_STATE *lz, BUFCPTR src, UINT pos, UINT max_len, UINT *dist);
+static VOID scan_block(struct LZ_STATE *lz, BUFCPTR src, UINT src_size, UINT start, UINT end, struct CODE_BLOCK *blk, struct BIT_WRITER *bw);
+static VOID scan_lengths(CONST BYTE *lens, INT num, struct CODE_BLOCK *blk, struct BIT_WRITER *bw);
+static VOID put_length_code(struct CODE_BLOCK *blk, struct BIT_WRITER *bw, INT sym, UINT extra, UINT extra_bits);
+static VOID make_lengths(CONST UINT *freq, INT num, INT limit, BYTE *lens);
+static VOID make_codes(CONST BYTE *lens, INT num, WORD *codes);
+
+/* 辅助函数 */
+static UINT reverse_bits(UINT code, UINT num);
+static DWORD adler32(BUFCPTR buf, UINT size);
+
+/************************************************************************/
+
+BOOL zlib_encode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	struct DEFLATE_WORK work;
+
+	/* 不使用上下文时工作状态在栈上 */
+	return encode_work(&work, src, src_size, dest, dest_size);
+}
+
+BOOL zlib_encode_ctx(struct CODEC_CONTEXT *ctx, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	struct DEFLATE_WORK *work;
+
+	/* 工作状态由上下文持有，每个块开始时都会重新初始化 */
+	work = get_codec_work(ctx, CODEC_WORK_ZLIB_ENC, sizeof(struct DEFLATE_WORK));
+	if (!work)
+		return FALSE;
+
+	return encode_work(work, src, src_size, dest, dest_size);
+}
+
+BOOL zlib_decode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	UINT i, final, type;
+	DWORD adler;
+	BUFCPTR rd_ptr;
+	BUFPTR wrt_ptr, wrt_end_ptr;
+	struct BIT_READER br;
+	struct HUFF_TABLE lit, dist;
+
+	/* 参数有效性检查，至少要有2字节的头部和4字节的校验值 */
+	if (!src || src_size < 6 || !dest || !dest_size)
+		return FALSE;
+
+	rd_ptr = src;
+
+	/* 检查zlib头部：必须是Deflate算法，窗口不超过32KB，并且没有预置字典 */
+	if ((rd_ptr[0] & 0x0f) != 8 || (rd_ptr[0] >> 4) > 7 || (rd_ptr[1] & 0x20))
+		return FALSE;
+	if (((rd_ptr[0] << 8) | rd_ptr[1]) % 31)
+		return FALSE;
+
+	init_reader(&br, rd_ptr + 2, rd_ptr + src_size);
+
+	wrt_ptr = dest;
+	wrt_end_ptr = wrt_ptr + *dest_size;
+
+	do {
+
+		/* 块头：是否为最后一块，以及块的类型 */
+		final = get_bits(&br, 1);
+		type = get_bits(&br, 2);
+
+		switch (type) {
+		case 0:
+			if (!stored_block(&br, &wrt_ptr, wrt_end_ptr))
+				return FALSE;
+			break;
+		case 1:
+			fixed_tables(&lit, &dist);
+			if (!inflate_block(&br, &lit, &dist, dest, &wrt_ptr, wrt_end_ptr))
+				return FALSE;
+			break;
+		case 2:
+			if (!read_tables(&br, &lit, &dist))
+				return FALSE;
+			if (!inflate_block(&br, &lit, &dist, dest, &wrt_ptr, wrt_end_ptr))
+				return FALSE;
+			break;
+		default:
+			return FALSE;
+		}
+
+		/* 已经读过了输入的末尾，数据不完整 */
+		if (br.pad_cnt * 8 > br.bit_cnt)
+			return FALSE;
+
+	} while (!final);
+
+	/* 校验值从字节边界开始 */
+	get_bits(&br, br.bit_cnt & 7);
+
+	adler = 0;
+	for (i = 0; i < 4; i++)
+		adler = (adler << 8) | get_bits(&br, 8);
+
+	if (br.pad_cnt * 8 > br.bit_cnt)
+		return FALSE;
+
+	if (adler != adler32(dest, (UINT)(wrt_ptr - (BUFPTR)dest)))
+		return FALSE;
+
+	/* 计算输出数据的大小 */
+	*dest_size = (UINT)(wrt_ptr - (BUFPTR)dest);
+
+	return TRUE;
+}
+
+/************************************************************************/
+
+static BOOL encode_work(struct DEFLATE_WORK *work, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	INT i, hlit, hdist, hclen;
+	UINT start, end;
+	DWORD adler;
+	BUFPTR wrt_ptr;
+	struct BIT_WRITER bw;
+	BYTE lens[LIT_NUM + DIST_NUM];
+
+	DAssert(work);
+
+	/* 参数有效性检查 */
+	if (!src || !src_size || !dest || !dest_size || *dest_size < 6)
+		return FALSE;
+
+	wrt_ptr = dest;
+
+	/* zlib头部：32KB窗口的Deflate，默认压缩级别，没有预置字典 */
+	*wrt_ptr++ = 0x78;
+	*wrt_ptr++ = 0x9c;
+
+	/* 末尾需要留出4字节的校验值 */
+	init_writer(&bw, wrt_ptr, (BUFPTR)dest + *dest_size - 4);
+
+	for (start = 0; start < src_size; start = end) {
+
+		end = DMin(start + BLOCK_SIZE, src_size);
+
+		/* 第一遍扫描，统计符号频率 */
+		DMemClr(&work->blk, sizeof(work->blk));
+		reset_window(&work->lz, src, src_size, start);
+		scan_block(&work->lz, src, src_size, start, end, &work->blk, NULL);
+
+		/* 生成字符/长度和距离的霍夫曼编码 */
+		make_lengths(work->blk.lit_freq, LIT_NUM, MAX_BITS, work->blk.lit_len);
+		make_lengths(work->blk.dist_freq, DIST_NUM, MAX_BITS, work->blk.dist_len);
+		make_codes(work->blk.lit_len, LIT_NUM, work->blk.lit_code);
+		make_codes(work->blk.dist_len, DIST_NUM, work->blk.dist_code);
+
+		/* 去掉末尾码长为0的符号 */
+		for (hlit = LIT_NUM - 2; hlit > LEN_SYM_BASE && !work->blk.lit_len[hlit - 1]; hlit--)
+			;
+		for (hdist = DIST_NUM; hdist > 1 && !work->blk.dist_len[hdist - 1]; hdist--)
+			;
+
+		/* 两组码长连在一起进行游程编码 */
+		DMemCpy(lens, work->blk.lit_len, hlit);
+		DMemCpy(lens + hlit, work->blk.dist_len, hdist);
+
+		scan_lengths(lens, hlit + hdist, &work->blk, NULL);
+		make_lengths(work->blk.cl_freq, CL_NUM, MAX_CL_BITS, work->blk.cl_len);
+		make_codes(work->blk.cl_len, CL_NUM, work->blk.cl_code);
+
+		for (hclen = CL_NUM; hclen > 4 && !work->blk.cl_len[s_ClOrder[hclen - 1]]; hclen--)
+			;
+
+		/* 写入动态霍夫曼块的块头 */
+		put_bits(&bw, end == src_size, 1);
+		put_bits(&bw, 2, 2);
+		put_bits(&bw, hlit - LEN_SYM_BASE, 5);
+		put_bits(&bw, hdist - 1, 5);
+		put_bits(&bw, hclen - 4, 4);
+
+		for (i = 0; i < hclen; i++)
+			put_bits(&bw, work->blk.cl_len[s_ClOrder[i]], 3);
+
+		scan_lengths(lens, hlit + hdist, &work->blk, &bw);
+
+		/* 第二遍扫描，输出编码 */
+		reset_window(&work->lz, src, src_size, start);
+		scan_block(&work->lz, src, src_size, start, end, &work->blk, &bw);
+
+		if (bw.overflow)
+			return FALSE;
+	}
+
+	flush_writer(&bw);
+
+	if (bw.overflow)
+		return FALSE;
+
+	/* 写入大端序的Adler-32校验值 */
+	adler = adler32(src, src_size);
+	wrt_ptr = bw.cur_ptr;
+	*wrt_ptr++ = (BYTE)(adler >> 24);
+	*wrt_ptr++ = (BYTE)(adler >> 16);
+	*wrt_ptr++ = (BYTE)(adler >> 8);
+	*wrt_ptr++ = (BYTE)adler;
+
+	/* 计算输出数据的大小 */
+	*dest_size = (UINT)(wrt_ptr - (BUFPTR)dest);
+
+	return TRUE;
+}
+
+static VOID init_reader(struct BIT_READER *br, VCPTR start, VCPTR end)
+{
+	DAssert(br && start && end && start <= end);
+
+	br->cur_ptr = start;
+	br->end_ptr = end;
+	br->bit_cnt = 0U;
+	br->bit_buf = 0UL;
+	br->pad_cnt = 0U;
+}
+
+static VOID need_bits(struct BIT_READER *br, UINT num)
+{
+	DAssert(br && num <= 24);
+
+	/* 输入结束之后补零，由调用者根据pad_cnt判断是否读过了头 */
+	while (br->bit_cnt < num) {
+		if (br->cur_ptr < br->end_ptr)
+			br->bit_buf |= (DWORD)*br->cur_ptr++ << br->bit_cnt;
+		else
+			br->pad_cnt++;
+		br->bit_cnt += 8;
+	}
+}
+
+static UINT get_bits(struct BIT_READER *br, UINT num)
+{
+	UINT bits;
+
+	DAssert(br && num <= 24);
+
+	if (!num)
+		return 0U;
+
+	need_bits(br, num);
+
+	bits = br->bit_buf & ((1UL << num) - 1);
+	br->bit_buf >>= num;
+	br->bit_cnt -= num;
+
+	return bits;
+}
+
+static VOID init_writer(struct BIT_WRITER *bw, VPTR start, VPTR end)
+{
+	DAssert(bw && start && end);
+
+	bw->cur_ptr = start;
+	bw->end_ptr = end;
+	bw->bit_cnt = 0U;
+	bw->bit_buf = 0UL;
+	bw->overflow = (start > end);
+}
+
+static VOID put_bits(struct BIT_WRITER *bw, UINT bits, UINT num)
+{
+	DAssert(bw && num <= 16);
+
+	bw->bit_buf |= (DWORD)bits << bw->bit_cnt;
+	bw->bit_cnt += num;
+
+	while (bw->bit_cnt >= 8) {
+
+		/* 缓冲不足时继续消耗位数据，只是不再写入 */
+		if (bw->cur_ptr < bw->end_ptr)
+			*bw->cur_ptr++ = (BYTE)bw->bit_buf;
+		else
+			bw->overflow = TRUE;
+
+		bw->bit_buf >>= 8;
+		bw->bit_cnt -= 8;
+	}
+}
+
+static VOID flush_writer(struct BIT_WRITER *bw)
+{
+	DAssert(bw);
+
+	/* 补齐到字节边界 */
+	if (bw->bit_cnt)
+		put_bits(bw, 0U, 8 - bw->bit_cnt);
+}
+
+/************************************************************************/
+
+static BOOL build_table(struct HUFF_TABLE *tab, CONST BYTE *lens, INT num)
+{
+	INT i, len, left;
+	UINT code, rev, step;
+	WORD offs[MAX_BITS + 2];
+	UINT next[MAX_BITS + 1];
+
+	DAssert(tab && lens && num <= LIT_NUM);
+
+	DMemClr(tab->count, sizeof(tab->count));
+	DMemClr(tab->fast, sizeof(tab->fast));
+
+	for (i = 0; i < num; i++)
+		tab->count[lens[i]]++;
+	tab->count[0] = 0;
+
+	/* 编码超额的树无效，不完整的树则允许（只有一个编码时就是如此） */
+	left = 1;
+	for (len = 1; len <= MAX_BITS; len++) {
+		left <<= 1;
+		left -= tab->count[len];
+		if (left < 0)
+			return FALSE;
+	}
+
+	/* 按码长和符号的顺序排列符号 */
+	offs[1] = 0;
+	for (len = 1; len <= MAX_BITS; len++)
+		offs[len + 1] = offs[len] + tab->count[len];
+
+	for (i = 0; i < num; i++) {
+		if (lens[i])
+			tab->symbol[offs[lens[i]]++] = i;
+	}
+
+	/* 范式霍夫曼编码：同一码长的编码按符号顺序递增 */
+	code = 0;
+	next[0] = 0;
+	for (len = 1; len <= MAX_BITS; len++) {
+		code = (code + tab->count[len - 1]) << 1;
+		next[len] = code;
+	}
+
+	/* 短编码填入查找表，编码是倒序存放在流中的 */
+	for (i = 0; i < num; i++) {
+		len = lens[i];
+		if (!len)
+			continue;
+		code = next[len]++;
+		if (len > FAST_BITS)
+			continue;
+		rev = reverse_bits(code, len);
+		step = 1U << len;
+		for (; rev < FAST_SIZE; rev += step)
+			tab->fast[rev] = (WORD)((len << FAST_BITS) | i);
+	}
+
+	return TRUE;
+}
+
+static INT decode_symbol(struct BIT_READER *br, CONST struct HUFF_TABLE *tab)
+{
+	INT len, code, first, index, count;
+	DWORD bits;
+	WORD entry;
+
+	DAssert(br && tab);
+
+	need_bits(br, MAX_BITS);
+
+	/* 先查快速解码表 */
+	entry = tab->fast[br->bit_buf & (FAST_SIZE - 1)];
+	if (entry) {
+		len = entry >> FAST_BITS;
+		br->bit_buf >>= len;
+		br->bit_cnt -= len;
+		return entry & (FAST_SIZE - 1);
+	}
+
+	/* 长编码逐位比较 */
+	bits = br->bit_buf;
+	code = first = index = 0;
+
+	for (len = 1; len <= MAX_BITS; len++) {
+		code |= bits & 1;
+		bits >>= 1;
+		count = tab->count[len];
+		if (code - first < count) {
+			br->bit_buf >>= len;
+			br->bit_cnt -= len;
+			return tab->symbol[index + code - first];
+		}
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+static BOOL read_tables(struct BIT_READER *br, struct HUFF_TABLE *lit, struct HUFF_TABLE *dist)
+{
+	INT i, sym, hlit, hdist, hclen, rep;
+	BYTE prev;
+	BYTE cl_lens[CL_NUM];
+	BYTE lens[LIT_NUM + DIST_NUM];
+
+	DAssert(br && lit && dist);
+
+	hlit = get_bits(br, 5) + LEN_SYM_BASE;
+	hdist = get_bits(br, 5) + 1;
+	hclen = get_bits(br, 4) + 4;
+
+	if (hlit > LIT_NUM - 2 || hdist > DIST_NUM)
+		return FALSE;
+
+	/* 先读入码长符号的码长 */
+	DMemClr(cl_lens, sizeof(cl_lens));
+	for (i = 0; i < hclen; i++)
+		cl_lens[s_ClOrder[i]] = get_bits(br, 3);
+
+	/* 借用字符/长度解码表解码码长 */
+	if (!build_table(lit, cl_lens, CL_NUM))
+		return FALSE;
+
+	for (i = 0; i < hlit + hdist; ) {
+
+		sym = decode_symbol(br, lit);
+		if (sym < 0)
+			return FALSE;
+
+		if (sym < 16) {
+			lens[i++] = sym;
+			continue;
+		}
+
+		switch (sym) {
+		case 16:
+			if (!i)
+				return FALSE;
+			prev = lens[i - 1];
+			rep = 3 + get_bits(br, 2);
+			break;
+		case 17:
+			prev = 0;
+			rep = 3 + get_bits(br, 3);
+			break;
+		default:
+			prev = 0;
+			rep = 11 + get_bits(br, 7);
+			break;
+		}
+
+		if (i + rep > hlit + hdist)
+			return FALSE;
+
+		while (rep--)
+			lens[i++] = prev;
+	}
+
+	/* 必须有块结束符号 */
+	if (!lens[END_BLOCK])
+		return FALSE;
+
+	if (!build_table(lit, lens, hlit))
+		return FALSE;
+
+	if (!build_table(dist, lens + hlit, hdist))
+		return FALSE;
+
+	return TRUE;
+}
+
+static VOID fixed_tables(struct HUFF_TABLE *lit, struct HUFF_TABLE *dist)
+{
+	INT i;
+	BYTE lens[LIT_NUM];
+
+	DAssert(lit && dist);
+
+	for (i = 0; i < 144; i++)
+		lens[i] = 8;
+	for (; i < 256; i++)
+		lens[i] = 9;
+	for (; i < 280; i++)
+		lens[i] = 7;
+	for (; i < LIT_NUM; i++)
+		lens[i] = 8;
+
+	DVerify(build_table(lit, lens, LIT_NUM));
+
+	for (i = 0; i < DIST_NUM; i++)
+		lens[i] = 5;
+
+	DVerify(build_table(dist, lens, DIST_NUM));
+}
+
+static BOOL inflate_block(struct BIT_READER *br, CONST struct HUFF_TABLE *lit, CONST struct HUFF_TABLE *dist, BUFPTR dest, BUFPTR *wrt_ptr, BUFPTR wrt_end_ptr)
+{
+	INT sym;
+	UINT len, offset;
+	BUFPTR wrt, copy_ptr;
+
+	DAssert(br && lit && dist && dest && wrt_ptr && wrt_end_ptr);
+
+	wrt = *wrt_ptr;
+
+	for (;;) {
+
+		sym = decode_symbol(br, lit);
+		if (sym < 0)
+			return FALSE;
+
+		/* 字符 */
+		if (sym < END_BLOCK) {
+			if (wrt >= wrt_end_ptr)
+				return FALSE;
+			*wrt++ = (BYTE)sym;
+			continue;
+		}
+
+		if (sym == END_BLOCK)
+			break;
+
+		/* 重复数据的长度和距离 */
+		sym -= LEN_SYM_BASE;
+		if (sym >= LEN_SYM_NUM)
+			return FALSE;
+		len = s_LenBase[sym] + get_bits(br, s_LenExtra[sym]);
+
+		sym = decode_symbol(br, dist);
+		if (sym < 0 || sym >= DIST_NUM)
+			return FALSE;
+		offset = s_DistBase[sym] + get_bits(br, s_DistExtra[sym]);
+
+		if (offset > (UINT)(wrt - dest) || len > (UINT)(wrt_end_ptr - wrt))
+			return FALSE;
+
+		/* 距离可能小于长度，必须逐字节复制 */
+		copy_ptr = wrt - offset;
+		while (len--)
+			*wrt++ = *copy_ptr++;
+	}
+
+	*wrt_ptr = wrt;
+	return TRUE;
+}
+
+static BOOL stored_block(struct BIT_READER *br, BUFPTR *wrt_ptr, BUFPTR wrt_end_ptr)
+{
+	UINT len, nlen;
+	BUFPTR wrt;
+
+	DAssert(br && wrt_ptr && wrt_end_ptr);
+
+	/* 长度从字节边界开始 */
+	get_bits(br, br->bit_cnt & 7);
+
+	len = get_bits(br, 16);
+	nlen = get_bits(br, 16);
+	if (len != (~nlen & 0xffff))
+		return FALSE;
+
+	wrt = *wrt_ptr;
+	if (len > (UINT)(wrt_end_ptr - wrt))
+		return FALSE;
+
+	/* 先取出位缓冲中剩余的字节，其余的直接复制 */
+	while (len && br->bit_cnt) {
+		*wrt++ = (BYTE)get_bits(br, 8);
+		len--;
+	}
+
+	if (br->pad_cnt)
+		return FALSE;
+
+	if (len > (UINT)(br->end_ptr - br->cur_ptr))
+		return FALSE;
+
+	DMemCpy(wrt, br->cur_ptr, len);
+	br->cur_ptr += len;
+	wrt += len;
+
+	*wrt_ptr = wrt;
+	return TRUE;
+}
+
+/************************************************************************/
+
+static VOID reset_window(struct LZ_STATE *lz, BUFCPTR src, UINT src_size, UINT start)
+{
+	UINT pos;
+
+	DAssert(lz && src && start <= src_size);
+
+	DMemClr(lz->head, sizeof(lz->head));
+
+	/* 两遍扫描必须得到同样的结果，因此每次都从块的开头重建窗口，与scan_block一样只加入其后还有MIN_MATCH字节的位置 */
+	pos = (start > WINDOW_SIZE) ? start - WINDOW_SIZE : 0;
+	for (; pos < start && pos + MIN_MATCH <= src_size; pos++)
+		insert_string(lz, src, pos);
+}
+
+static VOID insert_string(struct LZ_STATE *lz, BUFCPTR src, UINT pos)
+{
+	UINT hash, prev, dist;
+
+	DAssert(lz && src);
+
+	hash = ((DWORD)src[pos] | ((DWORD)src[pos + 1] << 8) | ((DWORD)src[pos + 2] << 16)) * 2654435761UL;
+	hash = (hash & 0xffffffffUL) >> (32 - HASH_BITS);
+
+	prev = lz->head[hash];
+	dist = prev ? pos - (prev - 1) : 0;
+
+	lz->prev[pos & WINDOW_MASK] = (dist <= WINDOW_SIZE) ? (WORD)dist : 0;
+	lz->head[hash] = pos + 1;
+}
+
+static UINT longest_match(CONST struct LZ_STATE *lz, BUFCPTR src, UINT pos, UINT max_len, UINT *dist)
+{
+	UINT hash, prev, offset, step, len, best, chain;
+	BUFCPTR cur_ptr, match_ptr;
+
+	DAssert(lz && src && dist);
+
+	if (max_len < MIN_MATCH)
+		return 0U;
+
+	hash = ((DWORD)src[pos] | ((DWORD)src[pos + 1] << 8) | ((DWORD)src[pos + 2] << 16)) * 2654435761UL;
+	hash = (hash & 0xffffffffUL) >> (32 - HASH_BITS);
+
+	prev = lz->head[hash];
+	if (!prev)
+		return 0U;
+
+	offset = pos - (prev - 1);
+	cur_ptr = src + pos;
+	best = 0U;
+
+	for (chain = MAX_CHAIN; chain && offset <= WINDOW_SIZE; chain--) {
+
+		match_ptr = cur_ptr - offset;
+
+		/* 先比较当前最长长度处的字节，不可能更长时跳过 */
+		if (match_ptr[best] == cur_ptr[best]) {
+			for (len = 0; len < max_len && match_ptr[len] == cur_ptr[len]; len++)
+				;
+			if (len > best) {
+				best = len;
+				*dist = offset;
+				if (len >= max_len)
+					break;
+			}
+		}
+
+		step = lz->prev[(pos - offset) & WINDOW_MASK];
+		if (!step)
+			break;
+		offset += step;
+	}
+
+	return (best >= MIN_MATCH) ? best : 0U;
+}
+
+static VOID scan_block(struct LZ_STATE *lz, BUFCPTR src, UINT src_size, UINT start, UINT end, struct CODE_BLOCK *blk, struct BIT_WRITER *bw)
+{
+	INT sym;
+	UINT pos, len, dist, i;
+
+	DAssert(lz && src && blk && start < end && end <= src_size);
+
+	/* bw为NULL时只统计频率，否则输出编码 */
+	for (pos = start; pos < end; ) {
+
+		len = 0U;
+
+		if (pos + MIN_MATCH <= src_size) {
+			len = longest_match(lz, src, pos, DMin(end - pos, MAX_MATCH), &dist);
+			insert_string(lz, src, pos);
+		}
+
+		if (!len) {
+			sym = src[pos++];
+			if (bw)
+				put_bits(bw, blk->lit_code[sym], blk->lit_len[sym]);
+			else
+				blk->lit_freq[sym]++;
+			continue;
+		}
+
+		/* 重复数据中的位置也加入散列链 */
+		for (i = 1; i < len; i++) {
+			if (pos + i + MIN_MATCH <= src_size)
+				insert_string(lz, src, pos + i);
+		}
+		pos += len;
+
+		for (sym = LEN_SYM_NUM - 1; s_LenBase[sym] > len; sym--)
+			;
+
+		if (bw) {
+			put_bits(bw, blk->lit_code[LEN_SYM_BASE + sym], blk->lit_len[LEN_SYM_BASE + sym]);
+			put_bits(bw, len - s_LenBase[sym], s_LenExtra[sym]);
+		} else {
+			blk->lit_freq[LEN_SYM_BASE + sym]++;
+		}
+
+		for (sym = DIST_NUM - 1; s_DistBase[sym] > dist; sym--)
+			;
+
+		if (bw) {
+			put_bits(bw, blk->dist_code[sym], blk->dist_len[sym]);
+			put_bits(bw, dist - s_DistBase[sym], s_DistExtra[sym]);
+		} else {
+			blk->dist_freq[sym]++;
+		}
+	}
+
+	if (bw)
+		put_bits(bw, blk->lit_code[END_BLOCK], blk->lit_len[END_BLOCK]);
+	else
+		blk->lit_freq[END_BLOCK]++;
+}
+
+static VOID scan_lengths(CONST BYTE *lens, INT num, struct CODE_BLOCK *blk, struct BIT_WRITER *bw)
+{
+	INT i, run, rep;
+
+	DAssert(lens && blk);
+
+	for (i = 0; i < num; ) {
+
+		for (run = 1; i + run < num && lens[i + run] == lens[i]; run++)
+			;
+
+		if (!lens[i]) {
+
+			/* 连续的0 */
+			while (run >= 11) {
+				rep = DMin(run, 138);
+				put_length_code(blk, bw, 18, rep - 11, 7);
+				run -= rep;
+				i += rep;
+			}
+			if (run >= 3) {
+				put_length_code(blk, bw, 17, run - 3, 3);
+				i += run;
+				run = 0;
+			}
+
+		} else {
+
+			/* 连续的非0码长，先写一次码长本身，其后用重复符号 */
+			put_length_code(blk, bw, lens[i], 0, 0);
+			run--;
+			i++;
+			while (run >= 3) {
+				rep = DMin(run, 6);
+				put_length_code(blk, bw, 16, rep - 3, 2);
+				run -= rep;
+				i += rep;
+			}
+		}
+
+		for (; run > 0; run--)
+			put_length_code(blk, bw, lens[i++], 0, 0);
+	}
+}
+
+static VOID put_length_code(struct CODE_BLOCK *blk, struct BIT_WRITER *bw, INT sym, UINT extra, UINT extra_bits)
+{
+	DAssert(blk && sym < CL_NUM);
+
+	if (!bw) {
+		blk->cl_freq[sym]++;
+		return;
+	}
+
+	put_bits(bw, blk->cl_code[sym], blk->cl_len[sym]);
+	if (extra_bits)
+		put_bits(bw, extra, extra_bits);
+}
+
+static VOID make_lengths(CONST UINT *freq, INT num, INT limit, BYTE *lens)
+{
+	INT i, k, n, a, b, len, max_len, heap_num, node_num, child, shift;
+	INT heap[LIT_NUM + 1];
+	INT parent[LIT_NUM * 2];
+	UINT weight[LIT_NUM * 2];
+
+	DAssert(freq && lens && num <= LIT_NUM);
+
+	DMemClr(lens, num);
+
+	for (n = 0, k = 0, i = 0; i < num; i++) {
+		if (freq[i]) {
+			n++;
+			k = i;
+		}
+	}
+
+	/* 少于两个符号时补成一棵完整的树 */
+	if (n < 2) {
+		lens[k] = 1;
+		lens[k ? 0 : 1] = 1;
+		return;
+	}
+
+	/* 码长超过限制时降低频率的差距后重新生成 */
+	for (shift = 0; ; shift++) {
+
+		heap_num = 0;
+		node_num = num;
+
+		for (i = 0; i < num; i++) {
+
+			if (!freq[i])
+				continue;
+
+			weight[i] = shift ? 1 + (freq[i] >> shift) : freq[i];
+			parent[i] = -1;
+
+			/* 加入最小堆（下标从1开始） */
+			k = ++heap_num;
+			while (k > 1 && weight[heap[k >> 1]] > weight[i]) {
+				heap[k] = heap[k >> 1];
+				k >>= 1;
+			}
+			heap[k] = i;
+		}
+
+		while (heap_num > 1) {
+
+			weight[node_num] = 0;
+
+			/* 依次取出权重最小的两个节点，合并成新节点 */
+			for (n = 0; n < 2; n++) {
+
+				a = heap[1];
+				b = heap[heap_num--];
+
+				for (k = 1; (child = k << 1) <= heap_num; k = child) {
+					if (child < heap_num && weight[heap[child + 1]] < weight[heap[child]])
+						child++;
+					if (weight[b] <= weight[heap[child]])
+						break;
+					heap[k] = heap[child];
+				}
+				heap[k] = b;
+
+				weight[node_num] += weight[a];
+				parent[a] = node_num;
+			}
+
+			/* 新节点放回堆中 */
+			parent[node_num] = -1;
+			k = ++heap_num;
+			while (k > 1 && weight[heap[k >> 1]] > weight[node_num]) {
+				heap[k] = heap[k >> 1];
+				k >>= 1;
+			}
+			heap[k] = node_num;
+			node_num++;
+		}
+
+		max_len = 0;
+		for (i = 0; i < num; i++) {
+			if (!freq[i])
+				continue;
+			for (len = 0, k = i; parent[k] >= 0; k = parent[k])
+				len++;
+			lens[i] = len;
+			max_len = DMax(max_len, len);
+		}
+
+		if (max_len <= limit)
+			break;
+	}
+}
+
+static VOID make_codes(CONST BYTE *lens, INT num, WORD *codes)
+{
+	INT i, len;
+	UINT code;
+	UINT count[MAX_BITS + 1];
+	UINT next[MAX_BITS + 1];
+
+	DAssert(lens && codes);
+
+	DMemClr(count, sizeof(count));
+	for (i = 0; i < num; i++)
+		count[lens[i]]++;
+	count[0] = 0;
+
+	code = 0;
+	next[0] = 0;
+	for (len = 1; len <= MAX_BITS; len++) {
+		code = (code + count[len - 1]) << 1;
+		next[len] = code;
+	}
+
+	for (i = 0; i < num; i++) {
+		len = lens[i];
+		codes[i] = len ? (WORD)reverse_bits(next[len]++, len) : 0;
+	}
+}
+
+/************************************************************************/
+
+static UINT reverse_bits(UINT code, UINT num)
+{
+	UINT rev = 0;
+
+	while (num--) {
+		rev = (rev << 1) | (code & 1);
+		code >>= 1;
+	}
+
+	return rev;
+}
+
+static DWORD adler32(BUFCPTR buf, UINT size)
+{
+	UINT len;
+	DWORD a = 1UL, b = 0UL;
+
+	while (size) {
+		len = DMin(size, ADLER_NMAX);
+		size -= len;
+		while (len--) {
+			a += *buf++;
+			b += a;
+		}
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+	}
+
+	return (b << 16) | a;
+}
+
+/************************************************************************/
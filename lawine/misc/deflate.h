@@ -0,0 +1,25 @@
+﻿/************************************************************************/
+/* File Name   : deflate.h                                              */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Lawine library                                         */
+/* Descript    : Deflate (zlib format) compression API definition       */
+/************************************************************************/
+
+#ifndef __SD_LAWINE_MISC_DEFLATE_H__
+#define __SD_LAWINE_MISC_DEFLATE_H__
+
+/************************************************************************/
+
+#include <common.h>
+#include "codec.h"
+
+/************************************************************************/
+
+CAPI extern BOOL zlib_encode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL zlib_encode_ctx(struct CODEC_CONTEXT *ctx, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL zlib_decode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+
+/************************************************************************/
+
+#endif	/* __SD_LAWINE_MISC_DEFLATE_H__ */
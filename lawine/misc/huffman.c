@@ -6,6 +6,7 @@
 /* Descript    : Blizzard huffman compression API implementation        */
 /************************************************************************/
 
+#include <stddef.h>
 #include "huffman.h"
 
 /*
@@ -38,10 +39,15 @@
 #define NODE_BUF_LEN		(CODE_MAP_LEN * 2 - 1)	/* 节点缓冲大小 */
 
 #ifdef QUICK_DECODE
-#define QD_BIT_NUM			7						/* 快速解压索引位数 */
+#define QD_BIT_NUM			8						/* 快速解压索引位数 */
 #define QD_BUF_MAX			(1 << QD_BIT_NUM)		/* 快速解压缓冲大小 */
+#define QD_CH_MAX			4						/* 每项快速解压数据最多可记录的字符数 */
 #endif
 
+#define SERIAL_MAX			0x7fffffffU				/* 序列号上限，超过后需要清空快速解压数据及编码缓存 */
+#define CODE_BIT_MAX		56						/* 编码缓存可记录的最大编码位数 */
+#define LEADER_NUM			1024					/* 同权重值首节点表大小，必须是2的幂 */
+
 /************************************************************************/
 
 /* 霍夫曼树节点（同时也是链表节点） */
@@ -55,12 +61,21 @@ struct HUFF_NODE {
 	struct HUFF_NODE *next;							/* 链表中的后一个节点 */
 };
 
+/* 压缩处理用的编码缓存 */
+struct HUFF_CODE {
+	UINT serial;									/* 序列号，用来标识该编码是否过期。0为无效值 */
+	UINT bit_cnt;									/* 编码位数 */
+	QWORD bits;										/* 编码，最先输出的位（靠近根节点的位）在最低位 */
+};
+
 #ifdef QUICK_DECODE
 /* 快速解压处理用数据 */
 struct QDBLOCK {
 	UINT serial;									/* 序列号，用来标识该数据是否过期。0为无效值 */
-	UINT bit_cnt;									/* 编码位数 */
-	struct HUFF_NODE *node;							/* 节点指针，当bit_cnt<=7时为叶节点，否则为分枝节点（需要继续往下找） */
+	BYTE ch_cnt;									/* 可直接输出的字符数，它们的编码都在索引位之内。0表示需要另行处理 */
+	BYTE bit_cnt;									/* 这些字符的编码总位数。ch_cnt为0时为第一个编码的位数 */
+	WORD node;										/* 第一个编码的节点下标，当bit_cnt小于索引位数时为叶节点，否则可能为分枝节点（需要继续往下找） */
+	BYTE ch[QD_CH_MAX];								/* 可直接输出的字符 */
 };
 #endif
 
@@ -70,9 +85,17 @@ struct HUFF_TREE {
 	struct HUFF_NODE *head;							/* 有序链表头节点，同时也是霍夫曼树的根节点 */
 	struct HUFF_NODE *tail;							/* 有序链表尾节点 */
 	struct HUFF_NODE node_buf[NODE_BUF_LEN];		/* 节点缓冲，为了避免动态内存分配 */
-	struct HUFF_NODE *code_map[CODE_MAP_LEN];		/* 编码映射表，下标即是编码字符（0-257）。仅用于压缩处理 */
+	struct HUFF_NODE *code_map[CODE_MAP_LEN];		/* 编码映射表，下标即是编码字符（0-257） */
+	INT init_type;									/* 初始状态所对应的编码类型，-1表示尚未保存。以下成员在重新初始化时保留 */
+	INT init_cnt;									/* 初始状态的有效节点缓冲数 */
+	struct HUFF_NODE *init_head;					/* 初始状态的有序链表头节点 */
+	struct HUFF_NODE *init_tail;					/* 初始状态的有序链表尾节点 */
+	struct HUFF_NODE init_buf[NODE_BUF_LEN];		/* 初始状态的节点缓冲，其中的指针都指向node_buf */
+	struct HUFF_NODE *init_map[CODE_MAP_LEN];		/* 初始状态的编码映射表 */
+	UINT serial;									/* 序列号，霍夫曼树每次改变时递增 */
+	struct HUFF_CODE code_buf[CODE_MAP_LEN];		/* 各字符的编码缓存，下标即是编码字符。仅用于压缩处理 */
+	struct HUFF_NODE *leader[LEADER_NUM];			/* 各权重值在链表中的第一个节点，以权重值的低位为下标。仅作为提示，使用前需要验证 */
 #ifdef QUICK_DECODE
-	UINT serial;									/* 快速解压处理序列号。仅用于解压处理 */
 	struct QDBLOCK qd_buf[QD_BUF_MAX];				/* 快速解压处理数据缓冲。仅用于解压处理 */
 #endif
 };
@@ -82,7 +105,8 @@ struct BIT_STREAM {
 	BUFPTR cur_ptr;									/* 当前数据指针 */
 	BUFCPTR end_ptr;								/* 结束位置指针 */
 	UINT bit_cnt;									/* 缓冲位数 */
-	UINT bit_buf;									/* 缓冲数据 */
+	QWORD bit_buf;									/* 缓冲数据 */
+	UINT pad_cnt;									/* 超出输入范围后以0填充的字节数。仅用于解压处理 */
 };
 
 /************************************************************************/
@@ -255,49 +279,103 @@ static CONST BYTE s_CodecTab[CODEC_TYPE_NUM][256] = {
 
 /************************************************************************/
 
+/* 压缩解压处理 */
+static BOOL encode_tree(struct HUFF_TREE *tree, INT type, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+static BOOL decode_tree(struct HUFF_TREE *tree, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+
 /* 位数据流操作函数 */
 static VOID init_bits(struct BIT_STREAM *bs, VCPTR start, VCPTR end);
 static VOID flush_bits(struct BIT_STREAM *bs);
+static VOID fill_bits(struct BIT_STREAM *bs);
 static UINT get_bit(struct BIT_STREAM *bs);
 static BYTE get_byte(struct BIT_STREAM *bs);
-static VOID put_bits(struct BIT_STREAM *bs, UINT bits, UINT num);
+static VOID put_bits(struct BIT_STREAM *bs, QWORD bits, UINT num);
 
 /* 霍夫曼树操作函数 */
+static struct HUFF_TREE *new_tree(VOID);
+static struct HUFF_TREE *context_tree(struct CODEC_CONTEXT *ctx);
 static VOID init_tree(struct HUFF_TREE *tree, INT type);
 static VOID sort_tree(struct HUFF_TREE *tree, struct HUFF_NODE *node);
 static struct HUFF_NODE *new_node(struct HUFF_TREE *tree, INT weight);
 static struct HUFF_NODE *new_branch(struct HUFF_TREE *tree, BYTE byte);
 static VOID swap_node(struct HUFF_TREE *tree, struct HUFF_NODE *n1, struct HUFF_NODE *n2);
-static VOID dump_node(struct HUFF_NODE *node, struct BIT_STREAM *bs);
+static VOID dump_node(struct HUFF_TREE *tree, INT ch, struct BIT_STREAM *bs);
 static struct HUFF_NODE *trace_node(struct HUFF_NODE *node, struct BIT_STREAM *bs);
 
 #ifdef QUICK_DECODE
 /* 快速解压处理专用函数 */
-static BYTE peek_7bits(struct BIT_STREAM *bs);
 static VOID skip_bits(struct BIT_STREAM *bs, UINT num);
-static struct HUFF_NODE *trace_node_qd(struct HUFF_TREE *tree, BYTE byte, struct BIT_STREAM *bs);
+static VOID fill_qd(struct HUFF_TREE *tree, UINT index);
 #endif
 
 /************************************************************************/
 
 BOOL huff_encode(INT type, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	BOOL ret;
+	struct CODEC_CONTEXT *ctx;
+
+	/* 从上下文缓存池中取得上下文，使用其中的霍夫曼树，以免每次分配内存和清空快速解压数据 */
+	ctx = alloc_codec_context();
+	ret = huff_encode_ctx(ctx, type, src, src_size, dest, dest_size);
+	free_codec_context(ctx);
+
+	return ret;
+}
+
+BOOL huff_decode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	BOOL ret;
+	struct CODEC_CONTEXT *ctx;
+
+	/* 同上 */
+	ctx = alloc_codec_context();
+	ret = huff_decode_ctx(ctx, src, src_size, dest, dest_size);
+	free_codec_context(ctx);
+
+	return ret;
+}
+
+BOOL huff_encode_ctx(struct CODEC_CONTEXT *ctx, INT type, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	struct HUFF_TREE *tree;
+
+	/* 使用上下文中的霍夫曼树 */
+	tree = context_tree(ctx);
+	if (!tree)
+		return FALSE;
+
+	return encode_tree(tree, type, src, src_size, dest, dest_size);
+}
+
+BOOL huff_decode_ctx(struct CODEC_CONTEXT *ctx, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	struct HUFF_TREE *tree;
+
+	/* 使用上下文中的霍夫曼树 */
+	tree = context_tree(ctx);
+	if (!tree)
+		return FALSE;
+
+	return decode_tree(tree, src, src_size, dest, dest_size);
+}
+
+/************************************************************************/
+
+static BOOL encode_tree(struct HUFF_TREE *tree, INT type, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 {
 	BYTE byte;
 	BUFCPTR rd_ptr, rd_end_ptr;
 	BUFPTR wrt_ptr, wrt_end_ptr;
 	struct BIT_STREAM bs;
-	struct HUFF_TREE *tree;
 	struct HUFF_NODE *node;
 
+	DAssert(tree);
+
 	/* 参数有效性检查 */
 	if (!src || !src_size || !dest || !dest_size || !*dest_size || !DBetween(type, 0, CODEC_TYPE_NUM))
 		return FALSE;
 
-	/* 分配霍夫曼树结构体内存 */
-	tree = DAlloc(sizeof(struct HUFF_TREE));
-	if (!tree)
-		return FALSE;
-
 	rd_ptr = src;
 	rd_end_ptr = rd_ptr + src_size;
 	wrt_ptr = dest;
@@ -316,10 +394,8 @@ BOOL huff_encode(INT type, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 	while (TRUE) {
 
 		/* 写缓冲不足，失败 */
-		if (bs.cur_ptr >= bs.end_ptr) {
-			DFree(tree);
+		if (bs.cur_ptr >= bs.end_ptr)
 			return FALSE;
-		}
 
 		/* 读取一个字符 */
 		byte = *rd_ptr++;
@@ -330,13 +406,12 @@ BOOL huff_encode(INT type, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 		if (node) {
 
 			/* 如果映射已存在，直接从映射节点生成编码 */
-			dump_node(node, &bs);
+			dump_node(tree, byte, &bs);
 
 		} else {
 
 			/* 映射尚不存在，先写一个未传输码到缓冲 */
-			node = tree->code_map[NYT];
-			dump_node(node, &bs);
+			dump_node(tree, NYT, &bs);
 
 			/* 紧接其后写入字符本身 */
 			put_bits(&bs, byte, 8U);
@@ -362,14 +437,14 @@ BOOL huff_encode(INT type, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 	}
 
 	/* 最后书写一个传输结束码作为结束标志 */
-	node = tree->code_map[EOT];
-	dump_node(node, &bs);
+	dump_node(tree, EOT, &bs);
 
 	/* 将位数据流中所有缓冲写回 */
 	flush_bits(&bs);
 
-	/* 压缩完毕，释放霍夫曼树结构的内存 */
-	DFree(tree);
+	/* 写缓冲不足以容纳全部编码，失败 */
+	if (bs.bit_cnt)
+		return FALSE;
 
 	/* 计算输出数据的大小 */
 	*dest_size = (UINT)(bs.cur_ptr - (BUFPTR)dest);
@@ -377,19 +452,21 @@ BOOL huff_encode(INT type, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 	return TRUE;
 }
 
-BOOL huff_decode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+static BOOL decode_tree(struct HUFF_TREE *tree, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 {
 	INT type;
 	BYTE byte;
 	BUFCPTR rd_ptr, rd_end_ptr;
 	BUFPTR wrt_ptr, wrt_end_ptr;
 	struct BIT_STREAM bs;
-	struct HUFF_TREE *tree;
 	struct HUFF_NODE *node;
 #ifdef QUICK_DECODE
-	struct QDBLOCK *qd;
+	UINT index, ch_cnt, bit_cnt, ext_cnt;
+	struct QDBLOCK *qd, *ext_qd;
 #endif
 
+	DAssert(tree);
+
 	/* 参数有效性检查 */
 	if (!src || !src_size || !dest || !dest_size || !*dest_size)
 		return FALSE;
@@ -404,44 +481,87 @@ BOOL huff_decode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 	if (type >= CODEC_TYPE_NUM)
 		return FALSE;
 
-	/* 分配霍夫曼树结构体内存 */
-	tree = DAlloc(sizeof(struct HUFF_TREE));
-	if (!tree)
-		return FALSE;
-
 	/* 将输入缓冲数据附着到位数据流结构上 */
 	init_bits(&bs, rd_ptr, rd_end_ptr);
 
 	/* 根据编码类型生成初始霍夫曼树 */
 	init_tree(tree, type);
 
+#ifdef QUICK_DECODE
+	/* 尚没有可以附加后续字符的快速解压数据 */
+	ext_qd = NULL;
+	ext_cnt = 0U;
+#endif
+
 	/* 主循环 */
 	while (TRUE) {
 
-		/* 如果超出了输入范围仍未结束，则认为压缩数据已被损坏，失败 */
-		if (bs.cur_ptr > bs.end_ptr) {
-			DFree(tree);
+		/* 如果读取的位超出了输入范围仍未结束，则认为压缩数据已被损坏，失败 */
+		if (bs.pad_cnt * 8U > bs.bit_cnt)
 			return FALSE;
-		}
 
 #ifdef QUICK_DECODE
-		/* 先获取流中接下来7位数据所对应的快速解压数据（不改变为数据流的读写位置） */
-		byte = peek_7bits(&bs);
-		qd = &tree->qd_buf[byte];
-
-		/* 判断快速解压数据是否过期 */
-		if (qd->serial >= tree->serial) {
-			/* 如果编码位数超过7位，需要继续沿节点查找，否则直接使用快速解压数据中记录的节点 */
-			if (qd->bit_cnt > QD_BIT_NUM) {
-				skip_bits(&bs, 7U);
-				node = trace_node(qd->node, &bs);
+		/* 类型0编码的霍夫曼树几乎每个字符都会改变，快速解压数据刚生成就会过期，直接查找更快 */
+		if (!type) {
+			node = trace_node(tree->head, &bs);
+		} else {
+
+			/* 先获取流中接下来8位数据所对应的快速解压数据（不改变为数据流的读写位置） */
+			if (bs.bit_cnt < QD_BIT_NUM)
+				fill_bits(&bs);
+
+			index = (UINT)bs.bit_buf & (QD_BUF_MAX - 1);
+			qd = &tree->qd_buf[index];
+
+			/* 如果快速解压数据已过期，从霍夫曼树的根节点开始查找并重新生成 */
+			if (qd->serial < tree->serial)
+				fill_qd(tree, index);
+
+			/* 普通字符直接从快速解压数据中输出，可能一次输出多个 */
+			if (qd->ch_cnt) {
+
+				ch_cnt = qd->ch_cnt;
+				bit_cnt = qd->bit_cnt;
+				skip_bits(&bs, bit_cnt);
+
+				/* 写缓冲足够时总是写满QD_CH_MAX个字节，多写的部分随后会被覆盖 */
+				if ((UINT)(wrt_end_ptr - wrt_ptr) > QD_CH_MAX) {
+					DMemCpy(wrt_ptr, qd->ch, QD_CH_MAX);
+					wrt_ptr += ch_cnt;
+				} else {
+					ch_cnt = DMin(ch_cnt, (UINT)(wrt_end_ptr - wrt_ptr));
+					DMemCpy(wrt_ptr, qd->ch, ch_cnt);
+					wrt_ptr += ch_cnt;
+					if (wrt_ptr >= wrt_end_ptr)
+						break;
+				}
+
+				/* 如果这些编码也在前一项快速解压数据的索引位之内，则将它们附加到那一项之后，*/
+				/* 这样以后再遇到同一索引时就能一次输出更多字符。前一项若已被fill_qd重新填充则不再附加 */
+				if (ext_qd && ext_qd->ch_cnt == ext_cnt && ext_cnt + ch_cnt <= QD_CH_MAX
+					&& ext_qd->bit_cnt + bit_cnt <= QD_BIT_NUM) {
+					DMemCpy(ext_qd->ch + ext_cnt, qd->ch, ch_cnt);
+					ext_cnt += ch_cnt;
+					ext_qd->ch_cnt = ext_cnt;
+					ext_qd->bit_cnt += bit_cnt;
+				} else {
+					ext_qd = qd;
+					ext_cnt = ch_cnt;
+				}
+
+				continue;
+			}
+
+			/* 控制码或者编码位数超过8位时，需要按原来的方式处理 */
+			ext_qd = NULL;
+			node = &tree->node_buf[qd->node];
+
+			if (node->left) {
+				skip_bits(&bs, QD_BIT_NUM);
+				node = trace_node(node, &bs);
 			} else {
 				skip_bits(&bs, qd->bit_cnt);
-				node = qd->node;
 			}
-		} else {
-			/* 从霍夫曼树的根节点开始查找，同时生成对应的快速解压数据 */
-			node = trace_node_qd(tree, byte, &bs);
 		}
 #else
 		/* 从霍夫曼树的根节点开始查找 */
@@ -454,6 +574,10 @@ BOOL huff_decode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 			/* 位数据流的下一个字节中存放着要传输的字符数据 */
 			byte = get_byte(&bs);
 
+			/* 已在树中的字符不会被再次传输，否则说明压缩数据已被损坏，继续处理将导致节点缓冲溢出 */
+			if (tree->code_map[byte])
+				return FALSE;
+
 			/* 从哈夫曼树的尾节点处创建新的分支并安置新字符数据 */
 			node = new_branch(tree, byte);
 
@@ -481,17 +605,12 @@ BOOL huff_decode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 			sort_tree(tree, node);
 	}
 
-	/* 解压完毕，释放霍夫曼树结构的内存 */
-	DFree(tree);
-
 	/* 计算输出数据的大小 */
 	*dest_size = (UINT)(wrt_ptr - (BUFPTR)dest);
 
 	return TRUE;
 }
 
-/************************************************************************/
-
 static VOID init_bits(struct BIT_STREAM *bs, VCPTR start, VCPTR end)
 {
 	DAssert(bs && start && end && start <= end);
@@ -500,6 +619,7 @@ static VOID init_bits(struct BIT_STREAM *bs, VCPTR start, VCPTR end)
 	bs->end_ptr = end;
 	bs->bit_buf = 0U;
 	bs->bit_cnt = 0U;
+	bs->pad_cnt = 0U;
 }
 
 static VOID flush_bits(struct BIT_STREAM *bs)
@@ -514,7 +634,7 @@ static VOID flush_bits(struct BIT_STREAM *bs)
 			break;
 
 		/* 回写一个字节 */
-		*bs->cur_ptr++ = bs->bit_buf;
+		*bs->cur_ptr++ = (BYTE)bs->bit_buf;
 
 		/* 残存数据不足一个字节时，作为一个完整的字节写完后立即结束 */
 		if (bs->bit_cnt < 8) {
@@ -529,6 +649,31 @@ static VOID flush_bits(struct BIT_STREAM *bs)
 	}
 }
 
+static VOID fill_bits(struct BIT_STREAM *bs)
+{
+	QWORD word;
+
+	DAssert(bs && bs->cur_ptr && bs->bit_cnt < 56);
+
+	/* 剩余输入足够时一次读入8个字节，只保留能完整放入缓冲的字节。多读入的位与下次读入的相同，不影响结果 */
+	if (bs->end_ptr - bs->cur_ptr >= (INT)sizeof(word)) {
+		DMemCpy(&word, bs->cur_ptr, sizeof(word));
+		bs->bit_buf |= word << bs->bit_cnt;
+		bs->cur_ptr += (63 - bs->bit_cnt) >> 3;
+		bs->bit_cnt |= 56;
+		return;
+	}
+
+	/* 否则逐字节读入，超出输入范围时以0填充并计数 */
+	while (bs->bit_cnt <= 56) {
+		if (bs->cur_ptr < bs->end_ptr)
+			bs->bit_buf |= (QWORD)*bs->cur_ptr++ << bs->bit_cnt;
+		else
+			bs->pad_cnt++;
+		bs->bit_cnt += 8;
+	}
+}
+
 static UINT get_bit(struct BIT_STREAM *bs)
 {
 	UINT buf;
@@ -536,13 +681,11 @@ static UINT get_bit(struct BIT_STREAM *bs)
 	DAssert(bs && bs->cur_ptr);
 
 	/* 如果没有缓冲，则需要先读取一个字节进缓冲 */
-	if (!bs->bit_cnt) {
-		bs->bit_buf = *bs->cur_ptr++;
-		bs->bit_cnt = 8U;
-	}
+	if (!bs->bit_cnt)
+		fill_bits(bs);
 
 	/* 暂存缓冲数据 */
-	buf = bs->bit_buf;
+	buf = (UINT)bs->bit_buf;
 
 	/* 消耗流中的一个位 */
 	bs->bit_buf >>= 1;
@@ -559,13 +702,11 @@ static BYTE get_byte(struct BIT_STREAM *bs)
 	DAssert(bs && bs->cur_ptr);
 
 	/* 如果缓冲已不足8位，则需要先读取一个字节进缓冲 */
-	if (bs->bit_cnt < 8) {
-		bs->bit_buf |= *bs->cur_ptr++ << bs->bit_cnt;
-		bs->bit_cnt += 8;
-	}
+	if (bs->bit_cnt < 8)
+		fill_bits(bs);
 
 	/* 暂存缓冲中的一个字节 */
-	byte = bs->bit_buf;
+	byte = (BYTE)bs->bit_buf;
 
 	/* 消耗流中的一个字节 */
 	bs->bit_buf >>= 8;
@@ -575,15 +716,27 @@ static BYTE get_byte(struct BIT_STREAM *bs)
 	return byte;
 }
 
-static VOID put_bits(struct BIT_STREAM *bs, UINT bits, UINT num)
+static VOID put_bits(struct BIT_STREAM *bs, QWORD bits, UINT num)
 {
-	DAssert(bs && bs->cur_ptr && num + bs->bit_cnt <= 32);
+	UINT n;
+
+	DAssert(bs && bs->cur_ptr && bs->bit_cnt <= 8 && num <= CODE_BIT_MAX);
 
 	/* 先追加输入位数据到位缓冲 */
 	bs->bit_buf |= bits << bs->bit_cnt;
 	bs->bit_cnt += num;
 
-	/* 数据写回处理 */
+	/* 写缓冲足够时一次写入8个字节，但只前进完整字节的个数，多写的部分随后会被覆盖 */
+	if (bs->end_ptr - bs->cur_ptr >= (INT)sizeof(bs->bit_buf)) {
+		DMemCpy(bs->cur_ptr, &bs->bit_buf, sizeof(bs->bit_buf));
+		n = bs->bit_cnt >> 3;
+		bs->cur_ptr += n;
+		bs->bit_buf >>= n << 3;
+		bs->bit_cnt &= 7;
+		return;
+	}
+
+	/* 否则逐字节写回 */
 	while (bs->bit_cnt >= 8) {
 
 		/* 如果已经到达写缓冲的末尾则停止一切写入操作 */
@@ -591,12 +744,45 @@ static VOID put_bits(struct BIT_STREAM *bs, UINT bits, UINT num)
 			break;
 
 		/* 回写一个字节 */
-		*bs->cur_ptr++ = bs->bit_buf;
+		*bs->cur_ptr++ = (BYTE)bs->bit_buf;
 
 		/* 消耗流中的一个字节 */
 		bs->bit_buf >>= 8;
 		bs->bit_cnt -= 8;
 	}
+
+	/* 写缓冲已满时丢弃无法写入的位，只保留一个字节以表示有数据未能写入 */
+	if (bs->bit_cnt > 8) {
+		bs->bit_buf &= 0xff;
+		bs->bit_cnt = 8U;
+	}
+}
+
+static struct HUFF_TREE *new_tree(VOID)
+{
+	struct HUFF_TREE *tree;
+
+	tree = DAlloc(sizeof(struct HUFF_TREE));
+	if (!tree)
+		return NULL;
+
+	/* 新分配的树需要整体清零，使快速解压数据全部无效 */
+	DMemClr(tree, sizeof(struct HUFF_TREE));
+	tree->init_type = -1;
+
+	return tree;
+}
+
+static struct HUFF_TREE *context_tree(struct CODEC_CONTEXT *ctx)
+{
+	/* 上下文中的霍夫曼树在第一次使用时分配，之后一直由该上下文持有 */
+	if (!ctx)
+		return NULL;
+
+	if (!ctx->work[CODEC_WORK_HUFFMAN])
+		ctx->work[CODEC_WORK_HUFFMAN] = new_tree();
+
+	return ctx->work[CODEC_WORK_HUFFMAN];
 }
 
 static VOID init_tree(struct HUFF_TREE *tree, INT type)
@@ -607,82 +793,126 @@ static VOID init_tree(struct HUFF_TREE *tree, INT type)
 
 	DAssert(tree && DBetween(type, 0, CODEC_TYPE_NUM));
 
-	/* 先将结构体清零 */
-	DMemClr(tree, sizeof(struct HUFF_TREE));
+	/* 该树上次初始化时用的是同一编码类型，则直接恢复保存的初始状态 */
+	if (tree->init_type == type) {
 
-	/* 获取编码类型所对应的编码表首地址 */
-	codec = s_CodecTab[type];
+		/* 上次使用时新分配的节点需要清零 */
+		DMemClr(&tree->node_buf[tree->init_cnt], (tree->buf_cnt - tree->init_cnt) * sizeof(struct HUFF_NODE));
 
-	/* 遍历编码表，为每个权重不为0的字符都创建一个新的节点到链表中并自动排序 */
-	for (ch = 0; ch < 0x100; ch++) {
-		node = new_node(tree, *codec++);
-		if (!node)
-			continue;
-		node->ch = ch;
-		tree->code_map[ch] = node;
-	}
+		DMemCpy(tree->node_buf, tree->init_buf, tree->init_cnt * sizeof(struct HUFF_NODE));
+		DMemCpy(tree->code_map, tree->init_map, sizeof(tree->code_map));
+		tree->buf_cnt = tree->init_cnt;
+		tree->head = tree->init_head;
+		tree->tail = tree->init_tail;
 
-	/* 追加传输结束码节点 */
-	left = new_node(tree, 1);
-	left->ch = EOT;
-	tree->code_map[EOT] = left;
+	} else {
 
-	/* 追加未传输码节点 */
-	right = new_node(tree, 1);
-	right->ch = NYT;
-	tree->code_map[NYT] = right;
+		/* 先将结构体清零，初始状态及快速解压数据除外 */
+		DMemClr(tree, offsetof(struct HUFF_TREE, init_type));
 
-	/* 从有序链表的最末两项（EOT和NYT）开始，构建成一棵霍夫曼树 */
-	while (TRUE) {
-		node = new_node(tree, left->weight + right->weight);
-		node->left = left;
-		node->right = right;
-		left->parent = node;
-		right->parent = node;
-		right = left->prev;
-		if (!right)
-			break;
-		left = right->prev;
-		if (!left)
-			break;
+		/* 获取编码类型所对应的编码表首地址 */
+		codec = s_CodecTab[type];
+
+		/* 遍历编码表，为每个权重不为0的字符都创建一个新的节点到链表中并自动排序 */
+		for (ch = 0; ch < 0x100; ch++) {
+			node = new_node(tree, *codec++);
+			if (!node)
+				continue;
+			node->ch = ch;
+			tree->code_map[ch] = node;
+		}
+
+		/* 追加传输结束码节点 */
+		left = new_node(tree, 1);
+		left->ch = EOT;
+		tree->code_map[EOT] = left;
+
+		/* 追加未传输码节点 */
+		right = new_node(tree, 1);
+		right->ch = NYT;
+		tree->code_map[NYT] = right;
+
+		/* 从有序链表的最末两项（EOT和NYT）开始，构建成一棵霍夫曼树 */
+		while (TRUE) {
+			node = new_node(tree, left->weight + right->weight);
+			node->left = left;
+			node->right = right;
+			left->parent = node;
+			right->parent = node;
+			right = left->prev;
+			if (!right)
+				break;
+			left = right->prev;
+			if (!left)
+				break;
+		}
+
+		/* 保存初始状态，以后再用同一编码类型初始化时可以省去建树处理 */
+		tree->init_type = type;
+		tree->init_cnt = tree->buf_cnt;
+		tree->init_head = tree->head;
+		tree->init_tail = tree->tail;
+		DMemCpy(tree->init_buf, tree->node_buf, tree->buf_cnt * sizeof(struct HUFF_NODE));
+		DMemCpy(tree->init_map, tree->code_map, sizeof(tree->code_map));
 	}
 
+	/* 递增序列号，使上次使用时留下的快速解压数据及编码缓存全部过期 */
+	/* 序列号过大时将它们清零，序列号从1重新开始 */
+	if (tree->serial >= SERIAL_MAX) {
+		DMemClr(tree->code_buf, sizeof(tree->code_buf));
 #ifdef QUICK_DECODE
-	/* 快速解压序列号初始化为1 */
-	tree->serial++;
+		DMemClr(tree->qd_buf, sizeof(tree->qd_buf));
 #endif
+		tree->serial = 0U;
+	}
+
+	tree->serial++;
 }
 
 static VOID sort_tree(struct HUFF_TREE *tree, struct HUFF_NODE *node)
 {
-	struct HUFF_NODE *p;
+	INT weight;
+	struct HUFF_NODE *p, **leader;
 
 	DAssert(tree && node);
 
 	/* 从node开始，沿parent方向一直遍历到根节点 */
-    for (; node; node = node->parent) {
+	for (; node; node = node->parent) {
 
-		/* 权重值递增1 */
-		node->weight++;
+		/* 找到与node权重值相同的节点中在链表里最靠前的一个p，它可能就是node本身 */
+		/* 链表按权重值降序排列，所以前一节点权重值更大（或者本身是头节点）即可确定p就是这样的节点 */
+		weight = node->weight;
+		leader = &tree->leader[weight & (LEADER_NUM - 1)];
+		p = *leader;
 
-		/* 向前找到第一个权重值大于等于node的节点，p为该节点的next */
-		/* 如果不存在这样的节点，p为根节点 */
-		for (p = node; p->prev; p = p->prev) {
-			if (p->prev->weight >= node->weight)
-				break;
+		if (!p || p->weight != weight || (p->prev ? p->prev->weight <= weight : p != tree->head)) {
+
+			/* 提示无效时向前逐个查找 */
+			for (p = node; p->prev; p = p->prev) {
+				if (p->prev->weight > weight)
+					break;
+			}
 		}
 
+		/* 权重值递增1 */
+		node->weight++;
+
 		/* 为了更高的执行速度，在swap_node函数外进行该处理 */
-		if (p == node)
-			continue;
+		if (p != node) {
 
-		/* 交换霍夫曼树中两个节点的位置 */
-		swap_node(tree, p, node);
+			/* 交换霍夫曼树中两个节点的位置 */
+			swap_node(tree, p, node);
 
-#ifdef QUICK_DECODE
-		/* 由于霍夫曼树发生了改变，需要递增序列号以使旧的快速解压数据过期 */
-		tree->serial++;
-#endif
+			/* 由于霍夫曼树发生了改变，需要递增序列号以使旧的快速解压数据及编码缓存过期 */
+			tree->serial++;
+		}
+
+		/* 此时node位于原权重值节点的最前面，其后的节点成为原权重值的第一个节点 */
+		*leader = node->next;
+
+		/* node前面的节点权重值更大时，node也是新权重值的第一个节点 */
+		if (!node->prev || node->prev->weight > node->weight)
+			tree->leader[node->weight & (LEADER_NUM - 1)] = node;
 	}
 }
 
@@ -777,6 +1007,9 @@ static struct HUFF_NODE *new_branch(struct HUFF_TREE *tree, BYTE byte)
 	tree->code_map[left->ch] = left;
 	tree->code_map[right->ch] = right;
 
+	/* 原尾节点已变为分枝节点，它的编码及指向它的快速解压数据需要过期 */
+	tree->serial++;
+
 	return right;
 }
 
@@ -846,23 +1079,44 @@ static VOID swap_node(struct HUFF_TREE *tree, struct HUFF_NODE *n1, struct HUFF_
 	}
 }
 
-static VOID dump_node(struct HUFF_NODE *node, struct BIT_STREAM *bs)
+static VOID dump_node(struct HUFF_TREE *tree, INT ch, struct BIT_STREAM *bs)
 {
-	UINT i, buf;
-	struct HUFF_NODE *p;
+	UINT i;
+	QWORD buf;
+	struct HUFF_CODE *code;
+	struct HUFF_NODE *node, *p;
 
-	DAssert(node && bs);
+	DAssert(tree && DBetween(ch, 0, CODE_MAP_LEN) && bs);
+
+	code = &tree->code_buf[ch];
+
+	/* 霍夫曼树自上次生成编码后没有改变时，直接输出缓存的编码 */
+	if (code->serial == tree->serial) {
+		put_bits(bs, code->bits, code->bit_cnt);
+		return;
+	}
 
 	/* 初始化位缓冲 */
 	i = 0U;
 	buf = 0U;
 
-	/* 以node为叶根沿树回溯，注意1表示左子节点，0表示右子节点 */
+	/* 以字符的叶节点为根沿树回溯，注意1表示左子节点，0表示右子节点 */
+	node = tree->code_map[ch];
+	DAssert(node);
+
 	for (p = node->parent; p; i++, p = node->parent) {
 		buf = (buf << 1) | (p->left == node);
 		node = p;
 	}
 
+	/* 权重值总和不超过32位，树的深度远小于缓存可记录的位数 */
+	DAssert(i <= CODE_BIT_MAX);
+
+	/* 保存到编码缓存 */
+	code->serial = tree->serial;
+	code->bit_cnt = i;
+	code->bits = buf;
+
 	/* 将结果写入位数据流 */
 	put_bits(bs, buf, i);
 }
@@ -881,88 +1135,44 @@ static struct HUFF_NODE *trace_node(struct HUFF_NODE *node, struct BIT_STREAM *b
 }
 
 #ifdef QUICK_DECODE
-static BYTE peek_7bits(struct BIT_STREAM *bs)
-{
-	DAssert(bs);
-
-	/* 如果缓冲不足7位，则需要先读取一个字节进缓冲 */
-	if (bs->bit_cnt < QD_BIT_NUM) {
-		bs->bit_buf |= *bs->cur_ptr++ << bs->bit_cnt;
-		bs->bit_cnt += 8;
-	}
-
-	/* 返回缓冲中的7个位，并不改变位数据流的读写位置 */
-	return bs->bit_buf & (QD_BUF_MAX - 1);
-}
-
 static VOID skip_bits(struct BIT_STREAM *bs, UINT num)
 {
-	DAssert(bs && num < 8);
+	DAssert(bs && num <= bs->bit_cnt);
 
-	/* 如果缓冲位数不够，则需要先读取一个字节进缓冲 */
-	if (bs->bit_cnt < num) {
-		num -= bs->bit_cnt;
-		bs->bit_buf = *bs->cur_ptr++;
-		bs->bit_cnt = 8U;
-	}
-
-	/* 跳过指定个数的位 */
+	/* 跳过指定个数的位，这些位已读入缓冲 */
 	bs->bit_buf >>= num;
 	bs->bit_cnt -= num;
 }
 
-static struct HUFF_NODE *trace_node_qd(struct HUFF_TREE *tree, BYTE byte, struct BIT_STREAM *bs)
+static VOID fill_qd(struct HUFF_TREE *tree, UINT index)
 {
-	UINT bit_cnt, index, step;
-	struct QDBLOCK *qd;
-	struct HUFF_NODE *node, *qd_node;
+	UINT bit_cnt, step;
+	struct QDBLOCK qd;
+	struct HUFF_NODE *node;
 
-	DAssert(tree && bs && byte < QD_BUF_MAX);
+	DAssert(tree && index < QD_BUF_MAX);
 
 	bit_cnt = 0U;
-	qd_node = NULL;
 
-	/* 从霍夫曼树的根节点开始查找 */
+	/* 从霍夫曼树的根节点开始沿索引的各位查找，1表示左子节点，0表示右子节点 */
 	node = tree->head;
 
-	/* 以node为根沿树查找叶节点 */
 	do {
-
-		/* 1表示左子节点，0表示右子节点 */
-		node = get_bit(bs) ? node->left : node->right;
-
-		/* 如果是第7位，保留当前node到qd_node变量 */
-		if (++bit_cnt == QD_BIT_NUM)
-			qd_node = node;
-
-	} while (node->left);
-
-	/* 是否大于等于7位？ */
-	if (bit_cnt >= QD_BIT_NUM) {
-
-		/* 如果大于等于7位，直接保存各项数据到对应的快速解压数据缓冲即可 */
-		qd = &tree->qd_buf[byte];
-
-		qd->serial = tree->serial;
-		qd->bit_cnt = bit_cnt;
-		qd->node = qd_node;
-
-	} else {
-
-		/* 位数不足7位时，需要填充所有可能的快速解压数据缓冲项 */
-		/* 比如6位需要填充2项、5位需要填充4项，4位需要填充8项，3位需要填充16项等等 */
-		step = 1 << bit_cnt;
-		index = byte & (step - 1);
-		qd = &tree->qd_buf[index];
-
-		for (; index < QD_BUF_MAX; index += step, qd += step) {
-			qd->serial = tree->serial;
-			qd->bit_cnt = bit_cnt;
-			qd->node = node;
-		}
-	}
-
-	return node;
+		node = ((index >> bit_cnt++) & 1) ? node->left : node->right;
+	} while (node->left && bit_cnt < QD_BIT_NUM);
+
+	/* 普通字符可以直接输出，控制码及分枝节点需要另行处理 */
+	qd.serial = tree->serial;
+	qd.ch_cnt = (!node->left && node->ch < 0x100) ? 1U : 0U;
+	qd.bit_cnt = bit_cnt;
+	qd.node = (WORD)(node - tree->node_buf);
+	qd.ch[0] = (BYTE)node->ch;
+
+	/* 位数不足8位时，需要填充所有低位相同的快速解压数据缓冲项 */
+	/* 比如7位需要填充2项、6位需要填充4项，5位需要填充8项等等 */
+	step = 1 << bit_cnt;
+	for (index &= step - 1; index < QD_BUF_MAX; index += step)
+		tree->qd_buf[index] = qd;
 }
 #endif
 
@@ -12,11 +12,14 @@
 /************************************************************************/
 
 #include <common.h>
+#include "codec.h"
 
 /************************************************************************/
 
 CAPI extern BOOL huff_encode(INT type, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
 CAPI extern BOOL huff_decode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL huff_encode_ctx(struct CODEC_CONTEXT *ctx, INT type, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL huff_decode_ctx(struct CODEC_CONTEXT *ctx, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
 
 /************************************************************************/
 
@@ -18,6 +18,30 @@
 /* Truncate value to a specified number of bits */
 #define TRUNCATE_VALUE(v, b)	((v) & ((1 << (b)) - 1))
 
+#define MIN_COPY_LEN		2			/* Shortest copy length */
+#define MAX_COPY_LEN		518			/* Longest copy length, 519 marks the end of the stream */
+#define MAX_DICT_SIZE		4096		/* Largest dictionary size */
+#define MAX_SHORT_OFF		256			/* Largest offset for copies of 2 bytes */
+
+#define HASH_BITS			12			/* Number of bits of the hash of 2 bytes */
+#define HASH_SIZE			(1 << HASH_BITS)
+#define MAX_CANDIDATE		16			/* Number of matches of increasing length kept for each position */
+#define LAZY_LEN			32			/* Copies at least this long are taken without looking ahead */
+#define NICE_LEN			128			/* Copies at least this long are taken without optimal parsing */
+#define PARSE_CHUNK			4096		/* Bytes parsed at a time by the optimal parser */
+#define INFINITE_COST		0xffffffffU	/* Cost of positions not reached yet */
+
+#define END_COPY_LEN		519			/* Copy length marking the end of the stream */
+#define LEN_DECODE_BITS		7			/* Number of bits to look up a copy length code */
+#define OFFS_DECODE_BITS	8			/* Number of bits to look up an offset code */
+#define CH_DECODE_BITS		7			/* Number of bits to look up a literal byte code */
+#define CH_DECODE_SUB		0x8000		/* Literal table entry referring to a second level table */
+#define REFILL_BITS			32			/* The bit buffer is refilled below this, any token fits in it */
+
+#define STREAM_BUF_SIZE		(3 * MAX_DICT_SIZE)	/* Input buffer of a stream: the dictionary, a chunk and the bytes after it */
+#define STREAM_OUT_SIZE		8192		/* Output buffer of a stream, large enough for the codes of a chunk */
+#define LOOKAHEAD_LEN		(MAX_COPY_LEN + 2)	/* Bytes needed after a position before the lazy parser decides on it */
+
 /************************************************************************/
 
 /* Bit sequences used to represent literal bytes */
@@ -113,52 +137,231 @@ static BYTE s_OffsBits[] = {
 	0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
 };
 
+/* Copy length code indexes, looked up by the next 7 bits */
+static CONST BYTE s_LenDecode[0x80] = {
+	0x0f, 0x02, 0x05, 0x01, 0x08, 0x00, 0x03, 0x01, 0x0a, 0x02, 0x04, 0x01, 0x06, 0x00, 0x03, 0x01,
+	0x0c, 0x02, 0x05, 0x01, 0x07, 0x00, 0x03, 0x01, 0x09, 0x02, 0x04, 0x01, 0x06, 0x00, 0x03, 0x01,
+	0x0d, 0x02, 0x05, 0x01, 0x08, 0x00, 0x03, 0x01, 0x0a, 0x02, 0x04, 0x01, 0x06, 0x00, 0x03, 0x01,
+	0x0b, 0x02, 0x05, 0x01, 0x07, 0x00, 0x03, 0x01, 0x09, 0x02, 0x04, 0x01, 0x06, 0x00, 0x03, 0x01,
+	0x0e, 0x02, 0x05, 0x01, 0x08, 0x00, 0x03, 0x01, 0x0a, 0x02, 0x04, 0x01, 0x06, 0x00, 0x03, 0x01,
+	0x0c, 0x02, 0x05, 0x01, 0x07, 0x00, 0x03, 0x01, 0x09, 0x02, 0x04, 0x01, 0x06, 0x00, 0x03, 0x01,
+	0x0d, 0x02, 0x05, 0x01, 0x08, 0x00, 0x03, 0x01, 0x0a, 0x02, 0x04, 0x01, 0x06, 0x00, 0x03, 0x01,
+	0x0b, 0x02, 0x05, 0x01, 0x07, 0x00, 0x03, 0x01, 0x09, 0x02, 0x04, 0x01, 0x06, 0x00, 0x03, 0x01,
+};
+
+/* Offset code indexes, looked up by the next 8 bits */
+static CONST BYTE s_OffsDecode[0x100] = {
+	0x3f, 0x06, 0x17, 0x00, 0x27, 0x02, 0x0e, 0x00, 0x2f, 0x04, 0x12, 0x00, 0x1f, 0x01, 0x0a, 0x00,
+	0x37, 0x05, 0x14, 0x00, 0x23, 0x02, 0x0c, 0x00, 0x2b, 0x03, 0x10, 0x00, 0x1b, 0x01, 0x08, 0x00,
+	0x3b, 0x06, 0x15, 0x00, 0x25, 0x02, 0x0d, 0x00, 0x2d, 0x04, 0x11, 0x00, 0x1d, 0x01, 0x09, 0x00,
+	0x33, 0x05, 0x13, 0x00, 0x21, 0x02, 0x0b, 0x00, 0x29, 0x03, 0x0f, 0x00, 0x19, 0x01, 0x07, 0x00,
+	0x3d, 0x06, 0x16, 0x00, 0x26, 0x02, 0x0e, 0x00, 0x2e, 0x04, 0x12, 0x00, 0x1e, 0x01, 0x0a, 0x00,
+	0x35, 0x05, 0x14, 0x00, 0x22, 0x02, 0x0c, 0x00, 0x2a, 0x03, 0x10, 0x00, 0x1a, 0x01, 0x08, 0x00,
+	0x39, 0x06, 0x15, 0x00, 0x24, 0x02, 0x0d, 0x00, 0x2c, 0x04, 0x11, 0x00, 0x1c, 0x01, 0x09, 0x00,
+	0x31, 0x05, 0x13, 0x00, 0x20, 0x02, 0x0b, 0x00, 0x28, 0x03, 0x0f, 0x00, 0x18, 0x01, 0x07, 0x00,
+	0x3e, 0x06, 0x17, 0x00, 0x27, 0x02, 0x0e, 0x00, 0x2f, 0x04, 0x12, 0x00, 0x1f, 0x01, 0x0a, 0x00,
+	0x36, 0x05, 0x14, 0x00, 0x23, 0x02, 0x0c, 0x00, 0x2b, 0x03, 0x10, 0x00, 0x1b, 0x01, 0x08, 0x00,
+	0x3a, 0x06, 0x15, 0x00, 0x25, 0x02, 0x0d, 0x00, 0x2d, 0x04, 0x11, 0x00, 0x1d, 0x01, 0x09, 0x00,
+	0x32, 0x05, 0x13, 0x00, 0x21, 0x02, 0x0b, 0x00, 0x29, 0x03, 0x0f, 0x00, 0x19, 0x01, 0x07, 0x00,
+	0x3c, 0x06, 0x16, 0x00, 0x26, 0x02, 0x0e, 0x00, 0x2e, 0x04, 0x12, 0x00, 0x1e, 0x01, 0x0a, 0x00,
+	0x34, 0x05, 0x14, 0x00, 0x22, 0x02, 0x0c, 0x00, 0x2a, 0x03, 0x10, 0x00, 0x1a, 0x01, 0x08, 0x00,
+	0x38, 0x06, 0x15, 0x00, 0x24, 0x02, 0x0d, 0x00, 0x2c, 0x04, 0x11, 0x00, 0x1c, 0x01, 0x09, 0x00,
+	0x30, 0x05, 0x13, 0x00, 0x20, 0x02, 0x0b, 0x00, 0x28, 0x03, 0x0f, 0x00, 0x18, 0x01, 0x07, 0x00,
+};
+
+/* Literal bytes (bits 0-7) and their code lengths (bits 8-11), looked up by the next 7 bits.
+   Codes longer than 7 bits have an entry with bit 15 set instead, giving the start of a
+   second level table (bits 0-9) and the number of further bits to look it up (bits 10-12) */
+static CONST WORD s_ChDecode[364] = {
+	0x9880, 0x0649, 0x0729, 0x056e, 0x076b, 0x0574, 0x0663, 0x0561,
+	0x84c0, 0x0631, 0x0668, 0x0569, 0x0737, 0x0572, 0x0652, 0x0420,
+	0x90c2, 0x0643, 0x0670, 0x056c, 0x0746, 0x0573, 0x0654, 0x0545,
+	0x84d2, 0x0575, 0x0666, 0x0565, 0x0732, 0x056f, 0x064e, 0x0420,
+	0x94d4, 0x0644, 0x070d, 0x056e, 0x0750, 0x0574, 0x0662, 0x0561,
+	0x84f4, 0x062d, 0x0667, 0x0569, 0x0734, 0x0572, 0x064f, 0x0420,
+	0x88f6, 0x0641, 0x066d, 0x056c, 0x073d, 0x0573, 0x0653, 0x0545,
+	0x84fa, 0x0575, 0x0664, 0x0565, 0x072e, 0x056f, 0x064c, 0x0420,
+	0x98fc, 0x0649, 0x0728, 0x056e, 0x0755, 0x0574, 0x0663, 0x0561,
+	0x853c, 0x0631, 0x0668, 0x0569, 0x0735, 0x0572, 0x0652, 0x0420,
+	0x8d3e, 0x0643, 0x0670, 0x056c, 0x0742, 0x0573, 0x0654, 0x0545,
+	0x8546, 0x0575, 0x0666, 0x0565, 0x0730, 0x056f, 0x064e, 0x0420,
+	0x9548, 0x0644, 0x070a, 0x056e, 0x074d, 0x0574, 0x0662, 0x0561,
+	0x8568, 0x062d, 0x0667, 0x0569, 0x0733, 0x0572, 0x064f, 0x0420,
+	0x856a, 0x0641, 0x066d, 0x056c, 0x0738, 0x0573, 0x0653, 0x0545,
+	0x0777, 0x0575, 0x0664, 0x0565, 0x072c, 0x056f, 0x064c, 0x0420,
+	0x0dff, 0x0da8, 0x0deb, 0x0d98, 0x0df7, 0x0da0, 0x0de0, 0x0d90,
+	0x0dfb, 0x0da4, 0x0de6, 0x0d94, 0x0df0, 0x0d9c, 0x0dac, 0x0d8c,
+	0x0dfd, 0x0da6, 0x0de8, 0x0d96, 0x0df5, 0x0d9e, 0x0dae, 0x0d8e,
+	0x0df9, 0x0da2, 0x0de3, 0x0d92, 0x0ded, 0x0d9a, 0x0daa, 0x0d8a,
+	0x0dfe, 0x0da7, 0x0dea, 0x0d97, 0x0df6, 0x0d9f, 0x0daf, 0x0d8f,
+	0x0dfa, 0x0da3, 0x0de4, 0x0d93, 0x0def, 0x0d9b, 0x0dab, 0x0d8b,
+	0x0dfc, 0x0da5, 0x0de7, 0x0d95, 0x0df1, 0x0d9d, 0x0dad, 0x0d8d,
+	0x0df8, 0x0da1, 0x0de2, 0x0d91, 0x0dec, 0x0d99, 0x0da9, 0x0d89,
+	0x0876, 0x085f, 0x0b7c, 0x0b3c, 0x0b5a, 0x0a71, 0x0b6a, 0x0a7a,
+	0x0b4a, 0x0a26, 0x0b7b, 0x0b00, 0x0b51, 0x0a71, 0x0b5c, 0x0a7a,
+	0x0b3f, 0x0a26, 0x0836, 0x082f, 0x0ccb, 0x0cbb, 0x0cc3, 0x0cb3,
+	0x0cc7, 0x0cb7, 0x0cbf, 0x0c7f, 0x0cc9, 0x0cb9, 0x0cc1, 0x0cb1,
+	0x0cc5, 0x0cb5, 0x0cbd, 0x0c7d, 0x0cca, 0x0cba, 0x0cc2, 0x0cb2,
+	0x0cc6, 0x0cb6, 0x0cbe, 0x0c7e, 0x0cc8, 0x0cb8, 0x0cc0, 0x0cb0,
+	0x0cc4, 0x0cb4, 0x0cbc, 0x0c60, 0x0848, 0x0847, 0x0956, 0x093e,
+	0x094b, 0x092b, 0x0822, 0x0809, 0x0d88, 0x0cdb, 0x0cee, 0x0cd3,
+	0x0d80, 0x0cd7, 0x0cdf, 0x0ccf, 0x0d84, 0x0cd9, 0x0ce5, 0x0cd1,
+	0x0cf3, 0x0cd5, 0x0cdd, 0x0ccd, 0x0d86, 0x0cda, 0x0ce9, 0x0cd2,
+	0x0cf4, 0x0cd6, 0x0cde, 0x0cce, 0x0d82, 0x0cd8, 0x0ce1, 0x0cd0,
+	0x0cf2, 0x0cd4, 0x0cdc, 0x0ccc, 0x0d87, 0x0cdb, 0x0cee, 0x0cd3,
+	0x0d1a, 0x0cd7, 0x0cdf, 0x0ccf, 0x0d83, 0x0cd9, 0x0ce5, 0x0cd1,
+	0x0cf3, 0x0cd5, 0x0cdd, 0x0ccd, 0x0d85, 0x0cda, 0x0ce9, 0x0cd2,
+	0x0cf4, 0x0cd6, 0x0cde, 0x0cce, 0x0d81, 0x0cd8, 0x0ce1, 0x0cd0,
+	0x0cf2, 0x0cd4, 0x0cdc, 0x0ccc, 0x085b, 0x0857, 0x0a24, 0x0959,
+	0x095d, 0x0958, 0x0a21, 0x0959, 0x095d, 0x0958, 0x082a, 0x0827,
+	0x0c5e, 0x0c13, 0x0c1c, 0x0c08, 0x0c23, 0x0c0f, 0x0c17, 0x0c04,
+	0x0c3b, 0x0c11, 0x0c19, 0x0c06, 0x0c1e, 0x0c0c, 0x0c15, 0x0c02,
+	0x0c40, 0x0c12, 0x0c1b, 0x0c07, 0x0c1f, 0x0c0e, 0x0c16, 0x0c03,
+	0x0c25, 0x0c10, 0x0c18, 0x0c05, 0x0c1d, 0x0c0b, 0x0c14, 0x0c01,
+	0x083a, 0x0839, 0x0879, 0x0878,
+};
+
+/************************************************************************/
+
+/* Bit buffer for the compressed data */
+struct BIT_WRITER {
+	BUFPTR cur_ptr;						// Current position in output buffer
+	BUFPTR end_ptr;						// Pointer to the end of dest buffer
+	UINT bit_num;						// Number of bits in bit buffer
+	DWORD bit_buf;						// Stores bits until there are enough to output a byte of data
+};
+
+/* Hash chains of the 2-byte prefixes in the dictionary */
+struct MATCH_FINDER {
+	UINT head[HASH_SIZE];				// Latest position plus one of each hash value, 0 if none
+	WORD prev[MAX_DICT_SIZE];			// Distance to the previous position with the same hash, 0 if none
+	UINT dict_size;						// Maximum size of dictionary
+	UINT max_chain;						// Maximum number of positions checked for each search
+};
+
+/* Matches of increasing length found at a position */
+struct MATCH_LIST {
+	UINT num;							// Number of matches
+	WORD len[MAX_CANDIDATE];			// Copy lengths
+	WORD dist[MAX_CANDIDATE];			// Distances back from the current position
+};
+
+/* Optimal parsing state of a chunk */
+struct PARSE_NODE {
+	UINT cost[PARSE_CHUNK + 1];			// Cheapest number of bits to reach each position
+	WORD len[PARSE_CHUNK + 1];			// Length of the last step to each position, 1 for a literal byte
+	WORD dist[PARSE_CHUNK + 1];			// Distance of the last step to each position
+};
+
+/* Working state of the compression, kept in the codec context between calls */
+struct IMPLODE_WORK {
+	struct MATCH_FINDER mf;				// Hash chains of the dictionary
+	struct PARSE_NODE node;				// State of the optimal parser
+	BOOL ahead;							// Whether the lazy parser has found the copies at the next position
+	struct MATCH_LIST next;				// Copies found at the next position by the lazy parser
+};
+
+/* State of a compression fed with input a piece at a time */
+struct IMPLODE_STREAM {
+	struct IMPLODE_WORK work;			// Hash chains and parsing state
+	struct BIT_WRITER bw;				// Bit buffer writing into the output buffer
+	INT type;							// Compression type
+	INT dict;							// Dictionary size code
+	INT level;							// Compression level
+	INT state;							// IMPLODE_STREAM_MORE until the stream has ended or is broken
+	BOOL finished;						// Whether the end of the stream has been stored in the output buffer
+	UINT pos;							// Position of the next byte to compress in the input buffer
+	UINT data_size;						// Number of bytes in the input buffer
+	BUFPTR out_ptr;						// Start of the output not yet returned
+	BYTE data[STREAM_BUF_SIZE];			// Input buffer, keeping the dictionary before the current position
+	BYTE out[STREAM_OUT_SIZE];			// Output buffer
+};
+
+/* State of a decompression fed with input a piece at a time */
+struct EXPLODE_STREAM {
+	INT state;							// IMPLODE_STREAM_MORE until the stream has ended or is broken
+	UINT head_num;						// Number of header bytes read
+	BYTE type;							// Specifies whether to use fixed or variable size literal bytes
+	BYTE dict;							// Dictionary size code
+	UINT bit_num;						// Number of bits in bit buffer
+	QWORD bit_buf;						// Stores bits read ahead from the input
+	UINT copy_len;						// Length of the copy not yet written out
+	UINT copy_dist;						// Distance back to the data of that copy
+	UINT win_pos;						// Position in the window where the next byte goes
+	UINT win_num;						// Number of bytes in the window
+	BYTE window[MAX_DICT_SIZE];			// Last bytes written out, the dictionary of later copies
+};
+
+/************************************************************************/
+
+static VOID init_finder(struct MATCH_FINDER *mf, UINT dict_size, INT level);
+static VOID insert_pos(struct MATCH_FINDER *mf, BUFCPTR src, UINT pos);
+static VOID find_matches(CONST struct MATCH_FINDER *mf, BUFCPTR src, UINT pos, UINT max_len, struct MATCH_LIST *ml);
+static BOOL put_bits(struct BIT_WRITER *bw, UINT bits, UINT num);
+static BOOL put_literal(struct BIT_WRITER *bw, INT type, BYTE ch);
+static BOOL put_copy(struct BIT_WRITER *bw, INT dict, UINT len, UINT dist);
+static UINT len_index(UINT len);
+static UINT copy_cost(INT dict, UINT len, UINT dist);
+static BOOL put_end(struct BIT_WRITER *bw);
+static UINT get_dict_size(INT dict);
+static BOOL parse_greedy(struct IMPLODE_WORK *work, struct BIT_WRITER *bw, INT type, INT dict, BOOL lazy, BUFCPTR src, UINT *pos, UINT end, UINT src_size);
+static BOOL parse_optimal(struct IMPLODE_WORK *work, struct BIT_WRITER *bw, INT type, INT dict, BUFCPTR src, UINT start, UINT end, UINT src_size);
+static VOID slide_stream(struct IMPLODE_STREAM *stream);
+static BUFPTR copy_output(struct EXPLODE_STREAM *stream, BUFPTR wrt_ptr, BUFPTR dest_end_ptr, BUFCPTR dest);
+static VOID update_window(struct EXPLODE_STREAM *stream, BUFCPTR dest, BUFCPTR wrt_ptr);
+static BOOL implode_work(struct IMPLODE_WORK *work, INT type, INT dict, INT level, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+
 /************************************************************************/
 
 BOOL implode(INT type, INT dict, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
 {
-	INT i;					// Index into tables
-	BYTE ch;				// Byte from input buffer
-	INT max_copy_len;		// Length of longest duplicate data in the dictionary
-	BUFPTR max_copy_ptr;	// Pointer to longest duplicate data in the dictionary
-	INT copy_len;			// Length of duplicate data in the dictionary
-	INT copy_off;			// Offset used in actual compressed data
-	INT new_copy_off;		// Secondary offset used in actual compressed data
-	BUFPTR copy_ptr;		// Pointer to duplicate data in the dictionary
-	BUFPTR bak_copy_ptr;	// Temporarily holds previous value of copy_ptr
-	BUFCPTR new_rd_ptr;		// Secondary offset into input buffer
-	BUFPTR new_dict_ptr;	// Secondary offset into dictionary
+	return implode_level(type, dict, IMPLODE_LEVEL_NORMAL, src, src_size, dest, dest_size);
+}
+
+BOOL implode_level(INT type, INT dict, INT level, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	struct IMPLODE_WORK work;
+
+	// Without a codec context the working state is on the stack
+	return implode_work(&work, type, dict, level, src, src_size, dest, dest_size);
+}
+
+BOOL implode_ctx(struct CODEC_CONTEXT *ctx, INT type, INT dict, INT level, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	struct IMPLODE_WORK *work;
+
+	// The working state is kept by the context between calls. It needs
+	// no clearing, as init_finder resets what is read before written
+	work = get_codec_work(ctx, CODEC_WORK_IMPLODE, sizeof(struct IMPLODE_WORK));
+	if (!work)
+		return FALSE;
+
+	return implode_work(work, type, dict, level, src, src_size, dest, dest_size);
+}
+
+BOOL explode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	UINT i;					// Index into tables
+	UINT entry;				// Entry of the literal decoding table
+	UINT code_bits;			// Number of bits of the current code
+	UINT copy_len;			// Length of data to copy from the output
+	UINT copy_dist;			// Distance back to the data to copy
+	BYTE type;				// Specifies whether to use fixed or variable size literal bytes
+	BYTE dict;				// Dictionary size; valid values are 4, 5, and 6 which represent 1024, 2048, and 4096 respectively
 	BUFCPTR	rd_ptr;			// Current position in input buffer
 	BUFPTR wrt_ptr;			// Current position in output buffer
 	BUFCPTR src_end_ptr;	// Pointer to the end of source buffer
 	BUFPTR dest_end_ptr;	// Pointer to the end of dest buffer
-	BYTE bit_num;			// Number of bits in bit buffer
-	DWORD bit_buf;			// Stores bits until there are enough to output a byte of data
-	BUFPTR dict_ptr;		// Position in dictionary
-	UINT dict_size;			// Maximum size of dictionary
-	UINT cur_dict_size;		// Current size of dictionary
-	BYTE dict_buf[4096];	// Sliding dictionary used for compression and decompression
+	BUFPTR copy_ptr;		// Position of the data to copy in the output buffer
+	BUFPTR copy_end_ptr;	// End of the data to copy in the output buffer
+	UINT bit_num;			// Number of bits in bit buffer
+	QWORD bit_buf;			// Stores bits read ahead from the input buffer
+	QWORD word;				// Next 8 bytes of the input buffer
 
-	// Check for a valid compression type
-	if (type != IMPLODE_BINARY && type != IMPLODE_ASCII)
-		return FALSE;
-
-	// Only dictionary sizes of 1024, 2048, and 4096 are allowed.
-	// The values 4, 5, and 6 correspond with those sizes
-	switch (dict) {
-	case IMPLODE_DICT_1K:
-		// Store actual dictionary size
-		dict_size = 1024;
-		break;
-	case IMPLODE_DICT_2K:
-		// Store actual dictionary size
-		dict_size = 2048;
-		break;
-	case IMPLODE_DICT_4K:
-		// Store actual dictionary size
-		dict_size = 4096;
-		break;
-	default:
+	// Compressed data cannot be less than 4 bytes;
+	// this is not possible in any case whatsoever
+	if (src_size < 4) {
+		*dest_size = 0;
 		return FALSE;
 	}
 
@@ -168,508 +371,1009 @@ BOOL implode(INT type, INT dict, VCPTR src, UINT src_size, VPTR dest, UINT *dest
 	src_end_ptr = rd_ptr + src_size;
 	dest_end_ptr = wrt_ptr + *dest_size;
 
-	// Initialize dictionary position
-	dict_ptr = dict_buf;
-
-	// Initialize current dictionary size to zero
-	cur_dict_size = 0;
+	// Get header from compressed data
+	type = *rd_ptr++;
+	dict = *rd_ptr++;
 
-	// If the output buffer size is less than 4, there
-	// is not enough room for the compressed data
-	if (*dest_size < 4 && !(src_size == 0 && *dest_size == 4))
+	// Check for a valid compression type
+	if (type != IMPLODE_BINARY && type != IMPLODE_ASCII)
 		return FALSE;
 
-	// Store compression type and dictionary size
-	*wrt_ptr++ = type;
-	*wrt_ptr++ = dict;
+	// Only dictionary sizes of 1024, 2048, and 4096 are allowed.
+	// The values 4, 5, and 6 correspond with those sizes
+	if (dict != IMPLODE_DICT_1K && dict != IMPLODE_DICT_2K && dict != IMPLODE_DICT_4K)
+		return FALSE;
 
 	// Initialize bit buffer
 	bit_buf = 0;
 	bit_num = 0;
 
-	// Compress until input buffer is empty
-	while (rd_ptr < src_end_ptr) {
+	// Decompress until output buffer is full. The dictionary is the output
+	// buffer itself, so copies are made from the bytes already written
+	while (wrt_ptr < dest_end_ptr) {
 
-		// Get a byte from the input buffer
-		ch = *rd_ptr++;
-		max_copy_len = 0;
+		// Refill the bit buffer. With 8 bytes left, load them at once and keep the
+		// whole bytes that fit; the bits of the next byte loaded beyond them are the
+		// same ones the next load will put there
+		if (bit_num < REFILL_BITS) {
+			if (src_end_ptr - rd_ptr >= (INT)sizeof(word)) {
+				DMemCpy(&word, rd_ptr, sizeof(word));
+				bit_buf |= word << bit_num;
+				rd_ptr += (63 - bit_num) >> 3;
+				bit_num |= 56;
+			} else {
+				while (bit_num <= 56 && rd_ptr < src_end_ptr) {
+					bit_buf |= (QWORD)*rd_ptr++ << bit_num;
+					bit_num += 8;
+				}
+			}
+		}
 
-		// If the dictionary is not empty, search for duplicate data in the dictionary
-		if (cur_dict_size > 1 && src_end_ptr - rd_ptr > 1) {
+		// First bit is 1; copy from dictionary
+		if (bit_buf & 1) {
 
-			// Initialize offsets and lengths used in search
-			copy_ptr = dict_buf;
-			max_copy_ptr = copy_ptr;
-			max_copy_len = 0;
+			// Find the base value for the copy length
+			i = s_LenDecode[(bit_buf >> 1) & ((1 << LEN_DECODE_BITS) - 1)];
+			code_bits = 1 + s_LenBits[i] + s_ExLenBits[i];
 
-			// Store position of last written dictionary byte
-			new_dict_ptr = dict_ptr - 1;
-			if (new_dict_ptr < dict_buf)
-				new_dict_ptr = dict_buf + cur_dict_size - 1;
+			// If input buffer is empty before end of stream, buffer is incomplete
+			if (bit_num < code_bits)
+				break;
 
-			// Search dictionary for duplicate data
-			for (; copy_ptr < dict_buf + cur_dict_size; copy_ptr++) {
+			// Store the copy length and remove the code from the bit buffer
+			copy_len = s_LenBase[i] + (UINT)TRUNCATE_VALUE(bit_buf >> (1 + s_LenBits[i]), s_ExLenBits[i]);
+			bit_buf >>= code_bits;
+			bit_num -= code_bits;
 
-				// Check for a match with first byte
-				if (ch != *copy_ptr)
-					continue;
+			// If copy length is 519, the end of the stream has been reached
+			if (copy_len == END_COPY_LEN) {
+				*dest_size = wrt_ptr - (BUFPTR)dest;
+				return TRUE;
+			}
 
-				bak_copy_ptr = copy_ptr;
-				copy_len = 0;
-				new_rd_ptr = rd_ptr - 1;
+			// Find most significant 6 bits of offset into the dictionary
+			i = s_OffsDecode[bit_buf & ((1 << OFFS_DECODE_BITS) - 1)];
 
-				// If there was a match, check for additional duplicate bytes
-				do {
+			// If the copy length is 2, there are only two more bits in the dictionary
+			// offset; otherwise, there are 4, 5, or 6 bits left, depending on what
+			// the dictionary size is
+			if (copy_len == 2) {
+				code_bits = s_OffsBits[i] + 2;
+				copy_dist = 1 + ((i << 2) + (UINT)((bit_buf >> s_OffsBits[i]) & 0x03));
+			} else {
+				code_bits = s_OffsBits[i] + dict;
+				copy_dist = 1 + ((i << dict) + (UINT)TRUNCATE_VALUE(bit_buf >> s_OffsBits[i], dict));
+			}
 
-					// Increment pointers and length
-					copy_len++;
-					new_rd_ptr++;
-					copy_ptr++;
+			if (bit_num < code_bits)
+				break;
 
-					// Wrap around pointer to beginning of dictionary buffer if the end of the buffer was reached
-					if (copy_ptr >= dict_buf + dict_size)
-						copy_ptr = dict_buf;
+			bit_buf >>= code_bits;
+			bit_num -= code_bits;
 
-					// Wrap dictionary bytes if end of the dictionary was reached
-					if (copy_ptr == dict_ptr)
-						copy_ptr = bak_copy_ptr;
+			// The data to copy must have been written already
+			if (copy_dist > (UINT)(wrt_ptr - (BUFPTR)dest))
+				return FALSE;
 
-					// Stop checking for additional bytes if there is no more input or maximum length was reached
-					if (copy_len >= 518 || new_rd_ptr >= src_end_ptr)
-						break;
+			copy_ptr = wrt_ptr - copy_dist;
 
-				} while (*new_rd_ptr == *copy_ptr);
+			// If output buffer becomes full during the copy, stop there
+			if (copy_len > (UINT)(dest_end_ptr - wrt_ptr)) {
+				while (wrt_ptr < dest_end_ptr)
+					*wrt_ptr++ = *copy_ptr++;
+				*dest_size = wrt_ptr - (BUFPTR)dest;
+				return FALSE;
+			}
 
-				// Return the pointer to the beginning of the matching data
-				copy_ptr = bak_copy_ptr;
+			copy_end_ptr = wrt_ptr + copy_len;
 
-				// Copying less than two bytes from dictionary wastes space, so don't do it ;)
-				if (copy_len < 2 || copy_len < max_copy_len)
-					continue;
+			// Copy 8 bytes at a time when the source is at least that far back and
+			// the output buffer has room for the overrun, which is rewritten later
+			if (copy_dist >= sizeof(word) && copy_len + sizeof(word) - 1 <= (UINT)(dest_end_ptr - wrt_ptr)) {
+				do {
+					DMemCpy(wrt_ptr, copy_ptr, sizeof(word));
+					wrt_ptr += sizeof(word);
+					copy_ptr += sizeof(word);
+				} while (wrt_ptr < copy_end_ptr);
+				wrt_ptr = copy_end_ptr;
+			}
+			// A run of the same byte
+			else if (copy_dist == 1) {
+				DMemSet(wrt_ptr, *copy_ptr, copy_len);
+				wrt_ptr = copy_end_ptr;
+			}
+			else {
+				while (wrt_ptr < copy_end_ptr)
+					*wrt_ptr++ = *copy_ptr++;
+			}
+		}
 
-				// Store the offset that will be outputted into the compressed data
-				new_copy_off = (new_dict_ptr - (copy_ptr - cur_dict_size)) % cur_dict_size;
+		// First bit is 0; literal byte
+		else {
 
-				// If the length is equal, check for a more efficient offset
-				if (copy_len == max_copy_len) {
+			// Fixed size literal byte
+			if (type == IMPLODE_BINARY) {
+				code_bits = 9;
+				entry = (UINT)(bit_buf >> 1) & 0xff;
+			}
 
-					// Use the most efficient offset
-					if (new_copy_off < copy_off) {
-						copy_off = new_copy_off;
-						max_copy_ptr = copy_ptr;
-						max_copy_len = copy_len;
-					}
-				}
-				// Only use the most efficient length and offset in dictionary
-				else {
+			// Variable size literal byte
+			else {
 
-					// Store the offset that will be outputted into the compressed data
-					copy_off = new_copy_off;
+				// Look up the byte from the bit sequence, long codes take a second lookup
+				entry = s_ChDecode[(bit_buf >> 1) & ((1 << CH_DECODE_BITS) - 1)];
+				if (entry & CH_DECODE_SUB)
+					entry = s_ChDecode[(entry & 0x3ff) + TRUNCATE_VALUE(bit_buf >> (1 + CH_DECODE_BITS), entry >> 10 & 0x07)];
 
-					// If the copy length is 2, check for a valid dictionary offset
-					if (copy_len > 2 || copy_off <= 255) {
-						max_copy_ptr = copy_ptr;
-						max_copy_len = copy_len;
-					}
-				}
+				code_bits = 1 + (entry >> 8);
 			}
 
-			// If there were at least 2 matching bytes in the dictionary that were found, output the length/offset pair
-			if (max_copy_len >= 2) {
+			if (bit_num < code_bits)
+				break;
 
-				// Reset the input pointers to the bytes that will be added to the dictionary
-				rd_ptr--;
-				new_rd_ptr = rd_ptr + max_copy_len;
+			// Copy the byte and remove it from the bit buffer
+			*wrt_ptr++ = (BYTE)entry;
+			bit_buf >>= code_bits;
+			bit_num -= code_bits;
+		}
+	}
 
-				while (rd_ptr < new_rd_ptr) {
+	// Store the decompressed size
+	*dest_size = wrt_ptr - (BUFPTR)dest;
 
-					// Add a byte to the dictionary
-					*dict_ptr++ = ch;
+	// The output buffer is full, or the input ended before the end of stream
+	return wrt_ptr >= dest_end_ptr;
+}
 
-					// If the dictionary is not full yet, increment the current dictionary size
-					if (cur_dict_size < dict_size)
-						cur_dict_size++;
+struct IMPLODE_STREAM *alloc_implode_stream(INT type, INT dict, INT level)
+{
+	UINT dict_size;
+	struct IMPLODE_STREAM *stream;
 
-					// If the current end of the dictionary is past the end of the buffer,
-					// wrap around back to the start
-					if (dict_ptr >= dict_buf + dict_size)
-						dict_ptr = dict_buf;
+	// Check for a valid compression type
+	if (type != IMPLODE_BINARY && type != IMPLODE_ASCII)
+		return NULL;
 
-					// Get the next byte to be added
-					if (++rd_ptr < new_rd_ptr)
-						ch = *rd_ptr;
-				}
+	// Check for a valid compression level
+	if (level != IMPLODE_LEVEL_FAST && level != IMPLODE_LEVEL_NORMAL && level != IMPLODE_LEVEL_BEST)
+		return NULL;
 
-				// Find bit code for the base value of the length from the table
-				for (i = 0; i < 0x0F; i++) {
+	// Check for a valid dictionary size
+	dict_size = get_dict_size(dict);
+	if (!dict_size)
+		return NULL;
 
-					if (s_LenBase[i] <= max_copy_len && max_copy_len < s_LenBase[i + 1])
-						break;
-				}
+	stream = DAlloc(sizeof(struct IMPLODE_STREAM));
+	if (!stream)
+		return NULL;
 
-				// Store the base value of the length
-				bit_buf += (1 + (s_LenCode[i] << 1)) << bit_num;
-				bit_num += 1 + s_LenBits[i];
+	stream->type = type;
+	stream->dict = dict;
+	stream->level = level;
+	stream->state = IMPLODE_STREAM_MORE;
+	stream->finished = FALSE;
+	stream->pos = 0;
+	stream->data_size = 0;
 
-				// Store the extra bits for the length
-				bit_buf += (max_copy_len - s_LenBase[i]) << bit_num;
-				bit_num += s_ExLenBits[i];
+	init_finder(&stream->work.mf, dict_size, level);
+	stream->work.ahead = FALSE;
 
-				// Output the data from the bit buffer
-				while (bit_num >= 8) {
+	// Store compression type and dictionary size, returned before the compressed data
+	stream->out[0] = (BYTE)type;
+	stream->out[1] = (BYTE)dict;
+	stream->out_ptr = stream->out;
 
-					// If output buffer has become full, stop immediately!
-					if (wrt_ptr >= dest_end_ptr)
-						return FALSE;
+	// Initialize bit buffer
+	stream->bw.cur_ptr = stream->out + 2;
+	stream->bw.end_ptr = stream->out + STREAM_OUT_SIZE;
+	stream->bw.bit_num = 0;
+	stream->bw.bit_buf = 0;
 
-					*wrt_ptr++ = (BYTE)bit_buf;
-					bit_buf >>= 8;
-					bit_num -= 8;
-				}
+	return stream;
+}
 
-				// The most significant 6 bits of the dictionary offset are encoded with a
-				// bit sequence then the first 2 after that if the copy length is 2,
-				// otherwise it is the first 4, 5, or 6 (based on the dictionary size)
-				if (max_copy_len == 2) {
+VOID free_implode_stream(struct IMPLODE_STREAM *stream)
+{
+	DFree(stream);
+}
 
-					// Store most significant 6 bits of offset using bit sequence
-					bit_buf += s_OffsCode[copy_off >> 2] << bit_num;
-					bit_num += s_OffsBits[copy_off >> 2];
+INT implode_stream(struct IMPLODE_STREAM *stream, VCPTR src, UINT *src_size, VPTR dest, UINT *dest_size, BOOL finish)
+{
+	BOOL ret, last;
+	UINT n, end;
+	BUFCPTR	rd_ptr;			// Current position in input buffer
+	BUFPTR wrt_ptr;			// Current position in output buffer
+	BUFCPTR src_end_ptr;	// Pointer to the end of source buffer
+	BUFPTR dest_end_ptr;	// Pointer to the end of dest buffer
 
-					// Store the first 2 bits
-					bit_buf += (copy_off & 0x03) << bit_num;
-					bit_num += 2;
-				}
-				else {
+	if (!stream || !src_size || !dest_size || (*src_size && !src) || (*dest_size && !dest))
+		return IMPLODE_STREAM_ERROR;
 
-					// Store most significant 6 bits of offset using bit sequence
-					bit_buf += s_OffsCode[copy_off >> dict] << bit_num;
-					bit_num += s_OffsBits[copy_off >> dict];
+	// Initialize buffer positions
+	rd_ptr = src;
+	wrt_ptr = dest;
+	src_end_ptr = rd_ptr + *src_size;
+	dest_end_ptr = wrt_ptr + *dest_size;
+
+	while (stream->state == IMPLODE_STREAM_MORE) {
+
+		// Return the output of the previous chunk before compressing another one
+		n = DMin((UINT)(stream->bw.cur_ptr - stream->out_ptr), (UINT)(dest_end_ptr - wrt_ptr));
+		DMemCpy(wrt_ptr, stream->out_ptr, n);
+		wrt_ptr += n;
+		stream->out_ptr += n;
+
+		// If output buffer has become full, stop until the caller drains it
+		if (stream->out_ptr < stream->bw.cur_ptr)
+			break;
+
+		stream->out_ptr = stream->out;
+		stream->bw.cur_ptr = stream->out;
+
+		if (stream->finished) {
+			stream->state = IMPLODE_STREAM_END;
+			break;
+		}
+
+		// Drop the bytes that are too far back to be copied from
+		while (stream->pos >= 2 * MAX_DICT_SIZE)
+			slide_stream(stream);
+
+		// Take as much input as the input buffer holds
+		n = DMin((UINT)(src_end_ptr - rd_ptr), STREAM_BUF_SIZE - stream->data_size);
+		DMemCpy(stream->data + stream->data_size, rd_ptr, n);
+		rd_ptr += n;
+		stream->data_size += n;
+
+		// Until the last input is given, a position is only compressed when the bytes
+		// after it that the parser looks at are there, so the output is the same as
+		// compressing the whole input at once
+		last = finish && rd_ptr >= src_end_ptr;
+		if (last)
+			end = DMin(stream->pos + PARSE_CHUNK, stream->data_size);
+		else if (stream->level == IMPLODE_LEVEL_BEST)
+			end = (stream->data_size > stream->pos + PARSE_CHUNK) ? stream->pos + PARSE_CHUNK : stream->pos;
+		else if (stream->data_size > stream->pos + LOOKAHEAD_LEN)
+			end = DMin(stream->pos + PARSE_CHUNK, stream->data_size - LOOKAHEAD_LEN);
+		else
+			end = stream->pos;
+
+		// Compress a chunk into the output buffer, which is large enough for it
+		if (end > stream->pos) {
+			if (stream->level == IMPLODE_LEVEL_BEST) {
+				ret = parse_optimal(&stream->work, &stream->bw, stream->type, stream->dict, stream->data, stream->pos, end, stream->data_size);
+				stream->pos = end;
+			} else {
+				ret = parse_greedy(&stream->work, &stream->bw, stream->type, stream->dict, stream->level == IMPLODE_LEVEL_NORMAL,
+					stream->data, &stream->pos, end, stream->data_size);
+			}
+			if (!ret)
+				stream->state = IMPLODE_STREAM_ERROR;
+			continue;
+		}
+
+		// Wait for more input
+		if (!last)
+			break;
+
+		// Store the code for the end of the compressed data stream
+		if (!put_end(&stream->bw))
+			stream->state = IMPLODE_STREAM_ERROR;
+		stream->finished = TRUE;
+	}
+
+	*src_size = rd_ptr - (BUFCPTR)src;
+	*dest_size = wrt_ptr - (BUFPTR)dest;
+
+	return stream->state;
+}
+
+struct EXPLODE_STREAM *alloc_explode_stream(VOID)
+{
+	struct EXPLODE_STREAM *stream;
+
+	stream = DAlloc(sizeof(struct EXPLODE_STREAM));
+	if (!stream)
+		return NULL;
+
+	stream->state = IMPLODE_STREAM_MORE;
+	stream->head_num = 0;
+	stream->bit_num = 0;
+	stream->bit_buf = 0;
+	stream->copy_len = 0;
+	stream->copy_dist = 0;
+	stream->win_pos = 0;
+	stream->win_num = 0;
+
+	return stream;
+}
+
+VOID free_explode_stream(struct EXPLODE_STREAM *stream)
+{
+	DFree(stream);
+}
 
-					// Store the first 4, 5, or 6 bits
-					bit_buf += TRUNCATE_VALUE(copy_off, dict) << bit_num;
-					bit_num += dict;
+INT explode_stream(struct EXPLODE_STREAM *stream, VCPTR src, UINT *src_size, VPTR dest, UINT *dest_size)
+{
+	UINT i;					// Index into tables
+	UINT entry;				// Entry of the literal decoding table
+	UINT len_bits;			// Number of bits of the copy length
+	UINT code_bits;			// Number of bits of the current code
+	UINT copy_len;			// Length of data to copy from the output
+	UINT copy_dist;			// Distance back to the data to copy
+	BUFCPTR	rd_ptr;			// Current position in input buffer
+	BUFPTR wrt_ptr;			// Current position in output buffer
+	BUFCPTR src_end_ptr;	// Pointer to the end of source buffer
+	BUFPTR dest_end_ptr;	// Pointer to the end of dest buffer
+	UINT bit_num;			// Number of bits in bit buffer
+	QWORD bit_buf;			// Stores bits read ahead from the input
+	QWORD word;				// Next 8 bytes of the input buffer
+
+	if (!stream || !src_size || !dest_size || (*src_size && !src) || (*dest_size && !dest))
+		return IMPLODE_STREAM_ERROR;
+
+	// Initialize buffer positions
+	rd_ptr = src;
+	wrt_ptr = dest;
+	src_end_ptr = rd_ptr + *src_size;
+	dest_end_ptr = wrt_ptr + *dest_size;
+
+	// Get header from compressed data, which may come in separate calls
+	if (stream->head_num == 0 && rd_ptr < src_end_ptr) {
+		stream->type = *rd_ptr++;
+		stream->head_num++;
+	}
+
+	if (stream->head_num == 1 && rd_ptr < src_end_ptr) {
+		stream->dict = *rd_ptr++;
+		stream->head_num++;
+
+		// Check for a valid compression type and dictionary size
+		if (stream->type != IMPLODE_BINARY && stream->type != IMPLODE_ASCII)
+			stream->state = IMPLODE_STREAM_ERROR;
+		if (!get_dict_size(stream->dict))
+			stream->state = IMPLODE_STREAM_ERROR;
+	}
+
+	bit_buf = stream->bit_buf;
+	bit_num = stream->bit_num;
+
+	// Decompress until the input or the output runs out. A code is only removed from
+	// the bit buffer once all of its bits are there, the rest is read by the next call
+	while (stream->state == IMPLODE_STREAM_MORE && stream->head_num == 2) {
+
+		// Write out the copy that did not fit in the output buffer last time
+		if (stream->copy_len) {
+			wrt_ptr = copy_output(stream, wrt_ptr, dest_end_ptr, dest);
+			if (stream->copy_len)
+				break;
+		}
+
+		// Refill the bit buffer the same way as explode does
+		if (bit_num < REFILL_BITS) {
+			if (src_end_ptr - rd_ptr >= (INT)sizeof(word)) {
+				DMemCpy(&word, rd_ptr, sizeof(word));
+				bit_buf |= word << bit_num;
+				rd_ptr += (63 - bit_num) >> 3;
+				bit_num |= 56;
+			} else {
+				while (bit_num <= 56 && rd_ptr < src_end_ptr) {
+					bit_buf |= (QWORD)*rd_ptr++ << bit_num;
+					bit_num += 8;
 				}
 			}
 		}
 
-		// If the copy length was less than two, include the byte as a literal byte
-		if (max_copy_len < 2) {
+		// First bit is 1; copy from dictionary
+		if (bit_buf & 1) {
+
+			// Find the base value for the copy length
+			i = s_LenDecode[(bit_buf >> 1) & ((1 << LEN_DECODE_BITS) - 1)];
+			len_bits = 1 + s_LenBits[i] + s_ExLenBits[i];
 
-			if (type == IMPLODE_BINARY) {
+			if (bit_num < len_bits)
+				break;
+
+			copy_len = s_LenBase[i] + (UINT)TRUNCATE_VALUE(bit_buf >> (1 + s_LenBits[i]), s_ExLenBits[i]);
 
-				// Store a fixed size literal byte
-				bit_buf += ch << (bit_num + 1);
-				bit_num += 9;
+			// If copy length is 519, the end of the stream has been reached
+			if (copy_len == END_COPY_LEN) {
+				bit_buf >>= len_bits;
+				bit_num -= len_bits;
+				stream->state = IMPLODE_STREAM_END;
+				break;
 			}
-			else {
 
-				// Store a variable size literal byte
-				bit_buf += s_ChCode[ch] << (bit_num + 1);
-				bit_num += 1 + s_ChBits[ch];
+			// Find most significant 6 bits of offset into the dictionary, then the
+			// 2 bits after them if the copy length is 2, otherwise 4, 5, or 6 bits
+			i = s_OffsDecode[(bit_buf >> len_bits) & ((1 << OFFS_DECODE_BITS) - 1)];
+			if (copy_len == 2) {
+				code_bits = s_OffsBits[i] + 2;
+				copy_dist = 1 + ((i << 2) + (UINT)((bit_buf >> (len_bits + s_OffsBits[i])) & 0x03));
+			} else {
+				code_bits = s_OffsBits[i] + stream->dict;
+				copy_dist = 1 + ((i << stream->dict) + (UINT)TRUNCATE_VALUE(bit_buf >> (len_bits + s_OffsBits[i]), stream->dict));
 			}
 
-			// Add the byte into the dictionary
-			*dict_ptr++ = ch;
+			code_bits += len_bits;
+			if (bit_num < code_bits)
+				break;
+
+			bit_buf >>= code_bits;
+			bit_num -= code_bits;
 
-			// If the dictionary is not full yet, increment the current dictionary size
-			if (cur_dict_size < dict_size)
-				cur_dict_size++;
+			// The data to copy must have been written already
+			if (copy_dist > stream->win_num + (UINT)(wrt_ptr - (BUFPTR)dest)) {
+				stream->state = IMPLODE_STREAM_ERROR;
+				break;
+			}
 
-			// If the current end of the dictionary is past the end of the buffer,
-			// wrap around back to the start
-			if (dict_ptr >= dict_buf + dict_size)
-				dict_ptr = dict_buf;
+			stream->copy_len = copy_len;
+			stream->copy_dist = copy_dist;
 		}
 
-		// Write any whole bytes from the bit buffer into the output buffer
-		while (bit_num >= 8) {
+		// First bit is 0; literal byte
+		else {
 
-			// If output buffer has become full, stop immediately!
-			if (wrt_ptr >= dest_end_ptr)
-				return FALSE;
+			// Fixed size literal byte
+			if (stream->type == IMPLODE_BINARY) {
+				code_bits = 9;
+				entry = (UINT)(bit_buf >> 1) & 0xff;
+			}
+
+			// Variable size literal byte
+			else {
+				entry = s_ChDecode[(bit_buf >> 1) & ((1 << CH_DECODE_BITS) - 1)];
+				if (entry & CH_DECODE_SUB)
+					entry = s_ChDecode[(entry & 0x3ff) + TRUNCATE_VALUE(bit_buf >> (1 + CH_DECODE_BITS), entry >> 10 & 0x07)];
 
-			*wrt_ptr++ = (BYTE)bit_buf;
-			bit_buf >>= 8;
-			bit_num -= 8;
+				code_bits = 1 + (entry >> 8);
+			}
+
+			// The end code needs no output space, only a literal waits for it
+			if (bit_num < code_bits || wrt_ptr >= dest_end_ptr)
+				break;
+
+			// Copy the byte and remove it from the bit buffer
+			*wrt_ptr++ = (BYTE)entry;
+			bit_buf >>= code_bits;
+			bit_num -= code_bits;
 		}
 	}
 
+	// Leave the whole bytes after the end of stream to the caller, as far as they came in this call
+	if (stream->state == IMPLODE_STREAM_END)
+		rd_ptr -= DMin(bit_num >> 3, (UINT)(rd_ptr - (BUFCPTR)src));
+
+	stream->bit_buf = bit_buf;
+	stream->bit_num = bit_num;
+
+	// Keep the last bytes written out for the copies of later calls
+	update_window(stream, dest, wrt_ptr);
+
+	*src_size = rd_ptr - (BUFCPTR)src;
+	*dest_size = wrt_ptr - (BUFPTR)dest;
+
+	return stream->state;
+}
+
+/************************************************************************/
+
+static BOOL implode_work(struct IMPLODE_WORK *work, INT type, INT dict, INT level, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+{
+	BOOL ret;
+	BUFPTR wrt_ptr;			// Current position in output buffer
+	UINT dict_size;			// Maximum size of dictionary
+	UINT pos;				// Position of the next byte to compress
+	struct BIT_WRITER bw;
+
+	DAssert(work);
+
+	// Check for a valid compression type
+	if (type != IMPLODE_BINARY && type != IMPLODE_ASCII)
+		return FALSE;
+
+	// Check for a valid compression level
+	if (level != IMPLODE_LEVEL_FAST && level != IMPLODE_LEVEL_NORMAL && level != IMPLODE_LEVEL_BEST)
+		return FALSE;
+
+	// Check for a valid dictionary size
+	dict_size = get_dict_size(dict);
+	if (!dict_size)
+		return FALSE;
+
+	if (!src || !dest || !dest_size)
+		return FALSE;
+
+	// If the output buffer size is less than 4, there
+	// is not enough room for the compressed data
+	if (*dest_size < 4)
+		return FALSE;
+
+	// Store compression type and dictionary size
+	wrt_ptr = dest;
+	*wrt_ptr++ = type;
+	*wrt_ptr++ = dict;
+
+	// Initialize bit buffer
+	bw.cur_ptr = wrt_ptr;
+	bw.end_ptr = (BUFPTR)dest + *dest_size;
+	bw.bit_num = 0;
+	bw.bit_buf = 0;
+
+	init_finder(&work->mf, dict_size, level);
+	work->ahead = FALSE;
+
+	// Compress the whole input buffer
+	pos = 0;
+	if (level == IMPLODE_LEVEL_BEST)
+		ret = parse_optimal(work, &bw, type, dict, src, 0, src_size, src_size);
+	else
+		ret = parse_greedy(work, &bw, type, dict, level == IMPLODE_LEVEL_NORMAL, src, &pos, src_size, src_size);
+
+	if (!ret)
+		return FALSE;
+
 	// Store the code for the end of the compressed data stream
-	bit_buf += (1 + (s_LenCode[0x0f] << 1)) << bit_num;
-	bit_num += 1 + s_LenBits[0x0f];
+	if (!put_end(&bw))
+		return FALSE;
 
-	bit_buf += 0xff << bit_num;
-	bit_num += 8;
+	// Store the compressed size
+	*dest_size = bw.cur_ptr - (BUFPTR)dest;
 
-	// Write any remaining bits from the bit buffer into the output buffer
-	while (bit_num > 0) {
+	return TRUE;
+}
+
+
+static VOID init_finder(struct MATCH_FINDER *mf, UINT dict_size, INT level)
+{
+	DAssert(mf);
+
+	DMemClr(mf->head, sizeof(mf->head));
+	mf->dict_size = dict_size;
+
+	// Longer chains find longer copies at the cost of speed
+	switch (level) {
+	case IMPLODE_LEVEL_FAST:
+		mf->max_chain = 4;
+		break;
+	case IMPLODE_LEVEL_NORMAL:
+		mf->max_chain = 64;
+		break;
+	default:
+		mf->max_chain = 512;
+		break;
+	}
+}
+
+static VOID insert_pos(struct MATCH_FINDER *mf, BUFCPTR src, UINT pos)
+{
+	UINT hash, prev, dist;
+
+	DAssert(mf && src);
+
+	// Hash the 2 bytes at the position
+	hash = (((DWORD)src[pos] << 8) | src[pos + 1]) * 2654435761UL;
+	hash = (hash & 0xffffffffUL) >> (32 - HASH_BITS);
+
+	// Link the position to the previous one with the same hash
+	prev = mf->head[hash];
+	dist = prev ? pos - (prev - 1) : 0;
+
+	mf->prev[pos & (MAX_DICT_SIZE - 1)] = (dist <= MAX_DICT_SIZE) ? (WORD)dist : 0;
+	mf->head[hash] = pos + 1;
+}
+
+static VOID find_matches(CONST struct MATCH_FINDER *mf, BUFCPTR src, UINT pos, UINT max_len, struct MATCH_LIST *ml)
+{
+	UINT hash, prev, dist, step, len, best, chain;
+	BUFCPTR cur_ptr, copy_ptr;
+
+	DAssert(mf && src && ml);
+
+	ml->num = 0;
+
+	if (max_len < MIN_COPY_LEN)
+		return;
+
+	hash = (((DWORD)src[pos] << 8) | src[pos + 1]) * 2654435761UL;
+	hash = (hash & 0xffffffffUL) >> (32 - HASH_BITS);
+
+	prev = mf->head[hash];
+	if (!prev)
+		return;
+
+	cur_ptr = src + pos;
+	dist = pos - (prev - 1);
+	best = MIN_COPY_LEN - 1;
+
+	// Positions are visited from the nearest one, so for each length
+	// the first copy found also has the most efficient offset
+	for (chain = mf->max_chain; chain && dist <= mf->dict_size; chain--) {
+
+		copy_ptr = cur_ptr - dist;
+
+		// Skip the position unless it can be longer than the best copy
+		if (copy_ptr[best] == cur_ptr[best] && copy_ptr[0] == cur_ptr[0]) {
+
+			for (len = 1; len < max_len && copy_ptr[len] == cur_ptr[len]; len++)
+				;
+
+			// Copies of 2 bytes can only use small offsets
+			if (len > best && (len > MIN_COPY_LEN || dist <= MAX_SHORT_OFF)) {
+
+				// Keep the longest ones if there are too many
+				if (ml->num == MAX_CANDIDATE)
+					ml->num--;
+
+				ml->len[ml->num] = (WORD)len;
+				ml->dist[ml->num] = (WORD)dist;
+				ml->num++;
+
+				best = len;
+				if (len >= max_len)
+					break;
+			}
+		}
+
+		step = mf->prev[(pos - dist) & (MAX_DICT_SIZE - 1)];
+		if (!step)
+			break;
+		dist += step;
+	}
+}
+
+static BOOL put_bits(struct BIT_WRITER *bw, UINT bits, UINT num)
+{
+	DAssert(bw && num <= 16);
+
+	bw->bit_buf += bits << bw->bit_num;
+	bw->bit_num += num;
+
+	// Write any whole bytes from the bit buffer into the output buffer
+	while (bw->bit_num >= 8) {
 
 		// If output buffer has become full, stop immediately!
-		if (wrt_ptr >= dest_end_ptr)
+		if (bw->cur_ptr >= bw->end_ptr)
 			return FALSE;
 
-		*wrt_ptr++ = (BYTE)bit_buf;
-		bit_buf >>= 8;
-		if (bit_num >= 8)
-			bit_num -= 8;
-		else
-			bit_num = 0;
+		*bw->cur_ptr++ = (BYTE)bw->bit_buf;
+		bw->bit_buf >>= 8;
+		bw->bit_num -= 8;
 	}
 
-	// Store the compressed size
-	*dest_size = wrt_ptr - (BUFPTR)dest;
-
 	return TRUE;
 }
 
-BOOL explode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size)
+static BOOL put_literal(struct BIT_WRITER *bw, INT type, BYTE ch)
 {
-	INT i;					// Index into tables
-	INT copy_len;			// Length of data to copy from the dictionary
-	BUFPTR copy_off;		// Offset to data to copy from the dictionary
-	BYTE type;				// Specifies whether to use fixed or variable size literal bytes
-	BYTE dict;				// Dictionary size; valid values are 4, 5, and 6 which represent 1024, 2048, and 4096 respectively
-	BUFCPTR	rd_ptr;			// Current position in input buffer
-	BUFPTR wrt_ptr;			// Current position in output buffer
-	BUFCPTR src_end_ptr;	// Pointer to the end of source buffer
-	BUFPTR dest_end_ptr;	// Pointer to the end of dest buffer
-	BYTE bit_num;			// Number of bits in bit buffer
-	DWORD bit_buf;			// Stores bits until there are enough to output a byte of data
-	BUFPTR dict_ptr;		// Position in dictionary
-	UINT dict_size;			// Maximum size of dictionary
-	UINT cur_dict_size;		// Current size of dictionary
-	BYTE dict_buf[0x1000];	// Sliding dictionary used for compression and decompression
+	// Store a fixed size literal byte
+	if (type == IMPLODE_BINARY)
+		return put_bits(bw, ch << 1, 9);
 
-	// Compressed data cannot be less than 4 bytes;
-	// this is not possible in any case whatsoever
-	if (src_size < 4) {
-		*dest_size = 0;
+	// Store a variable size literal byte
+	return put_bits(bw, s_ChCode[ch] << 1, 1 + s_ChBits[ch]);
+}
+
+static BOOL put_copy(struct BIT_WRITER *bw, INT dict, UINT len, UINT dist)
+{
+	UINT i, off;
+
+	DAssert(DBetween(len, MIN_COPY_LEN, MAX_COPY_LEN + 1) && dist);
+
+	i = len_index(len);
+	off = dist - 1;
+
+	// Store the base value of the length and the extra bits for the length
+	if (!put_bits(bw, 1 + (s_LenCode[i] << 1), 1 + s_LenBits[i]))
+		return FALSE;
+	if (!put_bits(bw, len - s_LenBase[i], s_ExLenBits[i]))
 		return FALSE;
+
+	// The most significant 6 bits of the dictionary offset are encoded with a
+	// bit sequence then the first 2 after that if the copy length is 2,
+	// otherwise it is the first 4, 5, or 6 (based on the dictionary size)
+	if (len == MIN_COPY_LEN) {
+		DAssert(off < MAX_SHORT_OFF);
+		if (!put_bits(bw, s_OffsCode[off >> 2], s_OffsBits[off >> 2]))
+			return FALSE;
+		return put_bits(bw, off & 0x03, 2);
 	}
 
-	// Initialize buffer positions
-	rd_ptr = src;
-	wrt_ptr = dest;
-	src_end_ptr = rd_ptr + src_size;
-	dest_end_ptr = wrt_ptr + *dest_size;
+	if (!put_bits(bw, s_OffsCode[off >> dict], s_OffsBits[off >> dict]))
+		return FALSE;
+	return put_bits(bw, TRUNCATE_VALUE(off, dict), dict);
+}
 
-	// Get header from compressed data
-	type = *rd_ptr++;
-	dict = *rd_ptr++;
+static BOOL put_end(struct BIT_WRITER *bw)
+{
+	DAssert(bw);
 
-	// Check for a valid compression type
-	if (type != IMPLODE_BINARY && type != IMPLODE_ASCII)
+	// Store the code for the end of the compressed data stream
+	if (!put_bits(bw, 1 + (s_LenCode[0x0f] << 1), 1 + s_LenBits[0x0f]) || !put_bits(bw, 0xff, 8))
 		return FALSE;
 
+	// Write any remaining bits from the bit buffer into the output buffer
+	if (bw->bit_num > 0) {
+
+		// If output buffer has become full, stop immediately!
+		if (bw->cur_ptr >= bw->end_ptr)
+			return FALSE;
+
+		*bw->cur_ptr++ = (BYTE)bw->bit_buf;
+		bw->bit_buf = 0;
+		bw->bit_num = 0;
+	}
+
+	return TRUE;
+}
+
+static UINT get_dict_size(INT dict)
+{
 	// Only dictionary sizes of 1024, 2048, and 4096 are allowed.
 	// The values 4, 5, and 6 correspond with those sizes
 	switch (dict) {
 	case IMPLODE_DICT_1K:
-		// Store actual dictionary size
-		dict_size = 1024;
-		break;
+		return 1024;
 	case IMPLODE_DICT_2K:
-		// Store actual dictionary size
-		dict_size = 2048;
-		break;
+		return 2048;
 	case IMPLODE_DICT_4K:
-		// Store actual dictionary size
-		dict_size = 4096;
-		break;
+		return 4096;
 	default:
-		return FALSE;
+		return 0;
 	}
+}
 
-	// Initialize dictionary position
-	dict_ptr = dict_buf;
+static UINT len_index(UINT len)
+{
+	UINT i;
 
-	// Initialize current dictionary size to zero
-	cur_dict_size = 0;
+	// Find bit code for the base value of the length from the table
+	for (i = 0; i < 0x0f && s_LenBase[i + 1] <= len; i++)
+		;
 
-	// Get first 16 bits
-	bit_buf = *rd_ptr++;
-	bit_buf += *rd_ptr++ << 8;
-	bit_num = 16;
+	return i;
+}
 
-	// Decompress until output buffer is full
-	while (wrt_ptr < dest_end_ptr) {
+static UINT copy_cost(INT dict, UINT len, UINT dist)
+{
+	UINT i, off;
 
-		// Fill bit buffer with at least 16 bits
-		while (bit_num < 16) {
+	i = len_index(len);
+	off = dist - 1;
 
-			// If input buffer is empty before end of stream, buffer is incomplete
-			if (rd_ptr >= src_end_ptr) {
+	if (len == MIN_COPY_LEN)
+		return 1 + s_LenBits[i] + s_ExLenBits[i] + s_OffsBits[off >> 2] + 2;
 
-				// Store the current size of output
-				*dest_size = wrt_ptr - (BUFPTR)dest;
-				return FALSE;
-			}
+	return 1 + s_LenBits[i] + s_ExLenBits[i] + s_OffsBits[off >> dict] + dict;
+}
 
-			bit_buf += *rd_ptr++ << bit_num;
-			bit_num += 8;
-		}
+static BOOL parse_greedy(struct IMPLODE_WORK *work, struct BIT_WRITER *bw, INT type, INT dict, BOOL lazy, BUFCPTR src, UINT *pos, UINT end, UINT src_size)
+{
+	UINT cur, len, dist, stop;
+	struct MATCH_FINDER *mf;
+	struct MATCH_LIST ml;
 
-		// First bit is 1; copy from dictionary
-		if (bit_buf & 1) {
+	DAssert(work && bw && src && pos);
 
-			// Remove first bit from bit buffer
-			bit_buf >>= 1;
-			bit_num--;
+	mf = &work->mf;
 
-			// Find the base value for the copy length
-			for (i = 0; i <= 0x0F; i++) {
+	// Positions from end on are left to the next call, but a copy may run past it
+	for (cur = *pos; cur < end; ) {
 
-				if (TRUNCATE_VALUE(bit_buf, s_LenBits[i]) == s_LenCode[i])
-					break;
-			}
+		// Reuse the copies found when looking ahead
+		if (work->ahead)
+			ml = work->next;
+		else
+			find_matches(mf, src, cur, DMin(MAX_COPY_LEN, src_size - cur), &ml);
 
-			// Remove value from bit buffer
-			bit_buf >>= s_LenBits[i];
-			bit_num -= s_LenBits[i];
+		work->ahead = FALSE;
 
-			// Store the copy length
-			copy_len = s_LenBase[i] + TRUNCATE_VALUE(bit_buf, s_ExLenBits[i]);
+		if (cur + 1 < src_size)
+			insert_pos(mf, src, cur);
 
-			// Remove the extra bits from the bit buffer
-			bit_buf >>= s_ExLenBits[i];
-			bit_num -= s_ExLenBits[i];
+		len = ml.num ? ml.len[ml.num - 1] : 0;
+		dist = ml.num ? ml.dist[ml.num - 1] : 0;
 
-			// If copy length is 519, the end of the stream has been reached
-			if (copy_len == 519)
-				break;
+		// Output a literal byte instead if a longer copy starts at the next byte
+		if (lazy && len && len < LAZY_LEN && cur + 2 < src_size) {
+			find_matches(mf, src, cur + 1, DMin(MAX_COPY_LEN, src_size - cur - 1), &work->next);
+			work->ahead = TRUE;
+			if (work->next.num && work->next.len[work->next.num - 1] > len)
+				len = 0;
+		}
 
-			// Fill bit buffer with at least 14 bits
-			while (bit_num < 14) {
+		// Output the byte as a literal byte
+		if (!len) {
+			if (!put_literal(bw, type, src[cur]))
+				return FALSE;
+			cur++;
+			continue;
+		}
 
-				// If input buffer is empty before end of stream, buffer is incomplete
-				if (rd_ptr >= src_end_ptr) {
+		if (!put_copy(bw, dict, len, dist))
+			return FALSE;
 
-					// Store the current size of output
-					*dest_size = wrt_ptr - (BUFPTR)dest;
-					return FALSE;
-				}
+		// Add the copied bytes into the dictionary
+		for (stop = cur + len, cur++; cur < stop; cur++) {
+			if (cur + 1 < src_size)
+				insert_pos(mf, src, cur);
+		}
 
-				bit_buf += *rd_ptr++ << bit_num;
-				bit_num += 8;
-			}
+		work->ahead = FALSE;
+	}
 
-			// Find most significant 6 bits of offset into the dictionary
-			for (i = 0; i <= 0x3f; i++) {
+	*pos = cur;
 
-				if (TRUNCATE_VALUE(bit_buf, s_OffsBits[i]) == s_OffsCode[i])
-					break;
-			}
+	return TRUE;
+}
 
-			// Remove value from bit buffer
-			bit_buf >>= s_OffsBits[i];
-			bit_num -= s_OffsBits[i];
+static BOOL parse_optimal(struct IMPLODE_WORK *work, struct BIT_WRITER *bw, INT type, INT dict, BUFCPTR src, UINT start, UINT end, UINT src_size)
+{
+	UINT i, k, n, pos, len, dist, cost, skip;
+	struct MATCH_FINDER *mf;
+	struct PARSE_NODE *node;
+	struct MATCH_LIST ml;
 
-			// If the copy length is 2, there are only two more bits in the dictionary
-			// offset; otherwise, there are 4, 5, or 6 bits left, depending on what
-			// the dictionary size is
-			if (copy_len == 2) {
+	DAssert(work && bw && src);
 
-				// Store the exact offset to a byte in the dictionary
-				copy_off = dict_ptr - 1 - ((i << 2) + (bit_buf & 0x03));
+	mf = &work->mf;
+	node = &work->node;
 
-				// Remove the rest of the dictionary offset from the bit buffer
-				bit_buf >>= 2;
-				bit_num -= 2;
-			}
-			else {
+	// Find the cheapest sequence of literal bytes and copies chunk by chunk
+	for (; start < end; start += n) {
+
+		n = DMin(PARSE_CHUNK, end - start);
+
+		node->cost[0] = 0;
+		for (i = 1; i <= n; i++)
+			node->cost[i] = INFINITE_COST;
+
+		for (i = 0, skip = 0; i < n; i++) {
 
-				// Store the exact offset to a byte in the dictionary
-				copy_off = dict_ptr - 1 - ((i << dict) + TRUNCATE_VALUE(bit_buf, dict));
+			pos = start + i;
 
-				// Remove the rest of the dictionary offset from the bit buffer
-				bit_buf >>= dict;
-				bit_num -= dict;
+			// Bytes inside a long copy are only added to the dictionary
+			if (skip) {
+				if (pos + 1 < src_size)
+					insert_pos(mf, src, pos);
+				skip--;
+				continue;
 			}
 
-			// While there are still bytes left, copy bytes from the dictionary
-			while (copy_len-- > 0) {
+			find_matches(mf, src, pos, DMin(MAX_COPY_LEN, n - i), &ml);
 
-				// If output buffer has become full, stop immediately!
-				if (wrt_ptr >= dest_end_ptr) {
+			if (pos + 1 < src_size)
+				insert_pos(mf, src, pos);
 
-					// Store the current size of output
-					*dest_size = wrt_ptr - (BUFPTR)dest;
-					return FALSE;
-				}
+			cost = node->cost[i] + ((type == IMPLODE_BINARY) ? 9 : 1 + s_ChBits[src[pos]]);
+			if (cost < node->cost[i + 1]) {
+				node->cost[i + 1] = cost;
+				node->len[i + 1] = 1;
+			}
 
-				// Check whether the offset is a valid one into the dictionary
-				while (copy_off < dict_buf)
-					copy_off += cur_dict_size;
-				while (copy_off >= dict_buf + cur_dict_size)
-					copy_off -= cur_dict_size;
+			// Each copy covers the lengths that the shorter and nearer ones cannot
+			for (len = MIN_COPY_LEN, k = 0; k < ml.num; k++) {
+				dist = ml.dist[k];
+				for (; len <= ml.len[k]; len++) {
+					if (len == MIN_COPY_LEN && dist > MAX_SHORT_OFF)
+						continue;
+					cost = node->cost[i] + copy_cost(dict, len, dist);
+					if (cost < node->cost[i + len]) {
+						node->cost[i + len] = cost;
+						node->len[i + len] = (WORD)len;
+						node->dist[i + len] = (WORD)dist;
+					}
+				}
+			}
 
-				// Copy the byte from the dictionary and add it to the end of the dictionary
-				*dict_ptr++ = *wrt_ptr++ = *copy_off++;
+			// Take very long copies directly
+			if (ml.num && ml.len[ml.num - 1] >= NICE_LEN)
+				skip = ml.len[ml.num - 1] - 1;
+		}
 
-				// If the dictionary is not full yet, increment the current dictionary size
-				if (cur_dict_size < dict_size)
-					cur_dict_size++;
+		// Walk back from the end and record the chosen step at its start
+		for (i = n; i > 0; i = k) {
+			k = i - node->len[i];
+			node->cost[k] = ((DWORD)node->len[i] << 16) | node->dist[i];
+		}
 
-				// If the current end of the dictionary is past the end of the buffer,
-				// wrap around back to the start
-				if (dict_ptr >= dict_buf + dict_size)
-					dict_ptr = dict_buf;
+		for (i = 0; i < n; i += len) {
+			len = node->cost[i] >> 16;
+			if (len == 1) {
+				if (!put_literal(bw, type, src[start + i]))
+					return FALSE;
+			} else {
+				if (!put_copy(bw, dict, len, node->cost[i] & 0xffff))
+					return FALSE;
 			}
 		}
+	}
 
-		// First bit is 0; literal byte
-		else {
+	return TRUE;
+}
 
-			// Fixed size literal byte
-			if (type == IMPLODE_BINARY) {
+static VOID slide_stream(struct IMPLODE_STREAM *stream)
+{
+	UINT i;
+	UINT *head;
 
-				// Copy the byte and add it to the end of the dictionary
-				*dict_ptr++ = (BYTE)(bit_buf >> 1);
-				*wrt_ptr++ = (BYTE)(bit_buf >> 1);
+	DAssert(stream && stream->pos >= 2 * MAX_DICT_SIZE);
 
-				// Remove the byte from the bit buffer
-				bit_buf >>= 9;
-				bit_num -= 9;
-			}
+	// Move the input by the largest dictionary size, so the chain links indexed by
+	// position stay where they are, and forget the positions moved out
+	DMemMov(stream->data, stream->data + MAX_DICT_SIZE, stream->data_size - MAX_DICT_SIZE);
+	stream->data_size -= MAX_DICT_SIZE;
+	stream->pos -= MAX_DICT_SIZE;
 
-			// Variable size literal byte
-			else {
+	head = stream->work.mf.head;
+	for (i = 0; i < HASH_SIZE; i++)
+		head[i] = (head[i] > MAX_DICT_SIZE) ? head[i] - MAX_DICT_SIZE : 0;
+}
 
-				// Remove the first bit from the bit buffer
-				bit_buf >>= 1;
-				bit_num--;
+static BUFPTR copy_output(struct EXPLODE_STREAM *stream, BUFPTR wrt_ptr, BUFPTR dest_end_ptr, BUFCPTR dest)
+{
+	UINT len, dist, back;
+	BUFPTR copy_ptr, copy_end_ptr;
+	QWORD word;
 
-				// Find the actual byte from the bit sequence
-				for (i = 0; i <= 0xff; i++) {
-					if (TRUNCATE_VALUE(bit_buf, s_ChBits[i]) == s_ChCode[i])
-						break;
-				}
+	DAssert(stream && wrt_ptr && dest);
 
-				// Copy the byte and add it to the end of the dictionary
-				*dict_ptr++ = i;
-				*wrt_ptr++ = i;
+	dist = stream->copy_dist;
+	len = DMin(stream->copy_len, (UINT)(dest_end_ptr - wrt_ptr));
+	stream->copy_len -= len;
 
-				// Remove the byte from the bit buffer
-				bit_buf >>= s_ChBits[i];
-				bit_num -= s_ChBits[i];
-			}
+	// Bytes written out by previous calls are copied from the window
+	for (; len && (UINT)(wrt_ptr - dest) < dist; len--) {
+		back = dist - (UINT)(wrt_ptr - dest);
+		*wrt_ptr++ = stream->window[(stream->win_pos - back) & (MAX_DICT_SIZE - 1)];
+	}
 
-			// If the dictionary is not full yet, increment the current dictionary size
-			if (cur_dict_size < dict_size)
-				cur_dict_size++;
+	if (!len)
+		return wrt_ptr;
 
-			// If the current end of the dictionary is past the end of the buffer,
-			// wrap around back to the start
-			if (dict_ptr >= dict_buf + dict_size)
-				dict_ptr = dict_buf;
-		}
+	// The rest are in the output buffer, copied the same way as explode does
+	copy_ptr = wrt_ptr - dist;
+	copy_end_ptr = wrt_ptr + len;
+
+	if (dist >= sizeof(word) && len + sizeof(word) - 1 <= (UINT)(dest_end_ptr - wrt_ptr)) {
+		do {
+			DMemCpy(wrt_ptr, copy_ptr, sizeof(word));
+			wrt_ptr += sizeof(word);
+			copy_ptr += sizeof(word);
+		} while (wrt_ptr < copy_end_ptr);
+	}
+	else if (dist == 1) {
+		DMemSet(wrt_ptr, *copy_ptr, len);
+	}
+	else {
+		while (wrt_ptr < copy_end_ptr)
+			*wrt_ptr++ = *copy_ptr++;
 	}
 
-	// Store the decompressed size
-	*dest_size = wrt_ptr - (BUFPTR)dest;
+	return copy_end_ptr;
+}
 
-	return TRUE;
+static VOID update_window(struct EXPLODE_STREAM *stream, BUFCPTR dest, BUFCPTR wrt_ptr)
+{
+	UINT size, num, pos, part;
+
+	DAssert(stream);
+
+	size = wrt_ptr - dest;
+	if (!size)
+		return;
+
+	num = DMin(size, MAX_DICT_SIZE);
+
+	// The window is circular, its oldest bytes are overwritten first
+	pos = (stream->win_pos + size - num) & (MAX_DICT_SIZE - 1);
+	part = DMin(num, MAX_DICT_SIZE - pos);
+	DMemCpy(stream->window + pos, wrt_ptr - num, part);
+	DMemCpy(stream->window, wrt_ptr - num + part, num - part);
+
+	stream->win_pos = (stream->win_pos + size) & (MAX_DICT_SIZE - 1);
+	stream->win_num = DMin(stream->win_num + num, MAX_DICT_SIZE);
 }
 
 /************************************************************************/
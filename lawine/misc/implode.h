@@ -12,6 +12,7 @@
 /************************************************************************/
 
 #include <common.h>
+#include "codec.h"
 
 /************************************************************************/
 
@@ -22,11 +23,33 @@
 #define IMPLODE_DICT_2K		5			/* Dictionary size is 2KB */
 #define IMPLODE_DICT_4K		6			/* Dictionary size is 4KB */
 
+#define IMPLODE_LEVEL_FAST		0		/* Greedy parsing with short hash chains */
+#define IMPLODE_LEVEL_NORMAL	1		/* Lazy parsing, used by implode() */
+#define IMPLODE_LEVEL_BEST		2		/* Optimal parsing with long hash chains */
+
+#define IMPLODE_STREAM_ERROR	(-1)	/* The stream is broken and cannot continue */
+#define IMPLODE_STREAM_MORE		0		/* More input or output space is needed */
+#define IMPLODE_STREAM_END		1		/* The end of the stream has been reached */
+
+/************************************************************************/
+
+struct IMPLODE_STREAM;
+struct EXPLODE_STREAM;
+
 /************************************************************************/
 
 CAPI extern BOOL implode(INT type, INT dict, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL implode_level(INT type, INT dict, INT level, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL implode_ctx(struct CODEC_CONTEXT *ctx, INT type, INT dict, INT level, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
 CAPI extern BOOL explode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
 
+CAPI extern struct IMPLODE_STREAM *alloc_implode_stream(INT type, INT dict, INT level);
+CAPI extern VOID free_implode_stream(struct IMPLODE_STREAM *stream);
+CAPI extern INT implode_stream(struct IMPLODE_STREAM *stream, VCPTR src, UINT *src_size, VPTR dest, UINT *dest_size, BOOL finish);
+CAPI extern struct EXPLODE_STREAM *alloc_explode_stream(VOID);
+CAPI extern VOID free_explode_stream(struct EXPLODE_STREAM *stream);
+CAPI extern INT explode_stream(struct EXPLODE_STREAM *stream, VCPTR src, UINT *src_size, VPTR dest, UINT *dest_size);
+
 /************************************************************************/
 
 #endif	/* __SD_LAWINE_MISC_IMPLODE_H__ */
@@ -0,0 +1,835 @@
+﻿/************************************************************************/
+/* File Name   : codectest.c                                            */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Lawine library                                         */
+/* Descript    : Codec round trip, bit-exactness tests and benchmark    */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../misc/implode.h"
+#include "../misc/huffman.h"
+#include "../misc/adpcm.h"
+#include "../misc/deflate.h"
+#include "../misc/bzip2.h"
+#include "../misc/crc32.h"
+#include "refimplode.h"
+
+/*
+		编解码测试程序，需要与misc目录下的implode.c、huffman.c、adpcm.c、deflate.c、bzip2.c、crc32.c、codec.c，
+	本目录下的refimplode.c以及common.c一起编译。
+
+		用法：codectest [file...]
+
+		1. implode：新的压缩/解压与改为查表解压以前的实现（refimplode.c）双向互通，
+	流式接口的结果与一次性接口逐字节相同，输出缓冲不足时与旧实现得到相同的部分结果。
+		2. huffman：各编码类型的压缩结果与改进以前的实现逐字节相同（以CRC32对照），并能还原。
+		3. adpcm：压缩结果与改进以前的实现逐字节相同，批量解压与逐段解压的结果逐字节相同。
+		4. deflate：各种数据都能还原，使用编解码上下文时压缩结果逐字节相同，能解开参考实现zlib
+	生成的存储块、固定霍夫曼块和动态霍夫曼块，拒绝空的输入、截断的数据和不足的输出缓冲。
+		5. bzip2：同上，能解开参考实现bzip2生成的数据，并拒绝超过0x5000字节的块。
+		6. 基准测试：把给出的文件（没有给出时使用生成的数据）按4096字节分段，用旧实现压缩后，
+	分别测量旧实现与新实现的解压速度并核对解压结果。
+
+		测试数据都由固定种子的伪随机数生成，因此对照用的CRC32在各平台上都是一样的。
+*/
+
+/************************************************************************/
+
+#define SECTOR_SIZE			4096					/* 基准测试的分段大小 */
+#define BENCH_DATA_SIZE		(2 * 1024 * 1024)		/* 没有给出文件时基准测试的数据大小 */
+#define BENCH_MIN_TIME		(CLOCKS_PER_SEC / 2)	/* 每项基准测试的最短时间 */
+#define MAX_SAMPLE_SIZE		65536					/* 测试数据的最大大小 */
+#define ADPCM_SECTOR_NUM	11						/* 批量解压测试的段数，不是SIMD通道数的倍数 */
+#define WORDS_NUM			60						/* make_words生成的单词数 */
+#define BZIP2_BLOCK_MAX		0x5000					/* bzip2解压时每块的最大字节数 */
+
+/************************************************************************/
+
+/* 测试数据种类 */
+enum {
+	SAMPLE_BINARY,									/* 带有重复片段的二进制数据 */
+	SAMPLE_TEXT,									/* 文本 */
+	SAMPLE_WAVE,									/* 16位PCM波形 */
+	SAMPLE_NUM
+};
+
+/* 改进以前的实现的压缩结果 */
+struct GOLDEN {
+	INT sample;										/* 测试数据种类 */
+	UINT size;										/* 测试数据大小 */
+	INT type;										/* 编码类型 */
+	UINT dest_size;									/* 压缩结果的大小 */
+	DWORD crc;										/* 压缩结果的CRC32 */
+};
+
+/************************************************************************/
+
+static CONST CHAR *s_Words[] = {
+	"unit", "Zerg", "Protoss", "Terran", "the", "of", "and", "mineral", "gas", "supply",
+	"rules\\", "images\\", "sound\\", ".wav", ".grp", "<0>", "\r\n", "0123", "  ", "=",
+};
+
+static CONST INT s_ImplodeType[] = { IMPLODE_BINARY, IMPLODE_ASCII };
+static CONST INT s_ImplodeDict[] = { IMPLODE_DICT_1K, IMPLODE_DICT_2K, IMPLODE_DICT_4K };
+static CONST INT s_ImplodeLevel[] = { IMPLODE_LEVEL_FAST, IMPLODE_LEVEL_NORMAL, IMPLODE_LEVEL_BEST };
+static CONST UINT s_SampleSize[] = { 1, 2, 3, 255, 4096, 12345, MAX_SAMPLE_SIZE };
+
+/* 改进以前的huff_encode的压缩结果 */
+static CONST struct GOLDEN s_HuffGolden[] = {
+	{ SAMPLE_BINARY, 4096, 0, 4025, 0x0aed070cU },
+	{ SAMPLE_BINARY, 4096, 1, 4516, 0xe0a903baU },
+	{ SAMPLE_BINARY, 4096, 2, 4796, 0x20981446U },
+	{ SAMPLE_BINARY, 4096, 3, 4664, 0x9f318400U },
+	{ SAMPLE_BINARY, 4096, 4, 5232, 0x1e82f5abU },
+	{ SAMPLE_BINARY, 4096, 5, 5324, 0x7d4b2e0dU },
+	{ SAMPLE_BINARY, 4096, 6, 5046, 0x68bb02a6U },
+	{ SAMPLE_BINARY, 4096, 7, 5625, 0x159bc45aU },
+	{ SAMPLE_BINARY, 4096, 8, 5616, 0xa017a021U },
+	{ SAMPLE_BINARY, 12345, 0, 12131, 0x225c9d94U },
+	{ SAMPLE_BINARY, 12345, 1, 13395, 0x363b687fU },
+	{ SAMPLE_BINARY, 12345, 2, 14184, 0xee536bf1U },
+	{ SAMPLE_BINARY, 12345, 3, 13909, 0x436e05c1U },
+	{ SAMPLE_BINARY, 12345, 4, 15127, 0x1d9d005eU },
+	{ SAMPLE_BINARY, 12345, 5, 15576, 0x44474433U },
+	{ SAMPLE_BINARY, 12345, 6, 15776, 0x362c3942U },
+	{ SAMPLE_BINARY, 12345, 7, 16276, 0x784bff2fU },
+	{ SAMPLE_BINARY, 12345, 8, 16784, 0x23679458U },
+	{ SAMPLE_TEXT, 4096, 0, 2493, 0xcc284554U },
+	{ SAMPLE_TEXT, 4096, 1, 3914, 0x488df40aU },
+	{ SAMPLE_TEXT, 4096, 2, 2989, 0xff48bd94U },
+	{ SAMPLE_TEXT, 4096, 3, 4059, 0xefe739f3U },
+	{ SAMPLE_TEXT, 4096, 4, 4632, 0xd0ed9880U },
+	{ SAMPLE_TEXT, 4096, 5, 5417, 0x838f9695U },
+	{ SAMPLE_TEXT, 4096, 6, 5208, 0x70f3802fU },
+	{ SAMPLE_TEXT, 4096, 7, 5608, 0xb97d1f98U },
+	{ SAMPLE_TEXT, 4096, 8, 5828, 0x3b3a99a3U },
+	{ SAMPLE_TEXT, 12345, 0, 7420, 0xdf0ad455U },
+	{ SAMPLE_TEXT, 12345, 1, 11828, 0x2c12b4a1U },
+	{ SAMPLE_TEXT, 12345, 2, 8990, 0x8883c34bU },
+	{ SAMPLE_TEXT, 12345, 3, 12264, 0x8ee0b63eU },
+	{ SAMPLE_TEXT, 12345, 4, 13898, 0xcd33c96aU },
+	{ SAMPLE_TEXT, 12345, 5, 16285, 0x4375bf79U },
+	{ SAMPLE_TEXT, 12345, 6, 15772, 0x116e59ceU },
+	{ SAMPLE_TEXT, 12345, 7, 16854, 0xc1854999U },
+	{ SAMPLE_TEXT, 12345, 8, 17460, 0x2b0c8086U },
+	{ SAMPLE_WAVE, 4096, 0, 4330, 0xa5088817U },
+	{ SAMPLE_WAVE, 4096, 1, 4436, 0xdd4f979dU },
+	{ SAMPLE_WAVE, 4096, 2, 4872, 0x6fa99d9cU },
+	{ SAMPLE_WAVE, 4096, 3, 4625, 0x10cf0693U },
+	{ SAMPLE_WAVE, 4096, 4, 5166, 0x11de2f5cU },
+	{ SAMPLE_WAVE, 4096, 5, 5176, 0xe3858d32U },
+	{ SAMPLE_WAVE, 4096, 6, 5419, 0x95291625U },
+	{ SAMPLE_WAVE, 4096, 7, 5448, 0x8f34124eU },
+	{ SAMPLE_WAVE, 4096, 8, 5607, 0x00417ff4U },
+	{ SAMPLE_WAVE, 12345, 0, 12530, 0x49c2aa6bU },
+	{ SAMPLE_WAVE, 12345, 1, 13377, 0x93b96537U },
+	{ SAMPLE_WAVE, 12345, 2, 14343, 0xce09f906U },
+	{ SAMPLE_WAVE, 12345, 3, 13912, 0x6327c91dU },
+	{ SAMPLE_WAVE, 12345, 4, 15050, 0x103d4b4eU },
+	{ SAMPLE_WAVE, 12345, 5, 15201, 0x7650f430U },
+	{ SAMPLE_WAVE, 12345, 6, 15791, 0x625e0653U },
+	{ SAMPLE_WAVE, 12345, 7, 15931, 0x77f87813U },
+	{ SAMPLE_WAVE, 12345, 8, 16428, 0x86122373U },
+};
+
+/* 改进以前的adpcm_encode的压缩结果，编码类型为声道数 */
+static CONST struct GOLDEN s_AdpcmGolden[] = {
+	{ SAMPLE_WAVE, 4096, 1, 2090, 0x672b75d5U },
+	{ SAMPLE_WAVE, 2000, 1, 1023, 0xdd1d34c5U },
+	{ SAMPLE_WAVE, 12, 1, 9, 0x05714624U },
+	{ SAMPLE_WAVE, 4096, 2, 2060, 0x869cf8c2U },
+	{ SAMPLE_WAVE, 2000, 2, 1012, 0xea0743c9U },
+	{ SAMPLE_WAVE, 12, 2, 10, 0x6d0a365aU },
+};
+
+static CONST CHAR s_FoxText[] = "The quick brown fox jumps over the lazy dog. The quick brown fox jumps over the lazy dog.";
+
+/* 参考实现zlib 1.2.13以级别0压缩s_FoxText的结果：存储块 */
+static CONST BYTE s_ZlibStored[] = {
+	0x78, 0x01, 0x01, 0x59, 0x00, 0xa6, 0xff, 0x54, 0x68, 0x65, 0x20, 0x71,
+	0x75, 0x69, 0x63, 0x6b, 0x20, 0x62, 0x72, 0x6f, 0x77, 0x6e, 0x20, 0x66,
+	0x6f, 0x78, 0x20, 0x6a, 0x75, 0x6d, 0x70, 0x73, 0x20, 0x6f, 0x76, 0x65,
+	0x72, 0x20, 0x74, 0x68, 0x65, 0x20, 0x6c, 0x61, 0x7a, 0x79, 0x20, 0x64,
+	0x6f, 0x67, 0x2e, 0x20, 0x54, 0x68, 0x65, 0x20, 0x71, 0x75, 0x69, 0x63,
+	0x6b, 0x20, 0x62, 0x72, 0x6f, 0x77, 0x6e, 0x20, 0x66, 0x6f, 0x78, 0x20,
+	0x6a, 0x75, 0x6d, 0x70, 0x73, 0x20, 0x6f, 0x76, 0x65, 0x72, 0x20, 0x74,
+	0x68, 0x65, 0x20, 0x6c, 0x61, 0x7a, 0x79, 0x20, 0x64, 0x6f, 0x67, 0x2e,
+	0xae, 0xd1, 0x20, 0x2f,
+};
+
+/* 同上，级别1：固定霍夫曼块 */
+static CONST BYTE s_ZlibFixed[] = {
+	0x78, 0x01, 0x0b, 0xc9, 0x48, 0x55, 0x28, 0x2c, 0xcd, 0x4c, 0xce, 0x56,
+	0x48, 0x2a, 0xca, 0x2f, 0xcf, 0x53, 0x48, 0xcb, 0xaf, 0x50, 0xc8, 0x2a,
+	0xcd, 0x2d, 0x28, 0x56, 0xc8, 0x2f, 0x4b, 0x2d, 0x52, 0x28, 0x01, 0x4a,
+	0xe7, 0x24, 0x56, 0x55, 0x2a, 0xa4, 0xe4, 0xa7, 0xeb, 0x29, 0x84, 0x90,
+	0xa0, 0x18, 0x00, 0xae, 0xd1, 0x20, 0x2f,
+};
+
+/* 同上，级别9压缩make_words生成的文本：动态霍夫曼块 */
+static CONST BYTE s_ZlibDynamic[] = {
+	0x78, 0xda, 0xad, 0xd0, 0xbb, 0x0d, 0x80, 0x30, 0x0c, 0x45, 0xd1, 0x55,
+	0x98, 0x80, 0x59, 0x28, 0xa8, 0x10, 0x8d, 0x25, 0x4c, 0x88, 0x94, 0x38,
+	0x91, 0x1d, 0x83, 0xd8, 0x1e, 0x51, 0x40, 0x3e, 0xb4, 0x54, 0x3e, 0xb7,
+	0x7c, 0x56, 0xb2, 0xa9, 0xf3, 0x96, 0x90, 0xc1, 0x75, 0xbd, 0xe1, 0x58,
+	0x07, 0xd0, 0x52, 0xe0, 0x80, 0x3d, 0x23, 0xac, 0xef, 0x95, 0xa0, 0xb4,
+	0xcc, 0x85, 0xd2, 0x86, 0x25, 0xad, 0x07, 0x83, 0x52, 0x7b, 0x44, 0x66,
+	0xa0, 0x36, 0x59, 0xdd, 0xb7, 0x06, 0x0e, 0x29, 0x88, 0xb4, 0x29, 0x1a,
+	0xa3, 0x3b, 0xdb, 0x9c, 0x90, 0x4d, 0x65, 0x03, 0x92, 0xa1, 0xf7, 0xdc,
+	0x17, 0xcf, 0x54, 0xfd, 0xef, 0x09, 0x17, 0x60, 0x6c, 0x78, 0x8a,
+};
+/* 参考实现bzip2 1.0.8以-1压缩s_FoxText的结果 */
+static CONST BYTE s_Bzip2Text[] = {
+	0x42, 0x5a, 0x68, 0x31, 0x31, 0x41, 0x59, 0x26, 0x53, 0x59, 0xd9, 0x3c,
+	0xf9, 0x43, 0x00, 0x00, 0x09, 0x93, 0x80, 0x40, 0x01, 0x04, 0x00, 0x3f,
+	0xff, 0xff, 0xf0, 0x20, 0x00, 0x54, 0x25, 0x53, 0x4f, 0x42, 0x34, 0x62,
+	0x34, 0x68, 0x1b, 0x48, 0x15, 0x54, 0xf5, 0x04, 0xc9, 0x84, 0x66, 0x91,
+	0xb5, 0x36, 0x89, 0x1a, 0x3a, 0x6c, 0xe9, 0x92, 0x68, 0x4d, 0xed, 0x87,
+	0x9d, 0xd0, 0x92, 0x12, 0x28, 0xad, 0xc3, 0x96, 0xaa, 0x2d, 0x7c, 0x43,
+	0x11, 0x4e, 0xc4, 0x26, 0x78, 0x7c, 0x21, 0x43, 0xd2, 0xc2, 0x0a, 0x29,
+	0xb1, 0x85, 0xcb, 0x9f, 0x8b, 0xb9, 0x22, 0x9c, 0x28, 0x48, 0x6c, 0x9e,
+	0x7c, 0xa1, 0x80,
+};
+
+/* 同上，压缩0x5000字节的"abab..."，块大小恰好是解压的上限 */
+static CONST BYTE s_Bzip2Limit[] = {
+	0x42, 0x5a, 0x68, 0x31, 0x31, 0x41, 0x59, 0x26, 0x53, 0x59, 0x69, 0xc4,
+	0x7b, 0xb9, 0x00, 0x13, 0xff, 0x81, 0x00, 0x30, 0x00, 0x20, 0x00, 0x30,
+	0x80, 0x2a, 0x69, 0x00, 0x0c, 0x80, 0x06, 0x71, 0x77, 0x24, 0x53, 0x85,
+	0x09, 0x06, 0x9c, 0x47, 0xbb, 0x90,
+};
+
+/* 同上，压缩0x6000字节的"abab..."，块超过解压的上限 */
+static CONST BYTE s_Bzip2Large[] = {
+	0x42, 0x5a, 0x68, 0x31, 0x31, 0x41, 0x59, 0x26, 0x53, 0x59, 0x8e, 0xb0,
+	0x04, 0x43, 0x00, 0x17, 0xff, 0x81, 0x00, 0x30, 0x00, 0x20, 0x00, 0x30,
+	0x80, 0x2a, 0x69, 0x00, 0x06, 0x80, 0x03, 0x71, 0x77, 0x24, 0x53, 0x85,
+	0x09, 0x08, 0xeb, 0x00, 0x44, 0x30,
+};
+
+static DWORD s_Seed;
+static INT s_FailNum;
+
+/************************************************************************/
+
+static UINT next_rand(VOID);
+static VOID make_sample(INT sample, UINT seed, BUFPTR buf, UINT size);
+static UINT make_words(BUFPTR buf);
+static VOID make_pattern(BUFPTR buf, UINT size);
+static VOID check(BOOL cond, CONST CHAR *what, INT a, INT b, INT c, UINT size);
+static VOID check_known(BOOL (*decode)(VCPTR, UINT, VPTR, UINT *), CONST CHAR *what, CONST BYTE *packed, UINT packed_size, BUFCPTR text, UINT size);
+static VOID test_implode(VOID);
+static VOID test_huffman(VOID);
+static VOID test_adpcm(VOID);
+static VOID test_deflate(VOID);
+static VOID test_bzip2(VOID);
+static VOID bench_explode(INT argc, CHAR *argv[]);
+static BUFPTR load_bench_data(INT argc, CHAR *argv[], UINT *size);
+static DOUBLE time_explode(BOOL ref, BUFCPTR packed, CONST UINT *packed_size, UINT num, BUFPTR dest);
+
+/************************************************************************/
+
+INT main(INT argc, CHAR *argv[])
+{
+	test_implode();
+	test_huffman();
+	test_adpcm();
+	test_deflate();
+	test_bzip2();
+
+	if (s_FailNum) {
+		printf("FAIL: %d\n", s_FailNum);
+		return 1;
+	}
+
+	printf("PASS\n");
+
+	bench_explode(argc, argv);
+
+	return 0;
+}
+
+/************************************************************************/
+
+static UINT next_rand(VOID)
+{
+	s_Seed = s_Seed * 1103515245U + 12345U;
+	return (s_Seed >> 16) & 0x7fff;
+}
+
+static VOID make_sample(INT sample, UINT seed, BUFPTR buf, UINT size)
+{
+	UINT i, n, len, dist;
+	INT value, step;
+	CONST CHAR *word;
+
+	s_Seed = seed;
+
+	switch (sample) {
+	case SAMPLE_BINARY:
+		/* 随机字节、连续相同的字节以及前面出现过的片段交替出现 */
+		for (i = 0; i < size; i += len) {
+			len = DMin(next_rand() % 40 + 1, size - i);
+			switch (next_rand() % 3) {
+			case 0:
+				for (n = 0; n < len; n++)
+					buf[i + n] = (BYTE)next_rand();
+				break;
+			case 1:
+				DMemSet(buf + i, (BYTE)next_rand(), len);
+				break;
+			default:
+				dist = i ? next_rand() % DMin(i, 4096U) + 1 : 0;
+				for (n = 0; n < len; n++)
+					buf[i + n] = dist ? buf[i + n - dist] : (BYTE)n;
+				break;
+			}
+		}
+		break;
+	case SAMPLE_TEXT:
+		for (i = 0; i < size; i += len) {
+			word = s_Words[next_rand() % DCount(s_Words)];
+			len = DMin((UINT)strlen(word), size - i);
+			DMemCpy(buf + i, word, len);
+		}
+		break;
+	default:
+		/* 带噪声的三角波，样本为小端序 */
+		value = 0;
+		step = 300;
+		for (i = 0; i + 1 < size; i += 2) {
+			value += step;
+			if (value > 20000 || value < -20000)
+				step = -step;
+			n = (UINT)(value + (INT)(next_rand() % 512) - 256);
+			buf[i] = (BYTE)n;
+			buf[i + 1] = (BYTE)(n >> 8);
+		}
+		if (i < size)
+			buf[i] = 0;
+		break;
+	}
+}
+
+static UINT make_words(BUFPTR buf)
+{
+	UINT i, len, size;
+
+	/* 以空格分隔的前15个单词，与生成s_ZlibDynamic时的文本相同 */
+	for (i = 0, size = 0; i < WORDS_NUM; i++) {
+		if (i)
+			buf[size++] = ' ';
+		len = (UINT)strlen(s_Words[(i * 7 + i / 3) % 15]);
+		DMemCpy(buf + size, s_Words[(i * 7 + i / 3) % 15], len);
+		size += len;
+	}
+
+	return size;
+}
+
+static VOID make_pattern(BUFPTR buf, UINT size)
+{
+	UINT i;
+
+	/* 没有连续4个相同的字节，bzip2的第一次游程编码不会缩小块 */
+	for (i = 0; i < size; i++)
+		buf[i] = (i & 1) ? 'b' : 'a';
+}
+
+static VOID check(BOOL cond, CONST CHAR *what, INT a, INT b, INT c, UINT size)
+{
+	if (cond)
+		return;
+
+	printf("%s failed (%d, %d, %d, size %u)\n", what, a, b, c, size);
+	s_FailNum++;
+}
+
+static VOID check_known(BOOL (*decode)(VCPTR, UINT, VPTR, UINT *), CONST CHAR *what, CONST BYTE *packed, UINT packed_size, BUFCPTR text, UINT size)
+{
+	UINT unpacked_size;
+	BUFPTR unpacked;
+	BOOL ret;
+
+	unpacked = (BUFPTR)malloc(MAX_SAMPLE_SIZE);
+
+	unpacked_size = MAX_SAMPLE_SIZE;
+	ret = decode(packed, packed_size, unpacked, &unpacked_size);
+	check(ret && unpacked_size == size && !DMemCmp(unpacked, text, size), what, 0, 0, 0, size);
+
+	free(unpacked);
+}
+
+/************************************************************************/
+
+static VOID test_implode(VOID)
+{
+	INT s, t, d, l;
+	UINT i, k, n, size, packed_size, ref_size, unpacked_size, out_size, src_used, dest_used;
+	BUFPTR src, packed, ref_packed, unpacked, ref_unpacked;
+	BOOL ret, ref_ret;
+	INT state;
+	struct IMPLODE_STREAM *is;
+	struct EXPLODE_STREAM *es;
+
+	src = (BUFPTR)malloc(MAX_SAMPLE_SIZE);
+	packed = (BUFPTR)malloc(MAX_SAMPLE_SIZE * 2 + 64);
+	ref_packed = (BUFPTR)malloc(MAX_SAMPLE_SIZE * 2 + 64);
+	unpacked = (BUFPTR)malloc(MAX_SAMPLE_SIZE);
+	ref_unpacked = (BUFPTR)malloc(MAX_SAMPLE_SIZE);
+
+	for (s = SAMPLE_BINARY; s <= SAMPLE_TEXT; s++) {
+	for (k = 0; k < DCount(s_SampleSize); k++) {
+
+		size = s_SampleSize[k];
+		make_sample(s, k + 1, src, size);
+
+		for (t = 0; t < (INT)DCount(s_ImplodeType); t++) {
+		for (d = 0; d < (INT)DCount(s_ImplodeDict); d++) {
+
+			/* 旧实现压缩的数据，新旧实现的解压结果都要与原数据相同 */
+			ref_size = MAX_SAMPLE_SIZE * 2 + 64;
+			ret = ref_implode(s_ImplodeType[t], s_ImplodeDict[d], src, size, ref_packed, &ref_size);
+			check(ret, "ref_implode", s, t, d, size);
+
+			unpacked_size = size;
+			ret = explode(ref_packed, ref_size, unpacked, &unpacked_size);
+			check(ret && unpacked_size == size && !DMemCmp(unpacked, src, size), "old implode -> new explode", s, t, d, size);
+
+			/* 截断的输入，旧实现每次都要先读入16位，所以新实现解压出的部分可能会多几个字节，
+			   输出缓冲已满时即使没有读到结束码也会成功 */
+			for (n = 1; n <= 3; n++) {
+				unpacked_size = size;
+				ret = explode(ref_packed, ref_size * n / 4, unpacked, &unpacked_size);
+				out_size = size;
+				ref_ret = ref_explode(ref_packed, ref_size * n / 4, ref_unpacked, &out_size);
+				check((ret || !ref_ret) && (!ret || unpacked_size == size) && unpacked_size >= out_size
+					&& !DMemCmp(unpacked, src, unpacked_size) && !DMemCmp(ref_unpacked, src, out_size),
+					"truncated explode", s, t, d, ref_size * n / 4);
+
+				/* 不足的输出缓冲，新实现要与旧实现得到相同的部分结果 */
+				unpacked_size = size * n / 4;
+				ret = explode(ref_packed, ref_size, unpacked, &unpacked_size);
+				out_size = size * n / 4;
+				ref_ret = ref_explode(ref_packed, ref_size, ref_unpacked, &out_size);
+				check(!ret == !ref_ret && unpacked_size == out_size && !DMemCmp(unpacked, ref_unpacked, out_size),
+					"short explode", s, t, d, size * n / 4);
+			}
+
+			for (l = 0; l < (INT)DCount(s_ImplodeLevel); l++) {
+
+				/* 新实现压缩的数据，新旧实现的解压结果都要与原数据相同 */
+				packed_size = MAX_SAMPLE_SIZE * 2 + 64;
+				ret = implode_level(s_ImplodeType[t], s_ImplodeDict[d], s_ImplodeLevel[l], src, size, packed, &packed_size);
+				check(ret, "implode_level", t, d, l, size);
+
+				unpacked_size = size;
+				ret = explode(packed, packed_size, unpacked, &unpacked_size);
+				check(ret && unpacked_size == size && !DMemCmp(unpacked, src, size), "new implode -> new explode", t, d, l, size);
+
+				unpacked_size = size;
+				ret = ref_explode(packed, packed_size, unpacked, &unpacked_size);
+				check(ret && unpacked_size == size && !DMemCmp(unpacked, src, size), "new implode -> old explode", t, d, l, size);
+
+				/* 每次只给出少量输入及输出空间，流式压缩的结果要与一次性压缩的结果相同 */
+				is = alloc_implode_stream(s_ImplodeType[t], s_ImplodeDict[d], s_ImplodeLevel[l]);
+				check(is != NULL, "alloc_implode_stream", t, d, l, size);
+				if (!is)
+					continue;
+				for (i = 0, out_size = 0, state = IMPLODE_STREAM_MORE; state == IMPLODE_STREAM_MORE; ) {
+					src_used = DMin(size - i, 1000U);
+					dest_used = DMin(MAX_SAMPLE_SIZE * 2 + 64 - out_size, 777U);
+					state = implode_stream(is, src + i, &src_used, ref_packed + out_size, &dest_used, i + src_used >= size);
+					i += src_used;
+					out_size += dest_used;
+				}
+				free_implode_stream(is);
+				check(state == IMPLODE_STREAM_END && out_size == packed_size && !DMemCmp(ref_packed, packed, packed_size),
+					"implode_stream", t, d, l, size);
+			}
+
+			/* 每次只给出少量输入及输出空间，流式解压的结果要与原数据相同 */
+			es = alloc_explode_stream();
+			check(es != NULL, "alloc_explode_stream", s, t, d, size);
+			if (!es)
+				continue;
+			for (i = 0, out_size = 0, state = IMPLODE_STREAM_MORE; state == IMPLODE_STREAM_MORE; ) {
+				src_used = DMin(packed_size - i, 333U);
+				dest_used = DMin(size - out_size, 555U);
+				state = explode_stream(es, packed + i, &src_used, unpacked + out_size, &dest_used);
+				if (!src_used && !dest_used)
+					break;
+				i += src_used;
+				out_size += dest_used;
+			}
+			free_explode_stream(es);
+			check(state == IMPLODE_STREAM_END && out_size == size && !DMemCmp(unpacked, src, size), "explode_stream", s, t, d, size);
+		}
+		}
+	}
+	}
+
+	free(src);
+	free(packed);
+	free(ref_packed);
+	free(unpacked);
+	free(ref_unpacked);
+}
+
+static VOID test_huffman(VOID)
+{
+	UINT i, size, packed_size, unpacked_size;
+	BUFPTR src, packed, unpacked;
+	CONST struct GOLDEN *g;
+	BOOL ret;
+
+	src = (BUFPTR)malloc(MAX_SAMPLE_SIZE);
+	packed = (BUFPTR)malloc(MAX_SAMPLE_SIZE * 2 + 64);
+	unpacked = (BUFPTR)malloc(MAX_SAMPLE_SIZE);
+
+	for (i = 0; i < DCount(s_HuffGolden); i++) {
+
+		g = &s_HuffGolden[i];
+		size = g->size;
+		make_sample(g->sample, i + 1, src, size);
+
+		packed_size = MAX_SAMPLE_SIZE * 2 + 64;
+		ret = huff_encode(g->type, src, size, packed, &packed_size);
+		check(ret && packed_size == g->dest_size && crc32_checksum(packed, packed_size) == g->crc,
+			"huff_encode", g->sample, g->type, 0, size);
+
+		unpacked_size = size;
+		ret = huff_decode(packed, packed_size, unpacked, &unpacked_size);
+		check(ret && unpacked_size == size && !DMemCmp(unpacked, src, size), "huff_decode", g->sample, g->type, 0, size);
+	}
+
+	free(src);
+	free(packed);
+	free(unpacked);
+}
+
+static VOID test_adpcm(VOID)
+{
+	UINT i, j, size, out_size;
+	BUFPTR src, packed, unpacked, batch;
+	CONST struct GOLDEN *g;
+	VCPTR src_ptr[ADPCM_SECTOR_NUM];
+	VPTR dest_ptr[ADPCM_SECTOR_NUM];
+	UINT src_size[ADPCM_SECTOR_NUM], dest_size[ADPCM_SECTOR_NUM];
+	BOOL ret;
+	INT ch;
+
+	src = (BUFPTR)malloc(SECTOR_SIZE * ADPCM_SECTOR_NUM);
+	packed = (BUFPTR)malloc(SECTOR_SIZE * ADPCM_SECTOR_NUM);
+	unpacked = (BUFPTR)malloc(SECTOR_SIZE * ADPCM_SECTOR_NUM);
+	batch = (BUFPTR)malloc(SECTOR_SIZE * ADPCM_SECTOR_NUM);
+
+	for (i = 0; i < DCount(s_AdpcmGolden); i++) {
+
+		g = &s_AdpcmGolden[i];
+		size = g->size;
+		make_sample(g->sample, i + 1, src, size);
+
+		out_size = SECTOR_SIZE;
+		ret = adpcm_encode(4, g->type, src, size, packed, &out_size);
+		check(ret && out_size == g->dest_size && crc32_checksum(packed, out_size) == g->crc,
+			"adpcm_encode", g->sample, g->type, 0, size);
+	}
+
+	/* 各段的大小互不相同，最后一段不是完整的扇区 */
+	for (ch = ADPCM_MONO; ch <= ADPCM_STEREO; ch++) {
+
+		make_sample(SAMPLE_WAVE, ch, src, SECTOR_SIZE * ADPCM_SECTOR_NUM);
+
+		for (i = 0; i < ADPCM_SECTOR_NUM; i++) {
+			size = (i == ADPCM_SECTOR_NUM - 1) ? SECTOR_SIZE / 3 & ~3U : SECTOR_SIZE;
+			src_size[i] = SECTOR_SIZE;
+			ret = adpcm_encode(3 + i % 4, ch, src + i * SECTOR_SIZE, size, packed + i * SECTOR_SIZE, &src_size[i]);
+			check(ret, "adpcm_encode", ch, i, 0, size);
+			src_ptr[i] = packed + i * SECTOR_SIZE;
+			dest_ptr[i] = batch + i * SECTOR_SIZE;
+			dest_size[i] = SECTOR_SIZE;
+		}
+
+		ret = adpcm_decode_batch(ch, ADPCM_SECTOR_NUM, src_ptr, src_size, dest_ptr, dest_size);
+		check(ret, "adpcm_decode_batch", ch, 0, 0, ADPCM_SECTOR_NUM);
+
+		for (i = 0; i < ADPCM_SECTOR_NUM; i++) {
+			out_size = SECTOR_SIZE;
+			ret = adpcm_decode(ch, packed + i * SECTOR_SIZE, src_size[i], unpacked + i * SECTOR_SIZE, &out_size);
+			j = i * SECTOR_SIZE;
+			check(ret && out_size == dest_size[i] && !DMemCmp(unpacked + j, batch + j, out_size), "adpcm batch decode", ch, i, 0, out_size);
+		}
+	}
+
+	free(src);
+	free(packed);
+	free(unpacked);
+	free(batch);
+}
+
+static VOID test_deflate(VOID)
+{
+	INT s;
+	UINT k, size, packed_size, ctx_size, unpacked_size;
+	BUFPTR src, packed, ctx_packed, unpacked;
+	struct CODEC_CONTEXT *ctx;
+	BOOL ret;
+
+	src = (BUFPTR)malloc(MAX_SAMPLE_SIZE);
+	packed = (BUFPTR)malloc(MAX_SAMPLE_SIZE * 2 + 64);
+	ctx_packed = (BUFPTR)malloc(MAX_SAMPLE_SIZE * 2 + 64);
+	unpacked = (BUFPTR)malloc(MAX_SAMPLE_SIZE);
+	ctx = alloc_codec_context();
+	check(ctx != NULL, "alloc_codec_context", 0, 0, 0, 0);
+
+	for (s = SAMPLE_BINARY; s < SAMPLE_NUM; s++) {
+	for (k = 0; k < DCount(s_SampleSize); k++) {
+
+		size = s_SampleSize[k];
+		make_sample(s, k + 1, src, size);
+
+		packed_size = MAX_SAMPLE_SIZE * 2 + 64;
+		ret = zlib_encode(src, size, packed, &packed_size);
+		check(ret, "zlib_encode", s, 0, 0, size);
+
+		/* 上下文只是保存工作状态的地方，不影响压缩结果 */
+		if (ctx) {
+			ctx_size = MAX_SAMPLE_SIZE * 2 + 64;
+			ret = zlib_encode_ctx(ctx, src, size, ctx_packed, &ctx_size);
+			check(ret && ctx_size == packed_size && !DMemCmp(ctx_packed, packed, packed_size), "zlib_encode_ctx", s, 0, 0, size);
+		}
+
+		unpacked_size = size;
+		ret = zlib_decode(packed, packed_size, unpacked, &unpacked_size);
+		check(ret && unpacked_size == size && !DMemCmp(unpacked, src, size), "zlib_decode", s, 0, 0, size);
+
+		/* 截断的数据和不足的输出缓冲都要失败 */
+		unpacked_size = size;
+		ret = zlib_decode(packed, packed_size - 1, unpacked, &unpacked_size);
+		check(!ret, "truncated zlib_decode", s, 0, 0, packed_size - 1);
+
+		unpacked_size = size - 1;
+		ret = zlib_decode(packed, packed_size, unpacked, &unpacked_size);
+		check(!ret, "short zlib_decode", s, 0, 0, size - 1);
+	}
+	}
+
+	/* 参考实现生成的三种块 */
+	check_known(zlib_decode, "zlib_decode stored", s_ZlibStored, sizeof(s_ZlibStored), (BUFCPTR)s_FoxText, sizeof(s_FoxText) - 1);
+	check_known(zlib_decode, "zlib_decode fixed", s_ZlibFixed, sizeof(s_ZlibFixed), (BUFCPTR)s_FoxText, sizeof(s_FoxText) - 1);
+	size = make_words(src);
+	check_known(zlib_decode, "zlib_decode dynamic", s_ZlibDynamic, sizeof(s_ZlibDynamic), src, size);
+
+	/* 空的输入 */
+	packed_size = MAX_SAMPLE_SIZE * 2 + 64;
+	check(!zlib_encode(src, 0, packed, &packed_size), "empty zlib_encode", 0, 0, 0, 0);
+	unpacked_size = MAX_SAMPLE_SIZE;
+	check(!zlib_decode(s_ZlibFixed, 0, unpacked, &unpacked_size), "empty zlib_decode", 0, 0, 0, 0);
+
+	free_codec_context(ctx);
+	free(src);
+	free(packed);
+	free(ctx_packed);
+	free(unpacked);
+}
+
+static VOID test_bzip2(VOID)
+{
+	INT s;
+	UINT k, size, packed_size, ctx_size, unpacked_size;
+	BUFPTR src, packed, ctx_packed, unpacked;
+	struct CODEC_CONTEXT *ctx;
+	BOOL ret;
+
+	src = (BUFPTR)malloc(MAX_SAMPLE_SIZE);
+	packed = (BUFPTR)malloc(MAX_SAMPLE_SIZE * 2 + 64);
+	ctx_packed = (BUFPTR)malloc(MAX_SAMPLE_SIZE * 2 + 64);
+	unpacked = (BUFPTR)malloc(MAX_SAMPLE_SIZE);
+	ctx = alloc_codec_context();
+	check(ctx != NULL, "alloc_codec_context", 0, 0, 0, 0);
+
+	for (s = SAMPLE_BINARY; s < SAMPLE_NUM; s++) {
+	for (k = 0; k < DCount(s_SampleSize); k++) {
+
+		size = s_SampleSize[k];
+		make_sample(s, k + 1, src, size);
+
+		packed_size = MAX_SAMPLE_SIZE * 2 + 64;
+		ret = bz2_encode(src, size, packed, &packed_size);
+		check(ret, "bz2_encode", s, 0, 0, size);
+
+		if (ctx) {
+			ctx_size = MAX_SAMPLE_SIZE * 2 + 64;
+			ret = bz2_encode_ctx(ctx, src, size, ctx_packed, &ctx_size);
+			check(ret && ctx_size == packed_size && !DMemCmp(ctx_packed, packed, packed_size), "bz2_encode_ctx", s, 0, 0, size);
+
+			unpacked_size = size;
+			ret = bz2_decode_ctx(ctx, packed, packed_size, unpacked, &unpacked_size);
+			check(ret && unpacked_size == size && !DMemCmp(unpacked, src, size), "bz2_decode_ctx", s, 0, 0, size);
+		}
+
+		unpacked_size = size;
+		ret = bz2_decode(packed, packed_size, unpacked, &unpacked_size);
+		check(ret && unpacked_size == size && !DMemCmp(unpacked, src, size), "bz2_decode", s, 0, 0, size);
+
+		unpacked_size = size;
+		ret = bz2_decode(packed, packed_size - 1, unpacked, &unpacked_size);
+		check(!ret, "truncated bz2_decode", s, 0, 0, packed_size - 1);
+
+		unpacked_size = size - 1;
+		ret = bz2_decode(packed, packed_size, unpacked, &unpacked_size);
+		check(!ret, "short bz2_decode", s, 0, 0, size - 1);
+	}
+	}
+
+	check_known(bz2_decode, "bz2_decode text", s_Bzip2Text, sizeof(s_Bzip2Text), (BUFCPTR)s_FoxText, sizeof(s_FoxText) - 1);
+
+	/* 解压的状态都在栈上，块的大小有上限，恰好达到上限的块仍能解开 */
+	make_pattern(src, BZIP2_BLOCK_MAX + 0x1000);
+	check_known(bz2_decode, "bz2_decode limit", s_Bzip2Limit, sizeof(s_Bzip2Limit), src, BZIP2_BLOCK_MAX);
+
+	unpacked_size = MAX_SAMPLE_SIZE;
+	ret = bz2_decode(s_Bzip2Large, sizeof(s_Bzip2Large), unpacked, &unpacked_size);
+	check(!ret, "bz2_decode large block", 0, 0, 0, BZIP2_BLOCK_MAX + 0x1000);
+
+	packed_size = MAX_SAMPLE_SIZE * 2 + 64;
+	check(!bz2_encode(src, 0, packed, &packed_size), "empty bz2_encode", 0, 0, 0, 0);
+	unpacked_size = MAX_SAMPLE_SIZE;
+	check(!bz2_decode(s_Bzip2Text, 0, unpacked, &unpacked_size), "empty bz2_decode", 0, 0, 0, 0);
+
+	free_codec_context(ctx);
+	free(src);
+	free(packed);
+	free(ctx_packed);
+	free(unpacked);
+}
+
+/************************************************************************/
+
+static VOID bench_explode(INT argc, CHAR *argv[])
+{
+	INT t;
+	UINT i, num, size, sector_size, packed_total;
+	BUFPTR data, packed, dest, ref_dest;
+	UINT *packed_size;
+	DOUBLE ref_time, new_time, mb;
+
+	data = load_bench_data(argc, argv, &size);
+	if (!data)
+		return;
+
+	num = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	packed = (BUFPTR)malloc(num * SECTOR_SIZE * 2);
+	packed_size = (UINT *)malloc(num * sizeof(UINT));
+	dest = (BUFPTR)malloc(num * SECTOR_SIZE);
+	ref_dest = (BUFPTR)malloc(num * SECTOR_SIZE);
+
+	mb = size / (1024.0 * 1024.0);
+
+	for (t = 0; t < (INT)DCount(s_ImplodeType); t++) {
+
+		/* 与经典的存档相同，用旧实现以4KB字典压缩各扇区 */
+		for (i = 0, packed_total = 0; i < num; i++) {
+			sector_size = DMin(size - i * SECTOR_SIZE, (UINT)SECTOR_SIZE);
+			packed_size[i] = SECTOR_SIZE * 2;
+			if (!ref_implode(s_ImplodeType[t], IMPLODE_DICT_4K, data + i * SECTOR_SIZE, sector_size, packed + i * SECTOR_SIZE * 2, &packed_size[i]))
+				packed_size[i] = 0;
+			packed_total += packed_size[i];
+		}
+
+		ref_time = time_explode(TRUE, packed, packed_size, num, ref_dest);
+		new_time = time_explode(FALSE, packed, packed_size, num, dest);
+
+		printf("explode %s: %u sectors, %.1f%%, old %.1f MB/s, new %.1f MB/s, %.2fx%s\n",
+			s_ImplodeType[t] == IMPLODE_BINARY ? "binary" : "ascii", num, packed_total * 100.0 / size,
+			mb / ref_time, mb / new_time, ref_time / new_time,
+			DMemCmp(dest, ref_dest, size) ? ", OUTPUT DIFFERS" : "");
+	}
+
+	free(data);
+	free(packed);
+	free(packed_size);
+	free(dest);
+	free(ref_dest);
+}
+
+static BUFPTR load_bench_data(INT argc, CHAR *argv[], UINT *size)
+{
+	INT i;
+	UINT total, pad;
+	LONG len;
+	BUFPTR data, buf;
+	FILE *fp;
+
+	/* 没有给出文件时使用生成的数据 */
+	if (argc < 2) {
+		data = (BUFPTR)malloc(BENCH_DATA_SIZE);
+		for (total = 0; total < BENCH_DATA_SIZE; total += MAX_SAMPLE_SIZE)
+			make_sample(total / MAX_SAMPLE_SIZE % SAMPLE_NUM, total, data + total, MAX_SAMPLE_SIZE);
+		*size = BENCH_DATA_SIZE;
+		return data;
+	}
+
+	/* 把各文件的内容连接在一起，每个文件都从扇区边界开始 */
+	data = NULL;
+	total = 0;
+
+	for (i = 1; i < argc; i++) {
+
+		fp = fopen(argv[i], "rb");
+		if (!fp) {
+			printf("cannot open %s\n", argv[i]);
+			continue;
+		}
+
+		fseek(fp, 0, SEEK_END);
+		len = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		/* 扇区末尾不足的部分补0 */
+		if (len > 0) {
+			pad = ((UINT)len + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+			buf = (BUFPTR)realloc(data, total + pad);
+			if (buf) {
+				data = buf;
+				DMemClr(data + total, pad);
+				fread(data + total, 1, (UINT)len, fp);
+				total += pad;
+			}
+		}
+
+		fclose(fp);
+	}
+
+	*size = total;
+	return data;
+}
+
+static DOUBLE time_explode(BOOL ref, BUFCPTR packed, CONST UINT *packed_size, UINT num, BUFPTR dest)
+{
+	UINT i, n, out_size;
+	clock_t start, elapsed;
+
+	start = clock();
+
+	/* 至少运行BENCH_MIN_TIME，取每一轮的平均时间 */
+	for (n = 0, elapsed = 0; elapsed < BENCH_MIN_TIME; n++) {
+		for (i = 0; i < num; i++) {
+			out_size = SECTOR_SIZE;
+			if (ref)
+				ref_explode(packed + i * SECTOR_SIZE * 2, packed_size[i], dest + i * SECTOR_SIZE, &out_size);
+			else
+				explode(packed + i * SECTOR_SIZE * 2, packed_size[i], dest + i * SECTOR_SIZE, &out_size);
+		}
+		elapsed = clock() - start;
+	}
+
+	return (DOUBLE)elapsed / CLOCKS_PER_SEC / n;
+}
+
+/************************************************************************/
@@ -0,0 +1,23 @@
+﻿/************************************************************************/
+/* File Name   : refimplode.h                                           */
+/* Creator     : ax.minaduki@gmail.com                                  */
+/* Create Time : Oct 17th, 2026                                         */
+/* Module      : Lawine library                                         */
+/* Descript    : Reference PKWare DCL implode codec definition          */
+/************************************************************************/
+
+#ifndef __SD_LAWINE_TEST_REFIMPLODE_H__
+#define __SD_LAWINE_TEST_REFIMPLODE_H__
+
+/************************************************************************/
+
+#include "../misc/implode.h"
+
+/************************************************************************/
+
+CAPI extern BOOL ref_implode(INT type, INT dict, VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+CAPI extern BOOL ref_explode(VCPTR src, UINT src_size, VPTR dest, UINT *dest_size);
+
+/************************************************************************/
+
+#endif	/* __SD_LAWINE_TEST_REFIMPLODE_H__ */